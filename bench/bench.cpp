@@ -0,0 +1,507 @@
+#include <webby.hpp>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Benchmarks for the hot paths of webby, and a load generator that drives a server in the same
+// process over the loopback interface. Build with `-DCMAKE_BUILD_TYPE=Release` for numbers that
+// mean something, and compare runs made on the same machine.
+//
+//     webby_bench [-d seconds] [-c clients] [-p port] [-e] [filter]
+//
+// Only benchmarks whose name contains the filter are run, e.g. `webby_bench router`.
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Command line options.
+struct options {
+  double duration = 2.0;
+  unsigned clients = 4;
+  unsigned short port = 8090;
+  bool event_loop = false;
+  std::string filter;
+
+  bool selected(const std::string& name) const {
+    return filter.empty() || name.find(filter) != std::string::npos;
+  }
+};
+
+// Keeps the compiler from discarding a computation whose result is not otherwise used.
+inline void keep(const void* p) {
+  asm volatile("" : : "g"(p) : "memory");
+}
+
+// Runs a function in doubling batches until a batch takes at least 200 ms, and reports the time
+// per call of the last batch.
+template<typename F>
+void measure(const options& opts, const std::string& name, F&& f) {
+  if(!opts.selected(name)) {
+    return;
+  }
+  for(uint64_t iterations = 1; ; iterations *= 2) {
+    const bench_clock::time_point start = bench_clock::now();
+    for(uint64_t i = 0; i < iterations; ++i) {
+      f();
+    }
+    const double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+    if(ns >= 2e8) {
+      printf("%-36s %12.1f ns/op %14llu ops\n", name.c_str(), ns / static_cast<double>(iterations),
+             static_cast<unsigned long long>(iterations));
+      fflush(stdout);
+      return;
+    }
+  }
+}
+
+// A connection whose peer end is held by the benchmark, so requests and responses can be built
+// without a server. The request is written to the peer before the connection reads it.
+class pipe_connection {
+  public:
+    explicit pipe_connection(const std::string& request) {
+      int fds[2];
+      if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        throw std::runtime_error("socketpair() failed");
+      }
+      _peer = fds[1];
+      if(::write(_peer, request.data(), request.size()) != static_cast<ssize_t>(request.size())) {
+        throw std::runtime_error("write() failed");
+      }
+
+      _connection.reset(new webby::connection(webby::socket(fds[0])));
+    }
+
+    ~pipe_connection() {
+      _connection.reset();
+      close(_peer);
+    }
+
+    webby::connection& get() {
+      return *_connection;
+    }
+
+  private:
+    int _peer;
+    std::unique_ptr<webby::connection> _connection;
+};
+
+// Exposes the constructor of webby::request, which is otherwise reserved for the server.
+class bench_request : public webby::request {
+  public:
+    bench_request(const webby::config& config, webby::connection& c) : request(config, c) { }
+};
+
+// Exposes the constructor and header formatting of webby::response.
+class bench_response : public webby::response {
+  public:
+    bench_response(const webby::config& config, webby::connection& c) : response(config, c) { }
+
+    void format_headers() {
+      stage_headers();
+    }
+};
+
+// A request as sent by a browser to a REST endpoint.
+static const char browser_request[] =
+    "GET /api/v1/users/42?fields=name,email HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: application/json, text/plain, */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: http://localhost:8080/users\r\n"
+    "Cookie: session=4f0d5b2a9c8e47e1b3a6d2c9f0e18a77; theme=dark\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+void bench_parser(const options& opts) {
+  std::string buffer(browser_request);
+  webby::parser p;
+  measure(opts, "parser/request", [&] {
+    p.reset();
+    webby::parser::status status = p.parse(&buffer[0], buffer.size());
+    keep(&status);
+  });
+}
+
+void bench_router(const options& opts, const webby::config& config) {
+  const unsigned sizes[] = { 10, 100, 1000 };
+  for(unsigned size : sizes) {
+    const std::string name = "router/dispatch/" + std::to_string(size);
+    if(!opts.selected(name)) {
+      continue;
+    }
+
+    // Routes are siblings with a parameter, and the last one added is requested.
+    webby::router router;
+    for(unsigned i = 0; i < size; ++i) {
+      router.add("/api/v1/resource" + std::to_string(i) + "/:id", webby::method::GET,
+                 [](const webby::request&, webby::response&) { });
+    }
+    pipe_connection c("GET /api/v1/resource" + std::to_string(size - 1) + "/42 HTTP/1.1\r\n"
+                      "Host: localhost\r\n\r\n");
+    bench_request req(config, c.get());
+    bench_response res(config, c.get());
+    measure(opts, name, [&] {
+      router.dispatch(req, res);
+    });
+  }
+}
+
+void bench_headers(const options& opts, const webby::config& config) {
+  pipe_connection c("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  webby::connection& conn = c.get();
+
+  // Each response is built in place and never destroyed, because its destructor would send it.
+  // Everything it allocates comes from the connection's arena, which is reset after each one.
+  alignas(bench_response) unsigned char storage[sizeof(bench_response)];
+  measure(opts, "response/headers", [&] {
+    bench_response* res = new(storage) bench_response(config, conn);
+    res->set_status_code(200)
+        .set_header("Content-Type", "application/json; charset=utf-8")
+        .set_header("Content-Length", "1024")
+        .set_header("Cache-Control", "no-cache")
+        .set_header("Location", "http://localhost:8080/api/v1/users/42");
+    res->format_headers();
+    conn.arena().reset();
+  });
+
+  // Typed headers, and headers that are not well known and are appended as lines.
+  measure(opts, "response/headers/typed", [&] {
+    bench_response* res = new(storage) bench_response(config, conn);
+    res->set_status_code(200)
+        .set_content_type("application/json; charset=utf-8")
+        .set_content_length(1024)
+        .set_header("X-Request-Id", 4242)
+        .set_header("X-Frame-Options", "DENY");
+    res->format_headers();
+    conn.arena().reset();
+  });
+}
+
+void bench_methods(const options& opts) {
+  measure(opts, "method/to_string/GET", [] {
+    std::string s = webby::to_string(webby::method::GET);
+    keep(s.data());
+  });
+  measure(opts, "method/to_string/ALL", [] {
+    std::string s = webby::to_string(webby::method::ALL);
+    keep(s.data());
+  });
+  measure(opts, "method/parse/OPTIONS", [] {
+    webby::method m;
+    keep(webby::parse_method("OPTIONS", m) ? &m : nullptr);
+  });
+  measure(opts, "header/find/Accept-Encoding", [] {
+    webby::known_header h = webby::find_known_header("accept-encoding");
+    keep(&h);
+  });
+}
+
+// A blocking HTTP client for the load generator.
+class client {
+  public:
+    client() : _fd(-1), _buffer(65536) { }
+
+    ~client() {
+      disconnect();
+    }
+
+    bool connected() const {
+      return _fd >= 0;
+    }
+
+    bool connect(unsigned short port) {
+      _fd = socket(AF_INET, SOCK_STREAM, 0);
+      if(_fd < 0) {
+        return false;
+      }
+      int on = 1;
+      setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(port);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      if(::connect(_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        disconnect();
+        return false;
+      }
+      return true;
+    }
+
+    void disconnect() {
+      if(_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+      }
+    }
+
+    // Sends a request and reads the whole response. @p open is cleared if the server will close
+    // the connection afterwards.
+    bool exchange(const std::string& request, bool& open) {
+      if(::send(_fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+         static_cast<ssize_t>(request.size())) {
+        return false;
+      }
+
+      // Reads until the end of the header block.
+      size_t length = 0;
+      size_t header_end = 0;
+      while(header_end == 0) {
+        if(length == _buffer.size() || !receive(length)) {
+          return false;
+        }
+        for(size_t i = 3; i < length; ++i) {
+          if(memcmp(&_buffer[i - 3], "\r\n\r\n", 4) == 0) {
+            header_end = i + 1;
+            break;
+          }
+        }
+      }
+
+      // Finds the framing of the body.
+      unsigned long content_length = 0;
+      bool has_length = false;
+      open = true;
+      webby::string_view headers(&_buffer[0], header_end);
+      size_t first = headers.find('\n') + 1;
+      while(first < header_end - 2) {
+        size_t last = headers.find('\n', first);
+        webby::string_view line = headers.substr(first, last - 1 - first);
+        size_t colon = line.find(':');
+        if(colon != webby::string_view::npos) {
+          webby::string_view name = line.substr(0, colon);
+          webby::string_view value = line.substr(colon + 1);
+          while(!value.empty() && value[0] == ' ') {
+            value = value.substr(1);
+          }
+          if(webby::iequals(name, "Content-Length")) {
+            has_length = webby::parse_number(value, content_length);
+          }
+          else if(webby::iequals(name, "Connection") && webby::iequals(value, "close")) {
+            open = false;
+          }
+        }
+        first = last + 1;
+      }
+      if(!has_length) {
+        return false;
+      }
+
+      // Reads the rest of the body.
+      unsigned long remaining = content_length - (length - header_end);
+      while(remaining > 0) {
+        ssize_t n = read(_fd, &_buffer[0], remaining < _buffer.size() ? remaining : _buffer.size());
+        if(n <= 0) {
+          return false;
+        }
+        remaining -= static_cast<unsigned long>(n);
+      }
+      return true;
+    }
+
+  private:
+    bool receive(size_t& length) {
+      ssize_t n = read(_fd, &_buffer[length], _buffer.size() - length);
+      if(n <= 0) {
+        return false;
+      }
+      length += static_cast<size_t>(n);
+      return true;
+    }
+
+    int _fd;
+    std::vector<char> _buffer;
+};
+
+// Sends a request from several clients for the configured duration, and reports the throughput
+// and the latency percentiles.
+void run_load(const options& opts, const std::string& name, const std::string& request,
+              bool keep_alive) {
+  if(!opts.selected(name)) {
+    return;
+  }
+
+  std::atomic<bool> stop(false);
+  std::vector<std::unique_ptr<webby::histogram>> latencies;
+  std::vector<uint64_t> errors(opts.clients);
+  std::vector<std::thread> threads;
+  for(unsigned i = 0; i < opts.clients; ++i) {
+    latencies.emplace_back(new webby::histogram());
+  }
+  for(unsigned i = 0; i < opts.clients; ++i) {
+    threads.emplace_back([&, i] {
+      client c;
+      while(!stop.load(std::memory_order_relaxed)) {
+        const bench_clock::time_point start = bench_clock::now();
+        bool open = false;
+        if((!c.connected() && !c.connect(opts.port)) || !c.exchange(request, open)) {
+          ++errors[i];
+          c.disconnect();
+          continue;
+        }
+        latencies[i]->record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                bench_clock::now() - start).count()));
+        if(!keep_alive || !open) {
+          c.disconnect();
+        }
+      }
+    });
+  }
+  const bench_clock::time_point start = bench_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(opts.duration));
+  stop = true;
+  for(auto& t : threads) {
+    t.join();
+  }
+  const double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+  uint64_t counts[webby::histogram::buckets] = {};
+  uint64_t failed = 0;
+  for(unsigned i = 0; i < opts.clients; ++i) {
+    latencies[i]->add_to(counts);
+    failed += errors[i];
+  }
+  uint64_t total = 0;
+  for(unsigned i = 0; i < webby::histogram::buckets; ++i) {
+    total += counts[i];
+  }
+  printf("%-36s %12.0f req/s  p50 %5llu us  p90 %5llu us  p99 %5llu us  p999 %5llu us",
+         name.c_str(), static_cast<double>(total) / seconds,
+         static_cast<unsigned long long>(webby::histogram::quantile(counts, total, 0.5)),
+         static_cast<unsigned long long>(webby::histogram::quantile(counts, total, 0.9)),
+         static_cast<unsigned long long>(webby::histogram::quantile(counts, total, 0.99)),
+         static_cast<unsigned long long>(webby::histogram::quantile(counts, total, 0.999)));
+  if(failed > 0) {
+    printf("  %llu errors", static_cast<unsigned long long>(failed));
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+void bench_loopback(const options& opts) {
+  const char* const names[] = {
+    "loopback/rest/keep-alive", "loopback/rest/close",
+    "loopback/static/keep-alive", "loopback/static/close"
+  };
+  bool any = false;
+  for(const char* name : names) {
+    any = any || opts.selected(name);
+  }
+  if(!any) {
+    return;
+  }
+
+  // Creates a 4 KiB file to serve.
+  char root[] = "/tmp/webby_bench.XXXXXX";
+  if(mkdtemp(root) == nullptr) {
+    throw std::runtime_error("mkdtemp() failed");
+  }
+  const std::string file = std::string(root) + "/index.html";
+  {
+    std::string contents(4096, 'x');
+    int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || ::write(fd, contents.data(), contents.size()) < 0) {
+      throw std::runtime_error("Cannot create " + file);
+    }
+    close(fd);
+  }
+
+  // The server cannot be stopped, so it and everything it uses are left running until the
+  // process exits.
+  std::unique_ptr<qlog::logger> error_log(new qlog::logger(std::cerr, qlog::severity::ERROR));
+  webby::config* config = new webby::config();
+  config->set_address("127.0.0.1")
+         .set_port(opts.port)
+         .set_error_log(error_log)
+         .set_log_level(webby::log_level::error)
+         .set_max_requests_per_connection(1000000);
+  if(opts.event_loop) {
+    config->set_concurrency(webby::config::concurrency_model::event_loop);
+  }
+  webby::router* router = new webby::router();
+  router->add("/item/:id", webby::method::GET, [](const webby::request&, webby::response& res) {
+            static const char body[] = "{\"id\":1,\"value\":\"First item\"}";
+            res.set_status_code(200)
+               .set_content_type("application/json")
+               .set_content_length(sizeof(body) - 1)
+               .write_block(reinterpret_cast<const unsigned char*>(body), sizeof(body) - 1);
+          })
+         .add("/", webby::method::GET | webby::method::HEAD, webby::file_handler(root));
+  webby::server* server = new webby::server(*config, *router);
+  std::thread([server] { server->run(); }).detach();
+
+  const std::string rest = "GET /item/1 HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+  const std::string file_request = "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+  run_load(opts, names[0], rest + "\r\n", true);
+  run_load(opts, names[1], rest + "Connection: close\r\n\r\n", false);
+  run_load(opts, names[2], file_request + "\r\n", true);
+  run_load(opts, names[3], file_request + "Connection: close\r\n\r\n", false);
+
+  unlink(file.c_str());
+  rmdir(root);
+}
+
+int main(int argc, char* argv[]) {
+  options opts;
+  for(int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if(arg == "-d" && i + 1 < argc) {
+      opts.duration = atof(argv[++i]);
+    }
+    else if(arg == "-c" && i + 1 < argc) {
+      opts.clients = static_cast<unsigned>(atoi(argv[++i]));
+    }
+    else if(arg == "-p" && i + 1 < argc) {
+      opts.port = static_cast<unsigned short>(atoi(argv[++i]));
+    }
+    else if(arg == "-e") {
+      opts.event_loop = true;
+    }
+    else if(arg[0] != '-' && opts.filter.empty()) {
+      opts.filter = arg;
+    }
+    else {
+      fprintf(stderr, "usage: %s [-d seconds] [-c clients] [-p port] [-e] [filter]\n", argv[0]);
+      return 2;
+    }
+  }
+  if(opts.clients == 0) {
+    opts.clients = 1;
+  }
+
+  try {
+    // The micro-benchmarks do not log.
+    webby::config config;
+    config.set_log_level(webby::log_level::error);
+
+    bench_parser(opts);
+    bench_router(opts, config);
+    bench_headers(opts, config);
+    bench_methods(opts);
+    bench_loopback(opts);
+  }
+  catch(const std::exception& e) {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
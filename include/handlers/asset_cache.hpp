@@ -0,0 +1,279 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <handlers/file_cache.hpp>
+#include <handlers/mime_types.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Byte-budgeted cache of small files held in memory with their response headers.
+   *
+   * A hit is answered without touching the filesystem. Each entry holds the body along with its
+   * precomputed `Content-Type`, `Content-Length`, `Last-Modified` and `ETag` values and, when a
+   * `.gz` or `.br` file sits next to the original and is at least as new, its precompressed
+   * variants. Entries are evicted least recently used first once the cached bodies exceed the
+   * budget, and are revalidated through the webby::file_cache once their time to live expires.
+   */
+  class asset_cache {
+    public:
+      /**
+       * @brief A body and its encoding.
+       */
+      struct variant {
+        /// Body of the response.
+        std::string body;
+
+        /// Value of the `ETag` header. Each encoding has its own strong validator, as their bytes
+        /// differ.
+        std::string etag;
+      };
+
+      /**
+       * @brief A cached file.
+       */
+      struct asset {
+        /// Uncompressed body.
+        variant identity;
+
+        /// Body compressed with gzip, or an empty body if there is no precompressed variant.
+        variant gzip;
+
+        /// Body compressed with Brotli, or an empty body if there is no precompressed variant.
+        variant brotli;
+
+        /// Value of the `Content-Type` header.
+        std::string content_type;
+
+        /// Value of the `Last-Modified` header.
+        std::string last_modified;
+
+        /// Modification time of the file, for `If-Modified-Since`.
+        time_t mtime;
+
+        /// Result of `stat()` when the file was read, to detect changes.
+        struct stat status;
+
+        /// Gets a value that indicates whether any precompressed variant exists.
+        bool compressed() const {
+          return !gzip.body.empty() || !brotli.body.empty();
+        }
+
+        /// Gets the number of bytes the entry counts against the budget.
+        size_t cost() const {
+          return identity.body.size() + gzip.body.size() + brotli.body.size();
+        }
+      };
+
+      /**
+       * @brief Shared reference to a cached file.
+       */
+      typedef std::shared_ptr<const asset> asset_ptr;
+
+      /**
+       * @brief Constructs an empty cache.
+       * @param[in] budget Maximum number of body bytes held in memory.
+       * @param[in] max_file_size Largest file that is cached.
+       * @param[in] ttl Milliseconds after which an entry is revalidated against the filesystem.
+       */
+      asset_cache(size_t budget, size_t max_file_size, unsigned ttl)
+          : _budget(budget), _max_file_size(max_file_size), _ttl(ttl), _size(0) { }
+
+      asset_cache(const asset_cache&) = delete;
+      asset_cache& operator=(const asset_cache&) = delete;
+
+      /**
+       * @brief Gets the largest file that is cached.
+       */
+      size_t max_file_size() const {
+        return _max_file_size;
+      }
+
+      /**
+       * @brief Finds a cached file that does not need to be revalidated.
+       * @param[in] path Requested path.
+       * @returns the cached file, or `nullptr` if it is not cached or its time to live expired.
+       */
+      asset_ptr find(const std::string& path) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto itr = _entries.find(path);
+        if(itr == _entries.end() || clock::now() - itr->second.checked >= _ttl) {
+          return asset_ptr();
+        }
+        _lru.splice(_lru.begin(), _lru, itr->second.lru);
+        return itr->second.a;
+      }
+
+      /**
+       * @brief Caches a file, reusing the cached copy if the file has not changed.
+       * @param[in] path Requested path.
+       * @param[in] f The open file. Its size must not exceed asset_cache::max_file_size().
+       * @returns the cached file.
+       * @throws std::system_error if the file cannot be read.
+       */
+      asset_ptr load(const std::string& path, const file_cache::file& f) {
+        const clock::time_point now = clock::now();
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          auto itr = _entries.find(path);
+          if(itr != _entries.end() && file_cache::same_file(itr->second.a->status, f.status())) {
+            itr->second.checked = now;
+            _lru.splice(_lru.begin(), _lru, itr->second.lru);
+            return itr->second.a;
+          }
+        }
+
+        // Reads the file and its precompressed variants outside the lock.
+        std::shared_ptr<asset> a = std::make_shared<asset>();
+        read_all(f.descriptor(), f.size(), a->identity);
+        read_variant(f.path() + ".gz", f.status(), a->gzip);
+        read_variant(f.path() + ".br", f.status(), a->brotli);
+        a->content_type = mime_type(f.path());
+        a->last_modified = f.last_modified();
+        a->identity.etag = f.etag();
+        a->gzip.etag = encoded_etag(f.etag(), "-gzip");
+        a->brotli.etag = encoded_etag(f.etag(), "-br");
+        a->mtime = f.status().st_mtime;
+        a->status = f.status();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto itr = _entries.find(path);
+        if(itr != _entries.end()) {
+          _size -= itr->second.a->cost();
+          itr->second.a = a;
+          itr->second.checked = now;
+          _lru.splice(_lru.begin(), _lru, itr->second.lru);
+        }
+        else {
+          _lru.push_front(path);
+          entry e = { a, now, _lru.begin() };
+          _entries.insert(std::make_pair(path, e));
+        }
+        _size += a->cost();
+
+        // Evicts the least recently used entries, but never the one just loaded.
+        while(_size > _budget && _lru.size() > 1) {
+          auto victim = _entries.find(_lru.back());
+          _size -= victim->second.a->cost();
+          _entries.erase(victim);
+          _lru.pop_back();
+        }
+        return a;
+      }
+
+    private:
+      typedef std::chrono::steady_clock clock;
+
+      /**
+       * @brief An entry in the cache.
+       */
+      struct entry {
+        /// Cached file.
+        asset_ptr a;
+
+        /// Time the entry was last loaded or revalidated.
+        clock::time_point checked;
+
+        /// Position of the entry's key in the LRU list.
+        std::list<std::string>::iterator lru;
+      };
+
+      /**
+       * @brief Derives the entity tag of an encoded variant by appending a suffix inside the
+       *        quotes of the file's tag, e.g. `"1a2b-400-5f5e1000-gzip"`.
+       */
+      static std::string encoded_etag(const std::string& etag, const char* suffix) {
+        return etag.substr(0, etag.size() - 1) + suffix + '"';
+      }
+
+      /**
+       * @brief Reads a whole file into a variant.
+       * @throws std::system_error if the file cannot be read.
+       */
+      static void read_all(int fd, size_t size, variant& v) {
+        v.body.resize(size);
+        size_t offset = 0;
+        while(offset < size) {
+          ssize_t n = ::pread(fd, &v.body[offset], size - offset, static_cast<off_t>(offset));
+          if(n < 0 && errno == EINTR) {
+            continue;
+          }
+          if(n < 0) {
+            throw std::system_error(errno, std::system_category());
+          }
+          if(n == 0) {
+            break;
+          }
+          offset += static_cast<size_t>(n);
+        }
+        v.body.resize(offset);
+      }
+
+      /**
+       * @brief Reads a precompressed variant if it exists and is not older than the original.
+       */
+      void read_variant(const std::string& path, const struct stat& original, variant& v) const {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+          return;
+        }
+        struct stat st;
+        if(::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_mtime >= original.st_mtime &&
+           static_cast<size_t>(st.st_size) <= _max_file_size) {
+          try {
+            read_all(fd, static_cast<size_t>(st.st_size), v);
+          }
+          catch(const std::system_error&) {
+            v = variant();
+          }
+        }
+        ::close(fd);
+      }
+
+      /**
+       * @brief Maximum number of body bytes held in memory.
+       */
+      const size_t _budget;
+
+      /**
+       * @brief Largest file that is cached.
+       */
+      const size_t _max_file_size;
+
+      /**
+       * @brief Time after which an entry is revalidated.
+       */
+      const std::chrono::milliseconds _ttl;
+
+      /**
+       * @brief Protects the cache.
+       */
+      std::mutex _mutex;
+
+      /**
+       * @brief Cached files by requested path.
+       */
+      std::unordered_map<std::string, entry> _entries;
+
+      /**
+       * @brief Requested paths, most recently used first.
+       */
+      std::list<std::string> _lru;
+
+      /**
+       * @brief Number of body bytes held in memory.
+       */
+      size_t _size;
+  };
+}
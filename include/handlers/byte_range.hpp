@@ -0,0 +1,181 @@
+#pragma once
+
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief An inclusive range of byte offsets, as in `Content-Range: bytes 0-499/1234`.
+   */
+  struct byte_range {
+    /// Offset of the first byte.
+    unsigned long first;
+
+    /// Offset of the last byte.
+    unsigned long last;
+
+    /// Gets the number of bytes in the range.
+    unsigned long length() const {
+      return last - first + 1;
+    }
+  };
+
+  /**
+   * @brief The satisfiable ranges of a `Range` header.
+   */
+  class range_set {
+    public:
+      /**
+       * @brief Maximum number of ranges served from one request, once overlapping ranges are
+       *        merged. Requests for more ranges are answered with the whole representation, so a
+       *        client cannot make the server send a flood of tiny parts.
+       */
+      static const unsigned max_ranges = 16;
+
+      /**
+       * @brief Outcome of parsing a `Range` header.
+       */
+      enum class status {
+        ignore,       ///< The header is malformed or not for bytes; send the whole representation.
+        satisfiable,  ///< At least one range overlaps the representation.
+        unsatisfiable ///< No range overlaps the representation; send 416.
+      };
+
+      range_set() : _count(0) { }
+
+      /**
+       * @brief Parses a `Range` header.
+       * @param[in] header Header value, e.g. `bytes=0-499, -500`.
+       * @param[in] size Length of the representation in bytes.
+       * @returns the outcome. Ranges that start past the end of the representation are dropped,
+       *          and ranges that end past it are shortened, as RFC 7233 requires.
+       *
+       * A range that overlaps or adjoins the range before it is merged into it, so that e.g.
+       * `bytes=0-,0-` sends the representation once. If ranges still overlap after that, they
+       * were not listed in order and the header is ignored (RFC 9110 section 14.2).
+       */
+      status parse(string_view header, unsigned long size) {
+        _count = 0;
+        if(header.compare(0, 6, "bytes=") != 0) {
+          return status::ignore;
+        }
+        string_view list = header.substr(6);
+        bool any = false;
+        size_t first = 0;
+        while(first < list.size()) {
+          size_t last = list.find(',', first);
+          if(last == string_view::npos) {
+            last = list.size();
+          }
+          string_view item = trim(list.substr(first, last - first));
+          first = last + 1;
+          if(item.empty()) {
+            continue;
+          }
+
+          size_t dash = item.find('-');
+          if(dash == string_view::npos) {
+            return status::ignore;
+          }
+          string_view from = trim(item.substr(0, dash));
+          string_view to = trim(item.substr(dash + 1));
+          byte_range r;
+          unsigned long n;
+          if(from.empty()) {
+            // A suffix range such as "-500" selects the last 500 bytes.
+            if(to.empty() || !parse_number(to, n)) {
+              return status::ignore;
+            }
+            any = true;
+            if(n == 0 || size == 0) {
+              continue;
+            }
+            r.first = n < size ? size - n : 0;
+            r.last = size - 1;
+          }
+          else {
+            if(!parse_number(from, r.first)) {
+              return status::ignore;
+            }
+            if(to.empty()) {
+              r.last = size - 1;
+            }
+            else if(!parse_number(to, r.last) || r.last < r.first) {
+              return status::ignore;
+            }
+            any = true;
+            if(r.first >= size) {
+              continue;
+            }
+            if(r.last >= size) {
+              r.last = size - 1;
+            }
+          }
+
+          if(_count > 0 && touches(_ranges[_count - 1], r)) {
+            byte_range& previous = _ranges[_count - 1];
+            previous.first = r.first < previous.first ? r.first : previous.first;
+            previous.last = r.last > previous.last ? r.last : previous.last;
+            continue;
+          }
+          if(_count == max_ranges) {
+            return status::ignore;
+          }
+          _ranges[_count++] = r;
+        }
+
+        if(!any) {
+          return status::ignore;
+        }
+        for(unsigned i = 0; i < _count; ++i) {
+          for(unsigned j = i + 1; j < _count; ++j) {
+            if(_ranges[i].first <= _ranges[j].last && _ranges[j].first <= _ranges[i].last) {
+              return status::ignore;
+            }
+          }
+        }
+        return _count > 0 ? status::satisfiable : status::unsatisfiable;
+      }
+
+      /**
+       * @brief Gets the number of satisfiable ranges.
+       */
+      unsigned size() const {
+        return _count;
+      }
+
+      /**
+       * @brief Gets a satisfiable range.
+       */
+      const byte_range& operator[](unsigned i) const {
+        return _ranges[i];
+      }
+
+    private:
+      /**
+       * @brief Gets a value that indicates whether two ranges overlap or adjoin, so that they can
+       *        be sent as one.
+       */
+      static bool touches(const byte_range& a, const byte_range& b) {
+        return b.first <= a.last + 1 && a.first <= b.last + 1;
+      }
+
+      /**
+       * @brief Removes leading and trailing whitespace.
+       */
+      static string_view trim(string_view s) {
+        while(!s.empty() && (s[0] == ' ' || s[0] == '\t')) {
+          s = s.substr(1);
+        }
+        while(!s.empty() && (s[s.size() - 1] == ' ' || s[s.size() - 1] == '\t')) {
+          s = s.substr(0, s.size() - 1);
+        }
+        return s;
+      }
+
+      byte_range _ranges[max_ranges];
+      unsigned _count;
+  };
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <webby/date.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Least recently used cache of open files and their `stat()` results.
+   *
+   * Entries are keyed by the path a handler asked for, so a hit costs no `open()`, `stat()` or
+   * `fstat()` calls: the descriptor is ready to be passed to response::send_file(). An entry
+   * older than the time to live is revalidated with one `stat()` of the resolved path, and is
+   * reopened only if the file was replaced or modified. Descriptors are reference counted, so a
+   * file evicted while it is being sent stays open until the send completes.
+   */
+  class file_cache {
+    public:
+      /**
+       * @brief An open file.
+       */
+      class file {
+        public:
+          /**
+           * @brief Takes ownership of an open descriptor.
+           * @param[in] fd Open descriptor.
+           * @param[in] path Resolved path of the file.
+           * @param[in] st Result of `fstat()` on the descriptor.
+           */
+          file(int fd, const std::string& path, const struct stat& st)
+              : _fd(fd), _path(path), _stat(st), _etag(make_etag(st)),
+                _last_modified(make_date(st.st_mtime)) { }
+
+          file(const file&) = delete;
+          file& operator=(const file&) = delete;
+
+          /**
+           * @brief Closes the descriptor.
+           */
+          ~file() {
+            ::close(_fd);
+          }
+
+          /**
+           * @brief Gets the descriptor.
+           */
+          int descriptor() const {
+            return _fd;
+          }
+
+          /**
+           * @brief Gets the resolved path, including any `index.html` appended for a directory.
+           */
+          const std::string& path() const {
+            return _path;
+          }
+
+          /**
+           * @brief Gets the result of `fstat()` when the file was opened.
+           */
+          const struct stat& status() const {
+            return _stat;
+          }
+
+          /**
+           * @brief Gets the size of the file in bytes.
+           */
+          unsigned long size() const {
+            return static_cast<unsigned long>(_stat.st_size);
+          }
+
+          /**
+           * @brief Gets the strong entity tag of the file, derived from its inode, size and
+           *        modification time.
+           */
+          const std::string& etag() const {
+            return _etag;
+          }
+
+          /**
+           * @brief Gets the modification time of the file as an RFC 1123 date.
+           */
+          const std::string& last_modified() const {
+            return _last_modified;
+          }
+
+        private:
+          /**
+           * @brief Formats an entity tag such as `"1a2b-400-5f5e1000"`.
+           */
+          static std::string make_etag(const struct stat& st) {
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), "\"%llx-%llx-%llx\"",
+                     static_cast<unsigned long long>(st.st_ino),
+                     static_cast<unsigned long long>(st.st_size),
+                     static_cast<unsigned long long>(st.st_mtime));
+            return buffer;
+          }
+
+          /**
+           * @brief Formats a time as an RFC 1123 date.
+           */
+          static std::string make_date(time_t t) {
+            char buffer[http_date_length];
+            format_http_date(t, buffer);
+            return std::string(buffer, sizeof(buffer));
+          }
+
+          const int _fd;
+          const std::string _path;
+          const struct stat _stat;
+          const std::string _etag;
+          const std::string _last_modified;
+      };
+
+      /**
+       * @brief Shared reference to an open file.
+       */
+      typedef std::shared_ptr<const file> file_ptr;
+
+      /**
+       * @brief Constructs an empty cache.
+       * @param[in] capacity Maximum number of open files. `0` disables caching.
+       * @param[in] ttl Milliseconds after which an entry is revalidated against the filesystem.
+       */
+      file_cache(size_t capacity, unsigned ttl) : _capacity(capacity), _ttl(ttl) { }
+
+      file_cache(const file_cache&) = delete;
+      file_cache& operator=(const file_cache&) = delete;
+
+      /**
+       * @brief Gets a value that indicates whether two `stat()` results describe the same,
+       *        unmodified file.
+       */
+      static bool same_file(const struct stat& a, const struct stat& b) {
+        return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+               a.st_mtime == b.st_mtime;
+      }
+
+      /**
+       * @brief Gets an open file, opening it if it is not cached.
+       * @param[in] path Path of the file. If it names a directory, its `index.html` is opened.
+       * @returns the open file.
+       * @throws std::system_error if the file cannot be opened or is not a regular file.
+       */
+      file_ptr open(const std::string& path) {
+        const clock::time_point now = clock::now();
+        file_ptr f;
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          auto itr = _entries.find(path);
+          if(itr != _entries.end()) {
+            _lru.splice(_lru.begin(), _lru, itr->second.lru);
+            if(now - itr->second.checked < _ttl) {
+              return itr->second.f;
+            }
+            f = itr->second.f;
+          }
+        }
+
+        // Revalidates a stale entry outside the lock.
+        if(f) {
+          struct stat st;
+          if(::stat(f->path().c_str(), &st) == 0 && same_file(st, f->status())) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto itr = _entries.find(path);
+            if(itr != _entries.end() && itr->second.f == f) {
+              itr->second.checked = now;
+            }
+            return f;
+          }
+        }
+
+        try {
+          f = open_file(path);
+        }
+        catch(const std::system_error&) {
+          // Forgets a file that has been removed.
+          std::lock_guard<std::mutex> lock(_mutex);
+          auto itr = _entries.find(path);
+          if(itr != _entries.end()) {
+            _lru.erase(itr->second.lru);
+            _entries.erase(itr);
+          }
+          throw;
+        }
+
+        if(_capacity > 0) {
+          std::lock_guard<std::mutex> lock(_mutex);
+          auto itr = _entries.find(path);
+          if(itr != _entries.end()) {
+            itr->second.f = f;
+            itr->second.checked = now;
+            _lru.splice(_lru.begin(), _lru, itr->second.lru);
+          }
+          else {
+            _lru.push_front(path);
+            entry e = { f, now, _lru.begin() };
+            _entries.insert(std::make_pair(path, e));
+            if(_entries.size() > _capacity) {
+              _entries.erase(_lru.back());
+              _lru.pop_back();
+            }
+          }
+        }
+        return f;
+      }
+
+    private:
+      typedef std::chrono::steady_clock clock;
+
+      /**
+       * @brief A cached file.
+       */
+      struct entry {
+        /// Open file.
+        file_ptr f;
+
+        /// Time the entry was last opened or revalidated.
+        clock::time_point checked;
+
+        /// Position of the entry's key in the LRU list.
+        std::list<std::string>::iterator lru;
+      };
+
+      /**
+       * @brief Opens a file, resolving a directory to its `index.html`.
+       * @throws std::system_error if the file cannot be opened or is not a regular file.
+       */
+      static file_ptr open_file(std::string path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+          throw std::system_error(errno, std::system_category());
+        }
+        struct stat st;
+        if(::fstat(fd, &st) != 0) {
+          int err = errno;
+          ::close(fd);
+          throw std::system_error(err, std::system_category());
+        }
+        if(S_ISDIR(st.st_mode)) {
+          ::close(fd);
+          if(path[path.length() - 1] != '/') {
+            path += "/";
+          }
+          path += "index.html";
+          return open_file(path);
+        }
+        if(!S_ISREG(st.st_mode)) {
+          ::close(fd);
+          throw std::system_error(EACCES, std::system_category());
+        }
+        return std::make_shared<const file>(fd, path, st);
+      }
+
+      /**
+       * @brief Maximum number of cached files.
+       */
+      const size_t _capacity;
+
+      /**
+       * @brief Time after which an entry is revalidated.
+       */
+      const std::chrono::milliseconds _ttl;
+
+      /**
+       * @brief Protects the cache.
+       */
+      std::mutex _mutex;
+
+      /**
+       * @brief Cached files by requested path.
+       */
+      std::unordered_map<std::string, entry> _entries;
+
+      /**
+       * @brief Requested paths, most recently used first.
+       */
+      std::list<std::string> _lru;
+  };
+}
@@ -1,6 +1,16 @@
 #pragma once
 
-#include <mapped_file.hpp>
+#include <errno.h>
+#include <sys/uio.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <handlers/asset_cache.hpp>
+#include <handlers/byte_range.hpp>
+#include <handlers/file_cache.hpp>
+#include <handlers/mime_types.hpp>
+#include <webby/date.hpp>
 
 /**
  * @namespace webby
@@ -8,14 +18,48 @@
 namespace webby {
   /**
    * @brief Serves static files from disk.
+   *
+   * Files are sent with response::send_file(), which uses `sendfile()` so that their contents are
+   * never copied through user space. Open descriptors and `stat()` results are kept in a
+   * webby::file_cache shared by all copies of the handler, so a hot file costs no filesystem
+   * calls at all. Small files can also be kept in memory with their headers in a
+   * webby::asset_cache, see file_handler::set_memory_cache().
+   *
+   * Every file is sent with `Last-Modified` and `ETag` validators, and conditional `GET` and
+   * `HEAD` requests for unchanged files are answered with `304 Not Modified`. `GET` requests with
+   * a `Range` header, optionally guarded by `If-Range`, are answered with `206 Partial Content`
+   * and only the requested bytes; several ranges are sent as `multipart/byteranges`.
    */
   class file_handler {
     public:
       /**
        * @brief Constructs a new file_handler object.
        * @param[in] root Root path of the directory to serve files from.
+       * @param[in] cache_size Maximum number of files kept open. `0` opens every file on each
+       *                       request.
+       * @param[in] cache_ttl Milliseconds after which a cached file is checked for changes.
        */
-      file_handler(const std::string& root) : _root(root) { }
+      file_handler(const std::string& root, size_t cache_size = 256, unsigned cache_ttl = 1000)
+          : _root(root), _cache_ttl(cache_ttl),
+            _cache(std::make_shared<file_cache>(cache_size, cache_ttl)) { }
+
+      /**
+       * @brief Keeps small files in memory.
+       * @param[in] budget Maximum number of bytes of file contents held in memory. `0` disables
+       *                   the memory cache.
+       * @param[in] max_file_size Largest file that is held in memory.
+       * @returns a reference to this `webby::file_handler` instance to allow for chaining.
+       *
+       * Precompressed `.gz` and `.br` files next to a cached file are held with it and sent to
+       * clients that accept those encodings, each with its own `ETag`.
+       */
+      file_handler& set_memory_cache(size_t budget, size_t max_file_size = 64 * 1024) {
+        _assets.reset();
+        if(budget > 0) {
+          _assets = std::make_shared<asset_cache>(budget, max_file_size, _cache_ttl);
+        }
+        return *this;
+      }
 
       /**
        * @brief Invoked by the router.
@@ -23,19 +67,42 @@ namespace webby {
        * @param[out] res Response sent to the connected host.
        */
       void operator()(const webby::request& req, webby::response& res) {
-        // Appends the requested path to the root path and adds "/index.html" if the request was for
-        // a directory.
-        std::string path = fix_path(_root + req.path());
+        // Appends the requested path to the root path. Directories are served from their
+        // "index.html".
+        const std::string path = _root + req.path();
+
+        // Static files are only sent compressed from their precompressed variants.
+        res.disable_compression();
 
         try {
-          mapped::file mf(path);
-          mapped::buffer_t b = mf.map();
-          res.set_status_code(200)
-             .set_header("Content-Length", std::to_string(b.second))
-             .write_block(reinterpret_cast<unsigned char const*>(b.first), b.second);
+          // Answers hot files from memory without touching the filesystem.
+          if(_assets) {
+            asset_cache::asset_ptr a = _assets->find(path);
+            if(a) {
+              send_asset(req, res, *a);
+              return;
+            }
+          }
+
+          file_cache::file_ptr f = _cache->open(path);
+          if(_assets && f->size() <= _assets->max_file_size()) {
+            send_asset(req, res, *_assets->load(path, *f));
+            return;
+          }
+
+          const std::string content_type = mime_type(f->path());
+          res.set_content_type(content_type)
+             .set_header("Last-Modified", f->last_modified())
+             .set_header("ETag", f->etag());
+          if(not_modified(req, f->etag(), f->status().st_mtime)) {
+            res.set_status_code(304);
+            return;
+          }
+          source src = { f->descriptor(), nullptr };
+          send_ranges(req, res, src, f->size(), content_type, f->etag(), f->status().st_mtime);
         }
         catch(std::system_error const& ex) {
-          if(ex.code().value() == 2) {
+          if(ex.code().value() == ENOENT || ex.code().value() == ENOTDIR) {
             res.set_status_code(404);
           }
           else {
@@ -46,25 +113,271 @@ namespace webby {
 
     private:
       /**
-       * @brief Appends "/index.html" to the path if it specified a directory.
-       * @param[in] path Path to fix.
-       * @return Fixed path.
+       * @brief Sends a file held in memory.
+       * @param[in] req Request for the file.
+       * @param[out] res Response sent to the connected host.
+       * @param[in] a The cached file.
        */
-      std::string fix_path(std::string path) {
-        struct stat st;
-        ::stat(path.c_str(), &st);
-        if(S_ISDIR(st.st_mode)) {
-          if(path[path.length() - 1] != '/') {
-            path += "/";
+      static void send_asset(const webby::request& req, webby::response& res,
+                             const asset_cache::asset& a) {
+        res.set_content_type(a.content_type)
+           .set_header("Last-Modified", a.last_modified);
+
+        // Chooses the smallest encoding the client accepts. Ranges always select bytes of the
+        // uncompressed file.
+        const asset_cache::variant* v = &a.identity;
+        if(a.compressed()) {
+          res.set_header("Vary", "Accept-Encoding");
+          if(req.has_header(known_header::accept_encoding) &&
+             !req.has_header(known_header::range)) {
+            string_view accept = req.header(known_header::accept_encoding);
+            if(!a.brotli.body.empty() && accepts_token(accept, "br")) {
+              res.set_header("Content-Encoding", "br");
+              v = &a.brotli;
+            }
+            else if(!a.gzip.body.empty() && accepts_token(accept, "gzip")) {
+              res.set_header("Content-Encoding", "gzip");
+              v = &a.gzip;
+            }
           }
-          path += "index.html";
         }
-        return path;
+
+        // Validators are those of the variant being sent.
+        res.set_header("ETag", v->etag);
+        if(not_modified(req, v->etag, a.mtime)) {
+          res.set_status_code(304);
+          return;
+        }
+        if(v != &a.identity) {
+          res.set_status_code(200)
+             .set_content_length(v->body.size())
+             .write_block(reinterpret_cast<const unsigned char*>(v->body.data()), v->body.size());
+          return;
+        }
+        source src = { -1, v->body.data() };
+        send_ranges(req, res, src, v->body.size(), a.content_type, v->etag, a.mtime);
+      }
+
+      /**
+       * @brief Contents of a file, either open or held in memory.
+       */
+      struct source {
+        /// Descriptor of the open file, if @p data is `nullptr`.
+        int fd;
+
+        /// Contents of the file, or `nullptr` to send from @p fd.
+        const char* data;
+      };
+
+      /**
+       * @brief Sends the whole file, or the ranges selected by the request.
+       * @param[in] req Request for the file.
+       * @param[out] res Response sent to the connected host.
+       * @param[in] src Contents of the file.
+       * @param[in] size Size of the file.
+       * @param[in] content_type Media type of the file.
+       * @param[in] etag Entity tag of the file, for `If-Range`.
+       * @param[in] mtime Modification time of the file, for `If-Range`.
+       */
+      static void send_ranges(const webby::request& req, webby::response& res, const source& src,
+                              unsigned long size, const std::string& content_type,
+                              const std::string& etag, time_t mtime) {
+        res.set_header("Accept-Ranges", "bytes");
+
+        range_set ranges;
+        range_set::status status = range_set::status::ignore;
+        if(req.method() == method::GET && req.has_header(known_header::range) &&
+           if_range(req, etag, mtime)) {
+          status = ranges.parse(req.header(known_header::range), size);
+        }
+
+        if(status == range_set::status::unsatisfiable) {
+          res.set_status_code(416)
+             .set_header("Content-Range", "bytes */" + std::to_string(size));
+          return;
+        }
+
+        if(status == range_set::status::ignore) {
+          res.set_status_code(200).set_content_length(size);
+          send_body(res, src, 0, size);
+          return;
+        }
+
+        if(ranges.size() == 1) {
+          const byte_range& r = ranges[0];
+          res.set_status_code(206)
+             .set_header("Content-Range", content_range(r, size))
+             .set_content_length(r.length());
+          send_body(res, src, r.first, r.length());
+          return;
+        }
+
+        // Formats the header of each part, then the closing delimiter, to find the length.
+        const std::string boundary = make_boundary();
+        std::vector<std::string> parts;
+        unsigned long length = 0;
+        for(unsigned i = 0; i < ranges.size(); ++i) {
+          parts.push_back("\r\n--" + boundary + "\r\nContent-Type: " + content_type +
+                          "\r\nContent-Range: " + content_range(ranges[i], size) + "\r\n\r\n");
+          length += parts.back().size() + ranges[i].length();
+        }
+        parts.push_back("\r\n--" + boundary + "--\r\n");
+        length += parts.back().size();
+
+        res.set_status_code(206)
+           .set_content_type("multipart/byteranges; boundary=" + boundary)
+           .set_content_length(length);
+
+        if(src.data != nullptr) {
+          // Gathers every part of a file held in memory into one write.
+          std::vector<struct iovec> iov;
+          for(unsigned i = 0; i <= ranges.size(); ++i) {
+            struct iovec header = { &parts[i][0], parts[i].size() };
+            iov.push_back(header);
+            if(i < ranges.size()) {
+              struct iovec body = { const_cast<char*>(src.data) + ranges[i].first,
+                                    ranges[i].length() };
+              iov.push_back(body);
+            }
+          }
+          res.write_iov(iov.data(), iov.size());
+          return;
+        }
+        for(unsigned i = 0; i <= ranges.size(); ++i) {
+          res.write_block(reinterpret_cast<const unsigned char*>(parts[i].data()), parts[i].size());
+          if(i < ranges.size()) {
+            send_body(res, src, ranges[i].first, ranges[i].length());
+          }
+        }
+      }
+
+      /**
+       * @brief Sends part of a file.
+       */
+      static void send_body(webby::response& res, const source& src, unsigned long offset,
+                            unsigned long length) {
+        if(src.data != nullptr) {
+          res.write_block(reinterpret_cast<const unsigned char*>(src.data) + offset, length);
+        }
+        else {
+          res.send_file(src.fd, static_cast<off_t>(offset), length);
+        }
+      }
+
+      /**
+       * @brief Formats a `Content-Range` value such as `bytes 0-499/1234`.
+       */
+      static std::string content_range(const byte_range& r, unsigned long size) {
+        return "bytes " + std::to_string(r.first) + "-" + std::to_string(r.last) + "/" +
+               std::to_string(size);
+      }
+
+      /**
+       * @brief Generates a random multipart boundary.
+       */
+      static std::string make_boundary() {
+        static thread_local std::mt19937_64 generator(std::random_device{}());
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "webby-%016llx",
+                 static_cast<unsigned long long>(generator()));
+        return buffer;
+      }
+
+      /**
+       * @brief Evaluates the `If-Range` header of a request.
+       * @returns `true` if the request has no `If-Range` header, or if it names the current
+       *          version of the file so that the `Range` header applies.
+       *
+       * Only strong validators match: a weak entity tag never does, and a date must equal the
+       * file's modification time.
+       */
+      static bool if_range(const webby::request& req, const std::string& etag, time_t mtime) {
+        if(!req.has_header(known_header::if_range)) {
+          return true;
+        }
+        string_view value = req.header(known_header::if_range);
+        if(!value.empty() && value[0] == '"') {
+          return value == etag;
+        }
+        time_t t;
+        return parse_http_date(value, t) && t == mtime;
+      }
+
+      /**
+       * @brief Evaluates the conditional headers of a request.
+       * @param[in] req Request to evaluate.
+       * @param[in] etag Entity tag of the file.
+       * @param[in] mtime Modification time of the file.
+       * @returns `true` if the client's copy is current and `304 Not Modified` should be sent.
+       *
+       * `If-None-Match` takes precedence over `If-Modified-Since`, as RFC 7232 requires. Only
+       * `GET` and `HEAD` requests are answered with 304.
+       */
+      static bool not_modified(const webby::request& req, const std::string& etag, time_t mtime) {
+        if(req.method() != method::GET && req.method() != method::HEAD) {
+          return false;
+        }
+        if(req.has_header(known_header::if_none_match)) {
+          return matches_etag(req.header(known_header::if_none_match), etag);
+        }
+        time_t since;
+        if(req.has_header(known_header::if_modified_since) &&
+           parse_http_date(req.header(known_header::if_modified_since), since)) {
+          return mtime <= since;
+        }
+        return false;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether an `If-None-Match` list matches an entity tag.
+       * @param[in] list Header value, e.g. `"a", W/"b"` or `*`.
+       * @param[in] etag Entity tag to look for.
+       *
+       * Uses the weak comparison, so `W/"x"` matches `"x"`.
+       */
+      static bool matches_etag(string_view list, string_view etag) {
+        size_t first = 0;
+        while(first < list.size()) {
+          size_t last = list.find(',', first);
+          if(last == string_view::npos) {
+            last = list.size();
+          }
+          string_view item = list.substr(first, last - first);
+          first = last + 1;
+          while(!item.empty() && (item[0] == ' ' || item[0] == '\t')) {
+            item = item.substr(1);
+          }
+          while(!item.empty() && (item[item.size() - 1] == ' ' || item[item.size() - 1] == '\t')) {
+            item = item.substr(0, item.size() - 1);
+          }
+          if(item.size() > 2 && item[0] == 'W' && item[1] == '/') {
+            item = item.substr(2);
+          }
+          if(item == "*" || item == etag) {
+            return true;
+          }
+        }
+        return false;
       }
 
       /**
        * @brief Root path of the served directory.
        */
       const std::string _root;
+
+      /**
+       * @brief Milliseconds after which cached files are checked for changes.
+       */
+      const unsigned _cache_ttl;
+
+      /**
+       * @brief Open files, shared by every copy of the handler.
+       */
+      std::shared_ptr<file_cache> _cache;
+
+      /**
+       * @brief Files held in memory, or `nullptr` if the memory cache is disabled.
+       */
+      std::shared_ptr<asset_cache> _assets;
   };
 }
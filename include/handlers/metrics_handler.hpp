@@ -0,0 +1,46 @@
+#pragma once
+
+#include <webby/metrics.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Serves a webby::metrics registry in the Prometheus text exposition format.
+   *
+   * Mount it on the router under a path of your choice:
+   *
+   *     router.add("/metrics", webby::method::GET, webby::metrics_handler(server.metrics()));
+   *
+   * Scraping merges the per-thread shards under the registry's lock, so it does not slow down
+   * the threads that are recording requests.
+   */
+  class metrics_handler {
+    public:
+      /**
+       * @brief Constructs a handler for a registry.
+       * @param[in] registry Registry to serve. It must outlive the handler.
+       */
+      explicit metrics_handler(const webby::metrics& registry) : _registry(&registry) { }
+
+      /**
+       * @brief Invoked by the router.
+       * @param[in] req Request that triggered the use of this handler.
+       * @param[out] res Response sent to the connected host.
+       */
+      void operator()(const webby::request& req, webby::response& res) {
+        (void)req;
+        res.set_status_code(200)
+           .set_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+           .set_header("Cache-Control", "no-store");
+        _registry->write(res.stream());
+      }
+
+    private:
+      /**
+       * @brief Registry to serve.
+       */
+      const webby::metrics* _registry;
+  };
+}
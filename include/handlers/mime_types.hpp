@@ -0,0 +1,68 @@
+#pragma once
+
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Gets the media type of a file from its extension.
+   * @param[in] path Path or name of the file.
+   * @returns the media type for the `Content-Type` header, or `application/octet-stream` if the
+   *          extension is not known.
+   */
+  inline const char* mime_type(string_view path) {
+    struct mapping {
+      const char* extension;
+      const char* type;
+    };
+    static const mapping types[] = {
+      { "css",   "text/css; charset=utf-8" },
+      { "csv",   "text/csv; charset=utf-8" },
+      { "gif",   "image/gif" },
+      { "htm",   "text/html; charset=utf-8" },
+      { "html",  "text/html; charset=utf-8" },
+      { "ico",   "image/x-icon" },
+      { "jpeg",  "image/jpeg" },
+      { "jpg",   "image/jpeg" },
+      { "js",    "application/javascript; charset=utf-8" },
+      { "json",  "application/json" },
+      { "map",   "application/json" },
+      { "mp3",   "audio/mpeg" },
+      { "mp4",   "video/mp4" },
+      { "pdf",   "application/pdf" },
+      { "png",   "image/png" },
+      { "svg",   "image/svg+xml" },
+      { "txt",   "text/plain; charset=utf-8" },
+      { "wasm",  "application/wasm" },
+      { "webm",  "video/webm" },
+      { "webp",  "image/webp" },
+      { "woff",  "font/woff" },
+      { "woff2", "font/woff2" },
+      { "xml",   "application/xml" },
+      { "zip",   "application/zip" }
+    };
+
+    // Finds the extension of the last path segment.
+    size_t dot = string_view::npos;
+    for(size_t i = path.size(); i > 0; --i) {
+      if(path[i - 1] == '/') {
+        break;
+      }
+      if(path[i - 1] == '.') {
+        dot = i;
+        break;
+      }
+    }
+    if(dot != string_view::npos) {
+      string_view extension = path.substr(dot);
+      for(size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+        if(iequals(extension, types[i].extension)) {
+          return types[i].type;
+        }
+      }
+    }
+    return "application/octet-stream";
+  }
+}
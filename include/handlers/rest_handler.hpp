@@ -1,39 +1,108 @@
 #pragma once
 
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <webby/method.hpp>
+#include <webby/request.hpp>
+#include <webby/response.hpp>
+#include <webby/router.hpp>
+
 /**
  * @namespace webby
  */
 namespace webby {
   /**
    * @brief Base class used to implement a standard RESTful resource handler.
+   *
+   * A resource added to a webby::router with a path such as `/items` gets two routes: the
+   * collection at `/items`, which takes `GET` (index) and `POST` (create), and its members at
+   * `/items/:id`, which take `GET` (show), `PUT` (update) and `DELETE` (destroy). Handlers read
+   * the ID of a member with `req.param<long>("id")`.
+   *
+   * Which of the members the subclass overrides is decided at compile time, and each route is
+   * bound directly to the member that handles it, so routing a request involves no further
+   * decision. Requests for members that are not overridden are answered with
+   * "501 Not Implemented", and other methods with "405 Method Not Allowed".
    */
   template<typename T> class rest_handler {
     public:
       /**
-       * @brief Invoked by the router to handle a request.
+       * @brief Adds the routes of a resource to a router.
+       * @param[in] r Router to add the routes to.
+       * @param[in] path Path of the collection, e.g. `/items`.
+       * @param[in] mask Mask of the HTTP methods that the resource accepts.
+       * @param[in] resource The resource, shared by its routes.
+       *
+       * This is called by webby::router::add().
+       */
+      static void add_routes(router& r, const std::string& path, enum webby::method mask,
+                             std::shared_ptr<T> resource) {
+        std::string member = path;
+        if(!member.empty() && member[member.size() - 1] == '/') {
+          member.erase(member.size() - 1);
+        }
+        member += "/:id";
+
+        enum webby::method missing = static_cast<enum webby::method>(0);
+        bind<decltype(&T::index)>(r, path, mask, method::GET, missing,
+            [resource](const webby::request& req, webby::response& res) {
+              resource->index(req, res);
+            });
+        bind<decltype(&T::create)>(r, path, mask, method::POST, missing,
+            [resource](const webby::request& req, webby::response& res) {
+              resource->create(req, res);
+            });
+        if(missing != static_cast<enum webby::method>(0)) {
+          r.add(path, missing, not_implemented);
+        }
+
+        missing = static_cast<enum webby::method>(0);
+        bind<decltype(&T::show)>(r, member, mask, method::GET, missing,
+            [resource](const webby::request& req, webby::response& res) {
+              resource->show(req, res);
+            });
+        bind<decltype(&T::update)>(r, member, mask, method::PUT, missing,
+            [resource](const webby::request& req, webby::response& res) {
+              resource->update(req, res);
+            });
+        bind<decltype(&T::destroy)>(r, member, mask, method::DELETE, missing,
+            [resource](const webby::request& req, webby::response& res) {
+              resource->destroy(req, res);
+            });
+        if(missing != static_cast<enum webby::method>(0)) {
+          r.add(member, missing, not_implemented);
+        }
+      }
+
+      /**
+       * @brief Handles a request for the resource when it is used as a plain handler.
        * @param[in] req Request that triggered the use of this handler.
        * @param[out] res Response sent to the connected host.
+       *
+       * Routes added with webby::router::add() do not go through this function.
        */
       void operator()(const webby::request& req, webby::response& res) {
-        // Returns a 501 "Not Implemented" response by default unless the subclass overrides it.
-        res.set_status_code(501);
         switch(req.method()) {
           case method::DELETE:
-            static_cast<T*>(this)->destroy(req, res);
+            call<decltype(&T::destroy)>(req, res, &T::destroy);
             break;
           case method::GET:
             if(req.path() == req.route()) {
-              static_cast<T*>(this)->index(req, res);
+              call<decltype(&T::index)>(req, res, &T::index);
             }
             else {
-              static_cast<T*>(this)->show(req, res);
+              call<decltype(&T::show)>(req, res, &T::show);
             }
             break;
           case method::POST:
-            static_cast<T*>(this)->create(req, res);
+            call<decltype(&T::create)>(req, res, &T::create);
             break;
           case method::PUT:
-            static_cast<T*>(this)->update(req, res);
+            call<decltype(&T::update)>(req, res, &T::update);
+            break;
+          default:
+            not_implemented(req, res);
             break;
         }
       }
@@ -82,6 +151,59 @@ namespace webby {
        * This method is invoked by a request in the form, "DELETE /path/{id}"
        */
       void destroy(const webby::request&, webby::response&) { }
+
+    private:
+      /**
+       * @brief Type of the members when the subclass does not override them.
+       */
+      typedef void (rest_handler::*action_t)(const webby::request&, webby::response&);
+
+      /**
+       * @brief Gets a value that indicates whether the subclass overrides a member, given the
+       *        type of a pointer to it.
+       */
+      template<typename A>
+      static constexpr bool implemented() {
+        return !std::is_same<A, action_t>::value;
+      }
+
+      /**
+       * @brief Adds the route of one member if the subclass implements it and the mask accepts
+       *        its method.
+       * @param[in,out] missing Receives the method if the subclass does not implement the member.
+       */
+      template<typename A, typename F>
+      static void bind(router& r, const std::string& path, enum webby::method mask,
+                       enum webby::method m, enum webby::method& missing, F handler) {
+        if(m != (mask & m)) {
+          return;
+        }
+        if(implemented<A>()) {
+          r.add(path, m, router::handler_t(handler));
+        }
+        else {
+          missing = missing | m;
+        }
+      }
+
+      /**
+       * @brief Calls a member of the subclass, or answers that it is not implemented.
+       */
+      template<typename A>
+      void call(const webby::request& req, webby::response& res, A action) {
+        if(implemented<A>()) {
+          (static_cast<T*>(this)->*action)(req, res);
+        }
+        else {
+          not_implemented(req, res);
+        }
+      }
+
+      /**
+       * @brief Answers requests for the members that the subclass does not override.
+       */
+      static void not_implemented(const webby::request&, webby::response& res) {
+        res.set_status_code(501);
+      }
   };
 }
-
@@ -0,0 +1,249 @@
+/**
+ * @file access_log.hpp
+ */
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <webby/config.hpp>
+#include <webby/connection.hpp>
+#include <webby/log.hpp>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Access log record for one request.
+   *
+   * The server marks the end of each phase of a request on a monotonic clock while it processes
+   * the request, then calls access_record::write() to format the record into a per-thread buffer
+   * and hand it to the asynchronous log sink, which writes records in batches. Nothing is measured
+   * or formatted unless an access log is set. Records have the form
+   *
+   *     127.0.0.1 GET /items/1 route=/items status=200 bytes=27 parse=3.1us handler=20.4us write=4.0us
+   *
+   * where `parse` is the time taken to receive and decompose the request, `handler` the time spent
+   * in the route's handler, and `write` the time taken to finish sending the response. Fields that
+   * are not known, such as the route of a request that matched none, are written as `-`.
+   */
+  class access_record {
+    public:
+      /**
+       * @brief Monotonic clock the phases are measured on.
+       */
+      typedef std::chrono::steady_clock clock;
+
+      /**
+       * @brief Starts a record, and the parse phase, for the next request on a connection.
+       * @param[in] config Server configuration.
+       * @param[in] connection Connection the request is received over.
+       */
+      access_record(const webby::config& config, webby::connection& connection)
+          : _config(config), _connection(connection), _enabled(config.access_log_enabled()),
+            _status(0), _bytes(0) {
+        if(_enabled) {
+          _start = _parsed = _handled = _finished = clock::now();
+        }
+      }
+
+      access_record(const access_record&) = delete;
+      access_record& operator=(const access_record&) = delete;
+
+      /**
+       * @brief Gets a value that indicates whether the record will be written.
+       */
+      bool enabled() const {
+        return _enabled;
+      }
+
+      /**
+       * @brief Ends the parse phase.
+       */
+      void parsed() {
+        if(_enabled) {
+          _parsed = _handled = _finished = clock::now();
+        }
+      }
+
+      /**
+       * @brief Ends the handler phase.
+       */
+      void handled() {
+        if(_enabled) {
+          _handled = _finished = clock::now();
+        }
+      }
+
+      /**
+       * @brief Ends the write phase.
+       */
+      void finished() {
+        if(_enabled) {
+          _finished = clock::now();
+        }
+      }
+
+      /**
+       * @brief Sets the fields that describe the request.
+       * @param[in] method Request method as sent by the client.
+       * @param[in] path Request path.
+       * @param[in] route Route that matched the request, or an empty view if none did.
+       *
+       * The views must remain valid until the record is written.
+       */
+      void set_request(string_view method, string_view path, string_view route) {
+        _method = method;
+        _path = path;
+        _route = route;
+      }
+
+      /**
+       * @brief Sets the fields that describe the response.
+       * @param[in] status HTTP status code.
+       * @param[in] bytes Number of body bytes sent.
+       */
+      void set_response(unsigned short status, unsigned long bytes) {
+        _status = status;
+        _bytes = bytes;
+      }
+
+      /**
+       * @brief Formats the record and writes it to the access log.
+       */
+      void write() {
+        if(!_enabled) {
+          return;
+        }
+
+        line& l = local_line();
+        l.reset();
+        l.append(_connection.peer_ip());
+        l.append(' ');
+        l.append(_method);
+        l.append(' ');
+        // A long path or route is cut short rather than the fields after it.
+        l.append(_path, 192);
+        l.append(" route=");
+        l.append(_route, 128);
+        l.append(" status=");
+        if(_status == 0) {
+          l.append('-');
+        }
+        else {
+          l.append(static_cast<unsigned long>(_status));
+        }
+        l.append(" bytes=");
+        l.append(_bytes);
+        l.append(" parse=");
+        l.append_micros(_parsed - _start);
+        l.append(" handler=");
+        l.append_micros(_handled - _parsed);
+        l.append(" write=");
+        l.append_micros(_finished - _handled);
+
+        if(_config.log_sink() != nullptr) {
+          _config.log_sink()->push(_config.access_log(), log_level::info, l.text());
+        }
+        else {
+          std::lock_guard<std::mutex> lock(log_mutex());
+          write_log(_config.access_log(), log_level::info, l.text());
+        }
+      }
+
+    private:
+      /**
+       * @brief Fixed-size buffer that a record is formatted into.
+       */
+      class line {
+        public:
+          line() : _size(0) { }
+
+          /// Starts a new record.
+          void reset() {
+            _size = 0;
+          }
+
+          /// Gets the formatted record.
+          string_view text() const {
+            return string_view(_data, _size);
+          }
+
+          /// Appends a character.
+          void append(char c) {
+            if(_size < sizeof(_data)) {
+              _data[_size++] = c;
+            }
+          }
+
+          /// Appends a string, or `-` if it is empty. Silently truncates it to leave @p keep bytes
+          /// free for the rest of the record.
+          void append(string_view s, size_t keep = 0) {
+            if(s.empty()) {
+              append('-');
+              return;
+            }
+            const size_t room = sizeof(_data) - _size > keep ? sizeof(_data) - _size - keep : 0;
+            size_t n = s.size() < room ? s.size() : room;
+            memcpy(_data + _size, s.data(), n);
+            _size += n;
+          }
+
+          /// Appends a string literal.
+          void append(const char* s) {
+            append(string_view(s));
+          }
+
+          /// Appends a number in decimal.
+          void append(unsigned long value) {
+            char digits[20];
+            unsigned n = 0;
+            do {
+              digits[n++] = static_cast<char>('0' + value % 10);
+              value /= 10;
+            } while(value != 0);
+            while(n > 0) {
+              append(digits[--n]);
+            }
+          }
+
+          /// Appends a duration in microseconds with one decimal place, e.g. `3.1us`.
+          void append_micros(clock::duration d) {
+            long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+            unsigned long tenths = ns > 0 ? static_cast<unsigned long>(ns) / 100 : 0;
+            append(tenths / 10);
+            append('.');
+            append(static_cast<char>('0' + tenths % 10));
+            append("us");
+          }
+
+        private:
+          char _data[async_sink::max_slots * async_sink::max_message];
+          size_t _size;
+      };
+
+      /**
+       * @brief Gets the calling thread's format buffer.
+       */
+      static line& local_line() {
+        static thread_local line l;
+        return l;
+      }
+
+      const webby::config& _config;
+      webby::connection& _connection;
+      const bool _enabled;
+      clock::time_point _start;
+      clock::time_point _parsed;
+      clock::time_point _handled;
+      clock::time_point _finished;
+      string_view _method;
+      string_view _path;
+      string_view _route;
+      unsigned short _status;
+      unsigned long _bytes;
+  };
+}
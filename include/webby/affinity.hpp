@@ -0,0 +1,169 @@
+/**
+ * @file affinity.hpp
+ */
+#pragma once
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Assigns the worker threads to CPUs, spreading them over the NUMA nodes.
+   *
+   * The CPUs are those the process may run on, e.g. as restricted by `taskset` or a cgroup. They
+   * are ordered so that consecutive workers land on different nodes, and within a node physical
+   * cores come before their hyperthreads as the kernel numbers them. A worker pins itself before
+   * it allocates anything, so the kernel's first-touch policy places its connections, arenas, log
+   * ring and metrics shard on its own node.
+   *
+   * Placement is only supported on Linux. Elsewhere there are no CPUs to pin to.
+   */
+  class cpu_placement {
+    public:
+      /**
+       * @brief Constructs an empty placement, which pins nothing.
+       */
+      cpu_placement() { }
+
+      /**
+       * @brief Reads the CPUs the process may run on and the NUMA nodes they belong to.
+       */
+      static cpu_placement detect() {
+        cpu_placement p;
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if(::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+          return p;
+        }
+
+        // Groups the allowed CPUs by node. Without NUMA information they form one node.
+        std::vector<std::vector<int>> nodes;
+        std::vector<bool> seen(CPU_SETSIZE, false);
+        DIR* dir = ::opendir("/sys/devices/system/node");
+        if(dir != nullptr) {
+          std::vector<unsigned> ids;
+          while(struct dirent* e = ::readdir(dir)) {
+            std::string name(e->d_name);
+            if(name.compare(0, 4, "node") == 0 && name.size() > 4 &&
+               name.find_first_not_of("0123456789", 4) == std::string::npos) {
+              ids.push_back(static_cast<unsigned>(atoi(name.c_str() + 4)));
+            }
+          }
+          ::closedir(dir);
+          std::sort(ids.begin(), ids.end());
+          for(auto id : ids) {
+            std::ifstream list("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            std::string text;
+            std::getline(list, text);
+            std::vector<int> cpus;
+            for(auto cpu : parse_list(text)) {
+              if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed) && !seen[cpu]) {
+                seen[cpu] = true;
+                cpus.push_back(cpu);
+              }
+            }
+            if(!cpus.empty()) {
+              nodes.push_back(cpus);
+            }
+          }
+        }
+        std::vector<int> rest;
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+          if(CPU_ISSET(cpu, &allowed) && !seen[cpu]) {
+            rest.push_back(cpu);
+          }
+        }
+        if(!rest.empty()) {
+          nodes.push_back(rest);
+        }
+
+        // Takes one CPU from each node in turn.
+        for(size_t i = 0; p._cpus.size() < static_cast<size_t>(CPU_COUNT(&allowed)); ++i) {
+          for(auto& node : nodes) {
+            if(i < node.size()) {
+              p._cpus.push_back(node[i]);
+            }
+          }
+        }
+#endif
+        return p;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether there are no CPUs to pin to.
+       */
+      bool empty() const {
+        return _cpus.empty();
+      }
+
+      /**
+       * @brief Gets the CPU of a worker.
+       * @param[in] worker Index of the worker. Workers beyond the number of CPUs wrap around.
+       * @returns the CPU, or `-1` if the placement is empty.
+       */
+      int cpu(unsigned worker) const {
+        return _cpus.empty() ? -1 : _cpus[worker % _cpus.size()];
+      }
+
+      /**
+       * @brief Pins the calling thread to the CPU of a worker.
+       * @param[in] worker Index of the worker.
+       * @returns `true` if the thread was pinned.
+       */
+      bool pin(unsigned worker) const {
+#if defined(__linux__)
+        const int c = cpu(worker);
+        if(c < 0) {
+          return false;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(c, &set);
+        return ::sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+        (void)(worker);
+        return false;
+#endif
+      }
+
+    private:
+      /**
+       * @brief Parses a CPU list such as `0-3,8-11`.
+       */
+      static std::vector<int> parse_list(const std::string& text) {
+        std::vector<int> cpus;
+        size_t first = 0;
+        while(first < text.size()) {
+          size_t last = text.find(',', first);
+          if(last == std::string::npos) {
+            last = text.size();
+          }
+          const std::string range = text.substr(first, last - first);
+          const size_t dash = range.find('-');
+          const int low = atoi(range.c_str());
+          const int high = dash == std::string::npos ? low : atoi(range.c_str() + dash + 1);
+          for(int cpu = low; cpu <= high && cpu >= 0; ++cpu) {
+            cpus.push_back(cpu);
+          }
+          first = last + 1;
+        }
+        return cpus;
+      }
+
+      /**
+       * @brief CPUs of the workers, in order.
+       */
+      std::vector<int> _cpus;
+  };
+}
@@ -0,0 +1,179 @@
+/**
+ * @file arena.hpp
+ */
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Bump allocator for memory that lives as long as one request.
+   *
+   * Each webby::connection owns an arena that the request's webby::response draws its headers
+   * and staging buffers from. Allocation advances a pointer through a block, deallocation does
+   * nothing, and connection::release() rewinds the arena for the next request on the
+   * connection. The blocks are kept across requests, so once a connection has served a request
+   * of a typical size the following ones allocate nothing from the global heap.
+   *
+   * An arena is used by one thread at a time, like the connection that owns it.
+   */
+  class arena {
+    public:
+      /**
+       * @brief Size of the blocks the arena grows by.
+       */
+      static const size_t block_size = 4096;
+
+      /**
+       * @brief Number of bytes of blocks kept when the arena is reset. Blocks beyond this were
+       *        needed by an unusually large response and are returned to the heap.
+       */
+      static const size_t retained_size = 64 * 1024;
+
+      arena() : _current(0), _offset(0) { }
+
+      arena(const arena&) = delete;
+      arena& operator=(const arena&) = delete;
+
+      /**
+       * @brief Allocates memory that stays valid until the arena is reset.
+       * @param[in] size Number of bytes.
+       * @param[in] alignment Alignment of the memory, which must be a power of two.
+       * @returns the memory.
+       * @throws std::bad_alloc if a new block cannot be allocated.
+       */
+      void* allocate(size_t size, size_t alignment = alignof(max_align_t)) {
+        while(_current < _blocks.size()) {
+          block& b = _blocks[_current];
+          size_t offset = (_offset + alignment - 1) & ~(alignment - 1);
+          if(offset + size <= b.size) {
+            _offset = offset + size;
+            return b.data.get() + offset;
+          }
+          ++_current;
+          _offset = 0;
+        }
+
+        // Adds a block big enough for the allocation, aligned by operator new[].
+        block b;
+        b.size = size + alignment > block_size ? size + alignment : block_size;
+        b.data.reset(new char[b.size]);
+        _blocks.push_back(std::move(b));
+        _current = _blocks.size() - 1;
+        _offset = size;
+        return _blocks.back().data.get();
+      }
+
+      /**
+       * @brief Copies a string into the arena.
+       * @returns a view of the copy.
+       */
+      string_view copy(string_view str) {
+        if(str.empty()) {
+          return string_view();
+        }
+        char* p = static_cast<char*>(allocate(str.size(), 1));
+        memcpy(p, str.data(), str.size());
+        return string_view(p, str.size());
+      }
+
+      /**
+       * @brief Releases everything allocated from the arena.
+       *
+       * Memory returned by arena::allocate() must no longer be used.
+       */
+      void reset() {
+        size_t kept = 0;
+        size_t i = 0;
+        while(i < _blocks.size() && kept + _blocks[i].size <= retained_size) {
+          kept += _blocks[i++].size;
+        }
+        _blocks.resize(i);
+        _current = 0;
+        _offset = 0;
+      }
+
+    private:
+      /**
+       * @brief A block of memory that allocations are carved from.
+       */
+      struct block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+      };
+
+      /**
+       * @brief Blocks in the order they are used.
+       */
+      std::vector<block> _blocks;
+
+      /**
+       * @brief Index of the block allocations are taken from.
+       */
+      size_t _current;
+
+      /**
+       * @brief Offset of the free space in the current block.
+       */
+      size_t _offset;
+  };
+
+  /**
+   * @brief Standard allocator that draws memory from a webby::arena.
+   *
+   * Containers built with it, such as the header map of a webby::response, allocate without
+   * locking and free everything at once when the arena is reset. Their destructors still run,
+   * but deallocation does nothing.
+   */
+  template<typename T>
+  class arena_allocator {
+    public:
+      typedef T value_type;
+
+      /**
+       * @brief Constructs an allocator for an arena.
+       */
+      explicit arena_allocator(webby::arena& a) : _arena(&a) { }
+
+      /**
+       * @brief Constructs an allocator for another type that uses the same arena.
+       */
+      template<typename U>
+      arena_allocator(const arena_allocator<U>& other) : _arena(other._arena) { }
+
+      T* allocate(size_t n) {
+        return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+      }
+
+      void deallocate(T*, size_t) { }
+
+      /**
+       * @brief Gets the arena the allocator draws from.
+       */
+      webby::arena& arena() const {
+        return *_arena;
+      }
+
+    private:
+      webby::arena* _arena;
+
+    template<typename U> friend class arena_allocator;
+  };
+
+  template<typename T, typename U>
+  inline bool operator==(const arena_allocator<T>& lhs, const arena_allocator<U>& rhs) {
+    return &lhs.arena() == &rhs.arena();
+  }
+
+  template<typename T, typename U>
+  inline bool operator!=(const arena_allocator<T>& lhs, const arena_allocator<U>& rhs) {
+    return !(lhs == rhs);
+  }
+}
@@ -0,0 +1,437 @@
+/**
+ * @file compression.hpp
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdexcept>
+#include <string>
+#include <webby/utility.hpp>
+
+#ifdef WEBBY_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef WEBBY_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Content codings that responses can be compressed with.
+   */
+  enum class content_coding {
+    identity, ///< Not compressed.
+    deflate,  ///< zlib format (RFC 1950), requires `WEBBY_HAVE_ZLIB`.
+    gzip,     ///< gzip format (RFC 1952), requires `WEBBY_HAVE_ZLIB`.
+    brotli    ///< Brotli (RFC 7932), requires `WEBBY_HAVE_BROTLI`.
+  };
+
+  /**
+   * @brief Gets the token of a content coding for the `Content-Encoding` header.
+   */
+  inline const char* coding_name(content_coding coding) {
+    switch(coding) {
+      case content_coding::deflate: return "deflate";
+      case content_coding::gzip:    return "gzip";
+      case content_coding::brotli:  return "br";
+      default:                      return "identity";
+    }
+  }
+
+  /**
+   * @brief Chooses the content coding for a response from the request's `Accept-Encoding`.
+   * @param[in] accept_encoding Value of the `Accept-Encoding` header.
+   * @returns the best coding that the client accepts and webby was built with: Brotli, then
+   *          gzip, then deflate. If there is none the response is not compressed.
+   */
+  inline content_coding negotiate_coding(string_view accept_encoding) {
+#ifdef WEBBY_HAVE_BROTLI
+    if(accepts_token(accept_encoding, "br")) {
+      return content_coding::brotli;
+    }
+#endif
+#ifdef WEBBY_HAVE_ZLIB
+    if(accepts_token(accept_encoding, "gzip")) {
+      return content_coding::gzip;
+    }
+    if(accepts_token(accept_encoding, "deflate")) {
+      return content_coding::deflate;
+    }
+#endif
+    (void)accept_encoding;
+    return content_coding::identity;
+  }
+
+  /**
+   * @brief Gets a value that indicates whether a media type is worth compressing.
+   * @param[in] content_type Value of the `Content-Type` header, or an empty string if the
+   *                         handler did not set one.
+   *
+   * Text, JSON, JavaScript and XML compress well. Images, audio, video and archives are already
+   * compressed, and compressing them again costs time without making them smaller.
+   */
+  inline bool compressible_type(string_view content_type) {
+    if(content_type.empty() || content_type.compare(0, 5, "text/") == 0) {
+      return true;
+    }
+    static const char* const keywords[] = { "json", "javascript", "xml", "wasm" };
+    for(size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); ++i) {
+      string_view keyword(keywords[i]);
+      for(size_t first = 0; first + keyword.size() <= content_type.size(); ++first) {
+        if(iequals(content_type.substr(first, keyword.size()), keyword)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief Streaming compressor for response bodies.
+   *
+   * Each compressor owns its zlib stream while its body is compressed, since a suspended
+   * response can be left half compressed while its thread serves others. Finished streams go to a
+   * small per-thread free list and are reset for the next response, so compressing a response
+   * allocates nothing once a thread has compressed a few. The Brotli encoder has no reset
+   * operation; an instance is created for each compressed response. Compressed output is
+   * collected in a per-thread buffer and handed to a sink whenever the buffer fills up, when the
+   * body is flushed, and when it ends.
+   */
+  class compressor {
+    public:
+      /**
+       * @brief Reports a failure of the compression library.
+       */
+      class error : public std::runtime_error {
+        public:
+          /**
+           * @brief Constructs the `compressor::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const std::string& what_arg) : runtime_error(what_arg) { }
+
+          /**
+           * @brief Constructs the `compressor::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const char* what_arg) : runtime_error(what_arg) { }
+      };
+
+      /**
+       * @brief What to do with compressed data the library is holding back.
+       */
+      enum class mode {
+        none,  ///< Keep it, to compress more input together.
+        flush, ///< Hand everything compressed so far to the sink, e.g. for a streamed response.
+        finish ///< End the compressed stream.
+      };
+
+      /**
+       * @brief Size of the buffer compressed output is collected in.
+       */
+      static const size_t output_size = 16384;
+
+      compressor() : _coding(content_coding::identity) {
+#ifdef WEBBY_HAVE_ZLIB
+        _zlib = nullptr;
+#endif
+#ifdef WEBBY_HAVE_BROTLI
+        _brotli = nullptr;
+#endif
+      }
+
+      compressor(const compressor&) = delete;
+      compressor& operator=(const compressor&) = delete;
+
+      ~compressor() {
+#ifdef WEBBY_HAVE_ZLIB
+        if(_zlib != nullptr) {
+          context().release(_zlib);
+        }
+#endif
+#ifdef WEBBY_HAVE_BROTLI
+        if(_brotli != nullptr) {
+          BrotliEncoderDestroyInstance(_brotli);
+        }
+#endif
+      }
+
+      /**
+       * @brief Gets the coding of the compressed stream, or content_coding::identity if no
+       *        stream has been started.
+       */
+      content_coding coding() const {
+        return _coding;
+      }
+
+      /**
+       * @brief Starts a compressed stream.
+       * @param[in] coding Coding to compress with. It must be one webby was built with.
+       * @param[in] level Compression level from `1` to `9`.
+       * @throws webby::compressor::error if the library cannot be initialized.
+       */
+      void begin(content_coding coding, int level) {
+        _coding = coding;
+        switch(coding) {
+#ifdef WEBBY_HAVE_ZLIB
+          case content_coding::deflate:
+          case content_coding::gzip:
+            if(_zlib != nullptr) {
+              context().release(_zlib);
+            }
+            _zlib = context().acquire(coding == content_coding::gzip, level);
+            break;
+#endif
+#ifdef WEBBY_HAVE_BROTLI
+          case content_coding::brotli:
+            _brotli = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+            if(_brotli == nullptr) {
+              throw compressor::error("Cannot create a Brotli encoder");
+            }
+            BrotliEncoderSetParameter(_brotli, BROTLI_PARAM_QUALITY, static_cast<uint32_t>(level));
+            BrotliEncoderSetParameter(_brotli, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+            break;
+#endif
+          default:
+            (void)level;
+            throw compressor::error("Content coding is not available");
+        }
+      }
+
+      /**
+       * @brief Compresses a block of the body.
+       * @param[in] data Uncompressed bytes.
+       * @param[in] length Number of bytes.
+       * @param[in] m What to do with data held back by the library.
+       * @param[in] sink Function called as `sink(const char* data, size_t length)` with each block
+       *                 of compressed output.
+       * @throws webby::compressor::error if the library fails.
+       */
+      template<typename Sink>
+      void write(const char* data, size_t length, mode m, Sink&& sink) {
+        char* const out = context().output;
+        switch(_coding) {
+#ifdef WEBBY_HAVE_ZLIB
+          case content_coding::deflate:
+          case content_coding::gzip: {
+            int flush = Z_NO_FLUSH;
+            if(m == mode::flush) {
+              flush = Z_SYNC_FLUSH;
+            }
+            else if(m == mode::finish) {
+              flush = Z_FINISH;
+            }
+            if(_zlib == nullptr) {
+              throw compressor::error("The compressed stream has ended");
+            }
+            z_stream& z = _zlib->z;
+            z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            z.avail_in = static_cast<uInt>(length);
+            while(1) {
+              z.next_out = reinterpret_cast<Bytef*>(out);
+              z.avail_out = static_cast<uInt>(output_size);
+              int rc = ::deflate(&z, flush);
+              if(rc == Z_STREAM_ERROR) {
+                throw compressor::error("deflate() failed");
+              }
+              size_t n = output_size - z.avail_out;
+              if(n > 0) {
+                sink(static_cast<const char*>(out), n);
+              }
+              // deflate() is done once it leaves room in the output buffer.
+              if(z.avail_out != 0 && (flush != Z_FINISH || rc == Z_STREAM_END)) {
+                break;
+              }
+            }
+            if(flush == Z_FINISH) {
+              context().release(_zlib);
+              _zlib = nullptr;
+            }
+            break;
+          }
+#endif
+#ifdef WEBBY_HAVE_BROTLI
+          case content_coding::brotli: {
+            BrotliEncoderOperation op = BROTLI_OPERATION_PROCESS;
+            if(m == mode::flush) {
+              op = BROTLI_OPERATION_FLUSH;
+            }
+            else if(m == mode::finish) {
+              op = BROTLI_OPERATION_FINISH;
+            }
+            const uint8_t* next_in = reinterpret_cast<const uint8_t*>(data);
+            size_t avail_in = length;
+            while(1) {
+              uint8_t* next_out = reinterpret_cast<uint8_t*>(out);
+              size_t avail_out = output_size;
+              if(!BrotliEncoderCompressStream(_brotli, op, &avail_in, &next_in, &avail_out,
+                                              &next_out, nullptr)) {
+                throw compressor::error("BrotliEncoderCompressStream() failed");
+              }
+              size_t n = output_size - avail_out;
+              if(n > 0) {
+                sink(static_cast<const char*>(out), n);
+              }
+              if(avail_in == 0 && !BrotliEncoderHasMoreOutput(_brotli) &&
+                 (op != BROTLI_OPERATION_FINISH || BrotliEncoderIsFinished(_brotli))) {
+                break;
+              }
+            }
+            break;
+          }
+#endif
+          default:
+            (void)data;
+            (void)length;
+            (void)m;
+            (void)sink;
+            (void)out;
+            throw compressor::error("No compressed stream has been started");
+        }
+      }
+
+    private:
+#ifdef WEBBY_HAVE_ZLIB
+      /**
+       * @brief A zlib stream and the format and level it was set up with.
+       */
+      struct zlib_stream {
+        z_stream z;
+        bool gzip;
+        int level;
+        zlib_stream* next;
+      };
+#endif
+
+      /**
+       * @brief Compression state kept by each thread.
+       */
+      struct thread_context {
+#ifdef WEBBY_HAVE_ZLIB
+        /**
+         * @brief Number of finished streams of each format a thread keeps for later responses.
+         */
+        static const size_t spare_streams = 8;
+
+        thread_context() {
+          spare[0] = spare[1] = nullptr;
+          spares[0] = spares[1] = 0;
+        }
+#endif
+
+        ~thread_context() {
+#ifdef WEBBY_HAVE_ZLIB
+          for(int i = 0; i < 2; ++i) {
+            while(spare[i] != nullptr) {
+              zlib_stream* s = spare[i];
+              spare[i] = s->next;
+              destroy(s);
+            }
+          }
+#endif
+        }
+
+#ifdef WEBBY_HAVE_ZLIB
+        /**
+         * @brief Gets a zlib stream for a new body, reusing a spare one if the thread has one.
+         * @throws webby::compressor::error if zlib cannot be initialized.
+         */
+        zlib_stream* acquire(bool gzip, int level) {
+          const int i = gzip ? 1 : 0;
+          zlib_stream* s = spare[i];
+          if(s != nullptr) {
+            spare[i] = s->next;
+            --spares[i];
+            deflateReset(&s->z);
+            if(s->level != level) {
+              deflateParams(&s->z, level, Z_DEFAULT_STRATEGY);
+              s->level = level;
+            }
+            return s;
+          }
+          s = new zlib_stream;
+          s->z.zalloc = Z_NULL;
+          s->z.zfree = Z_NULL;
+          s->z.opaque = Z_NULL;
+          // Window bits of 15 select the zlib format; adding 16 selects gzip.
+          if(deflateInit2(&s->z, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8,
+                          Z_DEFAULT_STRATEGY) != Z_OK) {
+            delete s;
+            throw compressor::error("deflateInit2() failed");
+          }
+          s->gzip = gzip;
+          s->level = level;
+          return s;
+        }
+
+        /**
+         * @brief Keeps a stream that is no longer used for a later body, or frees it.
+         */
+        void release(zlib_stream* s) {
+          const int i = s->gzip ? 1 : 0;
+          if(spares[i] < spare_streams) {
+            s->next = spare[i];
+            spare[i] = s;
+            ++spares[i];
+          }
+          else {
+            destroy(s);
+          }
+        }
+
+        /**
+         * @brief Frees a zlib stream.
+         */
+        static void destroy(zlib_stream* s) {
+          deflateEnd(&s->z);
+          delete s;
+        }
+
+        /**
+         * @brief Streams of each format, zlib first and then gzip, that no body is using.
+         */
+        zlib_stream* spare[2];
+
+        /**
+         * @brief Number of streams in each list of thread_context::spare.
+         */
+        size_t spares[2];
+#endif
+
+        /**
+         * @brief Buffer compressed output is collected in.
+         */
+        char output[output_size];
+      };
+
+      /**
+       * @brief Gets the calling thread's compression state.
+       */
+      static thread_context& context() {
+        static thread_local thread_context c;
+        return c;
+      }
+
+      /**
+       * @brief Coding of the current stream.
+       */
+      content_coding _coding;
+
+#ifdef WEBBY_HAVE_ZLIB
+      /**
+       * @brief zlib stream while a gzip or deflate body is compressed.
+       */
+      zlib_stream* _zlib;
+#endif
+
+#ifdef WEBBY_HAVE_BROTLI
+      /**
+       * @brief Brotli encoder while a Brotli body is compressed.
+       */
+      BrotliEncoderState* _brotli;
+#endif
+  };
+}
@@ -6,6 +6,8 @@
 #include <qlog.hpp>
 #include <memory>
 #include <string>
+#include <thread>
+#include <webby/log.hpp>
 
 /**
  * @namespace
@@ -16,6 +18,14 @@ namespace webby {
    */
   class config {
     public:
+      /**
+       * @brief Strategies the server can use to process connections concurrently.
+       */
+      enum class concurrency_model {
+        thread_pool, ///< One acceptor thread feeds a pool of blocking worker threads.
+        event_loop   ///< One non-blocking epoll/kqueue loop per worker thread.
+      };
+
       /**
        * @brief Gets the server address.
        * @returns current server address.
@@ -62,6 +72,30 @@ namespace webby {
         return *this;
       }
 
+      /**
+       * @brief Gets the inherited listening socket that the server adopts instead of binding.
+       * @returns the descriptor, or `-1` if the server binds its own. Defaults to `-1`.
+       */
+      int listener() const {
+        return _listener;
+      }
+
+      /**
+       * @brief Sets a listening socket that the server adopts instead of binding to the address
+       *        and port.
+       * @param[in] fd Descriptor of a socket that is already listening, e.g. one inherited from
+       *               the process being replaced. The server takes ownership of it.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * Connections queued on the socket while the processes change over are accepted by
+       * whichever process polls it next, so none is refused. Every event loop polls the adopted
+       * socket rather than binding `SO_REUSEPORT` listeners of its own.
+       */
+      config& set_listener(int fd) {
+        _listener = fd;
+        return *this;
+      }
+
       /**
        * @brief Gets the access log.
        * @returns a reference to the access log.
@@ -70,6 +104,15 @@ namespace webby {
         return *_access_log;
       }
 
+      /**
+       * @brief Gets a value that indicates whether an access log has been set.
+       *
+       * One record is written to the access log for every request while it is set.
+       */
+      bool access_log_enabled() const {
+        return _access_log != nullptr;
+      }
+
       /**
        * @brief Sets the access log stream.
        * @param[in] log Access log stream.
@@ -98,6 +141,407 @@ namespace webby {
         return *this;
       }
 
+      /**
+       * @brief Gets the lowest severity written to the error log.
+       * @returns the current log threshold. Defaults to `log_level::info`.
+       */
+      webby::log_level log_threshold() const {
+        return _log_threshold;
+      }
+
+      /**
+       * @brief Sets the lowest severity written to the error log.
+       * @param[in] level The new log threshold.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * Messages below the threshold are discarded before they are formatted. Messages below
+       * `WEBBY_LOG_LEVEL` are not compiled in at all.
+       */
+      config& set_log_level(const webby::log_level level) {
+        _log_threshold = level;
+        return *this;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether messages of a severity are logged.
+       * @param[in] level Severity to check.
+       */
+      bool log_enabled(const webby::log_level level) const {
+        return level >= _log_threshold;
+      }
+
+      /**
+       * @brief Enables or disables asynchronous logging.
+       * @param[in] enabled `true` to queue log messages and write them from a background thread.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * The logs must be set before asynchronous logging is enabled.
+       */
+      config& set_async_logging(const bool enabled) {
+        _log_sink.reset(enabled ? new async_sink() : nullptr);
+        return *this;
+      }
+
+      /**
+       * @brief Gets the asynchronous log sink.
+       * @returns the sink, or `nullptr` if messages are written synchronously.
+       */
+      async_sink* log_sink() const {
+        return _log_sink.get();
+      }
+
+      /**
+       * @brief Gets the number of threads that process requests.
+       * @returns the number of worker threads. Defaults to the hardware concurrency of the host.
+       */
+      unsigned worker_threads() const {
+        if(_worker_threads > 0) {
+          return _worker_threads;
+        }
+        unsigned n = std::thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+      }
+
+      /**
+       * @brief Sets the number of threads that process requests.
+       * @param[in] count Number of worker threads, or `0` to use the hardware concurrency.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       */
+      config& set_worker_threads(const unsigned count) {
+        _worker_threads = count;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the concurrency model.
+       * @returns the current concurrency model. Defaults to `concurrency_model::thread_pool`.
+       */
+      concurrency_model concurrency() const {
+        return _concurrency;
+      }
+
+      /**
+       * @brief Sets the concurrency model.
+       * @param[in] model The new concurrency model.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * With `concurrency_model::event_loop` the server runs `worker_threads()` event loops, each
+       * with its own `SO_REUSEPORT` listener so the kernel spreads connections across them.
+       */
+      config& set_concurrency(const concurrency_model model) {
+        _concurrency = model;
+        return *this;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether each worker thread is pinned to a CPU.
+       * @returns `true` if the workers are pinned. Defaults to `false`.
+       */
+      bool cpu_affinity() const {
+        return _cpu_affinity;
+      }
+
+      /**
+       * @brief Pins each worker thread or event loop to a CPU.
+       * @param[in] enabled `true` to pin the workers.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * The workers are spread over the NUMA nodes, and each allocates its connections and
+       * buffers after it has been pinned, so they stay in memory local to its CPU. Event loops
+       * also ask the kernel to hand them the connections that arrive on their CPU. The thread
+       * that calls webby::server::run() becomes the first event loop and is pinned too. See
+       * webby::cpu_placement.
+       */
+      config& set_cpu_affinity(bool enabled) {
+        _cpu_affinity = enabled;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how long a persistent connection may stay idle between requests.
+       * @returns the idle timeout in milliseconds. Defaults to 5000.
+       */
+      unsigned idle_timeout() const {
+        return _idle_timeout;
+      }
+
+      /**
+       * @brief Sets how long a persistent connection may stay idle between requests.
+       * @param[in] milliseconds Idle timeout in milliseconds.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       */
+      config& set_idle_timeout(const unsigned milliseconds) {
+        _idle_timeout = milliseconds;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the maximum number of requests served over one connection.
+       * @returns the maximum number of requests per connection. Defaults to 100.
+       */
+      unsigned max_requests_per_connection() const {
+        return _max_requests_per_connection;
+      }
+
+      /**
+       * @brief Sets the maximum number of requests served over one connection.
+       * @param[in] count Maximum number of requests, or `1` to disable persistent connections.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       */
+      config& set_max_requests_per_connection(const unsigned count) {
+        _max_requests_per_connection = count;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the largest request body accepted.
+       * @returns the maximum body size in bytes, or `0` if bodies are not limited. Defaults to
+       *          1 MiB.
+       */
+      unsigned long max_body_size() const {
+        return _max_body_size;
+      }
+
+      /**
+       * @brief Sets the largest request body accepted.
+       * @param[in] size Maximum body size in bytes, or `0` to accept bodies of any size.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * Requests that announce a larger `Content-Length` are rejected with `413 Request Entity Too
+       * Large` before their body is read. Reading a larger chunked body throws
+       * webby::request::body_too_large.
+       */
+      config& set_max_body_size(const unsigned long size) {
+        _max_body_size = size;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the maximum number of connections open at the same time.
+       * @returns the maximum number of connections, or `0` if they are not limited. Defaults to
+       *          `0`.
+       */
+      unsigned max_connections() const {
+        return _max_connections;
+      }
+
+      /**
+       * @brief Sets the maximum number of connections open at the same time.
+       * @param[in] count Maximum number of connections, or `0` for no limit.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * Connections accepted beyond the limit are answered with `503 Service Unavailable` and
+       * closed without reading their request. Queued connections count towards the limit.
+       */
+      config& set_max_connections(const unsigned count) {
+        _max_connections = count;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the maximum number of connections waiting for a worker thread.
+       * @returns the maximum queue length, or `0` if the queue is not limited. Defaults to `0`.
+       */
+      unsigned max_queued_connections() const {
+        return _max_queued_connections;
+      }
+
+      /**
+       * @brief Sets the maximum number of connections waiting for a worker thread.
+       * @param[in] count Maximum queue length, or `0` for no limit.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * With `concurrency_model::thread_pool` each accepted connection waits in a queue until a
+       * worker is free to serve its requests. Connections that would make the queue longer are
+       * answered with `503 Service Unavailable`, so clients are turned away at once instead of
+       * waiting behind a backlog that cannot be served in time. The event loop has no queue.
+       */
+      config& set_max_queued_connections(const unsigned count) {
+        _max_queued_connections = count;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the number of seconds clients turned away are asked to wait.
+       * @returns the value of the `Retry-After` header of `503` responses. Defaults to `1`.
+       */
+      unsigned retry_after() const {
+        return _retry_after;
+      }
+
+      /**
+       * @brief Sets the number of seconds clients turned away are asked to wait.
+       * @param[in] seconds Value of the `Retry-After` header of `503` responses.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       */
+      config& set_retry_after(const unsigned seconds) {
+        _retry_after = seconds;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how long the server waits for data from a client.
+       * @returns the read timeout in milliseconds, or `0` if reads wait forever. Defaults to
+       *          10000.
+       */
+      unsigned read_timeout() const {
+        return _read_timeout;
+      }
+
+      /**
+       * @brief Sets how long the server waits for data from a client.
+       * @param[in] milliseconds Read timeout in milliseconds, or `0` to wait forever.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * The whole header block of a request must arrive within the timeout, so a client that
+       * trickles it in a byte at a time cannot hold on to a worker. Each read of the body must
+       * complete within the timeout. Requests that time out are answered with `408 Request
+       * Timeout` and their connection is closed.
+       */
+      config& set_read_timeout(const unsigned milliseconds) {
+        _read_timeout = milliseconds;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how long the server waits for a client to accept response data.
+       * @returns the write timeout in milliseconds, or `0` if writes wait forever. Defaults to
+       *          30000.
+       */
+      unsigned write_timeout() const {
+        return _write_timeout;
+      }
+
+      /**
+       * @brief Sets how long the server waits for a client to accept response data.
+       * @param[in] milliseconds Write timeout in milliseconds, or `0` to wait forever.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * A client that stops reading its response is disconnected once a write has waited this
+       * long for room in the socket's send buffer.
+       */
+      config& set_write_timeout(const unsigned milliseconds) {
+        _write_timeout = milliseconds;
+        return *this;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether connections are encrypted with TLS.
+       */
+      bool tls() const {
+        return !_tls_certificate.empty();
+      }
+
+      /**
+       * @brief Gets the path of the TLS certificate chain.
+       */
+      const std::string& tls_certificate() const {
+        return _tls_certificate;
+      }
+
+      /**
+       * @brief Gets the path of the TLS private key.
+       */
+      const std::string& tls_private_key() const {
+        return _tls_private_key;
+      }
+
+      /**
+       * @brief Serves HTTPS instead of HTTP.
+       * @param[in] certificate Path of a PEM file with the server certificate, followed by any
+       *                        intermediate certificates.
+       * @param[in] private_key Path of the PEM file with the certificate's private key.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * TLS needs webby to be built with OpenSSL (`WEBBY_HAVE_OPENSSL`); otherwise the server
+       * refuses to start. Pass empty strings to serve plain HTTP again.
+       */
+      config& set_tls(const std::string& certificate, const std::string& private_key) {
+        _tls_certificate = certificate;
+        _tls_private_key = private_key;
+        return *this;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether clients can use HTTP/2.
+       */
+      bool http2() const {
+        return _http2;
+      }
+
+      /**
+       * @brief Enables or disables HTTP/2.
+       * @param[in] enabled `true` to serve HTTP/2 to clients that ask for it.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * Over TLS, HTTP/2 is offered with ALPN. Over plain HTTP a client can upgrade with
+       * `Upgrade: h2c`, or start with the HTTP/2 preface if it knows the server supports it.
+       * Either way, clients that do not ask for HTTP/2 are served HTTP/1.1. Enabled by default.
+       */
+      config& set_http2(const bool enabled) {
+        _http2 = enabled;
+        return *this;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether responses are compressed.
+       */
+      bool compression() const {
+        return _compression;
+      }
+
+      /**
+       * @brief Enables or disables response compression.
+       * @param[in] enabled `true` to compress responses that the client accepts compressed.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       *
+       * Textual bodies are compressed with Brotli, gzip or deflate, whichever the client prefers
+       * among the codings webby was built with (`WEBBY_HAVE_BROTLI`, `WEBBY_HAVE_ZLIB`). Handlers
+       * opt out with response::disable_compression(). Disabled by default.
+       */
+      config& set_compression(const bool enabled) {
+        _compression = enabled;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the smallest body that is compressed.
+       * @returns the size in bytes. Defaults to 1 KiB.
+       */
+      unsigned long compression_threshold() const {
+        return _compression_threshold;
+      }
+
+      /**
+       * @brief Sets the smallest body that is compressed.
+       * @param[in] size Size in bytes. Smaller bodies are sent as is, because compressing them
+       *                 saves little and can make them larger.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       */
+      config& set_compression_threshold(const unsigned long size) {
+        _compression_threshold = size;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the compression level.
+       * @returns the zlib level, from `1` (fastest) to `9` (smallest). Defaults to `6`.
+       */
+      int compression_level() const {
+        return _compression_level;
+      }
+
+      /**
+       * @brief Sets the compression level.
+       * @param[in] level zlib level, from `1` (fastest) to `9` (smallest). Brotli uses a quality
+       *                  of the same number, which is suited to on-the-fly compression.
+       * @returns a references to this `webby::config` instance to allow for chaining.
+       */
+      config& set_compression_level(const int level) {
+        _compression_level = level < 1 ? 1 : (level > 9 ? 9 : level);
+        return *this;
+      }
+
     private:
       /// Hostname or IPv4 address the server listens on. Defaults to `localhost`.
       std::string _address;
@@ -105,10 +549,70 @@ namespace webby {
       /// Port the server listens on. Defaults to `80`.
       unsigned short _port;
 
+      /// Inherited listening socket, or `-1` to bind one.
+      int _listener = -1;
+
       /// Access log location.
       std::unique_ptr<qlog::logger> _access_log;
 
       /// Error log location.
       std::unique_ptr<qlog::logger> _error_log;
+
+      /// Lowest severity written to the error log.
+      webby::log_level _log_threshold = webby::log_level::info;
+
+      /// Asynchronous log sink. Declared after the logs so it is drained before they are destroyed.
+      std::unique_ptr<async_sink> _log_sink;
+
+      /// Number of worker threads. `0` selects the hardware concurrency.
+      unsigned _worker_threads = 0;
+
+      /// Concurrency model used by `webby::server::run()`.
+      concurrency_model _concurrency = concurrency_model::thread_pool;
+
+      /// `true` if each worker thread is pinned to a CPU.
+      bool _cpu_affinity = false;
+
+      /// Idle timeout of persistent connections in milliseconds.
+      unsigned _idle_timeout = 5000;
+
+      /// Maximum number of requests served over one connection.
+      unsigned _max_requests_per_connection = 100;
+
+      /// Largest request body accepted, or `0` for no limit.
+      unsigned long _max_body_size = 1024 * 1024;
+
+      /// Maximum number of open connections, or `0` for no limit.
+      unsigned _max_connections = 0;
+
+      /// Maximum number of connections waiting for a worker thread, or `0` for no limit.
+      unsigned _max_queued_connections = 0;
+
+      /// `Retry-After` of responses to connections that are turned away, in seconds.
+      unsigned _retry_after = 1;
+
+      /// Read timeout in milliseconds, or `0` for none.
+      unsigned _read_timeout = 10000;
+
+      /// Write timeout in milliseconds, or `0` for none.
+      unsigned _write_timeout = 30000;
+
+      /// Path of the TLS certificate chain, or empty for plain HTTP.
+      std::string _tls_certificate;
+
+      /// Path of the TLS private key.
+      std::string _tls_private_key;
+
+      /// `true` if clients can use HTTP/2.
+      bool _http2 = true;
+
+      /// `true` if responses are compressed.
+      bool _compression = false;
+
+      /// Smallest body that is compressed.
+      unsigned long _compression_threshold = 1024;
+
+      /// zlib compression level.
+      int _compression_level = 6;
   };
 }
@@ -0,0 +1,1051 @@
+/**
+ * @file connection.hpp
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <webby/arena.hpp>
+#include <webby/known_header.hpp>
+#include <webby/parser.hpp>
+#include <webby/socket.hpp>
+#include <webby/transport.hpp>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  // Forward reference.
+  class executor;
+
+  /**
+   * @brief Buffered reader and writer for a connected socket.
+   *
+   * Data received from the connected host is accumulated in a per-connection buffer that the
+   * connection's webby::parser works over in place. While a request is being processed its header
+   * block is pinned in the buffer, so the views the parser returns stay valid until
+   * connection::release() is called. The connection works over both
+   * blocking and non-blocking sockets: when a non-blocking socket is not ready, read and write
+   * operations wait for it with `poll()` so request handlers can always treat I/O as blocking.
+   * A connection served by an event loop queues the output the socket cannot take instead; see
+   * connection::queue_writes().
+   */
+  class connection {
+    public:
+      /**
+       * @brief Reports that the connected host did not send or accept data in time.
+       */
+      class timeout : public socket::error {
+        public:
+          /**
+           * @brief Constructs the `connection::timeout` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit timeout(const std::string& what_arg) : socket::error(what_arg) { }
+
+          /**
+           * @brief Constructs the `connection::timeout` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit timeout(const char* what_arg) : socket::error(what_arg) { }
+      };
+
+      /**
+       * @brief State of a protocol that has taken over the connection from HTTP/1.1, such as
+       *        HTTP/2.
+       */
+      class protocol {
+        public:
+          virtual ~protocol() { }
+      };
+
+      /**
+       * @brief Size of the blocks the receive buffer grows by.
+       */
+      static const size_t block_size = 4096;
+
+      /**
+       * @brief Maximum number of bytes buffered while waiting for a complete header block.
+       */
+      static const size_t max_header_size = 64 * 1024;
+
+      /**
+       * @brief Size of the buffer that streamed response bodies are collected in.
+       */
+      static const size_t output_size = 8192;
+
+      /**
+       * @brief Maximum number of bytes of data a connection that queues its writes holds for the
+       *        connected host before writes wait for it again.
+       */
+      static const size_t max_unsent = 1024 * 1024;
+
+      /**
+       * @brief Constructs a connection that takes ownership of a socket.
+       * @param[in] s Connected socket.
+       */
+      explicit connection(webby::socket&& s)
+          : _socket(std::move(s)), _buffer(block_size), _begin(0), _end(0), _pinned(false),
+            _eof(false), _requests(0), _read_timeout(-1), _write_timeout(-1),
+            _executor(nullptr), _suspended(false), _queue_writes(false), _unsent_size(0),
+            _awaiting_body(false), _continued(false) { }
+
+      connection(const connection&) = delete;
+      connection& operator=(const connection&) = delete;
+
+      /**
+       * @brief Closes the files that queued output still refers to.
+       */
+      ~connection() {
+        for(auto itr = _unsent.begin(); itr != _unsent.end(); ++itr) {
+          if(itr->fd >= 0) {
+            ::close(itr->fd);
+          }
+        }
+      }
+
+      /**
+       * @brief Limits how long reads and writes wait for the connected host.
+       * @param[in] read_ms Read timeout in milliseconds, or `0` to wait forever.
+       * @param[in] write_ms Write timeout in milliseconds, or `0` to wait forever.
+       *
+       * A read or write that waits longer throws webby::connection::timeout. The read timeout
+       * also bounds the time taken to receive a whole header block; see
+       * connection::read_header(). A blocking socket is switched to non-blocking mode, so that
+       * every wait goes through `poll()` with the timeout.
+       */
+      void set_timeouts(unsigned read_ms, unsigned write_ms) {
+        _read_timeout = read_ms == 0 ? -1 : static_cast<int>(std::min(read_ms, 1u << 30));
+        _write_timeout = write_ms == 0 ? -1 : static_cast<int>(std::min(write_ms, 1u << 30));
+        if(read_ms > 0 || write_ms > 0) {
+          _socket.set_nonblocking();
+        }
+      }
+
+      /**
+       * @brief Layers a transport such as TLS over the socket.
+       * @param[in] t Transport that all further reads and writes go through.
+       */
+      void set_transport(std::unique_ptr<webby::transport> t) {
+        _transport = std::move(t);
+      }
+
+      /**
+       * @brief Enables or disables Nagle's algorithm on the socket.
+       * @param[in] on `true` to send small segments immediately.
+       */
+      void set_nodelay(bool on) {
+        _socket.set_nodelay(on);
+      }
+
+      /**
+       * @brief Hands the connection over to another protocol.
+       * @param[in] p State of the protocol, owned by the connection from now on.
+       *
+       * The bytes received afterwards are not HTTP/1.1 requests, so the parser is no longer used.
+       * See connection::parse().
+       */
+      void upgrade(std::unique_ptr<protocol> p) {
+        _protocol = std::move(p);
+      }
+
+      /**
+       * @brief Gets the protocol the connection has been handed over to.
+       * @returns the protocol's state, or `nullptr` if the connection still carries HTTP/1.1.
+       */
+      protocol* upgraded() const {
+        return _protocol.get();
+      }
+
+      /**
+       * @brief Sets the executor of the thread that serves the connection.
+       * @param[in] e Executor, or `nullptr` if the thread cannot leave a request to finish later.
+       */
+      void set_executor(webby::executor* e) {
+        _executor = e;
+      }
+
+      /**
+       * @brief Gets the executor of the thread that serves the connection, or `nullptr`.
+       */
+      webby::executor* executor() const {
+        return _executor;
+      }
+
+      /**
+       * @brief Marks the current request as waiting for an asynchronous handler, or as resumed.
+       *
+       * The server suspends a connection when its handler returns before finishing the response.
+       * Nothing is read from it until it has been resumed.
+       */
+      void set_suspended(bool suspended) {
+        _suspended = suspended;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the current request waits for an asynchronous
+       *        handler.
+       */
+      bool suspended() const {
+        return _suspended;
+      }
+
+      /**
+       * @brief Queues the output that the socket cannot take instead of waiting for it.
+       * @param[in] on `true` to queue writes.
+       *
+       * An event loop sets this so that a client that stops reading cannot hold up its thread.
+       * Writes then return once their data has been sent or queued, and the loop sends the queued
+       * output with connection::flush() whenever the socket becomes writable. Parts of files are
+       * queued as a duplicate of their descriptor rather than copied. Writes only wait for the
+       * socket again while more than connection::max_unsent bytes of data are queued, which
+       * bounds the memory a large streamed response can take.
+       */
+      void queue_writes(bool on) {
+        _queue_writes = on;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether queued output has not been sent yet.
+       */
+      bool unsent() const {
+        return !_unsent.empty();
+      }
+
+      /**
+       * @brief Sends as much of the queued output as the socket takes without waiting.
+       * @returns `true` once all of it has been sent.
+       * @throws webby::socket::error if the data could not be sent or a queued file was
+       *         truncated.
+       */
+      bool flush() {
+        while(!_unsent.empty()) {
+          unsent_block& b = _unsent.front();
+          ssize_t n;
+          if(b.fd < 0) {
+            struct iovec iov;
+            iov.iov_base = &b.data[b.sent];
+            iov.iov_len = b.data.size() - b.sent;
+            n = _transport ? _transport->writev(&iov, 1, false) : _socket.writev(&iov, 1, false);
+          }
+          else {
+            n = _transport ? _transport->sendfile(b.fd, b.offset, b.length)
+                           : _socket.sendfile(b.fd, b.offset, b.length);
+            if(n == 0) {
+              throw socket::error("sendfile: the file was truncated while it was being sent");
+            }
+          }
+          if(n < 0) {
+            return false;
+          }
+
+          const size_t sent = static_cast<size_t>(n);
+          if(b.fd < 0) {
+            b.sent += sent;
+            _unsent_size -= sent;
+            if(b.sent < b.data.size()) {
+              continue;
+            }
+          }
+          else {
+            b.offset += n;
+            b.length -= sent;
+            if(b.length > 0) {
+              continue;
+            }
+            ::close(b.fd);
+          }
+          _unsent.pop_front();
+        }
+        return true;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the transport holds received data that has
+       *        not been read into the buffer yet.
+       *
+       * The socket does not become readable for that data, so an event loop must call
+       * connection::fill() again before it waits.
+       */
+      bool pending() const {
+        return _transport && _transport->pending() > 0;
+      }
+
+      /**
+       * @brief Reads whatever data is available from the socket into the buffer without waiting.
+       * @returns the number of bytes added, `0` if the peer closed the connection, or `-1` if the
+       *          socket is non-blocking and no data was available.
+       */
+      ssize_t fill() {
+        // Nothing is moved while a request is pinned; the receive buffer is only filled from the
+        // socket between requests and while the header block is incomplete.
+        if(!_pinned) {
+          if(_begin == _end) {
+            _begin = _end = 0;
+            // Gives back the memory of a large request body that was buffered.
+            if(_buffer.size() > max_header_size + block_size) {
+              std::vector<char>(block_size).swap(_buffer);
+            }
+          }
+          else if(_end == _buffer.size() && _begin > 0) {
+            // Moves the unread data to the front to make room.
+            std::copy(_buffer.begin() + _begin, _buffer.begin() + _end, _buffer.begin());
+            _end -= _begin;
+            _begin = 0;
+          }
+          if(_end == _buffer.size()) {
+            _buffer.resize(_buffer.size() + block_size);
+          }
+        }
+
+        ssize_t n = receive(&_buffer[_end], _buffer.size() - _end, false);
+        if(n > 0) {
+          _end += static_cast<size_t>(n);
+        }
+        else if(n == 0) {
+          _eof = true;
+        }
+        return n;
+      }
+
+      /**
+       * @brief Parses the buffered part of the next request.
+       * @returns webby::parser::status::complete if the header block has been parsed and pinned,
+       *          webby::parser::status::incomplete if more data is needed, or
+       *          webby::parser::status::invalid if the request is malformed or its header block is
+       *          larger than connection::max_header_size.
+       *
+       * Once the connection has been upgraded nothing is parsed: the result is
+       * webby::parser::status::complete whenever data is buffered, so that the caller passes it to
+       * the protocol.
+       */
+      parser::status parse() {
+        if(_protocol) {
+          return buffered() > 0 ? parser::status::complete : parser::status::incomplete;
+        }
+        parser::status status = _parser.parse(&_buffer[_begin], buffered());
+        if(status == parser::status::complete) {
+          if(!_pinned) {
+            _pinned = true;
+            _begin += _parser.length();
+          }
+        }
+        else if(status == parser::status::incomplete && buffered() >= max_header_size) {
+          status = parser::status::invalid;
+        }
+        return status;
+      }
+
+      /**
+       * @brief Reads and parses the header block of the next request, waiting for data as needed.
+       * @returns the result of connection::parse(). webby::parser::status::incomplete means the
+       *          peer closed the connection before the header block was complete.
+       * @throws webby::connection::timeout if the rest of the header block does not arrive within
+       *         the read timeout. The time is counted from the first wait, so a client cannot
+       *         stretch it by sending a byte at a time.
+       */
+      parser::status read_header() {
+        std::chrono::steady_clock::time_point deadline;
+        bool waited = false;
+        while(1) {
+          parser::status status = parse();
+          if(status != parser::status::incomplete || _eof) {
+            return status;
+          }
+          int timeout_ms = -1;
+          if(_read_timeout >= 0) {
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if(!waited) {
+              deadline = now + std::chrono::milliseconds(_read_timeout);
+              waited = true;
+            }
+            timeout_ms = now < deadline ? static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) : 0;
+          }
+          if(!wait_fill(timeout_ms)) {
+            return status;
+          }
+        }
+      }
+
+      /**
+       * @brief Receives the body of the parsed request into the buffer before it is processed.
+       * @param[in] limit Largest body that is buffered, in bytes as sent.
+       * @returns `true` if the body is buffered or need not be: the request has none, it is
+       *          larger than @p limit, or its framing is invalid, which the request reports.
+       *          `false` if more of the body must be received first.
+       *
+       * An event loop calls this once a header block is complete, so that handlers read the body
+       * from memory instead of waiting for the client on the loop thread. While the body is
+       * incomplete the header block is unpinned, so that the buffer can grow to hold the whole
+       * request, and it is parsed again once more data has arrived. A client that sent
+       * `Expect: 100-continue` is sent `100 Continue` first.
+       */
+      bool buffer_body(unsigned long limit) {
+        _awaiting_body = false;
+        if(_protocol || !_pinned) {
+          return true;
+        }
+
+        // The request rejects bodies whose framing it does not understand, so those are left to
+        // it.
+        const parser::field* te = nullptr;
+        const parser::field* cl = nullptr;
+        const parser::field* expect = nullptr;
+        const std::vector<parser::field>& fields = _parser.fields();
+        for(auto itr = fields.cbegin(); itr != fields.cend(); ++itr) {
+          switch(find_known_header(itr->name)) {
+            case known_header::transfer_encoding:
+              if(te != nullptr) {
+                return true;
+              }
+              te = &*itr;
+              break;
+            case known_header::content_length:
+              if(cl != nullptr && cl->value != itr->value) {
+                return true;
+              }
+              cl = &*itr;
+              break;
+            case known_header::expect:
+              expect = &*itr;
+              break;
+            default:
+              break;
+          }
+        }
+
+        unsigned long length = 0;
+        if(te != nullptr && !iequals(te->value, "identity")) {
+          if(cl != nullptr || !iequals(te->value, "chunked")) {
+            return true;
+          }
+          size_t framed = 0;
+          if(chunked_length(&_buffer[_begin], buffered(), framed) != parser::status::incomplete ||
+             buffered() > limit) {
+            return true;
+          }
+        }
+        else if(cl != nullptr) {
+          if(cl->value.empty() || !parse_number(cl->value, length) || length == 0 ||
+             length > limit || buffered() >= length) {
+            return true;
+          }
+        }
+        else {
+          return true;
+        }
+
+        if(expect != nullptr && !_continued && _parser.version() != "1.0" &&
+           iequals(expect->value, "100-continue")) {
+          static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+          _continued = true;
+          write(interim, sizeof(interim) - 1);
+        }
+
+        // Makes room for the whole request when its length is known.
+        const size_t header_length = _parser.length();
+        _begin -= header_length;
+        _pinned = false;
+        _parser.reset();
+        const size_t request_size = header_length + static_cast<size_t>(length);
+        if(_begin > 0 && _buffer.size() - _begin < request_size) {
+          std::copy(_buffer.begin() + _begin, _buffer.begin() + _end, _buffer.begin());
+          _end -= _begin;
+          _begin = 0;
+        }
+        if(_buffer.size() < _begin + request_size) {
+          _buffer.resize(_begin + request_size);
+        }
+        _awaiting_body = true;
+        return false;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the last call to connection::buffer_body()
+       *        is waiting for more of the body.
+       */
+      bool awaiting_body() const {
+        return _awaiting_body;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether `100 Continue` has been sent for the current
+       *        request.
+       */
+      bool continued() const {
+        return _continued;
+      }
+
+      /**
+       * @brief Gets the parser that holds the current request's header block.
+       */
+      const webby::parser& request_header() const {
+        return _parser;
+      }
+
+      /**
+       * @brief Unpins the current request once it has been processed.
+       *
+       * Views obtained from connection::request_header() and memory allocated from
+       * connection::arena() are invalid after this call.
+       */
+      void release() {
+        _pinned = false;
+        _continued = false;
+        _parser.reset();
+        _arena.reset();
+      }
+
+      /**
+       * @brief Gets the arena that memory for the current request is allocated from.
+       */
+      webby::arena& arena() {
+        return _arena;
+      }
+
+      /**
+       * @brief Gets the number of bytes buffered but not yet consumed.
+       */
+      size_t buffered() const {
+        return _end - _begin;
+      }
+
+      /**
+       * @brief Reads a block of data, consuming buffered data before reading from the socket.
+       * @param[in] buffer Buffer that receives the data.
+       * @param[in] length Length of the buffer.
+       * @param[in] peek `true` to leave the data available for the next read.
+       * @returns the number of bytes read, or `0` at end of stream.
+       */
+      size_t read(char* buffer, size_t length, bool peek = false) {
+        if(buffered() == 0) {
+          if(_eof) {
+            return 0;
+          }
+
+          // Small reads, such as the size lines of a chunked body, refill the connection buffer
+          // so that they do not cost a system call each. The pinned header block must not move,
+          // so this needs free space after it.
+          if(length < block_size / 4 && (!_pinned || _end < _buffer.size())) {
+            if(!wait_fill()) {
+              return 0;
+            }
+            return read(buffer, length, peek);
+          }
+
+          // Larger reads bypass the connection buffer once it has been drained, which also keeps
+          // the pinned header block in place.
+          while(1) {
+            ssize_t n = receive(buffer, length, peek);
+            if(n >= 0) {
+              return static_cast<size_t>(n);
+            }
+            wait(POLLIN, _read_timeout);
+          }
+        }
+        size_t n = std::min(length, buffered());
+        memcpy(buffer, &_buffer[_begin], n);
+        if(!peek) {
+          _begin += n;
+        }
+        return n;
+      }
+
+      /**
+       * @brief Writes a block of data, waiting for the socket when its send buffer is full, or
+       *        queueing what it cannot take; see connection::queue_writes().
+       * @param[in] data Data to write.
+       * @param[in] length Length of the data.
+       * @throws webby::socket::error if the data could not be sent.
+       */
+      void write(const void* data, size_t length) {
+        const char* p = static_cast<const char*>(data);
+        // Output queued earlier goes first.
+        if(!_unsent.empty() && !flush()) {
+          queue(p, length);
+          return;
+        }
+        while(length > 0) {
+          ssize_t n;
+          if(_transport) {
+            struct iovec iov = { const_cast<char*>(p), length };
+            n = _transport->writev(&iov, 1, false);
+          }
+          else {
+            n = _socket.write(p, length);
+          }
+          if(n < 0) {
+            if(_queue_writes) {
+              queue(p, length);
+              return;
+            }
+            wait(POLLOUT, _write_timeout);
+            continue;
+          }
+          p += n;
+          length -= static_cast<size_t>(n);
+        }
+      }
+
+      /**
+       * @brief Writes data gathered from several buffers, waiting for the socket when its send
+       *        buffer is full, or queueing what it cannot take.
+       * @param[in,out] iov Buffers to write. The array is modified as partial writes advance
+       *                    through it.
+       * @param[in] count Number of buffers.
+       * @param[in] more `true` if more data follows immediately, e.g. a file sent with
+       *                 connection::sendfile().
+       * @throws webby::socket::error if the data could not be sent.
+       *
+       * Each call to the socket sends as many buffers as the platform allows in one `sendmsg()`,
+       * so a header block and a body go out in a single system call and, with Nagle's algorithm
+       * enabled, usually a single segment.
+       */
+      void writev(struct iovec* iov, size_t count, bool more = false) {
+#ifdef IOV_MAX
+        const size_t max_iov = IOV_MAX;
+#else
+        const size_t max_iov = 16;
+#endif
+        if(!_unsent.empty() && !flush()) {
+          queue(iov, count);
+          return;
+        }
+        while(count > 0) {
+          // Skips buffers that have been completely written.
+          if(iov->iov_len == 0) {
+            ++iov;
+            --count;
+            continue;
+          }
+
+          const int batch = static_cast<int>(count < max_iov ? count : max_iov);
+          ssize_t n = _transport ? _transport->writev(iov, batch, more)
+                                 : _socket.writev(iov, batch, more);
+          if(n < 0) {
+            if(_queue_writes) {
+              queue(iov, count);
+              return;
+            }
+            wait(POLLOUT, _write_timeout);
+            continue;
+          }
+
+          // Advances past the bytes that were sent.
+          size_t sent = static_cast<size_t>(n);
+          while(count > 0 && sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            ++iov;
+            --count;
+          }
+          if(sent > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + sent;
+            iov->iov_len -= sent;
+          }
+        }
+      }
+
+      /**
+       * @brief Sends part of a file, waiting for the socket when its send buffer is full, or
+       *        queueing what it cannot take.
+       * @param[in] fd Descriptor of a regular file open for reading.
+       * @param[in] offset Offset of the first byte to send.
+       * @param[in] length Number of bytes to send.
+       * @throws webby::socket::error if the data could not be sent or the file is shorter than
+       *         expected.
+       */
+      void sendfile(int fd, off_t offset, size_t length) {
+        if(!_unsent.empty() && !flush()) {
+          queue_file(fd, offset, length);
+          return;
+        }
+        while(length > 0) {
+          ssize_t n = _transport ? _transport->sendfile(fd, offset, length)
+                                 : _socket.sendfile(fd, offset, length);
+          if(n < 0) {
+            if(_queue_writes) {
+              queue_file(fd, offset, length);
+              return;
+            }
+            wait(POLLOUT, _write_timeout);
+            continue;
+          }
+          if(n == 0) {
+            throw socket::error("sendfile: the file was truncated while it was being sent");
+          }
+          offset += n;
+          length -= static_cast<size_t>(n);
+        }
+      }
+
+      /**
+       * @brief Waits for the first bytes of the next request on a persistent connection.
+       * @param[in] timeout_ms Maximum time to wait in milliseconds.
+       * @returns `true` if data is available; `false` if the wait timed out or the peer closed the
+       *          connection.
+       */
+      bool wait_request(int timeout_ms) {
+        if(buffered() > 0) {
+          return true;
+        }
+        if(!_eof && pending()) {
+          return wait_fill();
+        }
+        if(_eof || !_socket.wait(POLLIN, timeout_ms)) {
+          return false;
+        }
+        return wait_fill();
+      }
+
+      /**
+       * @brief Counts a request received over the connection.
+       * @returns the number of requests received so far, including this one.
+       */
+      unsigned count_request() {
+        return ++_requests;
+      }
+
+      /**
+       * @brief Gets the underlying socket.
+       */
+      const webby::socket& socket() const {
+        return _socket;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the peer has closed the connection.
+       */
+      bool eof() const {
+        return _eof;
+      }
+
+      /**
+       * @brief Gets the buffer that streamed response bodies are collected in.
+       * @returns a buffer of connection::output_size bytes, allocated on first use and reused by
+       *          every response sent over the connection.
+       */
+      char* output_buffer() {
+        if(_output.empty()) {
+          _output.resize(output_size);
+        }
+        return &_output[0];
+      }
+
+      /**
+       * @brief Gets the IP address of the connected host.
+       *
+       * The address is looked up on first use and cached for the lifetime of the connection.
+       */
+      string_view peer_ip() {
+        if(_peer_ip.empty()) {
+          _peer_ip = _socket.peer_ip();
+        }
+        return _peer_ip;
+      }
+
+    private:
+      /**
+       * @brief Output queued for the connected host: a block of data or part of a file.
+       */
+      struct unsent_block {
+        unsent_block() : fd(-1), sent(0), offset(0), length(0) { }
+
+        /// Data to send, unless the block is part of a file.
+        std::string data;
+
+        /// Duplicate descriptor of the file, or `-1` for data.
+        int fd;
+
+        /// Number of bytes of the data sent so far.
+        size_t sent;
+
+        /// Offset of the next byte of the file to send.
+        off_t offset;
+
+        /// Number of bytes of the file left to send.
+        size_t length;
+      };
+
+      /**
+       * @brief Queues data that the socket did not take.
+       */
+      void queue(const char* data, size_t length) {
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(data);
+        iov.iov_len = length;
+        queue(&iov, 1);
+      }
+
+      /**
+       * @brief Queues the buffers that the socket did not take.
+       *
+       * A handler that produces output faster than the client reads it waits while more than
+       * connection::max_unsent bytes from its earlier writes are queued, rather than queueing an
+       * unbounded body. A single large write is queued whole, since its data is in memory anyway.
+       */
+      void queue(const struct iovec* iov, size_t count) {
+        while(_unsent_size > max_unsent) {
+          wait(POLLOUT, _write_timeout);
+          flush();
+        }
+        for(size_t i = 0; i < count; ++i) {
+          if(iov[i].iov_len == 0) {
+            continue;
+          }
+          // A block that has started to go out is not appended to, so that it never holds on to
+          // the bytes already sent.
+          if(_unsent.empty() || _unsent.back().fd >= 0 || _unsent.back().sent > 0) {
+            _unsent.push_back(unsent_block());
+          }
+          _unsent.back().data.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+          _unsent_size += iov[i].iov_len;
+        }
+      }
+
+      /**
+       * @brief Queues part of a file that the socket did not take.
+       * @throws webby::socket::error if the descriptor cannot be duplicated.
+       *
+       * The descriptor is duplicated, so the caller can close the file once the write returns.
+       */
+      void queue_file(int fd, off_t offset, size_t length) {
+        if(length == 0) {
+          return;
+        }
+        unsent_block b;
+        b.fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if(b.fd < 0) {
+          throw socket::error(std::string("fcntl: ") + strerror(errno));
+        }
+        b.offset = offset;
+        b.length = length;
+        _unsent.push_back(std::move(b));
+      }
+
+      /**
+       * @brief Finds the end of a chunked body.
+       * @param[in] data Start of the body.
+       * @param[in] size Number of bytes available.
+       * @param[out] length Receives the length of the body with its framing and trailers.
+       * @returns webby::parser::status::complete if the whole body is available,
+       *          webby::parser::status::incomplete if more is needed, or
+       *          webby::parser::status::invalid if the framing is not valid.
+       */
+      static parser::status chunked_length(const char* data, size_t size, size_t& length) {
+        size_t p = 0;
+        while(1) {
+          const char* lf = static_cast<const char*>(memchr(data + p, '\n', size - p));
+          if(lf == nullptr) {
+            return parser::status::incomplete;
+          }
+          const size_t eol = static_cast<size_t>(lf - data);
+
+          // Parses the hexadecimal size, ignoring any chunk extensions.
+          size_t chunk = 0;
+          size_t i = p;
+          for(; i < eol && isxdigit(static_cast<unsigned char>(data[i])); ++i) {
+            if(chunk > (static_cast<size_t>(-1) >> 4)) {
+              return parser::status::invalid;
+            }
+            const char c = data[i];
+            chunk = (chunk << 4) | static_cast<size_t>(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+          }
+          if(i == p) {
+            return parser::status::invalid;
+          }
+          p = eol + 1;
+
+          if(chunk == 0) {
+            // Skips the trailer fields up to the empty line that ends the body.
+            while(1) {
+              lf = static_cast<const char*>(memchr(data + p, '\n', size - p));
+              if(lf == nullptr) {
+                return parser::status::incomplete;
+              }
+              const size_t end = static_cast<size_t>(lf - data);
+              const bool empty = end == p || (end == p + 1 && data[p] == '\r');
+              p = end + 1;
+              if(empty) {
+                length = p;
+                return parser::status::complete;
+              }
+            }
+          }
+
+          // Skips the data and the line break that ends it.
+          if(size - p < chunk || size - p - chunk < 2) {
+            return parser::status::incomplete;
+          }
+          p += chunk;
+          if(data[p] == '\r') {
+            ++p;
+          }
+          if(data[p] != '\n') {
+            return parser::status::invalid;
+          }
+          ++p;
+        }
+      }
+
+      /**
+       * @brief Waits for data and reads it into the buffer.
+       * @param[in] timeout_ms Maximum time to wait in milliseconds, or `-1` for the read timeout.
+       * @returns `false` if the peer closed the connection.
+       * @throws webby::connection::timeout if no data arrived in time.
+       */
+      bool wait_fill(int timeout_ms = -1) {
+        while(1) {
+          ssize_t n = fill();
+          if(n >= 0) {
+            return n > 0;
+          }
+          wait(POLLIN, timeout_ms >= 0 ? timeout_ms : _read_timeout);
+        }
+      }
+
+      /**
+       * @brief Receives data from the transport, or from the socket if there is none.
+       */
+      ssize_t receive(char* buffer, size_t length, bool peek) {
+        return _transport ? _transport->read(buffer, length, peek)
+                          : _socket.read(buffer, length, peek);
+      }
+
+      /**
+       * @brief Waits until the socket is ready.
+       * @param[in] events `POLLIN` or `POLLOUT`.
+       * @param[in] timeout_ms Maximum time to wait in milliseconds, or `-1` to wait forever.
+       * @throws webby::connection::timeout if the socket did not become ready in time.
+       */
+      void wait(short events, int timeout_ms) {
+        if(!_socket.wait(_transport ? _transport->wait_events(events) : events, timeout_ms)) {
+          throw connection::timeout(events == POLLIN ? "Timed out waiting for the client to send"
+                                                     : "Timed out waiting for the client to read");
+        }
+      }
+
+      /**
+       * @brief Connected socket.
+       */
+      webby::socket _socket;
+
+      /**
+       * @brief Transport layered over the socket, or empty. Declared after the socket so that it
+       *        is shut down before the socket is closed.
+       */
+      std::unique_ptr<webby::transport> _transport;
+
+      /**
+       * @brief Protocol the connection has been handed over to, or empty for HTTP/1.1.
+       */
+      std::unique_ptr<protocol> _protocol;
+
+      /**
+       * @brief Receive buffer.
+       */
+      std::vector<char> _buffer;
+
+      /**
+       * @brief Offset of the first unread byte in the buffer.
+       */
+      size_t _begin;
+
+      /**
+       * @brief Offset one past the last byte received into the buffer.
+       */
+      size_t _end;
+
+      /**
+       * @brief `true` while the current request's header block must not move.
+       */
+      bool _pinned;
+
+      /**
+       * @brief Parses the header block of each request.
+       */
+      webby::parser _parser;
+
+      /**
+       * @brief `true` once the peer has closed the connection.
+       */
+      bool _eof;
+
+      /**
+       * @brief Number of requests received over the connection.
+       */
+      unsigned _requests;
+
+      /**
+       * @brief Read timeout in milliseconds, or `-1` to wait forever.
+       */
+      int _read_timeout;
+
+      /**
+       * @brief Write timeout in milliseconds, or `-1` to wait forever.
+       */
+      int _write_timeout;
+
+      /**
+       * @brief Executor of the thread that serves the connection, or `nullptr`.
+       */
+      webby::executor* _executor;
+
+      /**
+       * @brief `true` while the current request waits for an asynchronous handler.
+       */
+      bool _suspended;
+
+      /**
+       * @brief `true` if writes queue what the socket cannot take instead of waiting.
+       */
+      bool _queue_writes;
+
+      /**
+       * @brief Output that the socket did not take yet, in order.
+       */
+      std::deque<unsent_block> _unsent;
+
+      /**
+       * @brief Number of bytes of data in connection::_unsent.
+       */
+      size_t _unsent_size;
+
+      /**
+       * @brief `true` while connection::buffer_body() waits for more of the body.
+       */
+      bool _awaiting_body;
+
+      /**
+       * @brief `true` once `100 Continue` has been sent for the current request.
+       */
+      bool _continued;
+
+      /**
+       * @brief Memory for the current request, rewound by connection::release().
+       */
+      webby::arena _arena;
+
+      /**
+       * @brief Buffer for streamed response bodies, or empty until first used.
+       */
+      std::vector<char> _output;
+
+      /**
+       * @brief IP address of the connected host, or empty until connection::peer_ip() is called.
+       */
+      std::string _peer_ip;
+  };
+}
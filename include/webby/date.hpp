@@ -0,0 +1,121 @@
+/**
+ * @file date.hpp
+ */
+#pragma once
+
+#include <string.h>
+#include <time.h>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Length of an RFC 1123 date such as `Wed, 14 Oct 2026 17:34:14 GMT`.
+   */
+  static const size_t http_date_length = 29;
+
+  /**
+   * @brief Formats a time as an RFC 1123 date.
+   * @param[in] t Time to format.
+   * @param[out] buffer Receives http_date_length characters. No terminator is written.
+   *
+   * The day and month names are always English, as HTTP requires, whatever the C locale is.
+   */
+  inline void format_http_date(time_t t, char* buffer) {
+    static const char days[] = "SunMonTueWedThuFriSat";
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    struct tm tm;
+    gmtime_r(&t, &tm);
+
+    char* p = buffer;
+    memcpy(p, days + tm.tm_wday * 3, 3);
+    p += 3;
+    *p++ = ',';
+    *p++ = ' ';
+    *p++ = static_cast<char>('0' + tm.tm_mday / 10);
+    *p++ = static_cast<char>('0' + tm.tm_mday % 10);
+    *p++ = ' ';
+    memcpy(p, months + tm.tm_mon * 3, 3);
+    p += 3;
+    *p++ = ' ';
+    int year = tm.tm_year + 1900;
+    *p++ = static_cast<char>('0' + year / 1000 % 10);
+    *p++ = static_cast<char>('0' + year / 100 % 10);
+    *p++ = static_cast<char>('0' + year / 10 % 10);
+    *p++ = static_cast<char>('0' + year % 10);
+    *p++ = ' ';
+    *p++ = static_cast<char>('0' + tm.tm_hour / 10);
+    *p++ = static_cast<char>('0' + tm.tm_hour % 10);
+    *p++ = ':';
+    *p++ = static_cast<char>('0' + tm.tm_min / 10);
+    *p++ = static_cast<char>('0' + tm.tm_min % 10);
+    *p++ = ':';
+    *p++ = static_cast<char>('0' + tm.tm_sec / 10);
+    *p++ = static_cast<char>('0' + tm.tm_sec % 10);
+    memcpy(p, " GMT", 4);
+  }
+
+  /**
+   * @brief Parses an RFC 1123 date, e.g. the value of an `If-Modified-Since` header.
+   * @param[in] str Date in the form `Wed, 14 Oct 2026 17:34:14 GMT`.
+   * @param[out] t Receives the time.
+   * @returns `false` if the date is not in that form. The obsolete RFC 850 and asctime forms are
+   *          not accepted; callers treat them as if the header were absent.
+   */
+  inline bool parse_http_date(string_view str, time_t& t) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    if(str.size() != http_date_length || str.compare(25, 4, " GMT") != 0) {
+      return false;
+    }
+    static const unsigned char digits[] = { 5, 6, 12, 13, 14, 15, 17, 18, 20, 21, 23, 24 };
+    const char* p = str.data();
+    for(size_t i = 0; i < sizeof(digits); ++i) {
+      if(p[digits[i]] < '0' || p[digits[i]] > '9') {
+        return false;
+      }
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_mon = -1;
+    for(int m = 0; m < 12; ++m) {
+      if(memcmp(p + 8, months + m * 3, 3) == 0) {
+        tm.tm_mon = m;
+      }
+    }
+    if(tm.tm_mon < 0) {
+      return false;
+    }
+    tm.tm_mday = (p[5] - '0') * 10 + (p[6] - '0');
+    tm.tm_year = (p[12] - '0') * 1000 + (p[13] - '0') * 100 + (p[14] - '0') * 10 + (p[15] - '0') -
+                 1900;
+    tm.tm_hour = (p[17] - '0') * 10 + (p[18] - '0');
+    tm.tm_min = (p[20] - '0') * 10 + (p[21] - '0');
+    tm.tm_sec = (p[23] - '0') * 10 + (p[24] - '0');
+    t = timegm(&tm);
+    return true;
+  }
+
+  /**
+   * @brief Gets the current time as an RFC 1123 date for the `Date` header.
+   * @returns a view of a per-thread buffer that is reformatted at most once per second.
+   *
+   * Each thread keeps its own copy of the string, so the cache needs no locking and the common
+   * case is a single call to `time()`, which most platforms answer without entering the kernel.
+   */
+  inline string_view http_date() {
+    struct cache {
+      time_t second;
+      char text[http_date_length];
+    };
+    static thread_local cache c = { static_cast<time_t>(-1), { 0 } };
+    time_t now = time(nullptr);
+    if(now != c.second) {
+      format_http_date(now, c.text);
+      c.second = now;
+    }
+    return string_view(c.text, http_date_length);
+  }
+}
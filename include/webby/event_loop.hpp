@@ -0,0 +1,753 @@
+/**
+ * @file event_loop.hpp
+ */
+#pragma once
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#include <sys/event.h>
+#include <sys/time.h>
+#define WEBBY_USE_KQUEUE 1
+#else
+#error "webby::event_loop requires epoll or kqueue"
+#endif
+
+#include <chrono>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <webby/connection.hpp>
+#include <webby/executor.hpp>
+#include <webby/metrics.hpp>
+#include <webby/socket.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Thin wrapper over the platform readiness API: epoll on Linux, kqueue on BSD and macOS.
+   *
+   * Descriptors are watched for either read or write readiness, and are level triggered.
+   */
+  class poller {
+    public:
+      /**
+       * @brief Creates the epoll or kqueue descriptor.
+       * @throws webby::socket::error if the descriptor cannot be created.
+       */
+      poller() {
+#ifdef WEBBY_USE_KQUEUE
+        _fd = ::kqueue();
+#else
+        _fd = ::epoll_create1(EPOLL_CLOEXEC);
+#endif
+        if(_fd < 0) {
+          throw socket::error(std::string("poller: ") + strerror(errno));
+        }
+      }
+
+      poller(const poller&) = delete;
+      poller& operator=(const poller&) = delete;
+
+      /**
+       * @brief Closes the epoll or kqueue descriptor.
+       */
+      ~poller() {
+        ::close(_fd);
+      }
+
+      /**
+       * @brief Starts watching a descriptor.
+       * @param[in] fd Descriptor to watch.
+       * @param[in] write `true` to watch for write readiness instead of read readiness.
+       */
+      void add(int fd, bool write = false) {
+#ifdef WEBBY_USE_KQUEUE
+        struct kevent ev;
+        EV_SET(&ev, fd, write ? EVFILT_WRITE : EVFILT_READ, EV_ADD, 0, 0, nullptr);
+        ::kevent(_fd, &ev, 1, nullptr, 0, nullptr);
+#else
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = write ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        ::epoll_ctl(_fd, EPOLL_CTL_ADD, fd, &ev);
+#endif
+      }
+
+      /**
+       * @brief Switches a watched descriptor between read and write readiness.
+       * @param[in] fd Descriptor being watched.
+       * @param[in] write `true` to watch for write readiness; `false` for read readiness.
+       */
+      void modify(int fd, bool write) {
+#ifdef WEBBY_USE_KQUEUE
+        struct kevent ev;
+        EV_SET(&ev, fd, write ? EVFILT_READ : EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+        ::kevent(_fd, &ev, 1, nullptr, 0, nullptr);
+        add(fd, write);
+#else
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = write ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        ::epoll_ctl(_fd, EPOLL_CTL_MOD, fd, &ev);
+#endif
+      }
+
+      /**
+       * @brief Stops watching a descriptor.
+       * @param[in] fd Descriptor to stop watching.
+       */
+      void remove(int fd) {
+#ifdef WEBBY_USE_KQUEUE
+        // Each filter is deleted on its own, since deleting one that is not set fails.
+        struct kevent ev;
+        EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+        ::kevent(_fd, &ev, 1, nullptr, 0, nullptr);
+        EV_SET(&ev, fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+        ::kevent(_fd, &ev, 1, nullptr, 0, nullptr);
+#else
+        ::epoll_ctl(_fd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+      }
+
+      /**
+       * @brief Waits for descriptors to become ready.
+       * @param[out] ready Receives the ready descriptors.
+       * @param[in] capacity Number of elements in @p ready.
+       * @param[in] timeout_ms Maximum time to wait in milliseconds, or `-1` to wait forever.
+       * @returns the number of descriptors written to @p ready.
+       */
+      size_t wait(int* ready, size_t capacity, int timeout_ms) {
+        const size_t max_events = 256;
+        capacity = std::min(capacity, max_events);
+#ifdef WEBBY_USE_KQUEUE
+        struct kevent events[max_events];
+        struct timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        int n = ::kevent(_fd, nullptr, 0, events, static_cast<int>(capacity), timeout_ms < 0 ?
+                         nullptr : &ts);
+        for(int i = 0; i < n; ++i) {
+          ready[i] = static_cast<int>(events[i].ident);
+        }
+#else
+        struct epoll_event events[max_events];
+        int n = ::epoll_wait(_fd, events, static_cast<int>(capacity), timeout_ms);
+        for(int i = 0; i < n; ++i) {
+          ready[i] = events[i].data.fd;
+        }
+#endif
+        if(n < 0) {
+          if(errno == EINTR) {
+            return 0;
+          }
+          throw socket::error(std::string("poller: ") + strerror(errno));
+        }
+        return static_cast<size_t>(n);
+      }
+
+    private:
+      /**
+       * @brief epoll or kqueue descriptor.
+       */
+      int _fd;
+  };
+
+  /**
+   * @brief Single-threaded event loop that multiplexes many connections over one poller.
+   *
+   * Connections are read without blocking until a complete header block, and the body that
+   * follows it, have been buffered, so idle and slow clients cost a buffer rather than a thread.
+   * Once a request is complete the handler runs on the loop thread and reads the body from
+   * memory. Bodies larger than the limit are left for the handler to read as it goes, which waits
+   * for the client on the loop thread. The output that a client does not take right away is
+   * queued by its connection and sent whenever the socket becomes writable; meanwhile nothing
+   * more is read from the connection. See connection::queue_writes().
+   *
+   * Persistent connections stay registered after each response. Pipelined requests that are
+   * already buffered are processed immediately, and connections that stay idle longer than the
+   * idle timeout are closed. A header block that has begun to arrive must be complete within the
+   * read timeout, however slowly its bytes trickle in, or its connection is closed too. So is a
+   * connection whose body, or whose queued output, makes no progress within the read or the write
+   * timeout.
+   *
+   * Connections accepted while the loop is at its connection limit are handed to a reject
+   * function instead of being registered.
+   *
+   * The loop is also the executor of its connections. A connection whose handler suspended the
+   * response is neither read nor timed out until event_loop::resume() is called for it, and the
+   * tasks that complete the response are posted to the loop from whichever thread they come.
+   *
+   * A loop that is drained stops accepting connections and closes each connection once it is
+   * idle, so that the requests in progress are answered. event_loop::run() then returns.
+   */
+  class event_loop : public executor {
+    public:
+      /**
+       * @brief Signature of the function that processes a buffered request.
+       *
+       * The function returns `true` if the connection should be kept open for another request.
+       */
+      typedef std::function<bool(connection&)> handler_t;
+
+      /**
+       * @brief Signature of the function that turns away a connection accepted beyond the limit.
+       */
+      typedef std::function<void(webby::socket&)> reject_t;
+
+      /**
+       * @brief Signature of the function that prepares each accepted connection, e.g. by
+       *        starting TLS on it.
+       */
+      typedef std::function<void(connection&)> open_t;
+
+      /**
+       * @brief Timeouts and limits of the connections of an event loop.
+       */
+      struct limits {
+        /// Milliseconds a connection may stay idle between requests before it is closed.
+        unsigned idle_timeout;
+
+        /// Read timeout of each connection in milliseconds, or `0` for none.
+        unsigned read_timeout;
+
+        /// Write timeout of each connection in milliseconds, or `0` for none.
+        unsigned write_timeout;
+
+        /// Maximum number of open connections, or `0` for no limit.
+        unsigned max_connections;
+
+        /// Largest request body received before the handler runs, in bytes.
+        unsigned long max_body_buffer;
+      };
+
+      /**
+       * @brief Constructs an event loop that accepts connections from a listening socket.
+       * @param[in] listener Non-blocking listening socket. It must outlive the event loop.
+       * @param[in] handler Function that processes each request.
+       * @param[in] l Timeouts and limits of the connections.
+       * @param[in] connections Gauge of open connections to update, or `nullptr`. Loops that
+       *                        share a gauge share their connection limit.
+       * @param[in] reject Function that turns away connections beyond the limit. By default they
+       *                   are closed.
+       * @param[in] open Function called with each accepted connection before it is registered,
+       *                 or empty.
+       */
+      event_loop(const webby::socket& listener, handler_t handler, const limits& l,
+                 gauge* connections = nullptr, reject_t reject = reject_t(),
+                 open_t open = open_t())
+          : _listener(listener), _handler(handler), _limits(l), _open(connections),
+            _reject(reject), _prepare(open), _stop(-1), _unlisten(false),
+            _draining(false) {
+        if(::pipe(_wake) != 0) {
+          throw socket::error(std::string("event_loop: ") + strerror(errno));
+        }
+        for(int fd : _wake) {
+          ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+          ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        _poller.add(_listener.descriptor());
+        _poller.add(_wake[0]);
+      }
+
+      /**
+       * @brief Closes the pipe that wakes the loop up.
+       */
+      ~event_loop() {
+        ::close(_wake[0]);
+        ::close(_wake[1]);
+      }
+
+      /**
+       * @brief Queues a task to run on the loop thread and wakes the loop up.
+       * @param[in] task Task to run.
+       *
+       * This can be called from any thread.
+       */
+      void post(task_t task) override {
+        bool wake;
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          wake = _posted.empty();
+          _posted.push_back(std::move(task));
+        }
+        if(wake) {
+          const char c = 0;
+          ssize_t n = ::write(_wake[1], &c, 1);
+          (void)(n);
+        }
+      }
+
+      /**
+       * @brief Goes on with a suspended connection once its response has been finished.
+       * @param[in] c Connection, which must belong to this loop.
+       * @param[in] keep `true` if the connection can carry another request.
+       *
+       * This must be called on the loop thread. Requests that were pipelined behind the one that
+       * suspended the connection are processed immediately.
+       */
+      void resume(connection& c, bool keep) {
+        auto itr = _connections.find(c.socket().descriptor());
+        if(itr == _connections.end()) {
+          return;
+        }
+        c.set_suspended(false);
+        if(c.unsent()) {
+          _poller.add(itr->first, true);
+          start_sending(itr->second, !keep);
+          return;
+        }
+        if(!keep) {
+          close(itr, false);
+          return;
+        }
+        _poller.add(itr->first);
+        serve(itr, false);
+      }
+
+      /**
+       * @brief Drains the loop once a descriptor becomes readable.
+       * @param[in] fd Descriptor to watch, e.g. the read end of a pipe that is written to when the
+       *               server stops. It is never read, so it can stop several loops at once.
+       * @param[in] unlisten `true` if the listener belongs to this loop alone, and stops listening
+       *                     when the loop is drained.
+       */
+      void stop_on(int fd, bool unlisten) {
+        _stop = fd;
+        _unlisten = unlisten;
+        _poller.add(fd);
+      }
+
+      /**
+       * @brief Stops accepting connections and closes the idle ones.
+       *
+       * This must be called on the loop thread. The connections that are still pending on the
+       * listener are accepted and served, so that none is lost when the listener is closed. The
+       * busy connections are closed once their current request has been answered.
+       *
+       * A listener that belongs to the loop alone stops listening, so that new connections go to
+       * the other listeners on the same address, e.g. those of the process replacing this one,
+       * rather than waiting on a listener that is no longer polled.
+       */
+      void drain() {
+        if(_draining) {
+          return;
+        }
+        _draining = true;
+        for(auto itr = _connections.begin(); itr != _connections.end(); ) {
+          if(idle(*itr->second.conn)) {
+            itr = close(itr, true);
+          }
+          else {
+            ++itr;
+          }
+        }
+        accept();
+        _poller.remove(_listener.descriptor());
+        if(_unlisten) {
+          _listener.stop_listening();
+        }
+        if(_stop >= 0) {
+          _poller.remove(_stop);
+        }
+      }
+
+      /**
+       * @brief Runs the event loop until it has been drained and its last connection closed.
+       */
+      void run() {
+        int ready[256];
+        unsigned shortest = _limits.idle_timeout;
+        if(_limits.read_timeout > 0) {
+          shortest = std::min(shortest, _limits.read_timeout);
+        }
+        const int tick = static_cast<int>(std::min(shortest, 1000u));
+        clock::time_point next_sweep = clock::now() + std::chrono::milliseconds(tick);
+        while(!_draining || !_connections.empty()) {
+          size_t n = _poller.wait(ready, 256, tick);
+          for(size_t i = 0; i < n; ++i) {
+            if(ready[i] == _listener.descriptor()) {
+              accept();
+            }
+            else if(ready[i] == _stop) {
+              drain();
+            }
+            else if(ready[i] == _wake[0]) {
+              run_posted();
+            }
+            else {
+              ready_connection(ready[i]);
+            }
+          }
+
+          clock::time_point now = clock::now();
+          if(now >= next_sweep) {
+            sweep(now);
+            next_sweep = now + std::chrono::milliseconds(tick);
+          }
+        }
+      }
+
+    private:
+      /**
+       * @brief Clock used for idle timeouts.
+       */
+      typedef std::chrono::steady_clock clock;
+
+      /**
+       * @brief State kept for each open connection.
+       */
+      struct entry {
+        /**
+         * @brief The connection.
+         */
+        std::unique_ptr<connection> conn;
+
+        /**
+         * @brief Time after which the idle connection, or the incomplete request, is given up.
+         */
+        clock::time_point deadline;
+
+        /**
+         * @brief `true` while part of a request is buffered, when the deadline is the one set by
+         *        the read timeout.
+         */
+        bool reading;
+
+        /**
+         * @brief `true` while the connection's queued output is sent, when it is watched for
+         *        write readiness and the deadline is the one set by the write timeout.
+         */
+        bool sending;
+
+        /**
+         * @brief `true` if the connection is closed once its queued output has been sent.
+         */
+        bool closing;
+      };
+
+      /**
+       * @brief Accepts all pending connections.
+       */
+      void accept() {
+        while(1) {
+          webby::socket s = _listener.accept();
+          if(!s.valid()) {
+            return;
+          }
+          if(_limits.max_connections > 0 &&
+             (_open != nullptr ? static_cast<size_t>(std::max(_open->value(), 0L))
+                               : _connections.size()) >= _limits.max_connections) {
+            if(_reject) {
+              _reject(s);
+            }
+            continue;
+          }
+          s.set_nonblocking();
+          int fd = s.descriptor();
+          entry& e = _connections[fd];
+          e.conn.reset(new connection(std::move(s)));
+          e.conn->set_timeouts(_limits.read_timeout, _limits.write_timeout);
+          e.conn->set_executor(this);
+          e.conn->queue_writes(true);
+          if(_prepare) {
+            _prepare(*e.conn);
+          }
+          e.deadline = clock::now() + std::chrono::milliseconds(_limits.idle_timeout);
+          e.reading = false;
+          e.sending = false;
+          e.closing = false;
+          _poller.add(fd);
+          if(_open != nullptr) {
+            _open->increment();
+          }
+        }
+      }
+
+      /**
+       * @brief Goes on with a connection that became ready: sends its queued output if it is
+       *        writable, or reads from it if it is readable.
+       * @param[in] fd Descriptor of the connection.
+       */
+      void ready_connection(int fd) {
+        auto itr = _connections.find(fd);
+        if(itr == _connections.end()) {
+          return;
+        }
+        if(itr->second.sending) {
+          send(itr);
+        }
+        else {
+          receive(itr);
+        }
+      }
+
+      /**
+       * @brief Reads from a readable connection and processes its request once it is complete.
+       * @param[in] itr Entry of the connection.
+       */
+      void receive(std::unordered_map<int, entry>::iterator itr) {
+        connection& c = *itr->second.conn;
+        bool done = false;
+        try {
+          done = c.fill() == 0;
+        }
+        catch(const std::exception&) {
+          done = true;
+        }
+
+        // Each part of a body restarts the read timeout, as it would for a waiting read.
+        if(!done && c.awaiting_body() && _limits.read_timeout > 0) {
+          itr->second.deadline = clock::now() + std::chrono::milliseconds(_limits.read_timeout);
+          itr->second.reading = true;
+        }
+        serve(itr, done);
+      }
+
+      /**
+       * @brief Sends the queued output of a writable connection, and goes on with its next
+       *        request once all of it has been sent.
+       * @param[in] itr Entry of the connection.
+       */
+      void send(std::unordered_map<int, entry>::iterator itr) {
+        entry& e = itr->second;
+        try {
+          if(!e.conn->flush()) {
+            e.deadline = send_deadline();
+            return;
+          }
+        }
+        catch(const std::exception&) {
+          close(itr, true);
+          return;
+        }
+        e.sending = false;
+        if(e.closing || (_draining && idle(*e.conn))) {
+          close(itr, true);
+          return;
+        }
+        _poller.modify(itr->first, false);
+        serve(itr, false);
+      }
+
+      /**
+       * @brief Watches a connection for write readiness until its queued output has been sent.
+       * @param[in] e Entry of the connection, which is being watched for write readiness.
+       * @param[in] closing `true` to close the connection afterwards.
+       */
+      void start_sending(entry& e, bool closing) {
+        e.sending = true;
+        e.closing = closing;
+        e.reading = false;
+        e.deadline = send_deadline();
+      }
+
+      /**
+       * @brief Gets the time after which a connection whose queued output makes no progress is
+       *        given up.
+       */
+      clock::time_point send_deadline() const {
+        if(_limits.write_timeout == 0) {
+          return clock::time_point::max();
+        }
+        return clock::now() + std::chrono::milliseconds(_limits.write_timeout);
+      }
+
+      /**
+       * @brief Processes the complete requests buffered by a connection.
+       * @param[in] itr Entry of the connection.
+       * @param[in] done `true` if the connection must be closed.
+       */
+      void serve(std::unordered_map<int, entry>::iterator itr, bool done) {
+        connection& c = *itr->second.conn;
+        try {
+          // Processes every complete request, including pipelined ones that arrived together.
+          // Malformed requests are also passed to the handler so it can reject them. Data held
+          // by the connection's transport does not make the socket readable again, so it is read
+          // before waiting.
+          while(!done) {
+            const parser::status status = c.parse();
+            if(status == parser::status::complete && !c.buffer_body(_limits.max_body_buffer)) {
+              // Waits for the rest of the body.
+              break;
+            }
+            if(status != parser::status::incomplete) {
+              done = !_handler(c);
+              if(!done && c.suspended()) {
+                // Nothing is read until the response has been completed.
+                _poller.remove(itr->first);
+                return;
+              }
+              if(c.unsent()) {
+                // Nothing is read until the client has taken the response.
+                _poller.modify(itr->first, true);
+                start_sending(itr->second, done);
+                return;
+              }
+            }
+            else if(c.pending()) {
+              done = c.fill() == 0;
+            }
+            else {
+              break;
+            }
+          }
+        }
+        catch(const std::exception&) {
+          done = true;
+        }
+
+        // The idle timeout restarts after each request, while the read timeout runs from the
+        // first byte of a header block.
+        entry& e = itr->second;
+        if(done || (_draining && idle(c))) {
+          close(itr, true);
+        }
+        else if(c.buffered() == 0 || _limits.read_timeout == 0) {
+          e.deadline = clock::now() + std::chrono::milliseconds(_limits.idle_timeout);
+          e.reading = false;
+        }
+        else if(!e.reading) {
+          e.deadline = clock::now() + std::chrono::milliseconds(_limits.read_timeout);
+          e.reading = true;
+        }
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a connection is between requests.
+       */
+      static bool idle(const connection& c) {
+        return !c.suspended() && c.buffered() == 0 && !c.unsent();
+      }
+
+      /**
+       * @brief Runs the tasks posted to the loop.
+       */
+      void run_posted() {
+        char buffer[64];
+        while(::read(_wake[0], buffer, sizeof(buffer)) > 0) { }
+        std::vector<task_t> tasks;
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          tasks.swap(_posted);
+        }
+        for(auto& task : tasks) {
+          try {
+            task();
+          }
+          catch(const std::exception&) { }
+        }
+      }
+
+      /**
+       * @brief Closes connections that have been idle for longer than the idle timeout, that
+       *        have not completed a header block within the read timeout, or whose body or
+       *        queued output has made no progress within the read or the write timeout.
+       * @param[in] now Current time.
+       */
+      void sweep(clock::time_point now) {
+        for(auto itr = _connections.begin(); itr != _connections.end(); ) {
+          if(itr->second.deadline <= now && !itr->second.conn->suspended()) {
+            itr = close(itr, true);
+          }
+          else {
+            ++itr;
+          }
+        }
+      }
+
+      /**
+       * @brief Closes a connection.
+       * @param[in] itr Entry of the connection.
+       * @param[in] polled `false` if the connection was suspended and is no longer polled.
+       * @returns the entry that follows it.
+       */
+      std::unordered_map<int, entry>::iterator close(std::unordered_map<int, entry>::iterator itr,
+                                                     bool polled) {
+        if(polled) {
+          _poller.remove(itr->first);
+        }
+        if(_open != nullptr) {
+          _open->decrement();
+        }
+        return _connections.erase(itr);
+      }
+
+      /**
+       * @brief Listening socket.
+       */
+      const webby::socket& _listener;
+
+      /**
+       * @brief Processes each complete request.
+       */
+      handler_t _handler;
+
+      /**
+       * @brief Timeouts and limits of the connections.
+       */
+      limits _limits;
+
+      /**
+       * @brief Gauge of open connections, or `nullptr`.
+       */
+      gauge* _open;
+
+      /**
+       * @brief Turns away connections beyond the limit, or empty to close them.
+       */
+      reject_t _reject;
+
+      /**
+       * @brief Prepares each accepted connection, or empty.
+       */
+      open_t _prepare;
+
+      /**
+       * @brief Readiness notifications for the listener and all connections.
+       */
+      poller _poller;
+
+      /**
+       * @brief Open connections indexed by descriptor.
+       */
+      std::unordered_map<int, entry> _connections;
+
+      /**
+       * @brief Pipe that wakes the loop up when a task is posted: read end, then write end.
+       */
+      int _wake[2];
+
+      /**
+       * @brief Descriptor that drains the loop when it becomes readable, or `-1`.
+       */
+      int _stop;
+
+      /**
+       * @brief `true` if the listener stops listening when the loop is drained.
+       */
+      bool _unlisten;
+
+      /**
+       * @brief `true` once the loop has stopped accepting connections.
+       */
+      bool _draining;
+
+      /**
+       * @brief Protects the posted tasks.
+       */
+      std::mutex _mutex;
+
+      /**
+       * @brief Tasks posted and not yet run.
+       */
+      std::vector<task_t> _posted;
+  };
+}
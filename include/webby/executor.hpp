@@ -0,0 +1,246 @@
+/**
+ * @file executor.hpp
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Thread that serves connections and runs the tasks posted to it, such as the event loop
+   *        of a webby::event_loop.
+   */
+  class executor {
+    public:
+      /**
+       * @brief Signature of the tasks run by an executor.
+       */
+      typedef std::function<void()> task_t;
+
+      virtual ~executor() { }
+
+      /**
+       * @brief Queues a task to run on the executor's thread.
+       * @param[in] task Task to run. Tasks run in the order they were posted.
+       *
+       * This can be called from any thread.
+       */
+      virtual void post(task_t task) = 0;
+  };
+
+  /**
+   * @brief Executor whose tasks run on the thread that waits for them with
+   *        blocking_executor::run().
+   *
+   * A worker thread of the thread pool waits this way for an asynchronous handler that it cannot
+   * leave to finish on its own.
+   */
+  class blocking_executor : public executor {
+    public:
+      void post(task_t task) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push_back(std::move(task));
+        _ready.notify_one();
+      }
+
+      /**
+       * @brief Runs posted tasks until one of them sets @p done.
+       */
+      void run(const bool& done) {
+        while(!done) {
+          task_t task;
+          {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while(_tasks.empty()) {
+              _ready.wait(lock);
+            }
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+          }
+          task();
+        }
+      }
+
+    private:
+      /**
+       * @brief Protects the queue.
+       */
+      std::mutex _mutex;
+
+      /**
+       * @brief Signaled when a task is posted.
+       */
+      std::condition_variable _ready;
+
+      /**
+       * @brief Tasks posted and not yet run.
+       */
+      std::deque<task_t> _tasks;
+  };
+
+  // Forward references.
+  class response;
+  class server;
+
+  /**
+   * @brief Handle through which an asynchronous handler completes its response.
+   *
+   * A handler obtains it from webby::response::suspend() and returns without waiting for
+   * the upstream calls it starts. The thread that called the handler goes on serving other
+   * connections: only the connection the request came from waits for the response.
+   *
+   * Tasks passed to completion::post() and completion::finish() run on that thread, so they can
+   * use the request and the response like a synchronous handler would. Both functions can be
+   * called from any thread, such as the one that runs the callbacks of a database client, but
+   * they must not race with each other. Nothing can be posted once the response has been
+   * finished.
+   *
+   * Completions can be copied. If the last copy is destroyed before the response has been
+   * finished, it is finished with a "500 Internal Server Error".
+   */
+  class completion {
+    public:
+      /**
+       * @brief Signature of the tasks that write to the response.
+       */
+      typedef executor::task_t task_t;
+
+      /**
+       * @brief Constructs an empty completion, which cannot be used.
+       */
+      completion() { }
+
+      /**
+       * @brief Gets a value that indicates whether the completion belongs to a response.
+       */
+      explicit operator bool() const {
+        return static_cast<bool>(_ticket);
+      }
+
+      /**
+       * @brief Runs a task on the thread that serves the connection, e.g. to stream part of the
+       *        response as it becomes available.
+       * @param[in] task Task to run. An exception thrown from it fails the response as one thrown
+       *                 from a synchronous handler would.
+       */
+      void post(task_t task) const {
+        if(!_ticket->finished) {
+          _ticket->schedule(std::move(task), false);
+        }
+      }
+
+      /**
+       * @brief Runs a last task on the thread that serves the connection, then finishes the
+       *        response and goes on with the connection's next request.
+       * @param[in] task Task to run, or an empty function to only finish the response.
+       *
+       * Only the first call has an effect.
+       */
+      void finish(task_t task = task_t()) const {
+        if(!_ticket->finished.exchange(true)) {
+          _ticket->schedule(std::move(task), true);
+        }
+      }
+
+    private:
+      /**
+       * @brief Signature of the function that runs each task against the response.
+       *
+       * The second argument is `true` for the task passed to completion::finish().
+       */
+      typedef std::function<void(const task_t&, bool)> runner_t;
+
+      /**
+       * @brief State shared by the response and its completions.
+       */
+      struct state {
+        explicit state(executor& e) : exec(e), done(false) { }
+
+        /**
+         * @brief Executor of the thread that serves the connection.
+         */
+        executor& exec;
+
+        /**
+         * @brief Runs the tasks. It is set by the server before any of them can run.
+         */
+        runner_t run;
+
+        /**
+         * @brief `true` once the task passed to completion::finish() has run. Only used on the
+         *        executor's thread.
+         */
+        bool done;
+      };
+
+      /**
+       * @brief State of the copies of one completion.
+       */
+      struct ticket {
+        explicit ticket(std::shared_ptr<completion::state> s) : shared(s), finished(false) { }
+
+        /**
+         * @brief Finishes the response with an error if it was given up without being finished.
+         */
+        ~ticket() {
+          if(!finished) {
+            schedule([]() {
+              throw std::runtime_error("An asynchronous handler did not finish its response");
+            }, true);
+          }
+        }
+
+        /**
+         * @brief Posts a task that runs against the response unless it has been finished.
+         */
+        void schedule(task_t task, bool last) {
+          std::shared_ptr<completion::state> s = shared;
+          s->exec.post([s, task, last]() {
+            if(!s->done) {
+              s->done = last;
+              s->run(task, last);
+            }
+          });
+        }
+
+        /**
+         * @brief State shared with the response.
+         */
+        std::shared_ptr<completion::state> shared;
+
+        /**
+         * @brief `true` once completion::finish() has been called.
+         */
+        std::atomic<bool> finished;
+      };
+
+      /**
+       * @brief Constructs a completion for the response that owns @p s.
+       */
+      explicit completion(std::shared_ptr<state> s) : _ticket(std::make_shared<ticket>(s)) { }
+
+      /**
+       * @brief State shared by the copies.
+       */
+      std::shared_ptr<ticket> _ticket;
+
+      /**
+       * @brief Necessary so that webby::response can create completions.
+       */
+      friend class webby::response;
+
+      /**
+       * @brief Necessary so that webby::server can run the tasks.
+       */
+      friend class webby::server;
+  };
+}
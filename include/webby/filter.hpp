@@ -0,0 +1,174 @@
+/**
+ * @file filter.hpp
+ */
+#pragma once
+
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <webby/known_header.hpp>
+#include <webby/request.hpp>
+#include <webby/response.hpp>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief A filter reduced to plain function pointers, as stored in the chain of each route.
+   *
+   * A filter is any class with either or both of these members:
+   *
+   *     bool before(const webby::request& req, webby::response& res);
+   *     void after(const webby::request& req, webby::response& res);
+   *
+   * webby::router::use() turns it into a stage. Calling a stage costs one indirect call per member
+   * the filter has, without virtual functions or allocations.
+   */
+  class stage {
+    public:
+      /**
+       * @brief Signature of the function that calls a filter's `before()`.
+       */
+      typedef bool (*before_t)(void* filter, const request& req, response& res);
+
+      /**
+       * @brief Signature of the function that calls a filter's `after()`.
+       */
+      typedef void (*after_t)(void* filter, const request& req, response& res);
+
+      /**
+       * @brief Makes the stage of a filter.
+       * @param[in] f The filter, which must outlive the stage.
+       */
+      template<typename F>
+      static stage of(F& f) {
+        stage s;
+        s.before = before_of<F>(0);
+        s.after = after_of<F>(0);
+        s.filter = &f;
+        return s;
+      }
+
+      /**
+       * @brief Calls the filter's `before()`, or `nullptr` if the filter has none.
+       */
+      before_t before;
+
+      /**
+       * @brief Calls the filter's `after()`, or `nullptr` if the filter has none.
+       */
+      after_t after;
+
+      /**
+       * @brief The filter.
+       */
+      void* filter;
+
+    private:
+      template<typename F>
+      static bool call_before(void* f, const request& req, response& res) {
+        return static_cast<F*>(f)->before(req, res);
+      }
+
+      template<typename F>
+      static void call_after(void* f, const request& req, response& res) {
+        static_cast<F*>(f)->after(req, res);
+      }
+
+      /**
+       * @brief Gets the function that calls `F::before()`, chosen when `F` has one.
+       */
+      template<typename F>
+      static auto before_of(int) -> decltype(std::declval<F&>().before(
+          std::declval<const request&>(), std::declval<response&>()), before_t()) {
+        return &call_before<F>;
+      }
+
+      template<typename F>
+      static before_t before_of(...) {
+        return nullptr;
+      }
+
+      /**
+       * @brief Gets the function that calls `F::after()`, chosen when `F` has one.
+       */
+      template<typename F>
+      static auto after_of(int) -> decltype(std::declval<F&>().after(
+          std::declval<const request&>(), std::declval<response&>()), after_t()) {
+        return &call_after<F>;
+      }
+
+      template<typename F>
+      static after_t after_of(...) {
+        return nullptr;
+      }
+  };
+
+  /**
+   * @brief Runs a chain of stages around a handler.
+   * @param[in] first First stage of the chain.
+   * @param[in] count Number of stages.
+   * @param[in] req Request being answered.
+   * @param[out] res Response to the request.
+   * @param[in] handler Called with @p req and @p res if every `before()` returned `true`.
+   *
+   * The `before()` members run in order until one returns `false`, which means it answered the
+   * request itself. The `after()` members of the filters whose `before()` returned `true`, or
+   * that have none, then run in reverse order. An exception skips the rest of the chain.
+   */
+  template<typename H>
+  void run_stages(const stage* first, size_t count, const request& req, response& res,
+                  const H& handler) {
+    size_t passed = 0;
+    while(passed < count &&
+          (first[passed].before == nullptr ||
+           first[passed].before(first[passed].filter, req, res))) {
+      ++passed;
+    }
+    if(passed == count) {
+      handler(req, res);
+    }
+    while(passed > 0) {
+      const stage& s = first[--passed];
+      if(s.after != nullptr) {
+        s.after(s.filter, req, res);
+      }
+    }
+  }
+
+  /**
+   * @brief Filter that sets the `Location` header of each response to the URL of its request.
+   *
+   * A default webby::router starts with it, so that every response carries the header as it
+   * always has. Call webby::router::clear_filters() to do without it.
+   */
+  class location_filter {
+    public:
+      bool before(const request& req, response& res) {
+        if(!req.has_header(known_header::host)) {
+          return true;
+        }
+        string_view scheme = req.secure() ? "https://" : "http://";
+        string_view host = req.header(known_header::host);
+        string_view path = req.path();
+        const size_t length = scheme.size() + host.size() + path.size();
+
+        // Formats short URLs on the stack. The response copies the value.
+        char local[512];
+        std::string heap;
+        char* location = local;
+        if(length > sizeof(local)) {
+          heap.resize(length);
+          location = &heap[0];
+        }
+        memcpy(location, scheme.data(), scheme.size());
+        memcpy(location + scheme.size(), host.data(), host.size());
+        memcpy(location + scheme.size() + host.size(), path.data(), path.size());
+        res.set_header("Location", string_view(location, length));
+        return true;
+      }
+  };
+}
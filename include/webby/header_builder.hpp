@@ -0,0 +1,308 @@
+/**
+ * @file header_builder.hpp
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <webby/arena.hpp>
+#include <webby/known_header.hpp>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Headers of a response, kept in the form in which they are sent.
+   *
+   * Each well-known header has a slot indexed by known_header, and `Content-Length` is also kept
+   * as a number. Any other header is appended as a `Name: value\r\n` line to a buffer inside the
+   * builder, which moves to the connection's arena only if it overflows. Formatting the header
+   * block copies the lines as they are, so setting a header costs neither a node nor a lookup.
+   *
+   * Names must not contain `:`, and neither names nor values may contain line breaks.
+   */
+  class header_builder {
+    public:
+      /**
+       * @brief Number of bytes of other headers held without allocating.
+       */
+      static const size_t inline_size = 256;
+
+      /**
+       * @brief Constructs an empty builder.
+       * @param[in] a Arena that holds the lines that do not fit in the builder.
+       */
+      explicit header_builder(webby::arena& a)
+          : _arena(a), _present(0), _length(0), _lines(_inline), _size(0),
+            _capacity(inline_size) { }
+
+      header_builder(const header_builder&) = delete;
+      header_builder& operator=(const header_builder&) = delete;
+
+      /**
+       * @brief Gets a value that indicates whether a well-known header is set.
+       */
+      bool has(known_header name) const {
+        return (_present & bit(name)) != 0;
+      }
+
+      /**
+       * @brief Gets the value of a well-known header, or an empty view if it is not set.
+       */
+      string_view get(known_header name) const {
+        return has(name) ? _known[static_cast<unsigned>(name)] : string_view();
+      }
+
+      /**
+       * @brief Gets the value of `Content-Length`.
+       * @param[out] length Receives the value if the header is set.
+       * @returns `true` if the header is set.
+       */
+      bool content_length(unsigned long& length) const {
+        if(!has(known_header::content_length)) {
+          return false;
+        }
+        length = _length;
+        return true;
+      }
+
+      /**
+       * @brief Sets `Content-Length`.
+       */
+      void set_content_length(unsigned long length) {
+        _length = length;
+        put(known_header::content_length,
+            string_view(_length_text, format_number(length, _length_text)));
+      }
+
+      /**
+       * @brief Sets a well-known header other than `Content-Length`, which is set with
+       *        header_builder::set_content_length().
+       * @param[in] name The header.
+       * @param[in] value Value, which must stay valid until the response has been sent.
+       */
+      void put(known_header name, string_view value) {
+        _present |= bit(name);
+        _known[static_cast<unsigned>(name)] = value;
+      }
+
+      /**
+       * @brief Removes a well-known header.
+       */
+      void erase(known_header name) {
+        _present &= ~bit(name);
+      }
+
+      /**
+       * @brief Sets a header that is not well known, replacing any earlier value.
+       * @param[in] name Name of the header, which is sent as it is spelled here.
+       * @param[in] value Value of the header. Both are copied.
+       */
+      void add(string_view name, string_view value) {
+        remove(name);
+        const size_t size = name.size() + 2 + value.size() + 2;
+        if(_size + size > _capacity) {
+          grow(_size + size);
+        }
+        char* p = _lines + _size;
+        memcpy(p, name.data(), name.size());
+        p += name.size();
+        *p++ = ':';
+        *p++ = ' ';
+        memcpy(p, value.data(), value.size());
+        p += value.size();
+        *p++ = '\r';
+        *p++ = '\n';
+        _size += size;
+      }
+
+      /**
+       * @brief Finds a header by name.
+       * @param[in] name Name of the header. The comparison is case insensitive.
+       * @param[out] value Receives the value if the header is set.
+       * @returns `true` if the header is set.
+       */
+      bool find(string_view name, string_view& value) const {
+        const known_header known = find_known_header(name);
+        if(known != known_header::none) {
+          value = get(known);
+          return has(known);
+        }
+        bool found = false;
+        for_each_line([&](size_t, string_view n, string_view v) {
+          if(!found && iequals(n, name)) {
+            value = v;
+            found = true;
+          }
+        });
+        return found;
+      }
+
+      /**
+       * @brief Removes all of the headers.
+       */
+      void clear() {
+        _present = 0;
+        _size = 0;
+      }
+
+      /**
+       * @brief Gets the number of bytes that header_builder::format() writes.
+       */
+      size_t size() const {
+        size_t size = _size;
+        for_each_known([&size](string_view name, string_view value) {
+          size += name.size() + 2 + value.size() + 2;
+        });
+        return size;
+      }
+
+      /**
+       * @brief Writes a `Name: value\r\n` line for each header.
+       * @param[out] p Where to write them. There must be room for header_builder::size() bytes.
+       * @returns the position after the last line.
+       */
+      char* format(char* p) const {
+        for_each([&p](string_view name, string_view value) {
+          memcpy(p, name.data(), name.size());
+          p += name.size();
+          *p++ = ':';
+          *p++ = ' ';
+          memcpy(p, value.data(), value.size());
+          p += value.size();
+          *p++ = '\r';
+          *p++ = '\n';
+        });
+        return p;
+      }
+
+      /**
+       * @brief Calls @p f with the name and value of each header: the well-known ones first, in
+       *        the order of known_header, then the others in the order they were set.
+       */
+      template<typename F>
+      void for_each(const F& f) const {
+        for_each_known(f);
+        for_each_line([&f](size_t, string_view name, string_view value) { f(name, value); });
+      }
+
+    private:
+      /**
+       * @brief Gets the bit of a well-known header in header_builder::_present.
+       */
+      static uint32_t bit(known_header name) {
+        static_assert(known_header_count <= 32, "The well-known headers do not fit in the mask");
+        return static_cast<uint32_t>(1) << static_cast<unsigned>(name);
+      }
+
+      /**
+       * @brief Calls @p f with the name and value of each well-known header that is set.
+       */
+      template<typename F>
+      void for_each_known(const F& f) const {
+        for(uint32_t bits = _present; bits != 0; bits &= bits - 1) {
+          const unsigned i = static_cast<unsigned>(__builtin_ctz(bits));
+          f(to_string(static_cast<known_header>(i)), _known[i]);
+        }
+      }
+
+      /**
+       * @brief Calls @p f with the offset, name and value of each line of the other headers.
+       */
+      template<typename F>
+      void for_each_line(const F& f) const {
+        size_t offset = 0;
+        while(offset < _size) {
+          const char* line = _lines + offset;
+          const char* colon = static_cast<const char*>(memchr(line, ':', _size - offset));
+          const char* end = colon + 2;
+          while(end[0] != '\r' || end[1] != '\n') {
+            ++end;
+          }
+          f(offset, string_view(line, static_cast<size_t>(colon - line)),
+            string_view(colon + 2, static_cast<size_t>(end - colon - 2)));
+          offset = static_cast<size_t>(end + 2 - _lines);
+        }
+      }
+
+      /**
+       * @brief Removes the line of a header that is not well known, if it is set.
+       */
+      void remove(string_view name) {
+        size_t first = _size;
+        size_t last = _size;
+        for_each_line([&](size_t offset, string_view n, string_view v) {
+          if(first == _size && iequals(n, name)) {
+            first = offset;
+            last = static_cast<size_t>(v.data() + v.size() + 2 - _lines);
+          }
+        });
+        if(first < _size) {
+          memmove(_lines + first, _lines + last, _size - last);
+          _size -= last - first;
+        }
+      }
+
+      /**
+       * @brief Moves the lines to a larger buffer in the arena.
+       * @param[in] needed Number of bytes the buffer must hold.
+       */
+      void grow(size_t needed) {
+        size_t capacity = _capacity * 2;
+        while(capacity < needed) {
+          capacity *= 2;
+        }
+        char* lines = static_cast<char*>(_arena.allocate(capacity, 1));
+        memcpy(lines, _lines, _size);
+        _lines = lines;
+        _capacity = capacity;
+      }
+
+      /**
+       * @brief Arena that holds the lines once they overflow the builder.
+       */
+      webby::arena& _arena;
+
+      /**
+       * @brief Bit of each well-known header that is set.
+       */
+      uint32_t _present;
+
+      /**
+       * @brief Value of each well-known header, indexed by known_header.
+       */
+      string_view _known[known_header_count];
+
+      /**
+       * @brief Value of `Content-Length`.
+       */
+      unsigned long _length;
+
+      /**
+       * @brief Value of `Content-Length`, formatted once when it is set.
+       */
+      char _length_text[20];
+
+      /**
+       * @brief Lines of the other headers: header_builder::_inline, or memory from the arena.
+       */
+      char* _lines;
+
+      /**
+       * @brief Number of bytes of lines.
+       */
+      size_t _size;
+
+      /**
+       * @brief Number of bytes header_builder::_lines can hold.
+       */
+      size_t _capacity;
+
+      /**
+       * @brief Lines of the other headers while they fit.
+       */
+      char _inline[inline_size];
+  };
+}
@@ -0,0 +1,549 @@
+/**
+ * @file hpack.hpp
+ */
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Header compression for HTTP/2 (RFC 7541).
+   *
+   * The decoder implements all of HPACK: the static and dynamic tables and Huffman coded strings.
+   * The encoder only emits representations that leave the peer's dynamic table alone: fields that
+   * are in the static table are sent as a one or two byte index, and the others as literals with
+   * an indexed name where the static table has one.
+   */
+  class hpack {
+    public:
+      /**
+       * @brief Reports a header block that cannot be decoded, which is a connection error.
+       */
+      class error : public std::runtime_error {
+        public:
+          /**
+           * @brief Constructs the `hpack::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const std::string& what_arg) : runtime_error(what_arg) { }
+
+          /**
+           * @brief Constructs the `hpack::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const char* what_arg) : runtime_error(what_arg) { }
+      };
+
+      /**
+       * @brief Number of entries in the static table.
+       */
+      static const unsigned static_size = 61;
+
+      /**
+       * @brief Default size of the dynamic table in octets, which is also the largest size a
+       *        peer may choose since webby does not advertise a larger one.
+       */
+      static const size_t default_table_size = 4096;
+
+      /**
+       * @brief Gets an entry of the static table.
+       * @param[in] index Index of the entry, from `1` to hpack::static_size.
+       */
+      static const std::pair<string_view, string_view>& static_entry(unsigned index) {
+        static const std::pair<string_view, string_view> table[static_size + 1] = {
+          { "", "" },
+          { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+          { ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" },
+          { ":status", "200" }, { ":status", "204" }, { ":status", "206" }, { ":status", "304" },
+          { ":status", "400" }, { ":status", "404" }, { ":status", "500" },
+          { "accept-charset", "" }, { "accept-encoding", "gzip, deflate" },
+          { "accept-language", "" }, { "accept-ranges", "" }, { "accept", "" },
+          { "access-control-allow-origin", "" }, { "age", "" }, { "allow", "" },
+          { "authorization", "" }, { "cache-control", "" }, { "content-disposition", "" },
+          { "content-encoding", "" }, { "content-language", "" }, { "content-length", "" },
+          { "content-location", "" }, { "content-range", "" }, { "content-type", "" },
+          { "cookie", "" }, { "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" },
+          { "from", "" }, { "host", "" }, { "if-match", "" }, { "if-modified-since", "" },
+          { "if-none-match", "" }, { "if-range", "" }, { "if-unmodified-since", "" },
+          { "last-modified", "" }, { "link", "" }, { "location", "" }, { "max-forwards", "" },
+          { "proxy-authenticate", "" }, { "proxy-authorization", "" }, { "range", "" },
+          { "referer", "" }, { "refresh", "" }, { "retry-after", "" }, { "server", "" },
+          { "set-cookie", "" }, { "strict-transport-security", "" },
+          { "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+          { "www-authenticate", "" }
+        };
+        return table[index];
+      }
+
+      /**
+       * @brief Decodes the header blocks received over one connection.
+       *
+       * The dynamic table persists from one header block to the next, so every block received on
+       * the connection must be passed to the same decoder, in order.
+       */
+      class decoder {
+        public:
+          /**
+           * @brief Constructs a decoder with an empty dynamic table.
+           */
+          decoder() : _size(0), _capacity(default_table_size) { }
+
+          /**
+           * @brief Decodes a complete header block.
+           * @param[in] data The header block, made of the fragments of a `HEADERS` frame and the
+           *                 `CONTINUATION` frames that follow it.
+           * @param[in] size Length of the block.
+           * @param[in] emit Function called with the name and value of each field, in order. The
+           *                 views are only valid during the call.
+           * @throws webby::hpack::error if the block is malformed.
+           */
+          template<typename Emit>
+          void decode(const unsigned char* data, size_t size, Emit emit) {
+            const unsigned char* p = data;
+            const unsigned char* const end = data + size;
+            while(p < end) {
+              const unsigned char first = *p;
+              if(first & 0x80) {
+                // Indexed field. The static table needs no lookup beyond the array index.
+                const std::pair<string_view, string_view> e = entry(integer(p, end, 7));
+                emit(e.first, e.second);
+              }
+              else if((first & 0xe0) == 0x20) {
+                // Dynamic table size update.
+                const uint32_t capacity = integer(p, end, 5);
+                if(capacity > default_table_size) {
+                  throw hpack::error("HPACK table size update exceeds the advertised size");
+                }
+                _capacity = capacity;
+                evict(0);
+              }
+              else {
+                // Literal field, added to the dynamic table or not.
+                const bool indexing = (first & 0xc0) == 0x40;
+                const uint32_t index = integer(p, end, indexing ? 6 : 4);
+                if(index == 0) {
+                  string(p, end, _name);
+                }
+                else {
+                  const string_view name = entry(index).first;
+                  _name.assign(name.data(), name.size());
+                }
+                string(p, end, _value);
+                emit(string_view(_name), string_view(_value));
+                if(indexing) {
+                  insert(_name, _value);
+                }
+              }
+            }
+          }
+
+        private:
+          /**
+           * @brief Gets an entry of the static or the dynamic table.
+           * @throws webby::hpack::error if there is no such entry.
+           */
+          std::pair<string_view, string_view> entry(uint32_t index) const {
+            if(index >= 1 && index <= static_size) {
+              return static_entry(index);
+            }
+            if(index == 0 || index - static_size > _table.size()) {
+              throw hpack::error("HPACK index is out of range");
+            }
+            const std::pair<std::string, std::string>& e = _table[index - static_size - 1];
+            return std::make_pair(string_view(e.first), string_view(e.second));
+          }
+
+          /**
+           * @brief Adds a field to the dynamic table, evicting the oldest fields to make room.
+           */
+          void insert(const std::string& name, const std::string& value) {
+            const size_t size = name.size() + value.size() + 32;
+            evict(size);
+            if(size <= _capacity) {
+              _table.push_front(std::make_pair(name, value));
+              _size += size;
+            }
+          }
+
+          /**
+           * @brief Evicts the oldest fields until @p room octets are free.
+           *
+           * A field larger than the whole table empties it and is not added.
+           */
+          void evict(size_t room) {
+            while(!_table.empty() && _size + room > _capacity) {
+              _size -= _table.back().first.size() + _table.back().second.size() + 32;
+              _table.pop_back();
+            }
+          }
+
+          /**
+           * @brief Decodes an integer with an @p prefix bit prefix (RFC 7541, section 5.1).
+           */
+          static uint32_t integer(const unsigned char*& p, const unsigned char* end,
+                                  unsigned prefix) {
+            const uint32_t mask = (1u << prefix) - 1;
+            uint32_t value = *p++ & mask;
+            if(value < mask) {
+              return value;
+            }
+            for(unsigned shift = 0; ; shift += 7) {
+              if(p == end) {
+                throw hpack::error("HPACK integer is truncated");
+              }
+              if(shift > 21) {
+                throw hpack::error("HPACK integer is too large");
+              }
+              const unsigned char b = *p++;
+              value += static_cast<uint32_t>(b & 0x7f) << shift;
+              if((b & 0x80) == 0) {
+                return value;
+              }
+            }
+          }
+
+          /**
+           * @brief Decodes a string literal (RFC 7541, section 5.2) into @p out.
+           */
+          static void string(const unsigned char*& p, const unsigned char* end, std::string& out) {
+            if(p == end) {
+              throw hpack::error("HPACK string is truncated");
+            }
+            const bool huffman = (*p & 0x80) != 0;
+            const uint32_t length = integer(p, end, 7);
+            if(length > static_cast<size_t>(end - p)) {
+              throw hpack::error("HPACK string is truncated");
+            }
+            out.clear();
+            if(huffman) {
+              huffman_decode(p, length, out);
+            }
+            else {
+              out.assign(reinterpret_cast<const char*>(p), length);
+            }
+            p += length;
+          }
+
+          /**
+           * @brief Fields in the dynamic table, newest first.
+           */
+          std::deque<std::pair<std::string, std::string>> _table;
+
+          /**
+           * @brief Size of the dynamic table as defined by RFC 7541: the length of each name and
+           *        value plus 32 octets per field.
+           */
+          size_t _size;
+
+          /**
+           * @brief Maximum size of the dynamic table, set by the encoder within the size webby
+           *        advertised.
+           */
+          size_t _capacity;
+
+          /**
+           * @brief Name of the literal being decoded. Kept to reuse its capacity.
+           */
+          std::string _name;
+
+          /**
+           * @brief Value of the literal being decoded. Kept to reuse its capacity.
+           */
+          std::string _value;
+      };
+
+      /**
+       * @brief Encodes the header blocks of responses.
+       *
+       * The encoder never adds to the peer's dynamic table, so it has no state and the blocks of
+       * different streams can be encoded in any order.
+       */
+      class encoder {
+        public:
+          /**
+           * @brief Encodes the `:status` pseudo-header.
+           * @param[in] status_code Status code of the response, from 100 to 999.
+           * @param[out] out Header block the field is appended to.
+           *
+           * The common codes are a single octet that indexes the static table.
+           */
+          static void status(unsigned short status_code, std::string& out) {
+            static const unsigned short indexed[] = { 200, 204, 206, 304, 400, 404, 500 };
+            for(unsigned i = 0; i < sizeof(indexed) / sizeof(indexed[0]); ++i) {
+              if(indexed[i] == status_code) {
+                out += static_cast<char>(0x80 | (8 + i));
+                return;
+              }
+            }
+            const char digits[3] = {
+              static_cast<char>('0' + status_code / 100 % 10),
+              static_cast<char>('0' + status_code / 10 % 10),
+              static_cast<char>('0' + status_code % 10)
+            };
+            out += static_cast<char>(0x08);
+            literal(string_view(digits, 3), false, out);
+          }
+
+          /**
+           * @brief Encodes a header field.
+           * @param[in] name Name of the header in any case. It is sent in lower case, as HTTP/2
+           *                 requires.
+           * @param[in] value Value of the header.
+           * @param[out] out Header block the field is appended to.
+           */
+          static void field(string_view name, string_view value, std::string& out) {
+            unsigned name_index = 0;
+            for(unsigned i = 15; i <= static_size; ++i) {
+              const std::pair<string_view, string_view>& e = static_entry(i);
+              if(e.first.size() == name.size() && iequals(e.first, name)) {
+                if(e.second == value) {
+                  out += static_cast<char>(0x80 | i);
+                  return;
+                }
+                name_index = i;
+                break;
+              }
+            }
+
+            // Literal without indexing, with the name indexed if the static table has it.
+            integer(name_index, 4, 0x00, out);
+            if(name_index == 0) {
+              literal(name, true, out);
+            }
+            literal(value, false, out);
+          }
+
+        private:
+          /**
+           * @brief Encodes an integer with an @p prefix bit prefix and the bits of @p flags
+           *        above it.
+           */
+          static void integer(size_t value, unsigned prefix, unsigned char flags,
+                              std::string& out) {
+            const size_t mask = (static_cast<size_t>(1) << prefix) - 1;
+            if(value < mask) {
+              out += static_cast<char>(flags | value);
+              return;
+            }
+            out += static_cast<char>(flags | mask);
+            value -= mask;
+            while(value >= 0x80) {
+              out += static_cast<char>(0x80 | (value & 0x7f));
+              value >>= 7;
+            }
+            out += static_cast<char>(value);
+          }
+
+          /**
+           * @brief Encodes a string literal without Huffman coding, lowering its case if
+           *        @p lower is `true`.
+           */
+          static void literal(string_view str, bool lower, std::string& out) {
+            integer(str.size(), 7, 0x00, out);
+            if(!lower) {
+              out.append(str.data(), str.size());
+              return;
+            }
+            for(size_t i = 0; i < str.size(); ++i) {
+              const char c = str[i];
+              out += c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+            }
+          }
+      };
+
+    private:
+      /**
+       * @brief Decodes a Huffman coded string (RFC 7541, section 5.2 and appendix B).
+       * @throws webby::hpack::error if the string contains the EOS symbol or is padded with
+       *         anything other than the most significant bits of EOS.
+       *
+       * The code is walked eight bits at a time through a tree of 256-entry tables.
+       */
+      static void huffman_decode(const unsigned char* data, size_t size, std::string& out) {
+        const huffman_tree& tree = huffman_tree::get();
+        uint64_t bits = 0;
+        unsigned count = 0;
+        unsigned since_symbol = 0;
+        uint16_t table = 0;
+        for(size_t i = 0; i < size; ++i) {
+          bits = (bits << 8) | data[i];
+          count += 8;
+          since_symbol += 8;
+          while(count >= 8) {
+            const huffman_tree::node& n = tree.lookup(table, (bits >> (count - 8)) & 0xff);
+            if(n.length == 0) {
+              if(n.next == 0) {
+                throw hpack::error("Huffman string contains EOS");
+              }
+              table = n.next;
+              count -= 8;
+            }
+            else {
+              out += static_cast<char>(n.symbol);
+              count -= n.length;
+              table = 0;
+              since_symbol = count;
+            }
+          }
+        }
+
+        // Decodes the symbols in the last bits, which are shorter than eight bits.
+        while(count > 0) {
+          const huffman_tree::node& n = tree.lookup(table, (bits << (8 - count)) & 0xff);
+          if(n.length == 0 || n.length > count) {
+            break;
+          }
+          out += static_cast<char>(n.symbol);
+          count -= n.length;
+          table = 0;
+          since_symbol = count;
+        }
+        const uint64_t mask = (static_cast<uint64_t>(1) << count) - 1;
+        if(since_symbol > 7 || (bits & mask) != mask) {
+          throw hpack::error("Huffman string is padded incorrectly");
+        }
+      }
+
+      /**
+       * @brief Decoding tables for the HPACK Huffman code, built on first use.
+       */
+      class huffman_tree {
+        public:
+          /**
+           * @brief An entry of a table.
+           *
+           * An entry with a length is a symbol whose code ends in this table; the remaining bits
+           * of the index belong to the next code. An entry without a length continues in table
+           * `next`, or is invalid if `next` is `0` because it leads to EOS.
+           */
+          struct node {
+            uint16_t next;
+            uint8_t symbol;
+            uint8_t length;
+          };
+
+          /**
+           * @brief Gets the tables, which are shared by all threads.
+           */
+          static const huffman_tree& get() {
+            static const huffman_tree tree;
+            return tree;
+          }
+
+          /**
+           * @brief Gets the entry for the next eight bits of a code.
+           */
+          const node& lookup(uint16_t table, uint64_t index) const {
+            return _nodes[table * 256u + static_cast<unsigned>(index)];
+          }
+
+        private:
+          /**
+           * @brief Builds the tables from the code of each symbol.
+           */
+          huffman_tree() : _nodes(256) {
+            static const struct { uint32_t code; uint8_t length; } codes[256] = {
+          {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+          {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+          {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+          {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+          {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+          {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+          {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+          {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+          {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+          {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+          {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+          {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+          {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+          {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+          {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+          {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+          {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+          {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+          {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+          {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+          {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+          {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+          {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+          {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+          {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+          {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+          {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+          {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+          {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+          {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+          {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+          {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+          {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+          {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+          {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+          {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+          {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+          {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+          {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+          {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+          {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+          {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+          {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+          {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+          {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+          {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+          {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+          {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+          {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+          {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+          {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+          {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+          {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+          {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+          {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+          {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+          {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+          {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+          {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+          {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+          {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+          {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+          {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+          {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+            };
+            for(unsigned symbol = 0; symbol < 256; ++symbol) {
+              const uint32_t code = codes[symbol].code;
+              unsigned length = codes[symbol].length;
+              uint16_t table = 0;
+              while(length > 8) {
+                length -= 8;
+                node& n = _nodes[table * 256u + ((code >> length) & 0xff)];
+                if(n.next == 0) {
+                  n.next = static_cast<uint16_t>(_nodes.size() / 256);
+                  _nodes.resize(_nodes.size() + 256);
+                }
+                table = _nodes[table * 256u + ((code >> length) & 0xff)].next;
+              }
+              const unsigned shift = 8 - length;
+              const unsigned first = (code << shift) & 0xff;
+              for(unsigned i = 0; i < (1u << shift); ++i) {
+                node& n = _nodes[table * 256u + first + i];
+                n.symbol = static_cast<uint8_t>(symbol);
+                n.length = static_cast<uint8_t>(length);
+              }
+            }
+          }
+
+          /**
+           * @brief The tables, 256 entries each. Table `0` decodes the start of every code.
+           */
+          std::vector<node> _nodes;
+      };
+  };
+}
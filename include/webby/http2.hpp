@@ -0,0 +1,1421 @@
+/**
+ * @file http2.hpp
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <webby/config.hpp>
+#include <webby/connection.hpp>
+#include <webby/date.hpp>
+#include <webby/hpack.hpp>
+#include <webby/parser.hpp>
+#include <webby/response.hpp>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief HTTP/2 (RFC 7540) over a webby::connection.
+   *
+   * A connection switches to HTTP/2 when a client that negotiated `h2` with ALPN, or that knows
+   * the server speaks it, sends the connection preface, or when a cleartext HTTP/1.1 request asks
+   * to upgrade to `h2c`. The connection is then handed over to an http2::session, which
+   * multiplexes the streams and passes each complete request to the server as an http2::stream.
+   * The server dispatches it through the router like any other request, with a webby::request
+   * built from the stream's headers and a webby::response whose sink is the stream.
+   */
+  class http2 {
+    public:
+      /**
+       * @brief Error codes of `RST_STREAM` and `GOAWAY` frames.
+       */
+      enum class error_code : uint32_t {
+        no_error = 0x0,
+        protocol_error = 0x1,
+        internal_error = 0x2,
+        flow_control_error = 0x3,
+        stream_closed = 0x5,
+        frame_size_error = 0x6,
+        refused_stream = 0x7,
+        cancel = 0x8,
+        compression_error = 0x9,
+        enhance_your_calm = 0xb
+      };
+
+      /**
+       * @brief Reports a connection error, after which the connection is closed with `GOAWAY`.
+       */
+      class error : public std::runtime_error {
+        public:
+          /**
+           * @brief Constructs the `http2::error` object.
+           * @param[in] code Error code sent to the peer.
+           * @param[in] what_arg Explanatory string.
+           */
+          error(error_code code, const std::string& what_arg)
+              : runtime_error(what_arg), _code(code) { }
+
+          /**
+           * @brief Constructs the `http2::error` object.
+           * @param[in] code Error code sent to the peer.
+           * @param[in] what_arg Explanatory string.
+           */
+          error(error_code code, const char* what_arg) : runtime_error(what_arg), _code(code) { }
+
+          /**
+           * @brief Gets the error code sent to the peer.
+           */
+          error_code code() const {
+            return _code;
+          }
+
+        private:
+          error_code _code;
+      };
+
+      // Forward reference.
+      class session;
+
+      /**
+       * @brief A request received on a stream, and the sink its response is sent through.
+       *
+       * The header fields and the body are owned by the stream, because the header blocks of the
+       * streams of a connection arrive interleaved and are decoded as they arrive.
+       */
+      class stream : public response::sink {
+        public:
+          /**
+           * @brief Constructs a stream.
+           * @param[in] s Session the stream belongs to.
+           * @param[in] id Stream identifier.
+           * @param[in] window Initial flow control window for sending to the peer.
+           */
+          stream(session& s, uint32_t id, int64_t window)
+              : _session(s), _id(id), _send_window(window), _received(0), _oversized(false),
+                _end_remote(false), _end_local(false), _reset(false) { }
+
+          /**
+           * @brief Gets the stream identifier.
+           */
+          uint32_t id() const {
+            return _id;
+          }
+
+          /**
+           * @brief Gets the request method from the `:method` pseudo-header.
+           */
+          string_view method() const {
+            return _method;
+          }
+
+          /**
+           * @brief Gets the request target from the `:path` pseudo-header.
+           */
+          string_view path() const {
+            return _path;
+          }
+
+          /**
+           * @brief Gets the regular header fields. `:authority` is included as `host` if the
+           *        client did not send a `host` header.
+           */
+          const std::vector<parser::field>& fields() const {
+            return _fields;
+          }
+
+          /**
+           * @brief Gets the request body.
+           */
+          string_view body() const {
+            return string_view(_body);
+          }
+
+          /**
+           * @brief Gets the decoded size of the header fields.
+           */
+          size_t header_size() const {
+            return _text.size();
+          }
+
+          void send_headers(unsigned short status_code, const header_builder& headers,
+                            bool last) override;
+          void send_data(const struct iovec* iov, size_t count, bool last) override;
+          void abort() override;
+
+        private:
+          /**
+           * @brief Location of a decoded field in stream::_text.
+           */
+          struct span {
+            size_t name;
+            size_t name_length;
+            size_t value;
+            size_t value_length;
+          };
+
+          /**
+           * @brief Adds a decoded field.
+           *
+           * Fields beyond connection::max_header_size are dropped, and the request is answered
+           * with `431` once the header block has been decoded.
+           */
+          void add(string_view name, string_view value) {
+            if(_text.size() + name.size() + value.size() > connection::max_header_size) {
+              _oversized = true;
+              return;
+            }
+            span f = { _text.size(), name.size(), _text.size() + name.size(), value.size() };
+            _text.append(name.data(), name.size());
+            _text.append(value.data(), value.size());
+            _spans.push_back(f);
+          }
+
+          /**
+           * @brief Builds the request from the decoded fields.
+           * @returns `false` if the request is malformed.
+           *
+           * Pseudo-headers must come before the regular fields, `:method` and `:path` are
+           * required, and the fields that only apply to an HTTP/1.1 connection are not allowed.
+           * Cookies that the client split over several fields are joined again, as HTTP/1.1
+           * handlers expect a single `cookie` header.
+           */
+          bool complete_headers() {
+            string_view authority;
+            std::string cookies;
+            bool regular = false;
+            for(auto itr = _spans.cbegin(); itr != _spans.cend(); ++itr) {
+              string_view name(_text.data() + itr->name, itr->name_length);
+              string_view value(_text.data() + itr->value, itr->value_length);
+              if(!name.empty() && name[0] == ':') {
+                if(regular) {
+                  return false;
+                }
+                if(name == ":method") {
+                  _method = value;
+                }
+                else if(name == ":path") {
+                  _path = value;
+                }
+                else if(name == ":authority") {
+                  authority = value;
+                }
+                else if(name != ":scheme") {
+                  return false;
+                }
+                continue;
+              }
+              regular = true;
+              if(name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+                 name == "transfer-encoding" || name == "upgrade") {
+                return false;
+              }
+              if(name == "cookie") {
+                if(!cookies.empty()) {
+                  cookies += "; ";
+                }
+                cookies.append(value.data(), value.size());
+                continue;
+              }
+              _fields.push_back(parser::field{name, value});
+            }
+            if(_method.empty() || _path.empty()) {
+              return false;
+            }
+
+            // Appends the fields that are built here. The text is not modified again, so the
+            // views taken above stay valid.
+            _extra.reserve(2);
+            if(!cookies.empty()) {
+              _extra.push_back(cookies);
+              _fields.push_back(parser::field{"cookie", string_view(_extra.back())});
+            }
+            if(!authority.empty()) {
+              bool host = false;
+              for(auto itr = _fields.cbegin(); itr != _fields.cend() && !host; ++itr) {
+                host = itr->name == "host";
+              }
+              if(!host) {
+                _fields.push_back(parser::field{"host", authority});
+              }
+            }
+            return true;
+          }
+
+          /// Session the stream belongs to.
+          session& _session;
+
+          /// Stream identifier.
+          uint32_t _id;
+
+          /// Bytes the peer allows to be sent on the stream. Negative if the peer shrank it.
+          int64_t _send_window;
+
+          /// Body bytes received since the last `WINDOW_UPDATE` for the stream.
+          uint32_t _received;
+
+          /// Decoded names and values, back to back.
+          std::string _text;
+
+          /// Locations of the decoded fields.
+          std::vector<span> _spans;
+
+          /// Fields that are not views of stream::_text, i.e. the joined cookies.
+          std::vector<std::string> _extra;
+
+          /// Regular header fields.
+          std::vector<parser::field> _fields;
+
+          /// Request method.
+          string_view _method;
+
+          /// Request target.
+          string_view _path;
+
+          /// Request body.
+          std::string _body;
+
+          /// Response body that the flow control windows did not allow to be sent yet.
+          std::string _pending;
+
+          /// `true` if the header block was larger than connection::max_header_size.
+          bool _oversized;
+
+          /// `true` once the request has been received in full.
+          bool _end_remote;
+
+          /// `true` once the handler has ended the response, even if part of its body is held back
+          /// in stream::_pending.
+          bool _end_local;
+
+          /// `true` if the stream was reset by either side.
+          bool _reset;
+
+        friend class session;
+      };
+
+      /**
+       * @brief State of an HTTP/2 connection.
+       *
+       * The session is driven by the thread that owns the connection: session::process() handles
+       * the frames that have been received and then runs every request that is complete, one
+       * after the other. When a response runs out of flow control window the rest of its body is
+       * held back on its stream, and the handler goes on; the body is sent as the peer opens the
+       * windows, from later calls to session::process(). So a client that reads slowly does not
+       * hold up the thread, which may be an event loop serving other connections. Only a handler
+       * that streams more than session::max_pending bytes ahead of the peer waits for it, handling
+       * the frames that arrive meanwhile. Requests that complete meanwhile are run afterwards.
+       *
+       * Frames are not written as they are produced. Control frames and small responses are
+       * collected in an output buffer that is sent when it fills up, when a response waits and
+       * when session::process() returns, so the responses to a burst of requests usually leave in
+       * a single write. Larger bodies are gathered with their frame headers into one `writev()`
+       * without being copied.
+       */
+      class session : public connection::protocol {
+        public:
+          /**
+           * @brief Signature of the function that runs a complete request.
+           */
+          typedef std::function<void(stream&)> dispatch_t;
+
+          /**
+           * @brief Number of concurrent streams the peer may open.
+           */
+          static const unsigned max_streams = 100;
+
+          /**
+           * @brief Frame payloads up to this size are received, which is the protocol's default.
+           */
+          static const size_t max_frame_size = 16384;
+
+          /**
+           * @brief Collected output is sent once it reaches this size.
+           */
+          static const size_t batch_size = 16384;
+
+          /**
+           * @brief Maximum number of `DATA` frames gathered into one write.
+           */
+          static const unsigned max_batch = 16;
+
+          /**
+           * @brief Default send window, and the receive window webby keeps open.
+           */
+          static const uint32_t default_window = 65535;
+
+          /**
+           * @brief Response bodies held back for want of flow control window, over all streams,
+           *        beyond which a handler waits for the peer instead.
+           */
+          static const size_t max_pending = 1024 * 1024;
+
+          /**
+           * @brief Checks whether the next request on a connection starts the HTTP/2 preface.
+           * @param[in] c Connection that has not received a request yet.
+           * @returns `true` if it does, in which case the first part of the preface has been
+           *          consumed.
+           *
+           * The preface starts with `PRI * HTTP/2.0` and a blank line, which parses as an
+           * HTTP/1.1 request, so it is recognized by the connection's parser.
+           */
+          static bool preface(connection& c) {
+            if(c.read_header() != parser::status::complete) {
+              return false;
+            }
+            const parser& p = c.request_header();
+            if(p.method() != "PRI" || p.target() != "*" || p.version() != "2.0" ||
+               !p.fields().empty()) {
+              return false;
+            }
+            c.release();
+            return true;
+          }
+
+          /**
+           * @brief Constructs a session and queues the server's `SETTINGS`.
+           * @param[in] config Server configuration.
+           * @param[in] c Connection the session runs on. It must outlive the session.
+           * @param[in] dispatch Function that runs each complete request.
+           * @param[in] upgraded `true` if the connection was upgraded from HTTP/1.1, in which
+           *                     case the client has not sent any of the preface yet.
+           */
+          session(const webby::config& config, connection& c, dispatch_t dispatch,
+                  bool upgraded)
+              : _config(config), _connection(c), _dispatch(dispatch),
+                _preface(upgraded ? "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" : "SM\r\n\r\n"),
+                _last_stream(0), _send_window(default_window), _peer_window(default_window),
+                _peer_max_frame(max_frame_size), _received(0), _continuation(0),
+                _block_stream(0), _block_end_stream(false), _goaway(false), _broken(false),
+                _active(nullptr) {
+            // The session batches its own writes, and a peer that is waiting for a window update
+            // must not also wait for Nagle's algorithm.
+            _connection.set_nodelay(true);
+
+            // SETTINGS_MAX_CONCURRENT_STREAMS and SETTINGS_MAX_HEADER_LIST_SIZE.
+            unsigned char settings[12] = { 0x00, 0x03, 0, 0, 0, 0, 0x00, 0x06, 0, 0, 0, 0 };
+            write32(settings + 2, max_streams);
+            write32(settings + 8, static_cast<uint32_t>(connection::max_header_size));
+            frame(type::settings, 0, 0, settings, sizeof(settings));
+          }
+
+          /**
+           * @brief Switches protocols and turns the HTTP/1.1 request that asked for the upgrade
+           *        into stream 1.
+           * @param[in] settings Value of the request's `HTTP2-Settings` header.
+           * @returns the stream, whose request has been received in full.
+           * @throws webby::http2::error if the settings or the client preface are invalid.
+           *
+           * The `101 Switching Protocols` response is sent with the server's `SETTINGS`, and the
+           * request is only answered once the client preface has arrived. Clients may not keep
+           * much of the response before they have sent their preface.
+           */
+          stream& upgrade(string_view settings) {
+            std::string payload;
+            if(!base64url_decode(settings, payload)) {
+              throw http2::error(error_code::protocol_error, "Invalid HTTP2-Settings");
+            }
+            apply_settings(reinterpret_cast<const unsigned char*>(payload.data()), payload.size());
+            _last_stream = 1;
+            stream* s = new stream(*this, 1, _peer_window);
+            _streams[1].reset(s);
+            s->_end_remote = true;
+            _active = s;
+
+            static const char switching[] =
+                "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+            _out.insert(0, switching, sizeof(switching) - 1);
+            flush();
+            while(!_preface.empty()) {
+              receive();
+            }
+            return *s;
+          }
+
+          /**
+           * @brief Handles the received frames and runs the requests that are complete.
+           * @returns `true` if the connection stays open; `false` if it must be closed.
+           *
+           * All of the data buffered by the connection is consumed, so the connection does not
+           * report it again.
+           */
+          bool process() {
+            try {
+              if(_active != nullptr) {
+                // The request that asked for the upgrade has been answered.
+                finish(*_active);
+                _active = nullptr;
+              }
+              while(_connection.buffered() > 0) {
+                const size_t size = _in.size();
+                _in.resize(size + _connection.buffered());
+                _connection.read(reinterpret_cast<char*>(&_in[size]), _in.size() - size);
+              }
+              decode();
+              drain();
+              run();
+              flush();
+              return !_connection.eof() && !(_goaway && _streams.empty());
+            }
+            catch(const http2::error& e) {
+              WEBBY_LOG(_config, error) << e.what();
+              close(e.code());
+            }
+            catch(const hpack::error& e) {
+              WEBBY_LOG(_config, error) << e.what();
+              close(error_code::compression_error);
+            }
+            catch(const std::exception& e) {
+              WEBBY_LOG(_config, error) << e.what();
+            }
+            return false;
+          }
+
+          /**
+           * @brief Tells the client with `GOAWAY` that the server accepts no more streams, before
+           *        the connection is closed.
+           */
+          void shut_down() {
+            close(error_code::no_error);
+          }
+
+        private:
+          /**
+           * @brief Frame types.
+           */
+          enum class type : uint8_t {
+            data = 0x0,
+            headers = 0x1,
+            priority = 0x2,
+            rst_stream = 0x3,
+            settings = 0x4,
+            push_promise = 0x5,
+            ping = 0x6,
+            goaway = 0x7,
+            window_update = 0x8,
+            continuation = 0x9
+          };
+
+          /// Flag of `DATA` and `HEADERS` frames that ends the stream.
+          static const uint8_t end_stream = 0x1;
+
+          /// Flag of `SETTINGS` and `PING` frames that acknowledges the peer's frame.
+          static const uint8_t ack = 0x1;
+
+          /// Flag of `HEADERS` and `CONTINUATION` frames that ends the header block.
+          static const uint8_t end_headers = 0x4;
+
+          /// Flag of `DATA` and `HEADERS` frames that are padded.
+          static const uint8_t padded = 0x8;
+
+          /// Flag of `HEADERS` frames that carry a priority.
+          static const uint8_t has_priority = 0x20;
+
+          /**
+           * @brief Handles every complete frame in the input buffer.
+           * @throws webby::http2::error if the peer violated the protocol.
+           */
+          void decode() {
+            size_t p = 0;
+            while(p < _in.size()) {
+              if(!_preface.empty()) {
+                size_t n = std::min(_preface.size(), _in.size() - p);
+                if(memcmp(&_in[p], _preface.data(), n) != 0) {
+                  throw http2::error(error_code::protocol_error, "Invalid HTTP/2 preface");
+                }
+                _preface = _preface.substr(n);
+                p += n;
+                continue;
+              }
+              if(_in.size() - p < 9) {
+                break;
+              }
+              const unsigned char* h = &_in[p];
+              const size_t length = (static_cast<size_t>(h[0]) << 16) | (h[1] << 8) | h[2];
+              if(length > max_frame_size) {
+                throw http2::error(error_code::frame_size_error, "HTTP/2 frame is too large");
+              }
+              if(_in.size() - p < 9 + length) {
+                break;
+              }
+              const uint32_t id = read32(h + 5) & 0x7fffffff;
+              handle(static_cast<type>(h[3]), h[4], id, h + 9, length);
+              p += 9 + length;
+            }
+            _in.erase(_in.begin(), _in.begin() + static_cast<std::ptrdiff_t>(p));
+          }
+
+          /**
+           * @brief Handles a frame.
+           */
+          void handle(type t, uint8_t flags, uint32_t id, const unsigned char* payload,
+                      size_t length) {
+            if(_continuation != 0 && (t != type::continuation || id != _continuation)) {
+              throw http2::error(error_code::protocol_error, "Expected a CONTINUATION frame");
+            }
+            switch(t) {
+              case type::data:
+                on_data(flags, id, payload, length);
+                break;
+              case type::headers:
+                on_headers(flags, id, payload, length);
+                break;
+              case type::continuation:
+                if(_continuation == 0) {
+                  throw http2::error(error_code::protocol_error, "Unexpected CONTINUATION frame");
+                }
+                if(_block.size() + length > 2 * connection::max_header_size) {
+                  throw http2::error(error_code::enhance_your_calm, "Header block is too large");
+                }
+                _block.append(reinterpret_cast<const char*>(payload), length);
+                if(flags & end_headers) {
+                  _continuation = 0;
+                  end_block();
+                }
+                break;
+              case type::priority:
+                if(id == 0) {
+                  throw http2::error(error_code::protocol_error, "PRIORITY on stream 0");
+                }
+                break;
+              case type::rst_stream:
+                if(id == 0 || length != 4) {
+                  throw http2::error(error_code::protocol_error, "Invalid RST_STREAM frame");
+                }
+                on_reset(id);
+                break;
+              case type::settings:
+                if(id != 0) {
+                  throw http2::error(error_code::protocol_error, "SETTINGS on a stream");
+                }
+                if(flags & ack) {
+                  break;
+                }
+                if(length % 6 != 0) {
+                  throw http2::error(error_code::frame_size_error, "Invalid SETTINGS frame");
+                }
+                apply_settings(payload, length);
+                frame(type::settings, ack, 0, nullptr, 0);
+                break;
+              case type::push_promise:
+                throw http2::error(error_code::protocol_error, "Clients cannot push streams");
+              case type::ping:
+                if(id != 0 || length != 8) {
+                  throw http2::error(error_code::protocol_error, "Invalid PING frame");
+                }
+                if(!(flags & ack)) {
+                  frame(type::ping, ack, 0, payload, length);
+                }
+                break;
+              case type::goaway:
+                if(id != 0) {
+                  throw http2::error(error_code::protocol_error, "GOAWAY on a stream");
+                }
+                _goaway = true;
+                break;
+              case type::window_update:
+                if(length != 4) {
+                  throw http2::error(error_code::frame_size_error, "Invalid WINDOW_UPDATE frame");
+                }
+                on_window_update(id, read32(payload) & 0x7fffffff);
+                break;
+              default:
+                // Unknown frame types are ignored.
+                break;
+            }
+          }
+
+          /**
+           * @brief Handles a `HEADERS` frame, which opens a stream or carries its trailers.
+           */
+          void on_headers(uint8_t flags, uint32_t id, const unsigned char* payload,
+                          size_t length) {
+            if(id == 0 || id % 2 == 0) {
+              throw http2::error(error_code::protocol_error, "Invalid stream identifier");
+            }
+            strip_padding(flags, payload, length);
+            if(flags & has_priority) {
+              if(length < 5) {
+                throw http2::error(error_code::protocol_error, "HEADERS frame is too short");
+              }
+              payload += 5;
+              length -= 5;
+            }
+            if(id <= _last_stream) {
+              auto itr = _streams.find(id);
+              if(itr == _streams.end() || itr->second->_end_remote) {
+                throw http2::error(error_code::stream_closed, "HEADERS on a closed stream");
+              }
+            }
+            else {
+              _last_stream = id;
+            }
+            _block.assign(reinterpret_cast<const char*>(payload), length);
+            _block_stream = id;
+            _block_end_stream = (flags & end_stream) != 0;
+            if(flags & end_headers) {
+              end_block();
+            }
+            else {
+              _continuation = id;
+            }
+          }
+
+          /**
+           * @brief Decodes a complete header block and opens its stream.
+           *
+           * The block is decoded even if the stream is refused, because it may change the
+           * dynamic table that the following blocks refer to.
+           */
+          void end_block() {
+            const unsigned char* data = reinterpret_cast<const unsigned char*>(_block.data());
+            auto itr = _streams.find(_block_stream);
+            if(itr != _streams.end()) {
+              // Trailers are decoded and ignored, and must end the stream.
+              _decoder.decode(data, _block.size(), [](string_view, string_view) { });
+              if(!_block_end_stream) {
+                reset(*itr->second, error_code::protocol_error);
+                return;
+              }
+              itr->second->_end_remote = true;
+              _ready.push_back(_block_stream);
+              return;
+            }
+
+            std::unique_ptr<stream> s(new stream(*this, _block_stream, _peer_window));
+            stream& ref = *s;
+            _decoder.decode(data, _block.size(),
+                            [&ref](string_view name, string_view value) { ref.add(name, value); });
+            if(_goaway || _streams.size() >= max_streams) {
+              rst_stream(ref._id, error_code::refused_stream);
+              return;
+            }
+            if(!ref._oversized && !ref.complete_headers()) {
+              rst_stream(ref._id, error_code::protocol_error);
+              return;
+            }
+            _streams[ref._id] = std::move(s);
+            ref._end_remote = _block_end_stream;
+            if(ref._oversized) {
+              reply(ref, 431);
+            }
+            else if(ref._end_remote) {
+              _ready.push_back(ref._id);
+            }
+          }
+
+          /**
+           * @brief Handles a `DATA` frame by adding it to the body of its request.
+           *
+           * The body is buffered until the request is complete. The windows are reopened as the
+           * data arrives, so config::max_body_size() bounds what a request can buffer.
+           */
+          void on_data(uint8_t flags, uint32_t id, const unsigned char* payload, size_t length) {
+            if(id == 0) {
+              throw http2::error(error_code::protocol_error, "DATA on stream 0");
+            }
+            if(id > _last_stream) {
+              throw http2::error(error_code::protocol_error, "DATA on an idle stream");
+            }
+
+            // Padding counts against the windows too.
+            const uint32_t charged = static_cast<uint32_t>(length);
+            _received += charged;
+            if(_received >= default_window / 2) {
+              window_update(0, _received);
+              _received = 0;
+            }
+            strip_padding(flags, payload, length);
+
+            // Data for a stream that has been closed, e.g. after a response that did not wait for
+            // the whole body, is ignored.
+            auto itr = _streams.find(id);
+            if(itr == _streams.end() || itr->second->_end_remote || itr->second->_reset) {
+              return;
+            }
+            stream& s = *itr->second;
+            if(_config.max_body_size() != 0 &&
+               s._body.size() + length > _config.max_body_size()) {
+              reply(s, 413);
+              return;
+            }
+            s._body.append(reinterpret_cast<const char*>(payload), length);
+            if(flags & end_stream) {
+              s._end_remote = true;
+              _ready.push_back(id);
+            }
+            else {
+              s._received += charged;
+              if(s._received >= default_window / 2) {
+                window_update(id, s._received);
+                s._received = 0;
+              }
+            }
+          }
+
+          /**
+           * @brief Handles a `RST_STREAM` frame.
+           */
+          void on_reset(uint32_t id) {
+            auto itr = _streams.find(id);
+            if(itr == _streams.end()) {
+              if(id > _last_stream) {
+                throw http2::error(error_code::protocol_error, "RST_STREAM on an idle stream");
+              }
+              return;
+            }
+            itr->second->_reset = true;
+            itr->second->_pending.clear();
+            if(itr->second.get() != _active) {
+              _streams.erase(itr);
+            }
+          }
+
+          /**
+           * @brief Handles a `WINDOW_UPDATE` frame.
+           */
+          void on_window_update(uint32_t id, uint32_t increment) {
+            const int64_t limit = 0x7fffffff;
+            if(id == 0) {
+              if(increment == 0 || _send_window + increment > limit) {
+                throw http2::error(error_code::flow_control_error, "Invalid window update");
+              }
+              _send_window += increment;
+              return;
+            }
+            auto itr = _streams.find(id);
+            if(itr == _streams.end()) {
+              return;
+            }
+            if(increment == 0 || itr->second->_send_window + increment > limit) {
+              reset(*itr->second, increment == 0 ? error_code::protocol_error
+                                                 : error_code::flow_control_error);
+              return;
+            }
+            itr->second->_send_window += increment;
+          }
+
+          /**
+           * @brief Applies the parameters of a `SETTINGS` frame.
+           * @throws webby::http2::error if a parameter is out of range.
+           */
+          void apply_settings(const unsigned char* payload, size_t length) {
+            for(size_t i = 0; i + 6 <= length; i += 6) {
+              const unsigned id = (payload[i] << 8) | payload[i + 1];
+              const uint32_t value = read32(payload + i + 2);
+              switch(id) {
+                case 0x2: // SETTINGS_ENABLE_PUSH
+                  if(value > 1) {
+                    throw http2::error(error_code::protocol_error, "Invalid ENABLE_PUSH");
+                  }
+                  break;
+                case 0x4: { // SETTINGS_INITIAL_WINDOW_SIZE
+                  if(value > 0x7fffffff) {
+                    throw http2::error(error_code::flow_control_error, "Invalid window size");
+                  }
+                  const int64_t delta = static_cast<int64_t>(value) - _peer_window;
+                  for(auto itr = _streams.begin(); itr != _streams.end(); ++itr) {
+                    if(itr->second->_send_window + delta > 0x7fffffff) {
+                      throw http2::error(error_code::flow_control_error, "Window size overflow");
+                    }
+                    itr->second->_send_window += delta;
+                  }
+                  _peer_window = value;
+                  break;
+                }
+                case 0x5: // SETTINGS_MAX_FRAME_SIZE
+                  if(value < max_frame_size || value > 0xffffff) {
+                    throw http2::error(error_code::protocol_error, "Invalid MAX_FRAME_SIZE");
+                  }
+                  _peer_max_frame = value;
+                  break;
+                default:
+                  // The encoder does not use the peer's dynamic table, and webby never pushes, so
+                  // the other parameters do not matter.
+                  break;
+              }
+            }
+          }
+
+          /**
+           * @brief Runs the complete requests in the order they completed.
+           */
+          void run() {
+            while(!_ready.empty()) {
+              auto itr = _streams.find(_ready.front());
+              _ready.pop_front();
+              if(itr == _streams.end()) {
+                continue;
+              }
+              stream& s = *itr->second;
+              _active = &s;
+              _dispatch(s);
+              _active = nullptr;
+              if(_broken) {
+                throw http2::error(error_code::internal_error, "The connection failed");
+              }
+              finish(s);
+            }
+          }
+
+          /**
+           * @brief Closes a stream once its response has been sent, or abandoned.
+           *
+           * A stream whose body is partly held back stays open until drain() has sent the rest.
+           */
+          void finish(stream& s) {
+            if(s._end_local && !s._pending.empty()) {
+              return;
+            }
+            if(!s._end_local && !s._reset) {
+              rst_stream(s._id, error_code::internal_error);
+            }
+            _streams.erase(s._id);
+          }
+
+          /**
+           * @brief Sends the headers of a response.
+           */
+          void send_headers(stream& s, unsigned short status_code,
+                            const header_builder& headers, bool last) {
+            check(s);
+            _headers.clear();
+            hpack::encoder::status(status_code, _headers);
+            headers.for_each([this](string_view name, string_view value) {
+              if(!hop_by_hop(name)) {
+                hpack::encoder::field(name, value, _headers);
+              }
+            });
+            hpack::encoder::field("date", http_date(), _headers);
+            header_block(s, last);
+          }
+
+          /**
+           * @brief Answers a request with an empty response, without running a handler.
+           */
+          void reply(stream& s, unsigned short status_code) {
+            _headers.clear();
+            hpack::encoder::status(status_code, _headers);
+            hpack::encoder::field("content-length", "0", _headers);
+            hpack::encoder::field("date", http_date(), _headers);
+            header_block(s, true);
+            if(!s._end_remote) {
+              // Tells the client to stop sending the body.
+              reset(s, error_code::no_error);
+            }
+            else {
+              _streams.erase(s._id);
+            }
+          }
+
+          /**
+           * @brief Queues the encoded header block as a `HEADERS` frame and the `CONTINUATION`
+           *        frames needed to fit the peer's maximum frame size.
+           */
+          void header_block(stream& s, bool last) {
+            size_t offset = 0;
+            type t = type::headers;
+            do {
+              const size_t length = std::min<size_t>(_headers.size() - offset, _peer_max_frame);
+              uint8_t flags = offset + length == _headers.size() ? end_headers : 0;
+              if(t == type::headers && last) {
+                flags |= end_stream;
+              }
+              frame(t, flags, s._id, _headers.data() + offset, length);
+              offset += length;
+              t = type::continuation;
+            } while(offset < _headers.size());
+            if(last) {
+              s._end_local = true;
+            }
+            if(_out.size() >= batch_size) {
+              flush();
+            }
+          }
+
+          /**
+           * @brief Sends a block of a response body in `DATA` frames, holding back what the
+           *        windows do not allow yet.
+           */
+          void send_data(stream& s, const struct iovec* iov, size_t count, bool last) {
+            check(s);
+            size_t remaining = 0;
+            for(size_t i = 0; i < count; ++i) {
+              remaining += iov[i].iov_len;
+            }
+            if(!s._pending.empty()) {
+              // The body stays in order behind the part that is held back.
+              hold(s, iov, count, 0, last);
+              return;
+            }
+            if(remaining == 0) {
+              if(last) {
+                frame(type::data, end_stream, s._id, nullptr, 0);
+                s._end_local = true;
+              }
+              return;
+            }
+
+            // The end of a small response is collected with the other output, so the responses
+            // to several requests can share a write. Other blocks are sent at once, because the
+            // handler may be streaming.
+            if(last && _out.size() + 9 + remaining <= batch_size && remaining <= window(s)) {
+              char head[9];
+              frame_header(head, remaining, type::data, end_stream, s._id);
+              _out.append(head, 9);
+              for(size_t i = 0; i < count; ++i) {
+                _out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+              }
+              consume(s, remaining);
+              s._end_local = true;
+              return;
+            }
+
+            const size_t sent = transfer(s, iov, remaining, last);
+            if(sent < remaining) {
+              hold(s, iov, count, sent, last);
+              return;
+            }
+            s._end_local = last;
+          }
+
+          /**
+           * @brief Sends as much of a block of a response body as the windows allow.
+           * @param[in] s Stream of the response.
+           * @param[in] iov Chunks of the block.
+           * @param[in] length Length of the block.
+           * @param[in] last `true` if the block ends the body.
+           * @returns the number of bytes sent.
+           *
+           * The collected output and as many frames as the windows allow are gathered into each
+           * write.
+           */
+          size_t transfer(stream& s, const struct iovec* iov, size_t length, bool last) {
+            size_t sent = 0;
+            size_t index = 0;
+            size_t offset = 0;
+            size_t room = window(s);
+            while(sent < length && room > 0) {
+              std::vector<struct iovec> out;
+              char heads[max_batch][9];
+              if(!_out.empty()) {
+                out.push_back(iovec{ &_out[0], _out.size() });
+              }
+              for(unsigned frames = 0; frames < max_batch && sent < length && room > 0;
+                  ++frames) {
+                const size_t n = std::min(room, length - sent);
+                const bool end = last && sent + n == length;
+                frame_header(heads[frames], n, type::data, end ? end_stream : 0, s._id);
+                out.push_back(iovec{ heads[frames], 9 });
+                for(size_t left = n; left > 0; ) {
+                  const size_t k = std::min(iov[index].iov_len - offset, left);
+                  out.push_back(iovec{ static_cast<char*>(iov[index].iov_base) + offset, k });
+                  offset += k;
+                  left -= k;
+                  if(offset == iov[index].iov_len) {
+                    ++index;
+                    offset = 0;
+                  }
+                }
+                consume(s, n);
+                sent += n;
+                room = window(s);
+              }
+              write(out.data(), out.size());
+              _out.clear();
+            }
+            return sent;
+          }
+
+          /**
+           * @brief Holds back the part of a block of a response body that follows its first
+           *        @p skip bytes, until the peer opens the windows.
+           *
+           * The collected output, such as the response's headers, is sent meanwhile. If the
+           * responses of the session hold back more than session::max_pending bytes, the handler
+           * waits for the peer.
+           */
+          void hold(stream& s, const struct iovec* iov, size_t count, size_t skip, bool last) {
+            for(size_t i = 0; i < count; ++i) {
+              const size_t n = std::min(skip, iov[i].iov_len);
+              s._pending.append(static_cast<const char*>(iov[i].iov_base) + n,
+                                iov[i].iov_len - n);
+              skip -= n;
+            }
+            s._end_local = last;
+            flush();
+            if(pending() > max_pending) {
+              wait(s);
+            }
+          }
+
+          /**
+           * @brief Sends as much of the held back bodies as the windows allow, and closes the
+           *        streams whose responses have then been sent in full.
+           */
+          void drain() {
+            for(auto itr = _streams.begin(); itr != _streams.end(); ) {
+              stream& s = *itr->second;
+              if(!s._pending.empty() && window(s) > 0) {
+                struct iovec iov = { &s._pending[0], s._pending.size() };
+                s._pending.erase(0, transfer(s, &iov, s._pending.size(), s._end_local));
+                if(s._pending.empty() && s._end_local && &s != _active) {
+                  itr = _streams.erase(itr);
+                  continue;
+                }
+              }
+              ++itr;
+            }
+          }
+
+          /**
+           * @brief Gets the number of response body bytes held back over all streams.
+           */
+          size_t pending() const {
+            size_t size = 0;
+            for(auto itr = _streams.cbegin(); itr != _streams.cend(); ++itr) {
+              size += itr->second->_pending.size();
+            }
+            return size;
+          }
+
+          /**
+           * @brief Cuts a response short after its handler failed.
+           */
+          void abort(stream& s) {
+            if(!_broken && !s._reset && !s._end_local) {
+              reset(s, error_code::internal_error);
+            }
+          }
+
+          /**
+           * @brief Handles frames and sends the held back bodies until they fit in
+           *        session::max_pending again.
+           * @throws webby::response::error if the peer resets the stream meanwhile.
+           */
+          void wait(stream& s) {
+            while(!s._reset && pending() > max_pending) {
+              receive();
+              drain();
+              flush();
+            }
+            if(s._reset) {
+              throw response::error("The client reset the stream");
+            }
+          }
+
+          /**
+           * @brief Waits for more data from the peer and handles the frames that are complete.
+           * @throws webby::socket::error if the connection closed.
+           */
+          void receive() {
+            try {
+              char buffer[connection::block_size];
+              const size_t n = _connection.read(buffer, sizeof(buffer));
+              if(n == 0) {
+                throw socket::error("Connection closed by the client");
+              }
+              _in.insert(_in.end(), buffer, buffer + n);
+              decode();
+            }
+            catch(...) {
+              _broken = true;
+              throw;
+            }
+          }
+
+          /**
+           * @brief Throws if a response can no longer be sent on a stream.
+           */
+          void check(const stream& s) const {
+            if(_broken) {
+              throw response::error("The connection failed");
+            }
+            if(s._reset) {
+              throw response::error("The client reset the stream");
+            }
+          }
+
+          /**
+           * @brief Gets the largest `DATA` payload that the windows and the peer's frame size
+           *        allow on a stream.
+           */
+          size_t window(const stream& s) const {
+            const int64_t w = std::min(std::min(_send_window, s._send_window),
+                                       static_cast<int64_t>(_peer_max_frame));
+            return w > 0 ? static_cast<size_t>(w) : 0;
+          }
+
+          /**
+           * @brief Charges sent data to the windows.
+           */
+          void consume(stream& s, size_t length) {
+            _send_window -= static_cast<int64_t>(length);
+            s._send_window -= static_cast<int64_t>(length);
+          }
+
+          /**
+           * @brief Resets a stream and closes it, unless its handler is running.
+           */
+          void reset(stream& s, error_code code) {
+            rst_stream(s._id, code);
+            s._reset = true;
+            s._pending.clear();
+            if(&s != _active) {
+              _streams.erase(s._id);
+            }
+          }
+
+          /**
+           * @brief Sends `GOAWAY` and whatever output was collected.
+           */
+          void close(error_code code) {
+            unsigned char payload[8];
+            write32(payload, _last_stream);
+            write32(payload + 4, static_cast<uint32_t>(code));
+            frame(type::goaway, 0, 0, payload, sizeof(payload));
+            try {
+              flush();
+            }
+            catch(const std::exception&) { }
+          }
+
+          /**
+           * @brief Queues a `RST_STREAM` frame.
+           */
+          void rst_stream(uint32_t id, error_code code) {
+            unsigned char payload[4];
+            write32(payload, static_cast<uint32_t>(code));
+            frame(type::rst_stream, 0, id, payload, sizeof(payload));
+          }
+
+          /**
+           * @brief Queues a `WINDOW_UPDATE` frame.
+           */
+          void window_update(uint32_t id, uint32_t increment) {
+            unsigned char payload[4];
+            write32(payload, increment);
+            frame(type::window_update, 0, id, payload, sizeof(payload));
+          }
+
+          /**
+           * @brief Queues a frame.
+           */
+          void frame(type t, uint8_t flags, uint32_t id, const void* payload, size_t length) {
+            char head[9];
+            frame_header(head, length, t, flags, id);
+            _out.append(head, 9);
+            if(length > 0) {
+              _out.append(static_cast<const char*>(payload), length);
+            }
+          }
+
+          /**
+           * @brief Sends the collected output.
+           */
+          void flush() {
+            if(!_out.empty()) {
+              struct iovec iov = { &_out[0], _out.size() };
+              write(&iov, 1);
+              _out.clear();
+            }
+          }
+
+          /**
+           * @brief Writes to the connection, marking the session broken if it fails.
+           */
+          void write(struct iovec* iov, size_t count) {
+            try {
+              _connection.writev(iov, count);
+            }
+            catch(...) {
+              _broken = true;
+              throw;
+            }
+          }
+
+          /**
+           * @brief Removes the padding of a `DATA` or `HEADERS` frame.
+           */
+          static void strip_padding(uint8_t flags, const unsigned char*& payload,
+                                    size_t& length) {
+            if(!(flags & padded)) {
+              return;
+            }
+            if(length == 0 || payload[0] >= length) {
+              throw http2::error(error_code::protocol_error, "Invalid padding");
+            }
+            length -= 1 + payload[0];
+            ++payload;
+          }
+
+          /**
+           * @brief Gets a value that indicates whether a response header only applies to an
+           *        HTTP/1.1 connection, which HTTP/2 forbids.
+           */
+          static bool hop_by_hop(string_view name) {
+            return iequals(name, "Connection") || iequals(name, "Keep-Alive") ||
+                   iequals(name, "Transfer-Encoding") || iequals(name, "Upgrade") ||
+                   iequals(name, "Proxy-Connection");
+          }
+
+          /**
+           * @brief Formats a frame header.
+           */
+          static void frame_header(char* p, size_t length, type t, uint8_t flags, uint32_t id) {
+            p[0] = static_cast<char>(length >> 16);
+            p[1] = static_cast<char>(length >> 8);
+            p[2] = static_cast<char>(length);
+            p[3] = static_cast<char>(t);
+            p[4] = static_cast<char>(flags);
+            write32(reinterpret_cast<unsigned char*>(p + 5), id);
+          }
+
+          /// Reads a 32-bit integer in network byte order.
+          static uint32_t read32(const unsigned char* p) {
+            return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                   (static_cast<uint32_t>(p[2]) << 8) | p[3];
+          }
+
+          /// Writes a 32-bit integer in network byte order.
+          static void write32(unsigned char* p, uint32_t value) {
+            p[0] = static_cast<unsigned char>(value >> 24);
+            p[1] = static_cast<unsigned char>(value >> 16);
+            p[2] = static_cast<unsigned char>(value >> 8);
+            p[3] = static_cast<unsigned char>(value);
+          }
+
+          /**
+           * @brief Decodes base64url without padding, as used by `HTTP2-Settings`.
+           * @returns `false` if @p in is not valid base64url.
+           */
+          static bool base64url_decode(string_view in, std::string& out) {
+            uint32_t bits = 0;
+            unsigned count = 0;
+            for(size_t i = 0; i < in.size(); ++i) {
+              const char c = in[i];
+              int v;
+              if(c >= 'A' && c <= 'Z') {
+                v = c - 'A';
+              }
+              else if(c >= 'a' && c <= 'z') {
+                v = c - 'a' + 26;
+              }
+              else if(c >= '0' && c <= '9') {
+                v = c - '0' + 52;
+              }
+              else if(c == '-') {
+                v = 62;
+              }
+              else if(c == '_') {
+                v = 63;
+              }
+              else if(c == '=') {
+                break;
+              }
+              else {
+                return false;
+              }
+              bits = (bits << 6) | static_cast<uint32_t>(v);
+              count += 6;
+              if(count >= 8) {
+                count -= 8;
+                out += static_cast<char>((bits >> count) & 0xff);
+              }
+            }
+            return true;
+          }
+
+          /// Server configuration.
+          const webby::config& _config;
+
+          /// Connection the session runs on.
+          connection& _connection;
+
+          /// Runs each complete request.
+          dispatch_t _dispatch;
+
+          /// Part of the client preface that has not been received yet.
+          string_view _preface;
+
+          /// Decodes the header blocks of all streams.
+          hpack::decoder _decoder;
+
+          /// Open streams by identifier.
+          std::map<uint32_t, std::unique_ptr<stream>> _streams;
+
+          /// Streams whose request is complete, in the order they completed.
+          std::deque<uint32_t> _ready;
+
+          /// Highest stream identifier the client has used.
+          uint32_t _last_stream;
+
+          /// Bytes the peer allows to be sent on the connection.
+          int64_t _send_window;
+
+          /// Initial send window of new streams.
+          int64_t _peer_window;
+
+          /// Largest frame payload the peer accepts.
+          uint32_t _peer_max_frame;
+
+          /// Body bytes received since the last `WINDOW_UPDATE` for the connection.
+          uint32_t _received;
+
+          /// Stream whose header block continues in a `CONTINUATION` frame, or `0`.
+          uint32_t _continuation;
+
+          /// Header block being received.
+          std::string _block;
+
+          /// Stream of the header block being received.
+          uint32_t _block_stream;
+
+          /// `true` if the `HEADERS` frame of the block being received ends its stream.
+          bool _block_end_stream;
+
+          /// `true` once the peer has sent `GOAWAY`.
+          bool _goaway;
+
+          /// `true` once reading from or writing to the connection has failed.
+          bool _broken;
+
+          /// Stream whose handler is running, or `nullptr`.
+          stream* _active;
+
+          /// Received bytes that do not form a complete frame yet.
+          std::vector<unsigned char> _in;
+
+          /// Collected output frames.
+          std::string _out;
+
+          /// Header block being encoded. Kept to reuse its capacity.
+          std::string _headers;
+
+        friend class stream;
+      };
+  };
+
+  inline void http2::stream::send_headers(unsigned short status_code,
+                                          const header_builder& headers, bool last) {
+    _session.send_headers(*this, status_code, headers, last);
+  }
+
+  inline void http2::stream::send_data(const struct iovec* iov, size_t count, bool last) {
+    _session.send_data(*this, iov, count, last);
+  }
+
+  inline void http2::stream::abort() {
+    _session.abort(*this);
+  }
+}
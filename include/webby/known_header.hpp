@@ -0,0 +1,87 @@
+/**
+ * @file known_header.hpp
+ */
+#pragma once
+
+#include <webby/perfect_hash.hpp>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Header names that requests and responses find in constant time.
+   *
+   * The enumerators are in the order of known_header_names::values.
+   */
+  enum class known_header : unsigned char {
+    accept,
+    accept_encoding,
+    accept_ranges,
+    allow,
+    cache_control,
+    connection,
+    content_encoding,
+    content_length,
+    content_range,
+    content_type,
+    cookie,
+    date,
+    etag,
+    expect,
+    host,
+    http2_settings,
+    if_modified_since,
+    if_none_match,
+    if_range,
+    keep_alive,
+    last_modified,
+    location,
+    range,
+    transfer_encoding,
+    upgrade,
+    user_agent,
+    vary,
+    none ///< Any other header.
+  };
+
+  /**
+   * @brief Canonical spelling of the known headers.
+   */
+  template<typename T = void>
+  struct known_header_names {
+    static constexpr const char* values[] = {
+      "Accept", "Accept-Encoding", "Accept-Ranges", "Allow", "Cache-Control", "Connection",
+      "Content-Encoding", "Content-Length", "Content-Range", "Content-Type", "Cookie", "Date",
+      "ETag", "Expect", "Host", "HTTP2-Settings", "If-Modified-Since", "If-None-Match", "If-Range",
+      "Keep-Alive", "Last-Modified", "Location", "Range", "Transfer-Encoding", "Upgrade",
+      "User-Agent", "Vary"
+    };
+  };
+
+  template<typename T>
+  constexpr const char* known_header_names<T>::values[];
+
+  /**
+   * @brief Number of known headers.
+   */
+  static const unsigned known_header_count = static_cast<unsigned>(known_header::none);
+
+  /**
+   * @brief Finds a known header by name.
+   * @param[in] name Header name. The comparison is case insensitive.
+   * @returns the header, or known_header::none.
+   */
+  inline known_header find_known_header(string_view name) {
+    typedef perfect_hash<known_header_names<>, known_header_count, 64, 1, 4, 58> hash;
+    return static_cast<known_header>(hash::find(name));
+  }
+
+  /**
+   * @brief Gets the canonical spelling of a known header, e.g. `Content-Length`.
+   */
+  inline string_view to_string(known_header h) {
+    return known_header_names<>::values[static_cast<unsigned>(h)];
+  }
+}
@@ -0,0 +1,447 @@
+/**
+ * @file log.hpp
+ */
+#pragma once
+
+#include <qlog.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <streambuf>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <webby/utility.hpp>
+
+/**
+ * @brief Lowest severity compiled into the library: 0 for debug, 1 for info and 2 for error.
+ *
+ * Log statements below this severity are removed by the compiler. It defaults to info in
+ * `NDEBUG` builds and to debug otherwise.
+ */
+#ifndef WEBBY_LOG_LEVEL
+#ifdef NDEBUG
+#define WEBBY_LOG_LEVEL 1
+#else
+#define WEBBY_LOG_LEVEL 0
+#endif
+#endif
+
+/**
+ * @brief Evaluates to `true` if messages of @p level are written to the error log of @p cfg.
+ */
+#define WEBBY_LOG_ENABLED(cfg, level) \
+  (static_cast<int>(webby::log_level::level) >= WEBBY_LOG_LEVEL && \
+   (cfg).log_enabled(webby::log_level::level))
+
+/**
+ * @brief Starts a message for the error log of @p cfg, e.g. `WEBBY_LOG(_config, debug) << "x";`.
+ *
+ * Nothing to the right of the macro is evaluated unless the level is enabled, so disabled log
+ * statements cost one comparison and compile away entirely below `WEBBY_LOG_LEVEL`.
+ */
+#define WEBBY_LOG(cfg, level) \
+  if(!WEBBY_LOG_ENABLED(cfg, level)) { } \
+  else webby::log_record((cfg).error_log(), webby::log_level::level, (cfg).log_sink())
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Severity of a log message.
+   */
+  enum class log_level {
+    debug = 0, ///< Tracing of the request path.
+    info  = 1, ///< Normal operational messages.
+    error = 2, ///< Failures.
+    none  = 3  ///< Disables logging.
+  };
+
+  /**
+   * @brief Writes one message to a qlog logger.
+   * @param[in] target Logger to write to.
+   * @param[in] level Severity of the message.
+   * @param[in] text Message without a line terminator.
+   */
+  inline void write_log(qlog::logger& target, log_level level, string_view text) {
+    switch(level) {
+      case log_level::debug:
+        target << qlog::debug << text << std::endl;
+        break;
+      case log_level::info:
+        target << qlog::info << text << std::endl;
+        break;
+      case log_level::error:
+      case log_level::none:
+        target << qlog::error << text << std::endl;
+        break;
+    }
+  }
+
+  /**
+   * @brief Gets the mutex that serializes synchronous writes, as several threads share the
+   *        loggers.
+   */
+  inline std::mutex& log_mutex() {
+    static std::mutex m;
+    return m;
+  }
+
+  /**
+   * @brief Asynchronous log sink.
+   *
+   * Each thread that logs gets its own single-producer, single-consumer ring of fixed-size
+   * slots. Producers copy a formatted message into their ring without locking or blocking; a long
+   * message takes several consecutive slots. If the ring is full the message is dropped and
+   * counted. A background thread drains all rings in
+   * batches and writes the messages to their loggers, so the request path never waits on the
+   * console or the disk.
+   */
+  class async_sink {
+    public:
+      /**
+       * @brief Number of slots in each thread's ring.
+       */
+      static const size_t ring_size = 256;
+
+      /**
+       * @brief Number of message bytes stored in a slot.
+       */
+      static const size_t max_message = 240;
+
+      /**
+       * @brief Most slots one message takes. Messages longer than `max_slots * max_message` are
+       *        truncated.
+       */
+      static const size_t max_slots = 4;
+
+      /**
+       * @brief Starts the background thread.
+       */
+      async_sink() : _id(next_id()), _running(true), _dropped(0) {
+        _thread = std::thread(&async_sink::run, this);
+      }
+
+      async_sink(const async_sink&) = delete;
+      async_sink& operator=(const async_sink&) = delete;
+
+      /**
+       * @brief Stops the background thread after writing every queued message.
+       */
+      ~async_sink() {
+        _running = false;
+        _thread.join();
+        drain();
+      }
+
+      /**
+       * @brief Queues a message. Never blocks.
+       * @param[in] target Logger the message is written to.
+       * @param[in] level Severity of the message.
+       * @param[in] text Message without a line terminator.
+       * @returns `false` if the calling thread's ring was full and the message was dropped.
+       */
+      bool push(qlog::logger& target, log_level level, string_view text) {
+        ring& r = local_ring();
+        const size_t length = text.size() < max_slots * max_message ? text.size()
+                                                                     : max_slots * max_message;
+        const size_t needed = length == 0 ? 1 : (length + max_message - 1) / max_message;
+        const size_t tail = r.tail.load(std::memory_order_relaxed);
+        if(tail - r.head.load(std::memory_order_acquire) + needed > ring_size) {
+          _dropped.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        // The slots are published together, so the background thread never sees part of a
+        // message.
+        for(size_t i = 0, offset = 0; i < needed; ++i, offset += max_message) {
+          slot& s = r.slots[(tail + i) % ring_size];
+          s.target = &target;
+          s.level = level;
+          s.length = static_cast<uint16_t>(length - offset < max_message ? length - offset
+                                                                          : max_message);
+          s.more = i + 1 < needed;
+          memcpy(s.text, text.data() + offset, s.length);
+        }
+        r.tail.store(tail + needed, std::memory_order_release);
+        return true;
+      }
+
+      /**
+       * @brief Gets the number of messages dropped because a ring was full.
+       */
+      uint64_t dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+      }
+
+    private:
+      /**
+       * @brief A queued message, or part of one.
+       */
+      struct slot {
+        qlog::logger* target;
+        log_level level;
+        uint16_t length;
+        bool more;  ///< `true` if the message goes on in the next slot.
+        char text[max_message];
+      };
+
+      /**
+       * @brief Ring written by one producer thread and read by the background thread.
+       */
+      struct ring {
+        ring() : head(0), tail(0) { }
+
+        /// Index of the next slot to read. Written by the background thread.
+        std::atomic<size_t> head;
+
+        /// Keeps the two indices on separate cache lines.
+        char padding[64];
+
+        /// Index of the next slot to write. Written by the producer.
+        std::atomic<size_t> tail;
+
+        /// Message slots.
+        slot slots[ring_size];
+      };
+
+      /**
+       * @brief Gets a process-wide unique identifier for a sink.
+       */
+      static uint64_t next_id() {
+        static std::atomic<uint64_t> id(0);
+        return ++id;
+      }
+
+      /**
+       * @brief Gets the calling thread's ring, registering one on first use.
+       */
+      ring& local_ring() {
+        struct cached {
+          uint64_t id;
+          ring* r;
+        };
+        static thread_local std::vector<cached> rings;
+        for(auto itr = rings.cbegin(); itr != rings.cend(); ++itr) {
+          if(itr->id == _id) {
+            return *itr->r;
+          }
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _rings.push_back(std::unique_ptr<ring>(new ring()));
+        rings.push_back(cached{_id, _rings.back().get()});
+        return *_rings.back();
+      }
+
+      /**
+       * @brief Writes every queued message.
+       * @returns the number of messages written.
+       */
+      size_t drain() {
+        size_t written = 0;
+        char joined[max_slots * max_message];
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(auto itr = _rings.begin(); itr != _rings.end(); ++itr) {
+          ring& r = **itr;
+          size_t head = r.head.load(std::memory_order_relaxed);
+          const size_t tail = r.tail.load(std::memory_order_acquire);
+          for(; head != tail; ++head, ++written) {
+            const slot* s = &r.slots[head % ring_size];
+            if(!s->more) {
+              write_log(*s->target, s->level, string_view(s->text, s->length));
+              continue;
+            }
+            size_t length = 0;
+            for(;;) {
+              memcpy(joined + length, s->text, s->length);
+              length += s->length;
+              if(!s->more) {
+                break;
+              }
+              s = &r.slots[++head % ring_size];
+            }
+            write_log(*s->target, s->level, string_view(joined, length));
+          }
+          r.head.store(head, std::memory_order_release);
+        }
+        return written;
+      }
+
+      /**
+       * @brief Body of the background thread.
+       */
+      void run() {
+        while(_running.load()) {
+          if(drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+          }
+        }
+      }
+
+      /**
+       * @brief Identifies this sink in each thread's ring cache.
+       */
+      const uint64_t _id;
+
+      /**
+       * @brief Cleared to stop the background thread.
+       */
+      std::atomic<bool> _running;
+
+      /**
+       * @brief Number of dropped messages.
+       */
+      std::atomic<uint64_t> _dropped;
+
+      /**
+       * @brief Protects the list of rings.
+       */
+      std::mutex _mutex;
+
+      /**
+       * @brief One ring per producer thread.
+       */
+      std::vector<std::unique_ptr<ring>> _rings;
+
+      /**
+       * @brief Background thread.
+       */
+      std::thread _thread;
+  };
+
+  /**
+   * @brief A log message being formatted. Created by the `WEBBY_LOG` macro.
+   *
+   * The message is formatted into a per-thread buffer and handed to the logger, or to its
+   * webby::async_sink, when the record is destroyed at the end of the statement.
+   *
+   * A value streamed into a record may log a record of its own, e.g. a request accessor that logs
+   * at debug. Each record being formatted on a thread has its own buffer, so the inner message is
+   * written first and the outer one is left intact.
+   */
+  class log_record {
+    public:
+      /**
+       * @brief Starts a message.
+       * @param[in] target Logger the message is written to.
+       * @param[in] level Severity of the message.
+       * @param[in] sink Asynchronous sink, or `nullptr` to write synchronously.
+       */
+      log_record(qlog::logger& target, log_level level, async_sink* sink)
+          : _target(target), _level(level), _sink(sink) {
+        buffers& b = local_buffers();
+        if(b.depth < max_depth) {
+          _buffer = &b.levels[b.depth];
+        }
+        else {
+          _own.reset(new buffer());
+          _buffer = _own.get();
+        }
+        ++b.depth;
+        _buffer->reset();
+      }
+
+      log_record(const log_record&) = delete;
+      log_record& operator=(const log_record&) = delete;
+
+      /**
+       * @brief Writes the message.
+       */
+      ~log_record() {
+        --local_buffers().depth;
+        string_view text = _buffer->text();
+        if(_sink != nullptr) {
+          _sink->push(_target, _level, text);
+        }
+        else {
+          std::lock_guard<std::mutex> lock(log_mutex());
+          write_log(_target, _level, text);
+        }
+      }
+
+      /**
+       * @brief Appends a value to the message.
+       */
+      template<typename T> log_record& operator<<(const T& value) {
+        _buffer->stream() << value;
+        return *this;
+      }
+
+    private:
+      /**
+       * @brief Fixed-size stream buffer that holds a message being formatted.
+       */
+      class buffer : public std::streambuf {
+        public:
+          buffer() : _stream(this) { }
+
+          /// Starts a new message.
+          void reset() {
+            setp(_data, _data + sizeof(_data));
+            _stream.clear();
+          }
+
+          /// Gets the message without trailing line terminators.
+          string_view text() const {
+            size_t n = static_cast<size_t>(pptr() - pbase());
+            while(n > 0 && (_data[n - 1] == '\n' || _data[n - 1] == '\r')) {
+              --n;
+            }
+            return string_view(_data, n);
+          }
+
+          /// Gets the stream that formats into the buffer.
+          std::ostream& stream() {
+            return _stream;
+          }
+
+        protected:
+          /// Silently truncates messages that do not fit.
+          int_type overflow(int_type c) override {
+            return traits_type::not_eof(c);
+          }
+
+        private:
+          char _data[512];
+          std::ostream _stream;
+      };
+
+      /**
+       * @brief Number of nested records that format into per-thread buffers. Records nested
+       *        deeper allocate their own.
+       */
+      static const unsigned max_depth = 4;
+
+      /**
+       * @brief Format buffers of a thread, one for each record being formatted.
+       */
+      struct buffers {
+        buffers() : depth(0) { }
+
+        /// Buffer of the record at each nesting depth.
+        buffer levels[max_depth];
+
+        /// Number of records being formatted.
+        unsigned depth;
+      };
+
+      /**
+       * @brief Gets the calling thread's format buffers.
+       */
+      static buffers& local_buffers() {
+        static thread_local buffers b;
+        return b;
+      }
+
+      qlog::logger& _target;
+      log_level _level;
+      async_sink* _sink;
+      std::unique_ptr<buffer> _own;
+      buffer* _buffer;
+  };
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string>
+#include <webby/perfect_hash.hpp>
+#include <webby/utility.hpp>
+
 /**
  * @namespace webby
  */
@@ -21,31 +25,67 @@ namespace webby {
     ALL     = 0xFF  ///< Match any method
   };
 
-  method operator|(method lhs, method rhs) {
+  inline method operator|(method lhs, method rhs) {
     return static_cast<method>(static_cast<int>(lhs) | static_cast<int>(rhs));
   }
 
-  method operator&(method lhs, method rhs) {
+  inline method operator&(method lhs, method rhs) {
     return static_cast<method>(static_cast<int>(lhs) & static_cast<int>(rhs));
   }
 
-  std::string to_string(method m) {
-    std::string str;
-    std::vector<std::string> methods;
-    if(method::CONNECT == (method::CONNECT & m)) methods.push_back("CONNECT");
-    if(method::DELETE  == (method::DELETE  & m)) methods.push_back("DELETE");
-    if(method::GET     == (method::GET     & m)) methods.push_back("GET");
-    if(method::HEAD    == (method::HEAD    & m)) methods.push_back("HEAD");
-    if(method::OPTIONS == (method::OPTIONS & m)) methods.push_back("OPTIONS");
-    if(method::POST    == (method::POST    & m)) methods.push_back("POST");
-    if(method::PUT     == (method::PUT     & m)) methods.push_back("PUT");
-    if(method::TRACE   == (method::TRACE   & m)) methods.push_back("TRACE");
-    for(auto itr = methods.begin(); itr != methods.end(); ++itr) {
-      if(itr != methods.begin()) {
-        str.append(", ");
+  /**
+   * @brief Names of the methods, in the order of their bits.
+   */
+  template<typename T = void>
+  struct method_names {
+    static constexpr const char* values[] = {
+      "CONNECT", "DELETE", "GET", "HEAD", "OPTIONS", "POST", "PUT", "TRACE"
+    };
+  };
+
+  template<typename T>
+  constexpr const char* method_names<T>::values[];
+
+  /**
+   * @brief Formats a mask of methods as the value of an `Allow` header, e.g. `GET, HEAD`.
+   *
+   * The strings for all of the masks are formatted once, the first time one is needed.
+   */
+  inline const std::string& to_string(method m) {
+    struct table {
+      table() {
+        for(unsigned mask = 0; mask < 256; ++mask) {
+          for(unsigned bit = 0; bit < 8; ++bit) {
+            if(mask & (1u << bit)) {
+              if(!allow[mask].empty()) {
+                allow[mask].append(", ");
+              }
+              allow[mask].append(method_names<>::values[bit]);
+            }
+          }
+        }
       }
-      str.append(*itr);
+      std::string allow[256];
+    };
+    static const table t;
+    return t.allow[static_cast<unsigned>(m) & 0xFF];
+  }
+
+  /**
+   * @brief Converts a method name to a webby::method.
+   * @param[in] name Method name. The comparison is case insensitive.
+   * @param[out] m Receives the method.
+   * @returns `false` if the name is not an HTTP 1.1 method.
+   *
+   * The name is found with a perfect hash, so it is compared with one method name at most.
+   */
+  inline bool parse_method(string_view name, method& m) {
+    typedef perfect_hash<method_names<>, 8, 16, 1, 3, 5> hash;
+    const unsigned i = hash::find(name);
+    if(i == hash::none) {
+      return false;
     }
-    return str;
+    m = static_cast<method>(1 << i);
+    return true;
   }
 }
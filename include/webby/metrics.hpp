@@ -0,0 +1,519 @@
+/**
+ * @file metrics.hpp
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief A value that goes up and down, such as the number of open connections.
+   */
+  class gauge {
+    public:
+      gauge() : _value(0) { }
+
+      gauge(const gauge&) = delete;
+      gauge& operator=(const gauge&) = delete;
+
+      /// Adds one to the value.
+      void increment() {
+        _value.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      /// Subtracts one from the value.
+      void decrement() {
+        _value.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      /// Gets the value.
+      long value() const {
+        return _value.load(std::memory_order_relaxed);
+      }
+
+    private:
+      std::atomic<long> _value;
+  };
+
+  /**
+   * @brief Latency histogram with logarithmic buckets, in the manner of HdrHistogram.
+   *
+   * Values are microseconds. Each power of two is split into 16 linear buckets, so every value
+   * is counted in a bucket less than 1/16 (6.25%) wider than the value itself, from 1 µs up to
+   * about nine hours. Recording is a few shifts and one store.
+   *
+   * A histogram is written by one thread only. Other threads may read it at any time; they see
+   * each bucket's count as of some recent moment.
+   */
+  class histogram {
+    public:
+      /**
+       * @brief Number of linear buckets per power of two.
+       */
+      static const unsigned sub_buckets = 16;
+
+      /**
+       * @brief Number of buckets, covering values below 2^35.
+       */
+      static const unsigned buckets = sub_buckets * 32;
+
+      histogram() {
+        for(unsigned i = 0; i < buckets; ++i) {
+          _counts[i].store(0, std::memory_order_relaxed);
+        }
+      }
+
+      histogram(const histogram&) = delete;
+      histogram& operator=(const histogram&) = delete;
+
+      /**
+       * @brief Counts a value. Only the thread that owns the histogram may call this.
+       */
+      void record(uint64_t value) {
+        std::atomic<uint64_t>& c = _counts[index(value)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
+
+      /**
+       * @brief Adds the counts of this histogram to @p counts, which has histogram::buckets
+       *        entries.
+       */
+      void add_to(uint64_t* counts) const {
+        for(unsigned i = 0; i < buckets; ++i) {
+          counts[i] += _counts[i].load(std::memory_order_relaxed);
+        }
+      }
+
+      /**
+       * @brief Gets the bucket a value is counted in.
+       */
+      static unsigned index(uint64_t value) {
+        if(value < sub_buckets) {
+          return static_cast<unsigned>(value);
+        }
+        unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(value));
+        unsigned i = sub_buckets * (msb - 3) + static_cast<unsigned>((value >> (msb - 4)) & 15);
+        return i < buckets ? i : buckets - 1;
+      }
+
+      /**
+       * @brief Gets the largest value counted in a bucket.
+       */
+      static uint64_t highest(unsigned index) {
+        if(index < sub_buckets) {
+          return index;
+        }
+        unsigned shift = index / sub_buckets - 1;
+        uint64_t lowest = static_cast<uint64_t>(sub_buckets + index % sub_buckets) << shift;
+        return lowest + (static_cast<uint64_t>(1) << shift) - 1;
+      }
+
+      /**
+       * @brief Gets a quantile from merged counts.
+       * @param[in] counts Counts of each bucket.
+       * @param[in] total Sum of the counts.
+       * @param[in] q Quantile between `0` and `1`, e.g. `0.999`.
+       * @returns the largest value in the bucket that holds the quantile, or `0` if nothing was
+       *          counted.
+       */
+      static uint64_t quantile(const uint64_t* counts, uint64_t total, double q) {
+        if(total == 0) {
+          return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total) + 0.5);
+        if(rank == 0) {
+          rank = 1;
+        }
+        uint64_t seen = 0;
+        for(unsigned i = 0; i < buckets; ++i) {
+          seen += counts[i];
+          if(seen >= rank) {
+            return highest(i);
+          }
+        }
+        return highest(buckets - 1);
+      }
+
+    private:
+      std::atomic<uint64_t> _counts[buckets];
+  };
+
+  /**
+   * @brief Registry of request counters and latency histograms, by route.
+   *
+   * Every thread that handles requests updates a shard of its own, found through a thread-local
+   * pointer, so recording a request takes no lock and touches no cache line that another thread
+   * writes. Each counter has a single writer; readers merge the shards when the metrics are
+   * scraped. A thread takes a lock only the first time it records a request and the first time
+   * any thread sees a route.
+   *
+   * Routes are interned in the order they are first seen, up to metrics::max_routes; requests
+   * for later routes are counted under the route `"other"`. Requests that matched no route are
+   * counted under `"-"`.
+   */
+  class metrics {
+    public:
+      /**
+       * @brief Maximum number of routes tracked separately.
+       */
+      static const unsigned max_routes = 64;
+
+      metrics() : _id(next_id()), _route_count(0) { }
+
+      metrics(const metrics&) = delete;
+      metrics& operator=(const metrics&) = delete;
+
+      /**
+       * @brief Records a completed request.
+       * @param[in] route Route that handled the request, or an empty string if none did.
+       * @param[in] status Status code of the response.
+       * @param[in] bytes_in Bytes received: the header block and the part of the body read.
+       * @param[in] bytes_out Body bytes sent.
+       * @param[in] micros Time from the end of parsing until the response was sent.
+       */
+      void record(string_view route, unsigned status, uint64_t bytes_in, uint64_t bytes_out,
+                  uint64_t micros) {
+        counters& c = local().route(intern(route));
+        add(c.requests, 1);
+        add(c.status[status >= 100 && status < 600 ? status / 100 - 1 : 4], 1);
+        add(c.bytes_in, bytes_in);
+        add(c.bytes_out, bytes_out);
+        add(c.micros, micros);
+        c.latency.record(micros);
+      }
+
+      /**
+       * @brief Gets the gauge of open connections.
+       */
+      gauge& connections() {
+        return _connections;
+      }
+
+      /**
+       * @brief Gets the gauge of accepted connections waiting for a worker thread.
+       */
+      gauge& queued() {
+        return _queued;
+      }
+
+      /**
+       * @brief Writes all metrics in the Prometheus text exposition format.
+       */
+      void write(std::ostream& out) const {
+        // Merges the shards.
+        const unsigned count = _route_count.load(std::memory_order_acquire);
+        std::vector<merged> routes(count);
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          for(auto& s : _shards) {
+            for(unsigned r = 0; r < count; ++r) {
+              const counters* c = s->routes[r].load(std::memory_order_acquire);
+              if(c != nullptr) {
+                routes[r].add(*c);
+              }
+            }
+          }
+        }
+
+        out << "# HELP webby_requests_total Requests handled.\n"
+            << "# TYPE webby_requests_total counter\n";
+        for(unsigned r = 0; r < count; ++r) {
+          out << "webby_requests_total{route=\"" << label(r) << "\"} " << routes[r].requests
+              << "\n";
+        }
+
+        out << "# HELP webby_responses_total Responses sent, by status class.\n"
+            << "# TYPE webby_responses_total counter\n";
+        for(unsigned r = 0; r < count; ++r) {
+          for(unsigned s = 0; s < 5; ++s) {
+            if(routes[r].status[s] != 0) {
+              out << "webby_responses_total{route=\"" << label(r) << "\",code=\"" << s + 1
+                  << "xx\"} " << routes[r].status[s] << "\n";
+            }
+          }
+        }
+
+        out << "# HELP webby_request_bytes_total Bytes received in request headers and bodies.\n"
+            << "# TYPE webby_request_bytes_total counter\n";
+        for(unsigned r = 0; r < count; ++r) {
+          out << "webby_request_bytes_total{route=\"" << label(r) << "\"} " << routes[r].bytes_in
+              << "\n";
+        }
+
+        out << "# HELP webby_response_bytes_total Bytes sent in response bodies.\n"
+            << "# TYPE webby_response_bytes_total counter\n";
+        for(unsigned r = 0; r < count; ++r) {
+          out << "webby_response_bytes_total{route=\"" << label(r) << "\"} "
+              << routes[r].bytes_out << "\n";
+        }
+
+        static const char* const quantiles[] = { "0.5", "0.9", "0.99", "0.999" };
+        static const double values[] = { 0.5, 0.9, 0.99, 0.999 };
+        out << "# HELP webby_request_duration_seconds Time from parsing a request until its "
+               "response was sent.\n"
+            << "# TYPE webby_request_duration_seconds summary\n";
+        for(unsigned r = 0; r < count; ++r) {
+          const merged& m = routes[r];
+          for(unsigned q = 0; q < 4; ++q) {
+            out << "webby_request_duration_seconds{route=\"" << label(r) << "\",quantile=\""
+                << quantiles[q] << "\"} "
+                << seconds(histogram::quantile(m.latency, m.requests, values[q])) << "\n";
+          }
+          out << "webby_request_duration_seconds_sum{route=\"" << label(r) << "\"} "
+              << seconds(m.micros) << "\n"
+              << "webby_request_duration_seconds_count{route=\"" << label(r) << "\"} "
+              << m.requests << "\n";
+        }
+
+        out << "# HELP webby_connections Open client connections.\n"
+            << "# TYPE webby_connections gauge\n"
+            << "webby_connections " << _connections.value() << "\n"
+            << "# HELP webby_queued_connections Accepted connections waiting for a worker.\n"
+            << "# TYPE webby_queued_connections gauge\n"
+            << "webby_queued_connections " << _queued.value() << "\n";
+      }
+
+    private:
+      /**
+       * @brief Counters of one route in one shard.
+       */
+      struct counters {
+        counters() : requests(0), bytes_in(0), bytes_out(0), micros(0) {
+          for(unsigned i = 0; i < 5; ++i) {
+            status[i].store(0, std::memory_order_relaxed);
+          }
+        }
+
+        std::atomic<uint64_t> requests;
+        std::atomic<uint64_t> status[5];
+        std::atomic<uint64_t> bytes_in;
+        std::atomic<uint64_t> bytes_out;
+        std::atomic<uint64_t> micros;
+        histogram latency;
+      };
+
+      /**
+       * @brief Counters updated by one thread. Each route's counters are allocated the first
+       *        time the thread records a request for it.
+       */
+      struct shard {
+        shard() {
+          for(unsigned i = 0; i < max_routes; ++i) {
+            routes[i].store(nullptr, std::memory_order_relaxed);
+          }
+        }
+
+        ~shard() {
+          for(unsigned i = 0; i < max_routes; ++i) {
+            delete routes[i].load(std::memory_order_relaxed);
+          }
+        }
+
+        /**
+         * @brief Gets the counters of a route, allocating them on first use.
+         */
+        counters& route(unsigned r) {
+          counters* c = routes[r].load(std::memory_order_relaxed);
+          if(c == nullptr) {
+            c = new counters;
+            routes[r].store(c, std::memory_order_release);
+          }
+          return *c;
+        }
+
+        std::thread::id owner;
+        std::atomic<counters*> routes[max_routes];
+      };
+
+      /**
+       * @brief Sum of the counters of one route over all shards.
+       */
+      struct merged {
+        merged() : requests(0), bytes_in(0), bytes_out(0), micros(0) {
+          for(unsigned i = 0; i < 5; ++i) {
+            status[i] = 0;
+          }
+          for(unsigned i = 0; i < histogram::buckets; ++i) {
+            latency[i] = 0;
+          }
+        }
+
+        void add(const counters& c) {
+          requests += c.requests.load(std::memory_order_relaxed);
+          for(unsigned i = 0; i < 5; ++i) {
+            status[i] += c.status[i].load(std::memory_order_relaxed);
+          }
+          bytes_in += c.bytes_in.load(std::memory_order_relaxed);
+          bytes_out += c.bytes_out.load(std::memory_order_relaxed);
+          micros += c.micros.load(std::memory_order_relaxed);
+          c.latency.add_to(latency);
+        }
+
+        uint64_t requests;
+        uint64_t status[5];
+        uint64_t bytes_in;
+        uint64_t bytes_out;
+        uint64_t micros;
+        uint64_t latency[histogram::buckets];
+      };
+
+      /**
+       * @brief Adds to a counter that only the calling thread writes.
+       */
+      static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+      }
+
+      /**
+       * @brief Formats microseconds as seconds.
+       */
+      static std::string seconds(uint64_t micros) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.6f", static_cast<double>(micros) / 1e6);
+        return buffer;
+      }
+
+      /**
+       * @brief Gets the calling thread's shard, creating it the first time.
+       */
+      shard& local() {
+        struct cache {
+          uint64_t owner;
+          shard* s;
+        };
+        static thread_local cache c = { 0, nullptr };
+        if(c.owner == _id) {
+          return *c.s;
+        }
+
+        // Looks the shard up, since a thread may record into more than one registry.
+        std::lock_guard<std::mutex> lock(_mutex);
+        const std::thread::id id = std::this_thread::get_id();
+        for(auto& s : _shards) {
+          if(s->owner == id) {
+            c.owner = _id;
+            c.s = s.get();
+            return *s;
+          }
+        }
+        _shards.push_back(std::unique_ptr<shard>(new shard));
+        _shards.back()->owner = id;
+        c.owner = _id;
+        c.s = _shards.back().get();
+        return *c.s;
+      }
+
+      /**
+       * @brief Gets a number that identifies a registry for as long as the process runs, unlike
+       *        its address.
+       */
+      static uint64_t next_id() {
+        static std::atomic<uint64_t> last(0);
+        return last.fetch_add(1) + 1;
+      }
+
+      /**
+       * @brief Gets the index of a route, adding it the first time it is seen.
+       */
+      unsigned intern(string_view route) {
+        if(route.empty()) {
+          route = "-";
+        }
+        unsigned count = _route_count.load(std::memory_order_acquire);
+        for(unsigned i = 0; i < count; ++i) {
+          if(_routes[i].size() == route.size() && route == _routes[i]) {
+            return i;
+          }
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        count = _route_count.load(std::memory_order_relaxed);
+        for(unsigned i = 0; i < count; ++i) {
+          if(route == _routes[i]) {
+            return i;
+          }
+        }
+        if(count == max_routes - 1) {
+          route = "other";
+          for(unsigned i = 0; i < count; ++i) {
+            if(route == _routes[i]) {
+              return i;
+            }
+          }
+        }
+        else if(count == max_routes) {
+          return max_routes - 1;
+        }
+        _routes[count] = std::string(route);
+        _route_count.store(count + 1, std::memory_order_release);
+        return count;
+      }
+
+      /**
+       * @brief Gets a route as a label value, with `\`, `"` and newlines escaped.
+       */
+      std::string label(unsigned r) const {
+        std::string value;
+        for(char c : _routes[r]) {
+          if(c == '\\' || c == '"') {
+            value += '\\';
+            value += c;
+          }
+          else if(c == '\n') {
+            value += "\\n";
+          }
+          else {
+            value += c;
+          }
+        }
+        return value;
+      }
+
+      /**
+       * @brief Identifies the registry in the thread-local shard cache.
+       */
+      const uint64_t _id;
+
+      /**
+       * @brief Protects the shard list and the addition of routes.
+       */
+      mutable std::mutex _mutex;
+
+      /**
+       * @brief Shards of all threads that have recorded requests.
+       */
+      std::vector<std::unique_ptr<shard>> _shards;
+
+      /**
+       * @brief Interned routes. Entries below metrics::_route_count never change.
+       */
+      std::string _routes[max_routes];
+
+      /**
+       * @brief Number of interned routes.
+       */
+      std::atomic<unsigned> _route_count;
+
+      /**
+       * @brief Open connections.
+       */
+      gauge _connections;
+
+      /**
+       * @brief Connections waiting for a worker.
+       */
+      gauge _queued;
+  };
+}
@@ -0,0 +1,375 @@
+/**
+ * @file parser.hpp
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <webby/scan.hpp>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Incremental parser for the request line and headers of an HTTP request.
+   *
+   * The parser works in place over the connection's receive buffer. It can be fed partial input
+   * any number of times: each call resumes where the previous one stopped and only examines bytes
+   * it has not seen yet. Once the blank line that ends the header block has been parsed, the
+   * request line and the header fields are available as views into the buffer.
+   *
+   * Line ends and the request line delimiters are found with the vectorized kernels in
+   * webby::scan, which also reject control characters that are not allowed in a request.
+   *
+   * Header fields are kept in flat vectors owned by the parser. The parser belongs to the
+   * connection and parser::reset() keeps their capacity, so parsing requests on a persistent
+   * connection does not allocate once the vectors have grown to fit the typical header count.
+   */
+  class parser {
+    public:
+      /**
+       * @brief Result of parser::parse().
+       */
+      enum class status {
+        incomplete, ///< More input is needed.
+        complete,   ///< The header block has been parsed.
+        invalid     ///< The input is not a valid HTTP request.
+      };
+
+      /**
+       * @brief A header field.
+       */
+      struct field {
+        /**
+         * @brief Name of the header, as sent by the client.
+         */
+        string_view name;
+
+        /**
+         * @brief Value of the header without leading and trailing whitespace.
+         */
+        string_view value;
+      };
+
+      /**
+       * @brief Constructs a parser that is ready for the first request.
+       */
+      parser() : _state(state::request_line), _offset(0), _scanned(0), _length(0) {
+        _slots.reserve(16);
+        _fields.reserve(16);
+      }
+
+      /**
+       * @brief Prepares the parser for the next request on the connection.
+       */
+      void reset() {
+        _state = state::request_line;
+        _offset = _scanned = _length = 0;
+        _slots.clear();
+        _fields.clear();
+      }
+
+      /**
+       * @brief Parses as much of a request as is available.
+       * @param[in] data Start of the request in the receive buffer. The buffer may move between
+       *                 calls, but the bytes already passed must be passed again.
+       * @param[in] size Number of bytes available.
+       * @returns the parser status.
+       *
+       * Obsolete line folding is resolved in place by overwriting the line break with spaces, so
+       * @p data must be writable.
+       */
+      status parse(char* data, size_t size) {
+        if(_state == state::complete) {
+          return status::complete;
+        }
+
+        while(_state != state::complete) {
+          const char* lf = scan::find_line_stop(data + _scanned, data + size);
+          if(lf == data + size) {
+            _scanned = size;
+            return status::incomplete;
+          }
+
+          // A CR is only allowed at the end of a line (RFC 9112 section 2.2). One that is not
+          // followed by LF could be read as a line break by another recipient, so that a value
+          // would hide another header from it.
+          const bool cr = *lf == '\r';
+          if(cr) {
+            if(lf + 1 == data + size) {
+              _scanned = static_cast<size_t>(lf - data);
+              return status::incomplete;
+            }
+            ++lf;
+          }
+          if(*lf != '\n') {
+            return status::invalid;
+          }
+
+          const size_t eol = static_cast<size_t>(lf - data);
+          const size_t line_end = cr ? eol - 1 : eol;
+          bool valid = _state == state::request_line ? parse_request_line(data, line_end)
+                                                     : parse_header_line(data, line_end);
+          if(!valid) {
+            return status::invalid;
+          }
+          _offset = _scanned = eol + 1;
+        }
+
+        _length = _offset;
+        for(auto itr = _slots.cbegin(); itr != _slots.cend(); ++itr) {
+          _fields.push_back(field{view(data, itr->name), view(data, itr->value)});
+        }
+        _method = view(data, _method_slot);
+        _target = view(data, _target_slot);
+        _version = view(data, _version_slot);
+        return status::complete;
+      }
+
+      /**
+       * @brief Gets the request method exactly as sent by the client.
+       */
+      string_view method() const {
+        return _method;
+      }
+
+      /**
+       * @brief Gets the request target, e.g. `/path?query` or `http://host/path`.
+       */
+      string_view target() const {
+        return _target;
+      }
+
+      /**
+       * @brief Gets the protocol version without the `HTTP/` prefix, e.g. `1.1`.
+       */
+      string_view version() const {
+        return _version;
+      }
+
+      /**
+       * @brief Gets the header fields in the order they were received.
+       */
+      const std::vector<field>& fields() const {
+        return _fields;
+      }
+
+      /**
+       * @brief Gets the number of bytes in the parsed header block, including the blank line.
+       */
+      size_t length() const {
+        return _length;
+      }
+
+    private:
+      /**
+       * @brief Parser states.
+       */
+      enum class state {
+        request_line, ///< Waiting for the request line.
+        header_line,  ///< Waiting for a header line or the blank line that ends the headers.
+        complete      ///< The header block has been parsed.
+      };
+
+      /**
+       * @brief Location of a field in the buffer relative to the start of the request.
+       */
+      struct slot {
+        uint32_t offset;
+        uint32_t length;
+      };
+
+      /**
+       * @brief Locations of the name and value of a header field.
+       */
+      struct field_slot {
+        slot name;
+        slot value;
+      };
+
+      /**
+       * @brief Creates a view of a slot.
+       */
+      static string_view view(const char* data, slot s) {
+        return string_view(data + s.offset, s.length);
+      }
+
+      /**
+       * @brief Creates a slot for `[first, last)`.
+       */
+      static slot make_slot(size_t first, size_t last) {
+        return slot{static_cast<uint32_t>(first), static_cast<uint32_t>(last - first)};
+      }
+
+      /**
+       * @brief Gets a value that indicates whether @p c may appear in a method or header name.
+       */
+      static bool is_token(char c) {
+        static const char separators[] = "()<>@,;:\\\"/[]?={} \t";
+        return c > 0x20 && c < 0x7f && strchr(separators, c) == nullptr;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether @p c is a decimal digit.
+       */
+      static bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+      }
+
+      /**
+       * @brief Parses "method SP request-target SP HTTP-version".
+       * @param[in] data Start of the request.
+       * @param[in] line_end Offset of the line terminator.
+       * @returns `false` if the line is invalid.
+       */
+      bool parse_request_line(char* data, size_t line_end) {
+        size_t p = _offset;
+
+        // Empty lines before the request line are ignored (RFC 7230 section 3.5).
+        if(p == line_end) {
+          return true;
+        }
+
+        while(p < line_end && is_token(data[p])) {
+          ++p;
+        }
+        if(p == _offset || p == line_end || data[p] != ' ') {
+          return false;
+        }
+        _method_slot = make_slot(_offset, p);
+
+        const size_t target = ++p;
+        p = static_cast<size_t>(scan::find_delimiter(data + p, data + line_end, ' ') - data);
+        if(p == target || p == line_end) {
+          return false;
+        }
+        _target_slot = make_slot(target, p);
+
+        // The version is "HTTP/" DIGIT "." DIGIT. Which versions are supported is decided by the
+        // request.
+        ++p;
+        if(line_end - p != 8 || memcmp(data + p, "HTTP/", 5) != 0 || !is_digit(data[p + 5]) ||
+           data[p + 6] != '.' || !is_digit(data[p + 7])) {
+          return false;
+        }
+        _version_slot = make_slot(p + 5, line_end);
+
+        _state = state::header_line;
+        return true;
+      }
+
+      /**
+       * @brief Parses "field-name ':' OWS field-value OWS", a continuation line, or the blank line
+       *        that ends the header block.
+       * @param[in] data Start of the request.
+       * @param[in] line_end Offset of the line terminator.
+       * @returns `false` if the line is invalid.
+       */
+      bool parse_header_line(char* data, size_t line_end) {
+        size_t p = _offset;
+
+        if(p == line_end) {
+          _state = state::complete;
+          return true;
+        }
+
+        // A line that starts with whitespace continues the previous value (RFC 7230 section
+        // 3.2.4). The line break is replaced with spaces so the value stays contiguous.
+        if(data[p] == ' ' || data[p] == '\t') {
+          if(_slots.empty()) {
+            return false;
+          }
+          slot& value = _slots.back().value;
+          size_t last = trim_right(data, p, line_end);
+          if(last > p) {
+            if(value.length == 0) {
+              value = make_slot(skip_space(data, p, last), last);
+            }
+            else {
+              memset(data + value.offset + value.length, ' ', p - value.offset - value.length);
+              value.length = static_cast<uint32_t>(last - value.offset);
+            }
+          }
+          return true;
+        }
+
+        while(p < line_end && is_token(data[p])) {
+          ++p;
+        }
+        if(p == _offset || p == line_end || data[p] != ':') {
+          return false;
+        }
+        slot name = make_slot(_offset, p);
+
+        size_t first = skip_space(data, p + 1, line_end);
+        size_t last = trim_right(data, first, line_end);
+        _slots.push_back(field_slot{name, make_slot(first, last)});
+        return true;
+      }
+
+      /**
+       * @brief Skips spaces and tabs.
+       * @returns the offset of the first other character in `[first, last)`, or @p last.
+       */
+      static size_t skip_space(const char* data, size_t first, size_t last) {
+        while(first < last && (data[first] == ' ' || data[first] == '\t')) {
+          ++first;
+        }
+        return first;
+      }
+
+      /**
+       * @brief Trims trailing spaces and tabs.
+       * @returns the offset one past the last other character in `[first, last)`.
+       */
+      static size_t trim_right(const char* data, size_t first, size_t last) {
+        while(last > first && (data[last - 1] == ' ' || data[last - 1] == '\t')) {
+          --last;
+        }
+        return last;
+      }
+
+      /**
+       * @brief Current state.
+       */
+      state _state;
+
+      /**
+       * @brief Offset of the start of the next unparsed line.
+       */
+      size_t _offset;
+
+      /**
+       * @brief Offset up to which the input has been searched for a line terminator.
+       */
+      size_t _scanned;
+
+      /**
+       * @brief Length of the complete header block.
+       */
+      size_t _length;
+
+      /**
+       * @brief Locations of the request line fields.
+       */
+      slot _method_slot, _target_slot, _version_slot;
+
+      /**
+       * @brief Locations of the header fields while parsing.
+       */
+      std::vector<field_slot> _slots;
+
+      /**
+       * @brief Request line fields once parsing is complete.
+       */
+      string_view _method, _target, _version;
+
+      /**
+       * @brief Header fields once parsing is complete.
+       */
+      std::vector<field> _fields;
+  };
+}
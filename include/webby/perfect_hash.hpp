@@ -0,0 +1,122 @@
+/**
+ * @file perfect_hash.hpp
+ */
+#pragma once
+
+#include <stddef.h>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief List of slot indices, used to build a webby::perfect_hash table at compile time.
+   */
+  template<unsigned... I> struct slot_indices { };
+
+  /**
+   * @brief Generates the slot indices from `0` to `N - 1`.
+   */
+  template<unsigned N, unsigned... I>
+  struct make_slot_indices : make_slot_indices<N - 1, N - 1, I...> { };
+
+  template<unsigned... I>
+  struct make_slot_indices<0, I...> {
+    typedef slot_indices<I...> type;
+  };
+
+  /**
+   * @brief Slot table of a webby::perfect_hash. Each slot holds the index of the name that hashes
+   *        to it, or the number of names if none does.
+   */
+  template<typename Hash, typename Indices> struct perfect_hash_table;
+
+  template<typename Hash, unsigned... I>
+  struct perfect_hash_table<Hash, slot_indices<I...>> {
+    static const unsigned char slots[sizeof...(I)];
+  };
+
+  template<typename Hash, unsigned... I>
+  const unsigned char perfect_hash_table<Hash, slot_indices<I...>>::slots[sizeof...(I)] = {
+    Hash::slot(I, 0)...
+  };
+
+  /**
+   * @brief Perfect hash over a fixed set of names that are compared without regard to case.
+   * @tparam Names Class with a `static constexpr const char* values[]` member listing the names.
+   * @tparam Count Number of names, less than 255.
+   * @tparam Size Number of slots, a power of two.
+   * @tparam A Weight of the length of a name in its hash.
+   * @tparam B Weight of the first character.
+   * @tparam C Weight of the last character.
+   *
+   * The weights are chosen so that no two names hash to the same slot, which is checked at
+   * compile time, and the slot table is generated at compile time too. Finding a name costs one
+   * hash and at most one comparison.
+   */
+  template<typename Names, unsigned Count, unsigned Size, unsigned A, unsigned B, unsigned C>
+  class perfect_hash {
+    public:
+      /**
+       * @brief Index returned for names that are not in the set.
+       */
+      static const unsigned none = Count;
+
+      /**
+       * @brief Finds a name.
+       * @returns the index of the name in `Names::values`, or perfect_hash::none.
+       */
+      static unsigned find(string_view name) {
+        static_assert(perfect(0), "The names do not hash to distinct slots");
+        if(name.empty()) {
+          return none;
+        }
+        typedef perfect_hash_table<perfect_hash, typename make_slot_indices<Size>::type> table;
+        const unsigned i = table::slots[hash(name.data(), name.size())];
+        return i != none && iequals(name, Names::values[i]) ? i : none;
+      }
+
+      /**
+       * @brief Gets the index of the name that hashes to a slot, starting the search at name
+       *        @p i.
+       * @returns the index, or perfect_hash::none.
+       */
+      static constexpr unsigned slot(unsigned h, unsigned i) {
+        return i == Count ? none : hash(Names::values[i]) == h ? i : slot(h, i + 1);
+      }
+
+    private:
+      static constexpr unsigned lower(char c) {
+        return static_cast<unsigned char>(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+      }
+
+      static constexpr unsigned length(const char* s) {
+        return *s == '\0' ? 0 : 1 + length(s + 1);
+      }
+
+      static constexpr unsigned hash(const char* s, size_t n) {
+        return (static_cast<unsigned>(n) * A + lower(s[0]) * B + lower(s[n - 1]) * C) &
+               (Size - 1);
+      }
+
+      static constexpr unsigned hash(const char* s) {
+        return hash(s, length(s));
+      }
+
+      /**
+       * @brief Gets a value that indicates whether name @p i hashes to a different slot than the
+       *        names from @p j on.
+       */
+      static constexpr bool unique(unsigned i, unsigned j) {
+        return j == Count || (hash(Names::values[i]) != hash(Names::values[j]) && unique(i, j + 1));
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the names from @p i on hash to distinct slots.
+       */
+      static constexpr bool perfect(unsigned i) {
+        return i == Count || (unique(i, i + 1) && perfect(i + 1));
+      }
+  };
+}
@@ -0,0 +1,99 @@
+/**
+ * @file queue.hpp
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Thread-safe FIFO queue used to hand work from one thread to another.
+   *
+   * Consumers block in queue::pop() until an item is available or the queue has been closed.
+   */
+  template<typename T> class queue {
+    public:
+      /**
+       * @brief Constructs an empty, open queue.
+       */
+      queue() : _closed(false) { }
+
+      /**
+       * @brief Adds an item to the back of the queue and wakes one waiting consumer.
+       * @param[in] item Item to add. It is moved into the queue.
+       * @returns `false` if the queue has been closed and the item was not added; otherwise `true`.
+       */
+      bool push(T&& item) {
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          if(_closed) {
+            return false;
+          }
+          _items.push_back(std::move(item));
+        }
+        _ready.notify_one();
+        return true;
+      }
+
+      /**
+       * @brief Removes the item at the front of the queue, blocking until one is available.
+       * @param[out] item Receives the item.
+       * @returns `false` if the queue was closed and drained; otherwise `true`.
+       */
+      bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _ready.wait(lock, [this] { return _closed || !_items.empty(); });
+        if(_items.empty()) {
+          return false;
+        }
+        item = std::move(_items.front());
+        _items.pop_front();
+        return true;
+      }
+
+      /**
+       * @brief Closes the queue. Items already queued are still returned by queue::pop().
+       */
+      void close() {
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _closed = true;
+        }
+        _ready.notify_all();
+      }
+
+      /**
+       * @brief Gets the number of items waiting in the queue.
+       */
+      size_t size() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _items.size();
+      }
+
+    private:
+      /**
+       * @brief Protects the queue state.
+       */
+      mutable std::mutex _mutex;
+
+      /**
+       * @brief Signalled when an item is added or the queue is closed.
+       */
+      std::condition_variable _ready;
+
+      /**
+       * @brief Queued items.
+       */
+      std::deque<T> _items;
+
+      /**
+       * @brief `true` once queue::close() has been called.
+       */
+      bool _closed;
+  };
+}
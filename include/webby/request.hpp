@@ -4,15 +4,24 @@
 
 #pragma once
 
-#include <map>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+#include <webby/connection.hpp>
+#include <webby/known_header.hpp>
 #include <webby/method.hpp>
+#include <webby/parser.hpp>
 #include <webby/utility.hpp>
 
 /**
  * @namespace webby
  */
 namespace webby {
-  // Forward reference.
+  // Forward references.
+  class router;
   class server;
 
   /**
@@ -38,14 +47,75 @@ namespace webby {
           explicit error(const char* what_arg) : runtime_error(what_arg) { }
       };
 
+      /**
+       * @brief Reports a request body larger than config::max_body_size().
+       */
+      class body_too_large : public error {
+        public:
+          /**
+           * @brief Constructs the `request::body_too_large` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit body_too_large(const std::string& what_arg) : error(what_arg) { }
+
+          /**
+           * @brief Constructs the `request::body_too_large` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit body_too_large(const char* what_arg) : error(what_arg) { }
+      };
+
+      /**
+       * @brief Reports a request with an HTTP version other than 1.x.
+       */
+      class unsupported_version : public error {
+        public:
+          /**
+           * @brief Constructs the `request::unsupported_version` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit unsupported_version(const std::string& what_arg) : error(what_arg) { }
+
+          /**
+           * @brief Constructs the `request::unsupported_version` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit unsupported_version(const char* what_arg) : error(what_arg) { }
+      };
+
+      /**
+       * @brief A path parameter captured by a route such as `/users/:id`.
+       */
+      struct parameter {
+        /**
+         * @brief Name of the parameter without the leading `:`.
+         */
+        string_view name;
+
+        /**
+         * @brief Path segment that matched the parameter.
+         */
+        string_view value;
+      };
+
+      /**
+       * @brief Maximum number of path parameters captured for one request.
+       */
+      static const unsigned max_params = 8;
+
       /**
        * @brief Gets a header value.
-       * @param[in] name Name of the header.
-       * @returns The value of the header.
+       * @param[in] name Name of the header. The name is case insensitive.
+       * @returns A view of the value of the header. It is valid for the lifetime of the request.
+       * @throws std::out_of_range if the header is not defined.
        */
-      const std::string& header(const std::string& name) {
-        _config.error_log() << qlog::debug << "request::header()" << std::endl;
-        return _header.at(name);
+      string_view header(string_view name) const {
+        WEBBY_LOG(_config, debug) << "request::header()";
+        const parser::field* f = find_header(name);
+        if(f == nullptr) {
+          throw std::out_of_range("request::header");
+        }
+        return f->value;
       }
 
       /**
@@ -53,16 +123,47 @@ namespace webby {
        * @param[in] name Name of the header to check.
        * @returns `true` if the header exists; otherwise `false`.
        */
-      bool has_header(const std::string& name) {
-        _config.error_log() << qlog::debug << "request::has_header()" << std::endl;
-        return _header.count(name) == 1;
+      bool has_header(string_view name) const {
+        WEBBY_LOG(_config, debug) << "request::has_header()";
+        return find_header(name) != nullptr;
+      }
+
+      /**
+       * @brief Gets the value of a well-known header.
+       * @param[in] name The header.
+       * @returns A view of the value of the header. It is valid for the lifetime of the request.
+       * @throws std::out_of_range if the header is not defined.
+       *
+       * Known headers are indexed when the request is received, so this costs no search.
+       */
+      string_view header(known_header name) const {
+        const parser::field* f = find_header(name);
+        if(f == nullptr) {
+          throw std::out_of_range("request::header");
+        }
+        return f->value;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a well-known header is defined.
+       * @param[in] name The header.
+       */
+      bool has_header(known_header name) const {
+        return find_header(name) != nullptr;
+      }
+
+      /**
+       * @brief Gets all of the header fields in the order they were received.
+       */
+      const std::vector<parser::field>& headers() const {
+        return *_fields;
       }
 
       /**
        * @brief Gets the request method, e.g. @c GET/POST/HEAD etc.
        */
       webby::method method() const {
-        _config.error_log() << qlog::debug << "request::method()" << std::endl;
+        WEBBY_LOG(_config, debug) << "request::method()";
         return _method;
       }
 
@@ -71,11 +172,31 @@ namespace webby {
        *
        * This is in the form @c /path/of/request
        */
-      const std::string& path() const {
-        _config.error_log() << qlog::debug << "request::path()" << std::endl;
+      string_view path() const {
+        WEBBY_LOG(_config, debug) << "request::path()";
         return _path;
       }
 
+      /**
+       * @brief Reads the next block of the request body.
+       * @param[in] buffer Buffer that receives the data.
+       * @param[in] length Length of the buffer.
+       * @returns the number of bytes read, or `0` once the whole body has been read.
+       * @throws webby::request::error if the body is malformed or the connection closed before it
+       *         was complete.
+       * @throws webby::request::body_too_large if the body exceeds config::max_body_size().
+       *
+       * The body is decoded from the framing the client chose, so a chunked body is returned
+       * without its chunk sizes and trailers. It is read incrementally: a handler can stream an
+       * upload of any size into a file or a parser, one buffer at a time. If the client sent
+       * `Expect: 100-continue`, the interim `100 Continue` response is sent by the first read.
+       * Handlers should therefore read the body before they start sending the response.
+       */
+      size_t read_body(char* buffer, size_t length) const {
+        WEBBY_LOG(_config, debug) << "request::read_body()";
+        return read_body(buffer, length, false);
+      }
+
       /**
        * @brief Reads a block of data from the body of the request.
        * @param[in] buffer Buffer that receives the data.
@@ -83,23 +204,110 @@ namespace webby {
        * @param[in] peek   @c false to perform a normal read, @c true to read the data from the
        *                   request without removing it from the input queue.
        * @returns The number of bytes actually read from the request.
+       *
+       * This is request::read_body() with the ability to peek. A peek into a chunked body returns
+       * data from the current chunk only.
        */
       unsigned read_block(char* buffer, const size_t length, const bool peek = false) const {
-        _config.error_log() << qlog::debug << "request::read_block()" << std::endl;
-        return _worker.read(buffer, length, peek);
+        WEBBY_LOG(_config, debug) << "request::read_block()";
+        return static_cast<unsigned>(read_body(buffer, length, peek));
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the request has a body.
+       */
+      bool has_body() const {
+        return _chunked || _content_length > 0;
+      }
+
+      /**
+       * @brief Gets the length of the body announced by the `Content-Length` header.
+       * @returns the length, or `0` if the request has no body or its body is chunked.
+       */
+      unsigned long content_length() const {
+        return _content_length;
+      }
+
+      /**
+       * @brief Gets the HTTP version of the request, e.g. @c 1.1
+       */
+      string_view version() const {
+        WEBBY_LOG(_config, debug) << "request::version()";
+        return _version;
       }
 
-      const std::string& route() const {
-        _config.error_log() << qlog::debug << "request::route()" << std::endl;
+      /**
+       * @brief Gets a value that indicates whether the request was received over TLS.
+       */
+      bool secure() const {
+        return _config.tls();
+      }
+
+      /**
+       * @brief Gets the route that caused this request to be invoked.
+       */
+      string_view route() const {
+        WEBBY_LOG(_config, debug) << "request::route()";
         return _route;
       }
 
+      /**
+       * @brief Gets the path the matching route was registered with, e.g. `/users/:id`.
+       * @returns the pattern, or an empty string if no route matched the request.
+       *
+       * Unlike request::route(), this does not depend on the values of path parameters, so it is
+       * suitable for grouping requests in logs and metrics.
+       */
+      string_view route_pattern() const {
+        return _pattern;
+      }
+
+      /**
+       * @brief Gets a path parameter captured by the route.
+       * @param[in] name Name of the parameter, e.g. `id` for the route `/items/:id`.
+       * @returns A view of the path segment that matched the parameter, or an empty view if the
+       *          route has no such parameter.
+       */
+      string_view param(string_view name) const {
+        for(unsigned i = 0; i < _param_count; ++i) {
+          if(_params[i].name == name) {
+            return _params[i].value;
+          }
+        }
+        return string_view();
+      }
+
+      /**
+       * @brief Gets a path parameter captured by the route as an integer.
+       * @param[in] name Name of the parameter, e.g. `id` for the route `/items/:id`.
+       * @returns the value of the parameter.
+       * @throws webby::request::error if the route has no such parameter, or if its value is not a
+       *         decimal integer that fits in @p T. The server answers it with a 400.
+       *
+       * The value is parsed in place, so nothing is allocated.
+       */
+      template<typename T>
+      T param(string_view name) const {
+        static_assert(std::is_integral<T>::value, "Path parameters are parsed as integers");
+        string_view value = param(name);
+        const bool negative = std::is_signed<T>::value && !value.empty() && value[0] == '-';
+        unsigned long magnitude = 0;
+        const unsigned long limit = static_cast<unsigned long>(std::numeric_limits<T>::max()) +
+                                    (negative ? 1 : 0);
+        if(value.size() == (negative ? 1u : 0u) ||
+           !parse_number(negative ? value.substr(1) : value, magnitude) || magnitude > limit) {
+          throw request::error("Invalid path parameter");
+        }
+        return negative ? static_cast<T>(-static_cast<T>(magnitude - 1) - 1)
+                        : static_cast<T>(magnitude);
+      }
+
       /**
        * @brief Sets the route that caused this request to be invoked.
        * @param[in] route Route that caused this request to be invoked.
        * @returns Reference to this webby::response object for chaining.
        */
-      request& set_route(const std::string& route) {
+      request& set_route(string_view route) {
         _route = route;
         return *this;
       }
@@ -107,172 +315,393 @@ namespace webby {
     protected:
 
       /**
-       * @brief Constructs a new webby::request object from a @p worker socket.
-       * @param[in] worker Worker socket used to communicate with the connected host.
+       * @brief Constructs a new webby::request object from a @p connection.
+       * @param[in] config Server configuration.
+       * @param[in] connection Connection to the host that sent the request.
+       * @throws webby::request::error if the request was not valid.
+       * @throws webby::request::unsupported_version if its major version is not 1.
        */
-      request(const webby::config& config, const net::worker& worker) :
-            _config(config), _worker(worker) {
-        _config.error_log() << qlog::debug << "request::request()" << std::endl;
-        process_request_line();
+      request(const webby::config& config, webby::connection& connection) :
+            _config(config), _connection(connection),
+            _fields(&connection.request_header().fields()), _param_count(0), _content_length(0),
+            _body_remaining(0), _body_read(0), _buffered_body(nullptr),
+            _body_state(body_state::done), _chunked(false), _expect_continue(false),
+            _continued(false) {
+        WEBBY_LOG(_config, debug) << "request::request()";
+        parser::status status = _connection.read_header();
+        if(status == parser::status::incomplete) {
+          throw request::error("Connection closed before the request was complete");
+        }
+        if(status == parser::status::invalid) {
+          throw request::error("Invalid request");
+        }
+        const parser& p = _connection.request_header();
+        if(p.version()[0] != '1') {
+          std::ostringstream msg;
+          msg << "Unsupported HTTP version: " << p.version();
+          throw request::unsupported_version(msg.str());
+        }
+        process_request_line(p.method(), p.target(), p.version());
+        index_headers();
         process_header_lines();
+        // An event loop that buffered the body has already let the client send it.
+        _continued = _connection.continued();
+      }
+
+      /**
+       * @brief Constructs a new webby::request object from a request that has already been
+       *        received in full, such as an HTTP/2 stream.
+       * @param[in] config Server configuration.
+       * @param[in] connection Connection to the host that sent the request.
+       * @param[in] fields Header fields. They must outlive the request.
+       * @param[in] method Request method.
+       * @param[in] target Request target.
+       * @param[in] body Request body. It must outlive the request.
+       * @throws webby::request::error if the request was not valid.
+       */
+      request(const webby::config& config, webby::connection& connection,
+              const std::vector<parser::field>& fields, string_view method, string_view target,
+              string_view body) :
+            _config(config), _connection(connection), _fields(&fields), _param_count(0),
+            _content_length(body.size()), _body_remaining(body.size()), _body_read(0),
+            _buffered_body(body.data()),
+            _body_state(body.empty() ? body_state::done : body_state::data), _chunked(false),
+            _expect_continue(false), _continued(false) {
+        WEBBY_LOG(_config, debug) << "request::request()";
+        process_request_line(method, target, "2.0");
+        index_headers();
       }
 
       /**
        * @brief Extracts the method and path from the first line of the request.
+       * @param[in] method Method as sent by the client.
+       * @param[in] request_target Target as sent by the client.
+       * @param[in] version Protocol version without the `HTTP/` prefix.
        * @throws webby::request::error if the request line was not valid.
        *
        * The first line of an HTTP request contains the method, path, and protocol in the following
-       * format: "method [host[:port]]path HTTP/1.[0|1]"
+       * format: "method [scheme://host[:port]]path HTTP/1.[0|1]"
        */
-      void process_request_line() {
-        _config.error_log() << qlog::debug << "request::process_request_line()" << std::endl;
-        std::string request_line = _worker.read_line();
-        std::string::const_iterator first = request_line.cbegin();
-        std::string::const_iterator last = request_line.cbegin();
-
-        // Finds the space that separates the method from the path.
-        while(last != request_line.cend() && *last != ' ') {
-          ++last;
-        }
+      void process_request_line(string_view method, string_view request_target,
+                                string_view version) {
+        WEBBY_LOG(_config, debug) << "request::process_request_line()";
 
-        // Throws an exception if the method could not be found.
-        if(last == request_line.cend()) {
+        // Stores the method.
+        if(!parse_method(method, _method)) {
           std::ostringstream msg;
-          msg << "Invalid request line: " << request_line;
+          msg << "Invalid request method: " << method;
           throw request::error(msg.str());
         }
+        WEBBY_LOG(_config, debug) << "  Request Method: " << method;
 
-        // Stores the method.
-        std::string m = lowercase(std::string(first, last));
-        first = last;
-
-        if(m == "connect") {
-          _method = method::CONNECT;
-        }
-        else if(m == "delete") {
-          _method = method::DELETE;
+        // Strips the scheme and authority from an absolute request target.
+        string_view target = request_target;
+        if(target.empty()) {
+          throw request::error("Empty request target");
         }
-        else if(m == "get") {
-          _method = method::GET;
+        if(target[0] != '/') {
+          size_t scheme = target.find(':');
+          if(scheme == string_view::npos || target.substr(scheme).compare(0, 3, "://") != 0) {
+            std::ostringstream msg;
+            msg << "Invalid request target: " << target;
+            throw request::error(msg.str());
+          }
+          size_t first = target.find('/', scheme + 3);
+          target = first == string_view::npos ? string_view("/") : target.substr(first);
         }
-        else if(m == "head") {
-          _method = method::HEAD;
+
+        // Saves the path.
+        _path = target;
+        WEBBY_LOG(_config, debug) << "  Request Path: " << _path;
+
+        // Saves the protocol version.
+        _version = version;
+        WEBBY_LOG(_config, debug) << "  Request Version: " << _version;
+      }
+
+      /**
+       * @brief Determines how the request body is framed from the request headers.
+       * @throws webby::request::error if the `Content-Length` headers are not valid or do not
+       *         agree, if `Transfer-Encoding` is repeated or unsupported, or if both are present.
+       *         The server answers with a 400 and closes the connection.
+       *
+       * The headers have been parsed by the connection's webby::parser. Names are case
+       * insensitive, and values split over several lines have already been joined.
+       */
+      void process_header_lines() {
+        WEBBY_LOG(_config, debug) << "request::process_header_lines()";
+        if(WEBBY_LOG_ENABLED(_config, debug)) {
+          for(auto itr = headers().cbegin(); itr != headers().cend(); ++itr) {
+            WEBBY_LOG(_config, debug) << "  " << itr->name << ": " << itr->value;
+          }
         }
-        else if(m == "options") {
-          _method = method::OPTIONS;
+
+        // Determines how the body is framed. A request that frames its body in more than one way
+        // is rejected rather than guessed at: a proxy in front of the server may have read it
+        // differently, and the rest of the connection would then be taken for other requests
+        // (RFC 9112 section 6.3).
+        const parser::field* te = nullptr;
+        const parser::field* cl = nullptr;
+        for(auto itr = headers().cbegin(); itr != headers().cend(); ++itr) {
+          const known_header known = find_known_header(itr->name);
+          if(known == known_header::transfer_encoding) {
+            if(te != nullptr) {
+              throw request::error("Repeated Transfer-Encoding");
+            }
+            te = &*itr;
+          }
+          else if(known == known_header::content_length) {
+            unsigned long length = 0;
+            if(itr->value.empty() || !parse_number(itr->value, length) ||
+               (cl != nullptr && length != _content_length)) {
+              std::ostringstream msg;
+              msg << "Invalid Content-Length: " << itr->value;
+              throw request::error(msg.str());
+            }
+            cl = &*itr;
+            _content_length = length;
+          }
         }
-        else if(m == "post") {
-          _method = method::POST;
+        if(te != nullptr && cl != nullptr) {
+          throw request::error("Request has both Transfer-Encoding and Content-Length");
         }
-        else if(m == "put") {
-          _method = method::PUT;
+
+        if(te != nullptr && !iequals(te->value, "identity")) {
+          if(!iequals(te->value, "chunked")) {
+            std::ostringstream msg;
+            msg << "Unsupported Transfer-Encoding: " << te->value;
+            throw request::error(msg.str());
+          }
+          _chunked = true;
+          _body_state = body_state::size;
         }
-        else if(m == "trace") {
-          _method = method::TRACE;
+        else if(cl != nullptr) {
+          if(_config.max_body_size() != 0 && _content_length > _config.max_body_size()) {
+            std::ostringstream msg;
+            msg << "Request body of " << _content_length << " bytes exceeds the limit of "
+                << _config.max_body_size();
+            throw request::body_too_large(msg.str());
+          }
+          _body_remaining = _content_length;
+          _body_state = _content_length > 0 ? body_state::data : body_state::done;
         }
 
-        _config.error_log() << qlog::debug << "  Request Method: " << m << std::endl;
+        // Notes whether the client waits for permission before sending the body.
+        const parser::field* expect = find_header(known_header::expect);
+        _expect_continue = expect != nullptr && has_body() && _version != "1.0" &&
+                           iequals(expect->value, "100-continue");
+      }
 
-        // Finds the first "/" character in the path.
-        while(first != request_line.cend() && *first != '/') {
-          ++first;
+      /**
+       * @brief Finds a header field by name.
+       * @param[in] name Case insensitive name of the header.
+       * @returns the first field with that name, or `nullptr` if there is none.
+       */
+      const parser::field* find_header(string_view name) const {
+        const known_header known = find_known_header(name);
+        if(known != known_header::none) {
+          return find_header(known);
         }
-
-        // Throws an exception if the beginning of the path could not be found.
-        if(first == request_line.cend()) {
-          std::ostringstream msg;
-          msg << "Invalid request line: " << request_line;
-          throw request::error(msg.str());
+        for(auto itr = headers().cbegin(); itr != headers().cend(); ++itr) {
+          if(iequals(itr->name, name)) {
+            return &*itr;
+          }
         }
+        return nullptr;
+      }
 
-        last = first;
+      /**
+       * @brief Finds a well-known header field.
+       * @returns the first field with that name, or `nullptr` if there is none.
+       */
+      const parser::field* find_header(known_header name) const {
+        return _known[static_cast<unsigned>(name)];
+      }
 
-        // Finds the space that separates the path from the protocol.
-        while(last != request_line.cend() && *last != ' ') {
-          ++last;
+      /**
+       * @brief Indexes the first field of each well-known header.
+       */
+      void index_headers() {
+        memset(_known, 0, sizeof(_known));
+        for(auto itr = headers().cbegin(); itr != headers().cend(); ++itr) {
+          const known_header known = find_known_header(itr->name);
+          if(known != known_header::none && _known[static_cast<unsigned>(known)] == nullptr) {
+            _known[static_cast<unsigned>(known)] = &*itr;
+          }
         }
+      }
 
-        // Throws an exception if the path could not be found.
-        if(last == request_line.cend()) {
-          std::ostringstream msg;
-          msg << "Invalid request line: " << request_line;
-          throw request::error(msg.str());
+      /**
+       * @brief Gets a value that indicates whether the client asked to keep the connection open.
+       *
+       * HTTP/1.1 connections are persistent unless the client sends `Connection: close`, while
+       * HTTP/1.0 connections are closed unless the client sends `Connection: keep-alive`.
+       */
+      bool keep_alive() const {
+        const parser::field* f = find_header(known_header::connection);
+        string_view value = f == nullptr ? string_view() : f->value;
+        if(_version == "1.0") {
+          return contains_token(value, "keep-alive");
         }
-
-        // Saves the path.
-        _path = std::string(first, last);
-        _config.error_log() << qlog::debug << "  Request Path: " << _path << std::endl;
+        return !contains_token(value, "close");
       }
 
       /**
-       * @brief Extracts headers from the request
-       *
-       * Each header has the format, "header-name: value". The name is case insensitive. The line
-       * is terminated with a CRLF. It is possible to split a long value over multiple lines by
-       * terminating each line with a comma. For example, the following two headers are identical:
+       * @brief Discards any part of the body that the handler did not read.
+       * @returns `true` if the connection is positioned at the start of the next request; `false`
+       *          if the body could not be skipped and the connection must be closed.
        *
-       *     header1: value 1, value 2
-       *     HEADER1: value 1,
-       *              value 2
-       *
-       * The headers appear immediately after the HTTP request line, and are separated from the
-       * request body by a blank line that is terminated with a CRLF.
-       *
-       * NOTE: Invalid headers (those that could not be parsed properly) are ignored rather than
-       * throwing exceptions as this does not affect the server itself, only request handlers.
+       * A client that is still waiting for `100 Continue` has not sent its body and may never do
+       * so, so its connection is closed rather than drained.
        */
-      void process_header_lines() {
-        _config.error_log() << qlog::debug << "request::process_header_lines()" << std::endl;
-        std::string header_line = _worker.read_line();
-        std::string name;
+      bool discard_body() {
+        if(_body_state == body_state::done) {
+          return true;
+        }
+        if(_expect_continue && !_continued) {
+          return false;
+        }
+        try {
+          char buffer[connection::block_size];
+          while(read_body(buffer, sizeof(buffer), false) > 0) { }
+          return true;
+        }
+        catch(const std::exception&) {
+          return false;
+        }
+      }
 
-        // The request headers are separated from the request body by a blank line.
-        while(header_line.length() > 0) {
-          std::string::const_iterator itr = header_line.cbegin();
+      /**
+       * @brief Reads or peeks at the next block of the body, decoding its framing.
+       */
+      size_t read_body(char* buffer, size_t length, bool peek) const {
+        if(_expect_continue && !_continued) {
+          static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+          _continued = true;
+          _connection.write(interim, sizeof(interim) - 1);
+        }
+        if(_chunked) {
+          next_chunk();
+        }
+        if(_body_state != body_state::data || length == 0) {
+          return 0;
+        }
 
-          // Skips past whitespace at the beginning of the line.
-          while(itr != header_line.cend() && *itr == ' ') {
-            ++itr;
+        // Never reads past the end of the body or the current chunk, because on a persistent
+        // connection the bytes that follow belong to the next request.
+        size_t n = static_cast<size_t>(std::min<unsigned long>(length, _body_remaining));
+        if(_buffered_body != nullptr) {
+          memcpy(buffer, _buffered_body + _body_read, n);
+        }
+        else {
+          n = _connection.read(buffer, n, peek);
+        }
+        if(n == 0) {
+          throw request::error("Connection closed before the request body was complete");
+        }
+        if(!peek) {
+          _body_remaining -= n;
+          _body_read += n;
+          if(_chunked && _config.max_body_size() != 0 && _body_read > _config.max_body_size()) {
+            _body_state = body_state::done;
+            throw request::body_too_large("Chunked request body exceeds the size limit");
           }
-
-          // Removes the whitespace.
-          header_line = std::string(itr, header_line.cend());
-          itr = header_line.cbegin();
-
-          // If the value of the previous header ends in a comma, then this entire line is
-          // appended to that value.
-          if(name.length() > 0 && *(_header[name].crend()) == ',') {
-            _header[name] = _header[name] + std::string(" ") + header_line;
+          if(_body_remaining == 0) {
+            _body_state = _chunked ? body_state::data_end : body_state::done;
           }
+        }
+        return n;
+      }
 
-          else {
-            // Search for the colon that separates the name from the value.
-            while(itr != header_line.cend() && *itr != ':') {
-              ++itr;
+      /**
+       * @brief Reads chunk framing until the start of chunk data or the end of the body.
+       * @throws webby::request::error if the framing is invalid.
+       */
+      void next_chunk() const {
+        char line[256];
+        while(_body_state != body_state::data && _body_state != body_state::done) {
+          size_t n = read_line(line, sizeof(line));
+          switch(_body_state) {
+            case body_state::size: {
+              // Parses the hexadecimal size, ignoring any chunk extensions.
+              unsigned long size = 0;
+              size_t i = 0;
+              for(; i < n; ++i) {
+                int digit = hex_digit(line[i]);
+                if(digit < 0) {
+                  break;
+                }
+                if(size > (static_cast<unsigned long>(-1) >> 4)) {
+                  throw request::error("Chunk size overflows");
+                }
+                size = (size << 4) | static_cast<unsigned long>(digit);
+              }
+              if(i == 0 || (i < n && line[i] != ';' && line[i] != ' ' && line[i] != '\t')) {
+                throw request::error("Invalid chunk size");
+              }
+              _body_remaining = size;
+              _body_state = size > 0 ? body_state::data : body_state::trailer;
+              break;
             }
-
-            if(itr != header_line.cend()) {
-              // Saves the name of the header.
-              name = std::string(header_line.cbegin(), itr);
-
-              // Finds the value.
-              ++itr;
-              while(itr != header_line.cend() && *itr == ' ') {
-                ++itr;
+            case body_state::data_end:
+              if(n != 0) {
+                throw request::error("Chunk data is longer than its size");
               }
+              _body_state = body_state::size;
+              break;
+            case body_state::trailer:
+              // Trailer fields are ignored; an empty line ends the body.
+              if(n == 0) {
+                _body_state = body_state::done;
+              }
+              break;
+            default:
+              break;
+          }
+        }
+      }
 
-              // Saves the key and the value in the map
-              _header[name] = std::string(itr, header_line.cend());
+      /**
+       * @brief Reads one line of chunk framing.
+       * @param[out] line Receives the line without its terminator.
+       * @param[in] size Size of @p line.
+       * @returns the length of the line.
+       * @throws webby::request::error if the line is too long or the connection closed.
+       */
+      size_t read_line(char* line, size_t size) const {
+        size_t n = 0;
+        while(1) {
+          char c;
+          if(_connection.read(&c, 1) == 0) {
+            throw request::error("Connection closed before the request body was complete");
+          }
+          if(c == '\n') {
+            if(n > 0 && line[n - 1] == '\r') {
+              --n;
             }
+            return n;
           }
-
-          header_line = _worker.read_line();
+          if(n == size) {
+            throw request::error("Chunk framing line is too long");
+          }
+          line[n++] = c;
         }
+      }
 
-        for(auto itr = _header.cbegin(); itr != _header.cend(); ++itr) {
-          _config.error_log() << qlog::debug << "  " << (*itr).first << ": " << (*itr).second <<
-              std::endl;
+      /**
+       * @brief Converts a hexadecimal digit to its value, or `-1` if it is not one.
+       */
+      static int hex_digit(char c) {
+        if(c >= '0' && c <= '9') {
+          return c - '0';
         }
+        if(c >= 'a' && c <= 'f') {
+          return c - 'a' + 10;
+        }
+        if(c >= 'A' && c <= 'F') {
+          return c - 'A' + 10;
+        }
+        return -1;
       }
 
     // Fields.
@@ -283,9 +712,14 @@ namespace webby {
       const webby::config& _config;
 
       /**
-       * @brief Worker socket.
+       * @brief Connection to the host that sent the request.
        */
-      const net::worker& _worker;
+      webby::connection& _connection;
+
+      /**
+       * @brief Header fields, held by the connection's parser or by an HTTP/2 stream.
+       */
+      const std::vector<parser::field>* _fields;
 
       /**
        * @brief Request method.
@@ -295,19 +729,88 @@ namespace webby {
       /**
        * @brief Path of the request.
        */
-      std::string _path;
+      string_view _path;
+
+      /**
+       * @brief HTTP version of the request.
+       */
+      string_view _version;
 
       /**
        * @brief Route that caused the request to be invoked.
        */
-      std::string _route;
+      string_view _route;
+
+      /**
+       * @brief Path the matching route was registered with.
+       */
+      string_view _pattern;
+
+      /**
+       * @brief First field of each well-known header, or `nullptr`, indexed by known_header.
+       */
+      const parser::field* _known[known_header_count];
+
+      /**
+       * @brief Path parameters captured by the route.
+       */
+      parameter _params[max_params];
+
+      /**
+       * @brief Number of captured path parameters.
+       */
+      unsigned _param_count;
+
+      /**
+       * @brief Length announced by the `Content-Length` header.
+       */
+      unsigned long _content_length;
+
+      /**
+       * @brief Number of bytes left in the body, or in the current chunk of a chunked body.
+       */
+      mutable unsigned long _body_remaining;
+
+      /**
+       * @brief Number of decoded body bytes read so far.
+       */
+      mutable unsigned long _body_read;
+
+      /**
+       * @brief Body that was received before the request was dispatched, or `nullptr` if the
+       *        body is read from the connection.
+       */
+      const char* _buffered_body;
+
+      /**
+       * @brief Position of the body decoder.
+       */
+      enum class body_state {
+        size,     ///< Expects the size line of a chunk.
+        data,     ///< Reads body data.
+        data_end, ///< Expects the CRLF that ends a chunk.
+        trailer,  ///< Skips the trailer fields after the last chunk.
+        done      ///< The whole body has been read.
+      };
+      mutable body_state _body_state;
+
+      /**
+       * @brief `true` if the body uses a transfer coding other than `identity`.
+       */
+      bool _chunked;
+
+      /**
+       * @brief `true` if the client sent `Expect: 100-continue`.
+       */
+      bool _expect_continue;
 
       /**
-       * @brief Headers.
+       * @brief `true` once `100 Continue` has been sent.
        */
-      std::map<std::string, std::string, no_case_compare> _header;
+      mutable bool _continued;
 
     // Friends
+    friend class webby::router;
     friend class webby::server;
   };
 }
@@ -3,15 +3,32 @@
  */
 #pragma once
 
-#include <time.h>
-#include <map>
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <webby/arena.hpp>
+#include <webby/compression.hpp>
+#include <webby/connection.hpp>
+#include <webby/date.hpp>
+#include <webby/executor.hpp>
+#include <webby/header_builder.hpp>
+#include <webby/known_header.hpp>
+#include <webby/status.hpp>
 #include <webby/utility.hpp>
 
 /**
  * @namespace webby
  */
 namespace webby {
-  // Forward reference.
+  // Forward references.
+  class response_cache;
   class server;
 
   /**
@@ -37,26 +54,155 @@ namespace webby {
           explicit error(const char* what_arg) : runtime_error(what_arg) { }
       };
 
+      /**
+       * @brief Destination of a response that is not written to the connection as HTTP/1.1, such
+       *        as an HTTP/2 stream.
+       *
+       * The response decides on compression and collects the body as usual, then passes the
+       * headers and each block of the body to the sink instead of framing them itself.
+       */
+      class sink {
+        public:
+          virtual ~sink() { }
+
+          /**
+           * @brief Sends the status and headers.
+           * @param[in] status_code Status code of the response.
+           * @param[in] headers Headers of the response, without `Date`.
+           * @param[in] last `true` if the response has no body.
+           */
+          virtual void send_headers(unsigned short status_code, const header_builder& headers,
+                                    bool last) = 0;
+
+          /**
+           * @brief Sends a block of the body.
+           * @param[in] iov Pieces of the block, in order.
+           * @param[in] count Number of pieces. It is `0` if @p last ends the body without data.
+           * @param[in] last `true` to end the body.
+           */
+          virtual void send_data(const struct iovec* iov, size_t count, bool last) = 0;
+
+          /**
+           * @brief Cuts the response short after the handler failed.
+           */
+          virtual void abort() = 0;
+      };
+
+      /**
+       * @brief Receives a copy of a response as it is sent, such as a webby::response_cache that
+       *        stores it.
+       */
+      class recorder {
+        public:
+          virtual ~recorder() { }
+
+          /**
+           * @brief Records the status and headers when they are sent.
+           * @param[in] status_code Status code of the response.
+           * @param[in] headers Headers of the response, without `Date`.
+           */
+          virtual void record_headers(unsigned short status_code,
+                                      const header_builder& headers) = 0;
+
+          /**
+           * @brief Records a block of the body as it is sent, after compression and without the
+           *        framing.
+           */
+          virtual void record_data(const char* data, size_t length) = 0;
+
+          /**
+           * @brief Ends the recording. It is called once.
+           * @param[in] complete `true` if the whole response was sent and recorded; `false` if the
+           *                     handler failed, or part of the body bypassed the recorder.
+           */
+          virtual void record_end(bool complete) = 0;
+      };
+
       /**
        * @brief Sets a header value.
        * @param[in] name Name of the header.
        * @param[in] value Value of the header.
        * @returns Reference to this webby::response object for chaining.
+       *
+       * The name and value are copied, so they can be temporaries. Setting a header again
+       * replaces its value.
+       *
+       * @throws webby::response::error if the name or the value contains a line break, or if the
+       *         value of `Content-Length` is not a number.
        */
-      response& set_header(const std::string& name, const std::string& value) {
-        _config.error_log() << qlog::debug << "response::set_header" << std::endl;
-        _header[name] = value;
+      response& set_header(string_view name, string_view value) {
+        WEBBY_LOG(_config, debug) << "response::set_header";
+        if(name.empty() || name.find(':') != string_view::npos || !single_line(name) ||
+           !single_line(value)) {
+          throw response::error("Invalid header");
+        }
+        const known_header known = find_known_header(name);
+        if(known == known_header::content_length) {
+          unsigned long length = 0;
+          if(!parse_number(value, length)) {
+            throw response::error("Invalid Content-Length");
+          }
+          _headers.set_content_length(length);
+        }
+        else if(known != known_header::none) {
+          _headers.put(known, _connection.arena().copy(value));
+        }
+        else {
+          _headers.add(name, value);
+        }
         return *this;
       }
 
+      /**
+       * @brief Sets a header to an integer, formatted in decimal.
+       * @param[in] name Name of the header.
+       * @param[in] value Value of the header.
+       * @returns Reference to this webby::response object for chaining.
+       */
+      template<typename T>
+      typename std::enable_if<std::is_integral<T>::value, response&>::type
+      set_header(string_view name, T value) {
+        if(find_known_header(name) == known_header::content_length && value >= 0) {
+          return set_content_length(static_cast<unsigned long>(value));
+        }
+        char digits[21];
+        size_t length = 0;
+        unsigned long long magnitude = static_cast<unsigned long long>(value);
+        if(value < 0) {
+          digits[length++] = '-';
+          magnitude = 0 - magnitude;
+        }
+        length += format_number(magnitude, digits + length);
+        return set_header(name, string_view(digits, length));
+      }
+
+      /**
+       * @brief Sets the `Content-Length` header.
+       * @param[in] length Number of bytes in the body.
+       * @returns Reference to this webby::response object for chaining.
+       */
+      response& set_content_length(unsigned long length) {
+        _headers.set_content_length(length);
+        return *this;
+      }
+
+      /**
+       * @brief Sets the `Content-Type` header.
+       * @param[in] type Media type of the body, e.g. `text/html; charset=utf-8`.
+       * @returns Reference to this webby::response object for chaining.
+       */
+      response& set_content_type(string_view type) {
+        return set_known(known_header::content_type, type);
+      }
+
       /**
        * @brief Sets the status code for the response.
        * @param[in] status_code Status code for the response.
        * @returns Reference to this webby::response object for chaining.
        */
       response& set_status_code(unsigned short status_code) {
-        _config.error_log() << qlog::debug << "response::set_status_code" << std::endl;
-        if(0 == _status_map.count(status_code)) {
+        WEBBY_LOG(_config, debug) << "response::set_status_code";
+        if(status_table::line(status_code).empty()) {
           throw response::error("Invalid status code.");
         }
         _status_code = status_code;
@@ -71,7 +217,7 @@ namespace webby {
        * In general this function should not be needed. The default HTTP version is 1.1.
        */
       response& set_version(const std::string& version) {
-        _config.error_log() << qlog::debug << "response::set_version" << std::endl;
+        WEBBY_LOG(_config, debug) << "response::set_version";
         _version = version;
         return *this;
       }
@@ -81,35 +227,145 @@ namespace webby {
        * @param[in] data Data buffer to transmit.
        * @param[in] length Length of the data buffer.
        *
-       * When response::write_block() is invoked for the first time all of the headers are
-       * transmitted to the connected host. If the `Content-Length` header was not set, then a
-       * webby::response::error exception is thrown. The `Content-Length` header is not mandatory,
-       * but has become a de-facto standard, and is enforced.
+       * When response::write_block() is invoked for the first time the headers are staged, and
+       * they are transmitted to the connected host in the same system call as the first body
+       * bytes. Small chunks are collected in the connection's output buffer and sent together.
+       *
+       * If the `Content-Length` header was set the body is sent as is. Otherwise the response is
+       * streamed: it is sent with `Transfer-Encoding: chunked` to HTTP/1.1 clients, and to
+       * HTTP/1.0 clients it is delimited by closing the connection.
        */
       void write_block(const unsigned char* data, const unsigned long length) {
-        _config.error_log() << qlog::debug << "response::write_block" << std::endl;
+        WEBBY_LOG(_config, debug) << "response::write_block";
+        struct iovec iov;
+        iov.iov_base = const_cast<unsigned char*>(data);
+        iov.iov_len = length;
+        write_iov(&iov, 1);
+      }
 
-        // Sends the headers if necessary.
-        if(!_sent_headers) {
-          if(_header.count("Content-Length") == 0) {
-            throw response::error("The Content-Length header was not provided.");
+      /**
+       * @brief Sends several body chunks at once.
+       * @param[in] iov Chunks to transmit, in order.
+       * @param[in] count Number of chunks.
+       *
+       * Chunks that do not fit in the output buffer are gathered with a single `sendmsg()`
+       * instead of being concatenated first, so a handler can send e.g. a prefix, a cached
+       * payload and a suffix without copying them. The body is framed as described for
+       * response::write_block().
+       */
+      void write_iov(const struct iovec* iov, const size_t count) {
+        WEBBY_LOG(_config, debug) << "response::write_iov";
+        begin_body();
+        if(_head) {
+          return;
+        }
+
+        unsigned long length = 0;
+        for(size_t i = 0; i < count; ++i) {
+          length += iov[i].iov_len;
+        }
+
+        // Collects small chunks so that they go out together.
+        if(length <= _body.available()) {
+          for(size_t i = 0; i < count; ++i) {
+            _body.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
           }
-          send_headers();
+          return;
+        }
+        emit(iov, count, false);
+      }
+
+      /**
+       * @brief Sends part of a file as a body chunk without copying it through user space.
+       * @param[in] fd Descriptor of a regular file open for reading. The caller keeps ownership.
+       * @param[in] offset Offset of the first byte to send.
+       * @param[in] length Number of bytes to send.
+       *
+       * The file is sent with `sendfile()` where the platform has it. The body is framed as
+       * described for response::write_block().
+       */
+      void send_file(int fd, const off_t offset, const unsigned long length) {
+        WEBBY_LOG(_config, debug) << "response::send_file";
+        begin_body();
+        if(_head || length == 0) {
+          return;
+        }
+        if(_compression != compression::off || _sink != nullptr) {
+          copy_file(fd, offset, length);
+          return;
         }
 
-        // Send the data to the connected host.
-        _worker.write(data, length);
+        // Sends the headers, any collected chunks and, if the body is chunked, the size line of
+        // the file's chunk, holding them back so that they share a segment with the file.
+        emit(nullptr, 0, false, length);
+        _connection.sendfile(fd, offset, length);
         _bytes_sent += length;
+        _crlf_pending = _framing == framing::chunked;
+      }
+
+      /**
+       * @brief Gets a stream that writes to the body of the response.
+       *
+       * The stream formats directly into the connection's output buffer, which is sent whenever it
+       * fills up, when the stream is flushed and when the response is finished. Combined with a
+       * streamed response this lets a handler send a body of any size in bounded memory, e.g.
+       * `res.stream() << "[" << first << ", " << second << "]";`.
+       */
+      std::ostream& stream() {
+        if(_stream == nullptr) {
+          void* p = _connection.arena().allocate(sizeof(std::ostream), alignof(std::ostream));
+          _stream = new(p) std::ostream(&_body);
+        }
+        return *_stream;
+      }
+
+      /**
+       * @brief Sends the body as is even if response compression is enabled.
+       * @returns Reference to this webby::response object for chaining.
+       *
+       * Handlers call this for bodies that are already compressed, or that they want sent with
+       * its `Content-Length`. It must be called before the body is written. A response that sets
+       * `Content-Encoding` itself is never compressed again.
+       */
+      response& disable_compression() {
+        _compressible = false;
+        return *this;
+      }
+
+      /**
+       * @brief Suspends the response so that the handler can complete it asynchronously.
+       * @returns the completion through which the response is finished.
+       * @throws webby::response::error if the response has already been suspended.
+       *
+       * The handler returns as soon as it has started the work the response waits for, e.g. a
+       * call to a database, and finishes the response with completion::finish() when that work
+       * is done. See webby::completion.
+       *
+       * The task passed to completion::finish() may suspend the response again.
+       */
+      completion suspend() {
+        if((_async && !_async->done) || _executor == nullptr) {
+          throw error("The response cannot be suspended");
+        }
+        _async = std::make_shared<completion::state>(*_executor);
+        return completion(_async);
       }
 
     protected:
       /**
-       * @brief Constructs a new webby::response object from a @p worker socket.
-       * @param[in] worker Worker socket used to communicate with the connected host.
+       * @brief Constructs a new webby::response object for a @p connection.
+       * @param[in] config Server configuration.
+       * @param[in] connection Connection to the host that receives the response.
        */
-      response(const webby::config& config, const net::worker& worker) :
-          _config(config), _sent_headers(false), _worker(worker), _version("1.1"), _bytes_sent(0) {
-        _config.error_log() << qlog::debug << "response::response()" << std::endl;
+      response(const webby::config& config, webby::connection& connection) :
+          _config(config), _headers(connection.arena()), _sent_headers(false), _status_code(200),
+          _connection(connection), _version("1.1"), _bytes_sent(0), _head(false),
+          _chunked_allowed(true),
+          _framing(framing::unknown), _finished(false), _failed(false), _crlf_pending(false),
+          _compression(compression::off), _compressible(false), _coding(content_coding::identity),
+          _body(*this),
+          _stream(nullptr), _sink(nullptr), _executor(nullptr) {
+        WEBBY_LOG(_config, debug) << "response::response()";
       }
 
       /**
@@ -118,55 +374,742 @@ namespace webby {
        * If the response has not yet been sent it is sent at this time.
        */
       ~response() {
-        _config.error_log() << qlog::debug << "response::~response()" << std::endl;
+        WEBBY_LOG(_config, debug) << "response::~response()";
+        try {
+          finish();
+        }
+        catch(const std::exception& e) {
+          WEBBY_LOG(_config, error) << e.what();
+        }
+        stop_recording(false);
+        if(_stream != nullptr) {
+          _stream->~basic_ostream();
+        }
+      }
 
-        // Sends the headers if necessary.
-        if(!_sent_headers) {
-          if(_header.count("Content-Length") == 0) {
-            _header["Content-Length"] = "0";
+      /**
+       * @brief Sends whatever part of the response has not been sent.
+       *
+       * If the handler did not write a body an empty one is sent. A chunked body is ended with
+       * its last chunk.
+       */
+      void finish() {
+        if(_finished) {
+          return;
+        }
+        _finished = true;
+        if(_framing == framing::unknown && !has(known_header::content_length) && !bodiless()) {
+          _headers.set_content_length(0);
+        }
+        begin_body();
+        emit(nullptr, 0, true);
+        stop_recording(!_failed);
+      }
+
+      /**
+       * @brief Replaces the response with an empty error response after a handler failed.
+       * @param[in] status_code Status code of the error response.
+       *
+       * If the headers have not been sent the handler's headers are discarded, and an error with
+       * `Connection: close` is sent instead. Otherwise the response is cut short, so the client
+       * sees a truncated body rather than one that appears complete. Either way the connection is
+       * closed afterwards.
+       */
+      void fail(unsigned short status_code) {
+        _failed = true;
+        stop_recording(false);
+        if(_sent_headers) {
+          _finished = true;
+          if(_sink != nullptr) {
+            _sink->abort();
           }
-          send_headers();
+          return;
         }
+        _framing = framing::unknown;
+        _compression = compression::off;
+        _compressible = false;
+        _body.clear();
+        _headers.clear();
+        _status_code = status_code;
+        _headers.set_content_length(0);
+        put(known_header::connection, "close");
+        finish();
       }
 
       /**
-       * @brief Sends the status line and headers to the connected host.
+       * @brief Gets a value that indicates whether the connection can carry another request.
+       *
+       * This is `false` if the response asked for the connection to be closed, or if the handler
+       * sent a different number of bytes than it announced in `Content-Length`, because the client
+       * would then read the wrong bytes as the start of the next response.
        */
-      void send_headers() {
-        _config.error_log() << qlog::debug << "response::send_headers()" << std::endl;
-        std::ostringstream res;
+      bool persistent() const {
+        if(_failed) {
+          return false;
+        }
+        if(iequals(_headers.get(known_header::connection), "close")) {
+          return false;
+        }
+        if(_framing == framing::close) {
+          return false;
+        }
+        if(_framing == framing::chunked) {
+          return _finished;
+        }
+        unsigned long announced = 0;
+        return _head || bodiless() ||
+               (_headers.content_length(announced) && announced == _bytes_sent);
+      }
 
-        // Generates the status line.
-        res << "HTTP/" << _version << " " << _status_code << " " << _status_map[_status_code]
-          << "\r\n";
+      /**
+       * @brief Gets a value that indicates whether the status code forbids a body.
+       *
+       * Informational, `204 No Content` and `304 Not Modified` responses end with their headers,
+       * so they are sent without a default `Content-Length`.
+       */
+      bool bodiless() const {
+        return _status_code < 200 || _status_code == 204 || _status_code == 304;
+      }
 
-        // Adds all of the headers.
-        for(auto header = _header.cbegin(); header != _header.cend(); ++header) {
-          res << header->first << ": " << header->second << "\r\n";
+      /**
+       * @brief Formats the status line and headers into the staged header block.
+       *
+       * The block is measured first and then formatted into a single allocation from the
+       * connection's arena. The lines of the headers are copied as the builder holds them.
+       */
+      void stage_headers() {
+        WEBBY_LOG(_config, debug) << "response::stage_headers()";
+        string_view line = status_table::line(_status_code);
+        string_view date = http_date();
+        const bool patch = _version != "1.1";
+        size_t size = patch ? 5 + _version.size() + line.size() - 8 : line.size();
+        size += _headers.size() + 6 + date.size() + 2 + 2;
+
+        char* const block = static_cast<char*>(_connection.arena().allocate(size, 1));
+        char* p = block;
+
+        // Copies the precomputed status line, replacing the version if it is not 1.1.
+        if(!patch) {
+          p = append(p, line);
+        }
+        else {
+          p = append(append(append(p, "HTTP/"), _version), line.substr(8));
         }
 
-        // Adds the RFC 1123 Date header.
-        struct tm* timeinfo;
-        char buffer [80];
-        memset(buffer, 0, 80);
-        time_t tt = time(nullptr);
-        timeinfo = gmtime(&tt);
-        strftime (buffer, 80, "%a, %d %b %Y %H:%M:%S GMT", timeinfo);
-        res << "Date: " << buffer << "\r\n";
+        // Adds all of the headers.
+        p = _headers.format(p);
+
+        // Adds the RFC 1123 Date header from the per-second cache.
+        p = append(append(append(p, "Date: "), date), "\r\n");
 
         // Blank line.
-        res << "\r\n";
+        p = append(p, "\r\n");
+        _staged = string_view(block, static_cast<size_t>(p - block));
+
+        // Flag that the headers have been sent. They go out with the next call to transmit().
+        _sent_headers = true;
+      }
+
+      /**
+       * @brief Chooses how the body is framed and whether it is compressed, the first time the
+       *        body is written.
+       *
+       * While the compression decision is deferred so is the framing, because a body that turns
+       * out to be short is sent uncompressed with a `Content-Length`.
+       */
+      void begin_body() {
+        if(_framing != framing::unknown) {
+          return;
+        }
+        choose_compression();
+        if(_compression == compression::deferred) {
+          _framing = framing::pending;
+        }
+        else {
+          choose_framing();
+        }
+        _body.attach(_connection.output_buffer(), connection::output_size);
+      }
+
+      /**
+       * @brief Chooses how the body is framed.
+       */
+      void choose_framing() {
+        if(_sink != nullptr) {
+          _framing = framing::frames;
+        }
+        else if(has(known_header::content_length) || bodiless()) {
+          _framing = framing::length;
+        }
+        else if(_chunked_allowed) {
+          _framing = framing::chunked;
+          put(known_header::transfer_encoding, "chunked");
+        }
+        else {
+          _framing = framing::close;
+          put(known_header::connection, "close");
+        }
+      }
+
+      /**
+       * @brief Makes the deferred compression decision, and with it the framing.
+       * @param[in] last `true` if the body is complete.
+       * @param[in] length Length of the body written so far.
+       *
+       * A complete body below the threshold is sent as is, with its length in `Content-Length`.
+       */
+      void resolve_compression(bool last, unsigned long length) {
+        if(last && length < _config.compression_threshold()) {
+          _compression = compression::off;
+          _headers.set_content_length(length);
+        }
+        else {
+          start_compression();
+        }
+        choose_framing();
+      }
+
+      /**
+       * @brief Decides whether the body is compressed.
+       *
+       * Compression needs the server to enable it, the client to accept a coding, and a textual
+       * body that the handler has not encoded itself. The response then varies with
+       * `Accept-Encoding`. A body whose `Content-Length` is below the threshold is sent as is; a
+       * longer one is streamed compressed instead. When the length is not known the decision is
+       * left to the first emit() or flush(), which know whether the whole body fitted in the
+       * output buffer.
+       */
+      void choose_compression() {
+        if(!_compressible || bodiless() || _status_code == 206 ||
+           has(known_header::content_encoding)) {
+          return;
+        }
+        if(!compressible_type(_headers.get(known_header::content_type))) {
+          return;
+        }
+        add_vary("Accept-Encoding");
+        if(_coding == content_coding::identity || _head) {
+          return;
+        }
+        unsigned long n = 0;
+        if(!_headers.content_length(n)) {
+          _compression = compression::deferred;
+        }
+        else if(n >= _config.compression_threshold()) {
+          _headers.erase(known_header::content_length);
+          start_compression();
+        }
+      }
+
+      /**
+       * @brief Starts compressing the body with the negotiated coding.
+       */
+      void start_compression() {
+        _compressor.begin(_coding, _config.compression_level());
+        put(known_header::content_encoding, coding_name(_coding));
+        _compression = compression::on;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a well-known header is set.
+       */
+      bool has(known_header name) const {
+        return _headers.has(name);
+      }
+
+      /**
+       * @brief Sets a well-known header with its canonical name.
+       * @param[in] name The header, other than `Content-Length`.
+       * @param[in] value Value, which must stay valid until the response has been sent.
+       */
+      void put(known_header name, string_view value) {
+        _headers.put(name, value);
+      }
+
+      /**
+       * @brief Sets a well-known header to a copy of a value, after checking it.
+       */
+      response& set_known(known_header name, string_view value) {
+        if(!single_line(value)) {
+          throw response::error("Invalid header");
+        }
+        _headers.put(name, _connection.arena().copy(value));
+        return *this;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a header name or value fits on one line.
+       */
+      static bool single_line(string_view str) {
+        for(auto itr = str.begin(); itr != str.end(); ++itr) {
+          if(*itr == '\r' || *itr == '\n') {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      /**
+       * @brief Adds a token to the `Vary` header unless it is already listed.
+       */
+      void add_vary(string_view token) {
+        if(!has(known_header::vary)) {
+          put(known_header::vary, token);
+          return;
+        }
+        string_view vary = _headers.get(known_header::vary);
+        if(!accepts_token(vary, token)) {
+          const size_t size = vary.size() + 2 + token.size();
+          char* const value = static_cast<char*>(_connection.arena().allocate(size, 1));
+          append(append(append(value, vary), ", "), token);
+          put(known_header::vary, string_view(value, size));
+        }
+      }
 
-        const std::string& str = res.str();
-        _worker.write(str.c_str(), str.length());
+      /**
+       * @brief Sends the collected body followed by more chunks, compressing them if the body is
+       *        compressed.
+       * @param[in] iov Body chunks sent after the collected body.
+       * @param[in] count Number of body chunks.
+       * @param[in] last `true` to end the body.
+       * @param[in] following Number of body bytes that the caller sends immediately afterwards
+       *                      with `sendfile()`. It must be `0` if the body is compressed.
+       */
+      void emit(const struct iovec* iov, size_t count, bool last, unsigned long following = 0) {
+        if(_head) {
+          // Drops what the stream wrote into the buffer, which has no body to go to.
+          _body.clear();
+          transmit(string_view(), nullptr, 0, last, following);
+          return;
+        }
+        if(_compression == compression::deferred) {
+          resolve_compression(last, body_length(_body.text(), iov, count));
+        }
+        if(_compression == compression::on) {
+          compress(iov, count, last ? compressor::mode::finish : compressor::mode::none);
+          return;
+        }
+        _bytes_sent += body_length(_body.text(), iov, count);
+        transmit(_body.text(), iov, count, last, following);
+        _body.clear();
+      }
+
+      /**
+       * @brief Gets the number of body bytes in the collected body and more chunks.
+       *
+       * Body bytes are counted as they leave the buffer rather than as they are written, because
+       * the stream puts bytes into the buffer without calling it while there is room.
+       */
+      static unsigned long body_length(string_view collected, const struct iovec* iov,
+                                       size_t count) {
+        unsigned long length = collected.size();
+        for(size_t i = 0; i < count; ++i) {
+          length += iov[i].iov_len;
+        }
+        return length;
+      }
 
-        // Flag that the headers have been sent.
+      /**
+       * @brief Sends whatever has been collected when the handler flushes the body.
+       *
+       * A compressed body is flushed through the compressor, so that a streamed response reaches
+       * the client as it is produced.
+       */
+      void flush() {
+        begin_body();
+        if(_head) {
+          return;
+        }
+        if(_compression == compression::deferred) {
+          resolve_compression(false, 0);
+        }
+        if(_compression == compression::on) {
+          compress(nullptr, 0, compressor::mode::flush);
+        }
+        else if(!_body.text().empty()) {
+          emit(nullptr, 0, false);
+        }
+      }
+
+      /**
+       * @brief Compresses the collected body followed by more chunks.
+       * @param[in] iov Body chunks compressed after the collected body.
+       * @param[in] count Number of body chunks.
+       * @param[in] m What to do with output the compressor holds back. compressor::mode::finish
+       *              also ends the body.
+       */
+      void compress(const struct iovec* iov, size_t count, compressor::mode m) {
+        auto sink = [this](const char* data, size_t length) {
+          _bytes_sent += length;
+          transmit(string_view(data, length), nullptr, 0, false, 0);
+        };
+        string_view collected = _body.text();
+        if(!collected.empty() || count == 0) {
+          _compressor.write(collected.data(), collected.size(),
+                            count == 0 ? m : compressor::mode::none, sink);
+        }
+        _body.clear();
+        for(size_t i = 0; i < count; ++i) {
+          _compressor.write(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len,
+                            i + 1 == count ? m : compressor::mode::none, sink);
+        }
+        if(m == compressor::mode::finish) {
+          transmit(string_view(), nullptr, 0, true, 0);
+        }
+      }
+
+      /**
+       * @brief Sends part of a file by reading it, for a body that is compressed or framed by a
+       *        sink and so cannot be sent with `sendfile()`.
+       * @throws webby::response::error if the file cannot be read.
+       */
+      void copy_file(int fd, off_t offset, unsigned long length) {
+        char buffer[compressor::output_size];
+        while(length > 0) {
+          size_t size = length < sizeof(buffer) ? static_cast<size_t>(length) : sizeof(buffer);
+          ssize_t n = ::pread(fd, buffer, size, offset);
+          if(n < 0 && errno == EINTR) {
+            continue;
+          }
+          if(n <= 0) {
+            throw response::error("Cannot read the file being sent");
+          }
+          struct iovec iov;
+          iov.iov_base = buffer;
+          iov.iov_len = static_cast<size_t>(n);
+          write_iov(&iov, 1);
+          offset += n;
+          length -= static_cast<unsigned long>(n);
+        }
+      }
+
+      /**
+       * @brief Sends the header block, unless it has been sent, followed by a block of body bytes
+       *        and more chunks.
+       * @param[in] collected Body bytes sent first: the collected body, or compressed output.
+       * @param[in] iov Body chunks sent after the collected body. They are not sent in response
+       *                to a HEAD request.
+       * @param[in] count Number of body chunks.
+       * @param[in] last `true` to end a chunked body with its last chunk.
+       * @param[in] following Number of body bytes that the caller sends immediately afterwards.
+       *                      The size line of a chunk that long is sent, and the data is held back
+       *                      with `MSG_MORE` so that it shares a segment with them.
+       *
+       * Everything goes out in one `sendmsg()`. In a chunked body the collected bytes and @p iov
+       * form one chunk.
+       */
+      void transmit(string_view collected, const struct iovec* iov, size_t count, bool last,
+                    unsigned long following) {
+        if(_sink != nullptr) {
+          transmit_to_sink(collected, iov, count, last);
+          return;
+        }
+        if(!_sent_headers) {
+          stage_headers();
+          if(_recorder) {
+            _recorder->record_headers(_status_code, _headers);
+          }
+        }
+        const bool chunked = _framing == framing::chunked && !_head;
+        unsigned long length = collected.size();
+        if(_head) {
+          count = 0;
+        }
+        record(collected, iov, count, following);
+        for(size_t i = 0; i < count; ++i) {
+          length += iov[i].iov_len;
+        }
+
+        // Gathers the pieces on the stack unless there are many chunks.
+        const size_t total = count + 8;
+        struct iovec local[24];
+        std::vector<struct iovec> heap;
+        struct iovec* out = local;
+        if(total > sizeof(local) / sizeof(local[0])) {
+          heap.resize(total);
+          out = heap.data();
+        }
+
+        static const char crlf[] = "\r\n";
+        static const char last_chunk[] = "0\r\n\r\n";
+        char size_line[24];
+        char following_line[24];
+        size_t n = 0;
+        if(!_staged.empty()) {
+          push(out, n, _staged.data(), _staged.size());
+        }
+        if(_crlf_pending) {
+          // Ends a chunk that was sent from a file.
+          push(out, n, crlf, 2);
+          _crlf_pending = false;
+        }
+        if(length > 0 && chunked) {
+          push(out, n, size_line, format_size(length, size_line));
+        }
+        if(!collected.empty()) {
+          push(out, n, collected.data(), collected.size());
+        }
+        for(size_t i = 0; i < count; ++i) {
+          out[n++] = iov[i];
+        }
+        if(length > 0 && chunked) {
+          push(out, n, crlf, 2);
+        }
+        if(following > 0 && chunked) {
+          push(out, n, following_line, format_size(following, following_line));
+        }
+        if(last && chunked) {
+          push(out, n, last_chunk, sizeof(last_chunk) - 1);
+        }
+
+        if(n > 0) {
+          _connection.writev(out, n, following > 0);
+        }
+        _staged = string_view();
+      }
+
+      /**
+       * @brief Passes the headers, unless they have been sent, and a block of body bytes to the
+       *        response's sink.
+       * @param[in] collected Body bytes sent first.
+       * @param[in] iov Body chunks sent after the collected body. They are not sent in response
+       *                to a HEAD request.
+       * @param[in] count Number of body chunks.
+       * @param[in] last `true` to end the body.
+       */
+      void transmit_to_sink(string_view collected, const struct iovec* iov, size_t count,
+                            bool last) {
+        struct iovec local[16];
+        std::vector<struct iovec> heap;
+        struct iovec* out = local;
+        if(_head) {
+          count = 0;
+        }
+        if(count + 1 > sizeof(local) / sizeof(local[0])) {
+          heap.resize(count + 1);
+          out = heap.data();
+        }
+        size_t n = 0;
+        if(!collected.empty()) {
+          push(out, n, collected.data(), collected.size());
+        }
+        for(size_t i = 0; i < count; ++i) {
+          if(iov[i].iov_len > 0) {
+            out[n++] = iov[i];
+          }
+        }
+        if(!_sent_headers && _recorder) {
+          _recorder->record_headers(_status_code, _headers);
+        }
+        record(collected, iov, count, 0);
+
+        if(!_sent_headers) {
+          _sent_headers = true;
+          _sink->send_headers(_status_code, _headers, last && n == 0);
+          if(last && n == 0) {
+            return;
+          }
+        }
+        if(n > 0 || last) {
+          _sink->send_data(out, n, last);
+        }
+      }
+
+      /**
+       * @brief Passes a block of the body to the recorder, if there is one.
+       * @param[in] following Number of body bytes sent afterwards with `sendfile()`, which the
+       *                      recorder cannot see. The recording is abandoned if it is not `0`.
+       */
+      void record(string_view collected, const struct iovec* iov, size_t count,
+                  unsigned long following) {
+        if(!_recorder) {
+          return;
+        }
+        if(following > 0) {
+          stop_recording(false);
+          return;
+        }
+        if(!collected.empty()) {
+          _recorder->record_data(collected.data(), collected.size());
+        }
+        for(size_t i = 0; i < count; ++i) {
+          _recorder->record_data(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+        }
+      }
+
+      /**
+       * @brief Ends the recording, if one is in progress.
+       */
+      void stop_recording(bool complete) {
+        if(_recorder) {
+          std::shared_ptr<recorder> r = std::move(_recorder);
+          r->record_end(complete);
+        }
+      }
+
+      /**
+       * @brief Sends a response recorded by a webby::response_cache in a single system call.
+       * @param[in] status_code Status code of the recorded response.
+       * @param[in] head Status line and headers, without `Connection` and `Date`. It includes
+       *                 the `Content-Length` of @p body.
+       * @param[in] body The body.
+       *
+       * The `Connection` header of this response and the current `Date` are added to the
+       * recorded headers.
+       */
+      void send_recorded(unsigned short status_code, string_view head, string_view body) {
+        _status_code = status_code;
+        _compressible = false;
+        _framing = framing::length;
+        _headers.set_content_length(body.size());
+
+        static const char separator[] = ": ";
+        static const char crlf[] = "\r\n";
+        static const char date_name[] = "Date: ";
+        static const char end[] = "\r\n\r\n";
+        string_view date = http_date();
+        struct iovec out[9];
+        size_t n = 0;
+        push(out, n, head.data(), head.size());
+        if(has(known_header::connection)) {
+          string_view name = to_string(known_header::connection);
+          string_view connection = _headers.get(known_header::connection);
+          push(out, n, name.data(), name.size());
+          push(out, n, separator, 2);
+          push(out, n, connection.data(), connection.size());
+          push(out, n, crlf, 2);
+        }
+        push(out, n, date_name, sizeof(date_name) - 1);
+        push(out, n, date.data(), date.size());
+        push(out, n, end, sizeof(end) - 1);
+        if(!_head && !body.empty()) {
+          push(out, n, body.data(), body.size());
+          _bytes_sent = body.size();
+        }
         _sent_headers = true;
+        _finished = true;
+        _connection.writev(out, n, false);
       }
 
-    private:
-      static std::map<unsigned short, std::string> _status_map;
+      /**
+       * @brief Copies a string to @p p.
+       * @returns the position after the copy.
+       */
+      static char* append(char* p, string_view str) {
+        memcpy(p, str.data(), str.size());
+        return p + str.size();
+      }
+
+      /**
+       * @brief Appends a buffer to an I/O vector.
+       */
+      static void push(struct iovec* out, size_t& n, const char* data, size_t length) {
+        out[n].iov_base = const_cast<char*>(data);
+        out[n++].iov_len = length;
+      }
+
+      /**
+       * @brief Formats the size line of a chunk, e.g. `1f40\r\n`.
+       * @returns the length of the line.
+       */
+      static size_t format_size(unsigned long size, char* buffer) {
+        static const char digits[] = "0123456789abcdef";
+        char reversed[16];
+        size_t n = 0;
+        do {
+          reversed[n++] = digits[size & 0xf];
+          size >>= 4;
+        } while(size != 0);
+        size_t length = 0;
+        while(n > 0) {
+          buffer[length++] = reversed[--n];
+        }
+        buffer[length++] = '\r';
+        buffer[length++] = '\n';
+        return length;
+      }
+
+      /**
+       * @brief How the end of the body is indicated to the client.
+       */
+      enum class framing {
+        unknown, ///< The body has not been started.
+        pending, ///< The body has been started, but waits for the compression decision.
+        length,  ///< The body is as long as the `Content-Length` header says.
+        chunked, ///< The body is sent with `Transfer-Encoding: chunked`.
+        close,   ///< The body ends when the connection is closed.
+        frames   ///< The body is framed by the response's sink.
+      };
+
+      /**
+       * @brief Collects small body chunks in the connection's output buffer.
+       *
+       * It is also the stream buffer behind response::stream(): when it fills up its contents are
+       * sent as one body chunk.
+       */
+      class body_buffer : public std::streambuf {
+        public:
+          /// Constructs a buffer for a response.
+          explicit body_buffer(response& r) : _response(r) { }
+
+          /// Starts collecting into memory owned by the connection.
+          void attach(char* data, size_t size) {
+            setp(data, data + size);
+          }
+
+          /// Gets the collected bytes.
+          string_view text() const {
+            return string_view(pbase(), static_cast<size_t>(pptr() - pbase()));
+          }
 
+          /// Gets the number of bytes that can be collected before the buffer must be sent.
+          size_t available() const {
+            return static_cast<size_t>(epptr() - pptr());
+          }
+
+          /// Collects bytes. There must be room for them.
+          void append(const char* data, size_t length) {
+            memcpy(pptr(), data, length);
+            pbump(static_cast<int>(length));
+          }
+
+          /// Discards the collected bytes after they have been sent.
+          void clear() {
+            setp(pbase(), epptr());
+          }
+
+        protected:
+          /// Sends the collected bytes to make room.
+          int_type overflow(int_type c) override {
+            _response.begin_body();
+            _response.emit(nullptr, 0, false);
+            if(!traits_type::eq_int_type(c, traits_type::eof())) {
+              *pptr() = traits_type::to_char_type(c);
+              pbump(1);
+            }
+            return traits_type::not_eof(c);
+          }
+
+          /// Collects a block of bytes written to the stream.
+          std::streamsize xsputn(const char* s, std::streamsize n) override {
+            struct iovec iov;
+            iov.iov_base = const_cast<char*>(s);
+            iov.iov_len = static_cast<size_t>(n);
+            _response.write_iov(&iov, 1);
+            return n;
+          }
+
+          /// Sends the collected bytes when the stream is flushed.
+          int sync() override {
+            _response.flush();
+            return 0;
+          }
+
+        private:
+          response& _response;
+      };
+
+    private:
       /**
        * @brief Server configuration.
        */
@@ -175,22 +1118,27 @@ namespace webby {
       /**
        * @brief Headers sent with the response.
        */
-      std::map<std::string, std::string, no_case_compare> _header;
+      header_builder _headers;
 
       /**
        * @brief `true` if the headers have already been sent; otherwise `false`.
        */
       bool _sent_headers;
 
+      /**
+       * @brief Formatted header block waiting to be sent with the first body chunk.
+       */
+      string_view _staged;
+
       /**
        * @brief Status code of the response.
        */
       unsigned short _status_code;
 
       /**
-       * @brief Worker socket used to communicate with the connected host.
+       * @brief Connection to the host that receives the response.
        */
-      const net::worker& _worker;
+      webby::connection& _connection;
 
       /**
        * @brief HTTP version sent to the connected host.
@@ -198,60 +1146,105 @@ namespace webby {
       std::string _version;
 
       /**
-       * @brief Number of bytes sent to the client.
+       * @brief Number of body bytes sent to the client, after compression.
        */
       unsigned long _bytes_sent;
 
+      /**
+       * @brief `true` if the response is to a HEAD request and must not include a body.
+       */
+      bool _head;
+
+      /**
+       * @brief `true` if the client understands `Transfer-Encoding: chunked`, i.e. it is not an
+       *        HTTP/1.0 client.
+       */
+      bool _chunked_allowed;
+
+      /**
+       * @brief How the end of the body is indicated.
+       */
+      framing _framing;
+
+      /**
+       * @brief `true` once the response has been completely sent.
+       */
+      bool _finished;
+
+      /**
+       * @brief `true` if the handler failed and the connection must be closed.
+       */
+      bool _failed;
+
+      /**
+       * @brief `true` if a chunk sent from a file still needs its terminating CRLF.
+       */
+      bool _crlf_pending;
+
+      /**
+       * @brief Whether the body is compressed.
+       */
+      enum class compression {
+        off,      ///< The body is sent as is.
+        deferred, ///< The body is compressed unless it turns out to be below the threshold.
+        on        ///< The body is compressed.
+      };
+      compression _compression;
+
+      /**
+       * @brief `true` if the server compresses responses and the handler did not opt out.
+       */
+      bool _compressible;
+
+      /**
+       * @brief Coding negotiated from the request's `Accept-Encoding` header.
+       */
+      content_coding _coding;
+
+      /**
+       * @brief Compresses the body when it is compressed.
+       */
+      webby::compressor _compressor;
+
+      /**
+       * @brief Collects small body chunks.
+       */
+      body_buffer _body;
+
+      /**
+       * @brief Stream returned by response::stream(), created in the arena on first use.
+       */
+      std::ostream* _stream;
+
+      /**
+       * @brief Destination of the response, or `nullptr` to write it to the connection.
+       */
+      sink* _sink;
+
+      /**
+       * @brief Executor that runs the tasks of an asynchronous handler, or `nullptr` if the
+       *        response cannot be suspended.
+       */
+      executor* _executor;
+
+      /**
+       * @brief State shared with the completions, or empty unless response::suspend() was called.
+       */
+      std::shared_ptr<completion::state> _async;
+
+      /**
+       * @brief Receives a copy of the response, or empty if it is not being recorded.
+       */
+      std::shared_ptr<recorder> _recorder;
+
+      /**
+       * @brief Necessary so that webby::response_cache can record and replay responses.
+       */
+      friend class webby::response_cache;
+
       /**
        * @brief Necessary so that webby::server can call the send function.
        */
       friend class webby::server;
   };
-
-  std::map<unsigned short, std::string> response::_status_map = {
-    {100, "Continue"},
-    {101, "Switching Protocols"},
-
-    {200, "OK"},
-    {201, "Created"},
-    {202, "Accepted"},
-    {203, "Non-Authoritative Information"},
-    {204, "No Content"},
-    {205, "Reset Content"},
-    {206, "Partial Content"},
-
-    {300, "Multiple Choices"},
-    {301, "Moved Permanently"},
-    {302, "Found"},
-    {303, "See Other"},
-    {304, "Not Modified"},
-    {305, "Use Proxy"},
-    {307, "Temporary Redirect"},
-
-    {400, "Bad Request"},
-    {401, "Unauthorized"},
-    {402, "Payment Required"},
-    {403, "Forbidden"},
-    {404, "Not Found"},
-    {405, "Method Not Allowed"},
-    {406, "Not Acceptable"},
-    {407, "Proxy Authentication Required"},
-    {408, "Request Time-out"},
-    {409, "Conflict"},
-    {410, "Gone"},
-    {411, "Length Required"},
-    {412, "Precondition Failed"},
-    {413, "Request Entity Too Large"},
-    {414, "Request-URI Too Large"},
-    {415, "Unsupported Media Type"},
-    {416, "Requested rqange not satisfiable"},
-    {417, "Expectation Failed"},
-
-    {500, "Internal Server Error"},
-    {501, "Not Implemented"},
-    {502, "Bad Gateway"},
-    {503, "Service Unavailable"},
-    {504, "Gateway Time-out"},
-    {505, "HTTP Version not supported"}
-  };
 }
@@ -0,0 +1,521 @@
+/**
+ * @file response_cache.hpp
+ */
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <webby/executor.hpp>
+#include <webby/known_header.hpp>
+#include <webby/method.hpp>
+#include <webby/request.hpp>
+#include <webby/response.hpp>
+#include <webby/status.hpp>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief How a route's responses are cached. See webby::router::add().
+   */
+  class cache_policy {
+    public:
+      /**
+       * @brief Constructs the default policy: responses are kept for one second and keyed by
+       *        host and path alone.
+       */
+      cache_policy() : _ttl(1000), _max_entries(1024), _max_size(1 << 20) { }
+
+      /**
+       * @brief Gets the number of milliseconds a response is served from the cache.
+       */
+      unsigned ttl() const {
+        return _ttl;
+      }
+
+      /**
+       * @brief Sets the number of milliseconds a response is served from the cache.
+       * @param[in] ttl Time to live of the cached responses.
+       * @returns a reference to this `webby::cache_policy` instance to allow for chaining.
+       */
+      cache_policy& set_ttl(unsigned ttl) {
+        _ttl = ttl;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the request headers whose values are part of the key.
+       */
+      const std::vector<std::string>& key_headers() const {
+        return _key_headers;
+      }
+
+      /**
+       * @brief Adds a request header whose value is part of the key, e.g. `Accept` for a route
+       *        whose representation depends on it.
+       * @param[in] name Name of the header.
+       * @returns a reference to this `webby::cache_policy` instance to allow for chaining.
+       */
+      cache_policy& add_key_header(const std::string& name) {
+        _key_headers.push_back(name);
+        return *this;
+      }
+
+      /**
+       * @brief Gets the maximum number of responses kept.
+       */
+      size_t max_entries() const {
+        return _max_entries;
+      }
+
+      /**
+       * @brief Sets the maximum number of responses kept. Responses to other keys are not cached
+       *        until some expire.
+       * @param[in] max_entries Maximum number of responses.
+       * @returns a reference to this `webby::cache_policy` instance to allow for chaining.
+       */
+      cache_policy& set_max_entries(size_t max_entries) {
+        _max_entries = max_entries;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the size of the largest body that is cached.
+       */
+      size_t max_size() const {
+        return _max_size;
+      }
+
+      /**
+       * @brief Sets the size of the largest body that is cached.
+       * @param[in] max_size Largest body, in bytes, as sent.
+       * @returns a reference to this `webby::cache_policy` instance to allow for chaining.
+       */
+      cache_policy& set_max_size(size_t max_size) {
+        _max_size = max_size;
+        return *this;
+      }
+
+    private:
+      /**
+       * @brief Milliseconds a response is served from the cache.
+       */
+      unsigned _ttl;
+
+      /**
+       * @brief Request headers whose values are part of the key.
+       */
+      std::vector<std::string> _key_headers;
+
+      /**
+       * @brief Maximum number of responses kept.
+       */
+      size_t _max_entries;
+
+      /**
+       * @brief Largest body that is cached.
+       */
+      size_t _max_size;
+  };
+
+  /**
+   * @brief Keeps the complete responses of a route for a while, so that the handler is not
+   *        called again for the same request.
+   *
+   * Only `GET` and `HEAD` requests use the cache. The key is made of the `Host` header, the path
+   * with its query string, the values of the policy's key headers and the content coding
+   * negotiated for the response. A `GET` that misses calls the handler and records the response
+   * as it is sent. A hit is written with a single `writev()`: the recorded status line, headers
+   * and body, with the `Connection` header of the request's own response and the current `Date`.
+   *
+   * Only one miss per key calls the handler. Requests for the same key that arrive in the
+   * meantime suspend their responses and are answered from the recording once it is complete.
+   * If it is not cacheable they call the handler themselves. HTTP/2 streams do not wait: their
+   * session processes one stream at a time and could hold up the handler they wait for.
+   *
+   * A response is cached if its status is 200, 203, 300, 301, 404 or 410, it has no
+   * `Set-Cookie` header, its `Cache-Control` does not say `no-store`, `no-cache` or `private`,
+   * its `Vary` is not `*`, and its body was not sent with `sendfile()`.
+   *
+   * Keys are spread over shards that each have their own lock, so threads that look up different
+   * keys rarely contend.
+   */
+  class response_cache : public std::enable_shared_from_this<response_cache> {
+    public:
+      /**
+       * @brief Signature of the handlers whose responses are cached.
+       */
+      typedef std::function<void(const request&, response&)> handler_t;
+
+      /**
+       * @brief Constructs an empty cache.
+       * @param[in] policy How responses are cached.
+       */
+      explicit response_cache(const cache_policy& policy)
+          : _policy(policy),
+            _shard_capacity((policy.max_entries() + shard_count - 1) / shard_count) { }
+
+      response_cache(const response_cache&) = delete;
+      response_cache& operator=(const response_cache&) = delete;
+
+      /**
+       * @brief Makes a handler that answers from a new cache and calls @p handler on misses.
+       */
+      static handler_t wrap(const cache_policy& policy, handler_t handler) {
+        std::shared_ptr<response_cache> cache = std::make_shared<response_cache>(policy);
+        return [cache, handler](const request& req, response& res) {
+          cache->serve(req, res, handler);
+        };
+      }
+
+      /**
+       * @brief Answers a request from the cache, or with the handler.
+       * @param[in] req Request being answered.
+       * @param[out] res Response to the request.
+       * @param[in] handler Handler called if the response is not cached.
+       */
+      void serve(const request& req, response& res, const handler_t& handler) {
+        const enum webby::method m = req.method();
+        if(m != method::GET && m != method::HEAD) {
+          handler(req, res);
+          return;
+        }
+
+        std::string key = make_key(req, res);
+        shard& sh = _shards[std::hash<std::string>()(key) % shard_count];
+        std::unique_lock<std::mutex> lock(sh.mutex);
+        auto itr = sh.slots.find(key);
+        if(itr != sh.slots.end()) {
+          if(itr->second.cached && clock::now() < itr->second.cached->expires) {
+            std::shared_ptr<const entry> e = itr->second.cached;
+            lock.unlock();
+            send(*e, res);
+            return;
+          }
+          if(itr->second.filling) {
+            if(res._sink != nullptr) {
+              lock.unlock();
+              handler(req, res);
+              return;
+            }
+            completion done = res.suspend();
+            itr->second.filling->waiters.push_back(
+                [&req, &res, handler, done](std::shared_ptr<const entry> e) {
+                  done.finish([&req, &res, handler, e]() {
+                    if(e) {
+                      send(*e, res);
+                    }
+                    else {
+                      handler(req, res);
+                    }
+                  });
+                });
+            return;
+          }
+        }
+        if(m == method::HEAD) {
+          lock.unlock();
+          handler(req, res);
+          return;
+        }
+
+        // Records the response, making the other requests for the key wait for it.
+        std::shared_ptr<fill> f = std::make_shared<fill>();
+        if(itr == sh.slots.end()) {
+          itr = sh.slots.insert(std::make_pair(key, slot())).first;
+        }
+        itr->second.filling = f;
+        lock.unlock();
+        res._recorder = std::make_shared<recording>(shared_from_this(), std::move(key), f);
+        handler(req, res);
+      }
+
+    private:
+      typedef std::chrono::steady_clock clock;
+
+      /**
+       * @brief Number of shards the keys are spread over.
+       */
+      static const size_t shard_count = 16;
+
+      /**
+       * @brief A cached response.
+       */
+      struct entry {
+        /// Status code.
+        unsigned short status_code;
+
+        /// Status line and headers, without `Connection` and `Date`.
+        std::string head;
+
+        /// Headers without `Connection`, `Content-Length` and `Date`, for HTTP/2 streams.
+        std::vector<std::pair<std::string, std::string>> headers;
+
+        /// The body, as sent.
+        std::string body;
+
+        /// Time after which the response is no longer served.
+        clock::time_point expires;
+      };
+
+      /**
+       * @brief A response being recorded, and the requests waiting for it.
+       */
+      struct fill {
+        /// Called with the response once it has been recorded, or with `nullptr` if it is not
+        /// cacheable.
+        std::vector<std::function<void(std::shared_ptr<const entry>)>> waiters;
+      };
+
+      /**
+       * @brief State of a key.
+       */
+      struct slot {
+        /// The cached response, possibly expired.
+        std::shared_ptr<const entry> cached;
+
+        /// The response being recorded, if any.
+        std::shared_ptr<fill> filling;
+      };
+
+      /**
+       * @brief Keys whose hash falls in the same shard, and their lock.
+       */
+      struct shard {
+        /// Protects the slots.
+        std::mutex mutex;
+
+        /// Slots by key.
+        std::unordered_map<std::string, slot> slots;
+      };
+
+      /**
+       * @brief Records a response sent by the handler and stores it when it is complete.
+       */
+      class recording : public response::recorder {
+        public:
+          recording(std::shared_ptr<response_cache> cache, std::string key,
+                    std::shared_ptr<fill> f)
+              : _cache(std::move(cache)), _key(std::move(key)), _fill(std::move(f)),
+                _e(std::make_shared<entry>()), _cacheable(true) { }
+
+          void record_headers(unsigned short status_code,
+                              const header_builder& headers) override {
+            _e->status_code = status_code;
+            _cacheable = cacheable(status_code, headers);
+            if(!_cacheable) {
+              return;
+            }
+            _e->head = std::string(status_table::line(status_code));
+            headers.for_each([this](string_view name, string_view value) {
+              const known_header h = find_known_header(name);
+              if(h == known_header::connection || h == known_header::content_length ||
+                 h == known_header::keep_alive || h == known_header::transfer_encoding) {
+                return;
+              }
+              _e->headers.push_back(std::make_pair(std::string(name), std::string(value)));
+              append(_e->head, name);
+              _e->head += ": ";
+              append(_e->head, value);
+              _e->head += "\r\n";
+            });
+          }
+
+          void record_data(const char* data, size_t length) override {
+            if(!_cacheable) {
+              return;
+            }
+            if(_e->body.size() + length > _cache->_policy.max_size()) {
+              _cacheable = false;
+              return;
+            }
+            _e->body.append(data, length);
+          }
+
+          void record_end(bool complete) override {
+            std::shared_ptr<const entry> e;
+            if(complete && _cacheable) {
+              _e->head += "Content-Length: " + std::to_string(_e->body.size()) + "\r\n";
+              _e->expires = clock::now() + std::chrono::milliseconds(_cache->_policy.ttl());
+              e = _e;
+            }
+            _cache->store(_key, _fill, e);
+          }
+
+        private:
+          /**
+           * @brief The cache the response is stored in.
+           */
+          std::shared_ptr<response_cache> _cache;
+
+          /**
+           * @brief Key of the response.
+           */
+          std::string _key;
+
+          /**
+           * @brief The fill this recording completes.
+           */
+          std::shared_ptr<fill> _fill;
+
+          /**
+           * @brief The response recorded so far.
+           */
+          std::shared_ptr<entry> _e;
+
+          /**
+           * @brief `false` once the response is known not to be cacheable.
+           */
+          bool _cacheable;
+      };
+
+      /**
+       * @brief Builds the key of a request.
+       */
+      std::string make_key(const request& req, const response& res) const {
+        std::string key;
+        if(req.has_header(known_header::host)) {
+          append(key, req.header(known_header::host));
+        }
+        key += '\n';
+        append(key, req.path());
+        for(auto itr = _policy.key_headers().cbegin(); itr != _policy.key_headers().cend(); ++itr) {
+          // Tells a missing header from an empty one.
+          if(req.has_header(*itr)) {
+            key += '\n';
+            append(key, req.header(*itr));
+          }
+          else {
+            key += '\0';
+          }
+        }
+        key += '\n';
+        key += static_cast<char>(res._compressible ? '1' + static_cast<int>(res._coding) : '0');
+        return key;
+      }
+
+      /**
+       * @brief Appends a string view to a string.
+       */
+      static void append(std::string& s, string_view v) {
+        s.append(v.data(), v.size());
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a response can be cached, given its status and
+       *        headers.
+       */
+      static bool cacheable(unsigned short status_code, const header_builder& headers) {
+        if(status_code != 200 && status_code != 203 && status_code != 300 &&
+           status_code != 301 && status_code != 404 && status_code != 410) {
+          return false;
+        }
+        string_view cookie;
+        if(headers.find("Set-Cookie", cookie)) {
+          return false;
+        }
+        string_view control = headers.get(known_header::cache_control);
+        if(contains_token(control, "no-store") || contains_token(control, "no-cache") ||
+           contains_token(control, "private")) {
+          return false;
+        }
+        return !contains_token(headers.get(known_header::vary), "*");
+      }
+
+      /**
+       * @brief Stores a recorded response, if it is cacheable, and answers the requests that
+       *        waited for it.
+       * @param[in] key Key of the response.
+       * @param[in] f The fill that recorded it.
+       * @param[in] e The response, or `nullptr` if it is not cacheable.
+       */
+      void store(const std::string& key, const std::shared_ptr<fill>& f,
+                 std::shared_ptr<const entry> e) {
+        shard& sh = _shards[std::hash<std::string>()(key) % shard_count];
+        std::vector<std::function<void(std::shared_ptr<const entry>)>> waiters;
+        {
+          std::lock_guard<std::mutex> lock(sh.mutex);
+          auto itr = sh.slots.find(key);
+          if(itr != sh.slots.end() && itr->second.filling == f) {
+            waiters.swap(f->waiters);
+            itr->second.filling.reset();
+            if(e) {
+              itr->second.cached = e;
+            }
+            if(!itr->second.cached) {
+              sh.slots.erase(itr);
+            }
+            else if(sh.slots.size() > _shard_capacity) {
+              evict(sh, itr->first);
+            }
+          }
+        }
+        for(auto& waiter : waiters) {
+          waiter(e);
+        }
+      }
+
+      /**
+       * @brief Removes the expired responses of a shard that is over its capacity, then the
+       *        response just stored if the shard is still over it.
+       * @param[in] sh The shard, whose lock is held.
+       * @param[in] key Key of the response just stored.
+       */
+      void evict(shard& sh, const std::string& key) {
+        const clock::time_point now = clock::now();
+        for(auto itr = sh.slots.begin(); itr != sh.slots.end();) {
+          if(!itr->second.filling && itr->first != key && itr->second.cached->expires <= now) {
+            itr = sh.slots.erase(itr);
+          }
+          else {
+            ++itr;
+          }
+        }
+        if(sh.slots.size() > _shard_capacity) {
+          auto itr = sh.slots.find(key);
+          if(!itr->second.filling) {
+            sh.slots.erase(itr);
+          }
+        }
+      }
+
+      /**
+       * @brief Answers a request with a cached response.
+       */
+      static void send(const entry& e, response& res) {
+        if(res._sink == nullptr) {
+          res.send_recorded(e.status_code, e.head, e.body);
+          return;
+        }
+        res.set_status_code(e.status_code).disable_compression();
+        for(auto itr = e.headers.cbegin(); itr != e.headers.cend(); ++itr) {
+          res.set_header(itr->first, itr->second);
+        }
+        res.set_content_length(e.body.size());
+        res.write_block(reinterpret_cast<const unsigned char*>(e.body.data()), e.body.size());
+      }
+
+      /**
+       * @brief How responses are cached.
+       */
+      const cache_policy _policy;
+
+      /**
+       * @brief Maximum number of keys in each shard.
+       */
+      const size_t _shard_capacity;
+
+      /**
+       * @brief The shards.
+       */
+      shard _shards[shard_count];
+  };
+}
@@ -2,14 +2,37 @@
  * @file router.hpp
  */
 #pragma once
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <vector>
+#include <webby/executor.hpp>
+#include <webby/filter.hpp>
+#include <webby/method.hpp>
+#include <webby/request.hpp>
+#include <webby/response.hpp>
+#include <webby/response_cache.hpp>
+#include <webby/utility.hpp>
 
 /**
  * @namespace webby
  */
 namespace webby {
+  // Forward reference.
+  template<typename T> class rest_handler;
+
   /**
    * @brief Routes request to the correct handler.
+   *
+   * Routes are stored in a trie keyed by path segment, so the cost of routing a request depends
+   * on the depth of its path rather than on the number of routes.
+   *
+   * Filters added with router::use() run around the handlers. Each route keeps a flat array of
+   * the stages that apply to it, resolved when the route or the filter is added, so a request
+   * only walks that array. See webby::stage.
    */
   class router {
     public:
@@ -18,40 +41,222 @@ namespace webby {
        */
       typedef std::function<void(const request& ,response&)> handler_t;
 
+      /**
+       * @brief Signature of asynchronous route handlers.
+       *
+       * The handler is called with the response already suspended, and finishes it through the
+       * completion once the work it started is done. See webby::completion.
+       */
+      typedef std::function<void(const request&, response&, completion)> async_handler_t;
+
       /**
        * @brief Default constructor.
        */
       router() {
         _error_handler = router::default_error_handler;
+        use(location_filter());
       }
 
       /**
        * @brief Adds a new route to the table.
+       * @param[in] path Path to match, e.g. `/items` or `/users/:id/posts`. A segment that starts
+       *                 with `:` matches any single segment and is captured as a parameter that
+       *                 handlers read with webby::request::param().
+       * @param[in] mask Mask of the HTTP methods that the route accepts.
+       * @param[in] handler Function that handles requests for the route.
+       * @returns Reference to this webby::router object for chaining.
+       *
+       * Routes are compiled into a trie of path segments as they are added, so nothing needs to be
+       * done between the last call to router::add() and webby::server::run(). A path may be added
+       * several times with different method masks.
+       *
+       * @throws std::invalid_argument if a parameter has a different name than a parameter in the
+       *         same position of a route added before with the same leading segments, e.g.
+       *         `/users/:name` after `/users/:id/posts`. Routes share the trie node of a parameter, so
+       *         its value could only be read under one of the names.
        */
       router& add(const std::string& path, enum webby::method mask, handler_t handler) {
-        _route.push_back(route{path, mask, handler});
+        node* n = &_root;
+        size_t first = 0;
+        while(first < path.size()) {
+          size_t last = path.find('/', first);
+          if(last == std::string::npos) {
+            last = path.size();
+          }
+          if(last > first) {
+            n = &n->child(path.substr(first, last - first));
+          }
+          first = last + 1;
+        }
+        n->endpoints.push_back(endpoint{path, mask, handler, std::vector<stage>()});
+        for(auto itr = _filters.cbegin(); itr != _filters.cend(); ++itr) {
+          if(applies(itr->prefix, path)) {
+            n->endpoints.back().stages.push_back(itr->s);
+          }
+        }
+        return *this;
+      }
+
+      /**
+       * @brief Adds a new route whose handler completes its responses asynchronously.
+       * @param[in] path Path to match, as for the synchronous overload.
+       * @param[in] mask Mask of the HTTP methods that the route accepts.
+       * @param[in] handler Function that starts handling requests for the route.
+       * @returns Reference to this webby::router object for chaining.
+       *
+       * In an event loop the loop serves other connections until the handler finishes the
+       * response. Worker threads of the thread pool wait for it instead. Coroutines that return
+       * webby::task are registered with the synchronous overload.
+       */
+      router& add(const std::string& path, enum webby::method mask, async_handler_t handler) {
+        return add(path, mask, handler_t([handler](const request& req, response& res) {
+          handler(req, res, res.suspend());
+        }));
+      }
+
+      /**
+       * @brief Adds a new route whose `GET` and `HEAD` responses are cached.
+       * @param[in] path Path to match, as for the uncached overload.
+       * @param[in] mask Mask of the HTTP methods that the route accepts.
+       * @param[in] handler Function that handles requests that are not answered from the cache.
+       * @param[in] policy How long responses are kept and which request headers tell them apart.
+       * @returns Reference to this webby::router object for chaining.
+       *
+       * Requests with other methods always go to the handler. See webby::response_cache.
+       */
+      router& add(const std::string& path, enum webby::method mask, handler_t handler,
+                  const cache_policy& policy) {
+        return add(path, mask, response_cache::wrap(policy, handler));
+      }
+
+      /**
+       * @brief Adds a new route whose handler completes its responses asynchronously, and whose
+       *        `GET` and `HEAD` responses are cached.
+       * @param[in] path Path to match, as for the uncached overload.
+       * @param[in] mask Mask of the HTTP methods that the route accepts.
+       * @param[in] handler Function that starts handling requests that are not answered from the
+       *                    cache.
+       * @param[in] policy How long responses are kept and which request headers tell them apart.
+       * @returns Reference to this webby::router object for chaining.
+       */
+      router& add(const std::string& path, enum webby::method mask, async_handler_t handler,
+                  const cache_policy& policy) {
+        return add(path, mask, handler_t([handler](const request& req, response& res) {
+          handler(req, res, res.suspend());
+        }), policy);
+      }
+
+      /**
+       * @brief Adds the routes of a RESTful resource.
+       * @param[in] path Path of the collection, e.g. `/items`. Its members are routed at
+       *                 `/items/:id`.
+       * @param[in] mask Mask of the HTTP methods that the resource accepts.
+       * @param[in] resource Resource derived from webby::rest_handler.
+       * @returns Reference to this webby::router object for chaining.
+       *
+       * Each method of the collection and of its members is routed straight to the member of
+       * @p resource that handles it. See webby::rest_handler.
+       */
+      template<typename T>
+      typename std::enable_if<std::is_base_of<rest_handler<T>, T>::value, router&>::type
+      add(const std::string& path, enum webby::method mask, T resource) {
+        rest_handler<T>::add_routes(*this, path, mask, std::make_shared<T>(std::move(resource)));
+        return *this;
+      }
+
+      /**
+       * @brief Adds a filter that runs around the handlers of every route.
+       * @param[in] filter The filter. See webby::stage.
+       * @returns Reference to this webby::router object for chaining.
+       *
+       * Filters run in the order they were added. Those added for every route also run around the
+       * error handler and the "405 Method Not Allowed" responses.
+       */
+      template<typename F>
+      router& use(F filter) {
+        return use("/", std::move(filter));
+      }
+
+      /**
+       * @brief Adds a filter that runs around the handlers of the routes under a path.
+       * @param[in] prefix Path whose routes the filter applies to, e.g. `/admin` for `/admin` and
+       *                   `/admin/users/:id`, or `/` for every route.
+       * @param[in] filter The filter. See webby::stage.
+       * @returns Reference to this webby::router object for chaining.
+       *
+       * The filter applies to the routes added before it as well as after it.
+       */
+      template<typename F>
+      router& use(const std::string& prefix, F filter) {
+        std::shared_ptr<F> f = std::make_shared<F>(std::move(filter));
+        std::string p = prefix;
+        while(p.size() > 1 && p[p.size() - 1] == '/') {
+          p.erase(p.size() - 1);
+        }
+        if(p.empty()) {
+          p = "/";
+        }
+        _filters.push_back(registered_filter{p, f, stage::of(*f)});
+        add_stage(_root, _filters.back());
+        if(p == "/") {
+          _error_stages.push_back(_filters.back().s);
+        }
+        return *this;
+      }
+
+      /**
+       * @brief Removes every filter, including the webby::location_filter a router starts with.
+       * @returns Reference to this webby::router object for chaining.
+       */
+      router& clear_filters() {
+        _filters.clear();
+        _error_stages.clear();
+        clear_stages(_root);
         return *this;
       }
 
       /**
        * @brief Routes a request to the appropriate handler.
+       *
+       * The route that matches the most leading segments of the request path wins. Static
+       * segments are preferred over parameters, and the query string is ignored. If the matching
+       * route does not accept the request method a "405 Method Not Allowed" response is sent.
        */
       void dispatch(request& req, response& res) const {
-        for(auto itr = _route.cbegin(); itr != _route.cend(); ++itr) {
-          if(req.path().compare(0, itr->path.length(), itr->path) == 0) {
-            if(req.method() == (req.method() & itr->mask)) {
-              req.set_route(itr->path);
-              itr->handler(req, res);
-            }
-            else {
-              res.set_status_code(405)
-                 .set_header("Allow", to_string(itr->mask));
+        string_view path = req.path();
+        size_t query = path.find('?');
+        if(query != string_view::npos) {
+          path = path.substr(0, query);
+        }
+
+        match best;
+        match current;
+        find(_root, path, 0, current, best);
+        if(best.n == nullptr) {
+          run_stages(_error_stages.data(), _error_stages.size(), req, res, _error_handler);
+          return;
+        }
+
+        enum webby::method allowed = static_cast<enum webby::method>(0);
+        for(auto itr = best.n->endpoints.cbegin(); itr != best.n->endpoints.cend(); ++itr) {
+          if(req.method() == (req.method() & itr->mask)) {
+            req.set_route(path.substr(0, best.length == 0 ? 1 : best.length));
+            req._pattern = itr->path;
+            for(unsigned i = 0; i < best.count; ++i) {
+              req._params[i] = best.params[i];
             }
+            req._param_count = best.count;
+            run_stages(itr->stages.data(), itr->stages.size(), req, res, itr->handler);
             return;
           }
+          allowed = allowed | itr->mask;
         }
 
-        _error_handler(req, res);
+        run_stages(_error_stages.data(), _error_stages.size(), req, res,
+            [allowed](const request&, response& res) {
+              res.set_status_code(405)
+                 .set_header("Allow", to_string(allowed));
+            });
       }
 
       /**
@@ -83,11 +288,11 @@ namespace webby {
 
     private:
       /**
-       * @brief The structure of a route.
+       * @brief A handler registered for a route.
        */
-      struct route {
+      struct endpoint {
         /**
-         * @brief base path to match.
+         * @brief Path the route was registered with.
          */
         std::string path;
 
@@ -100,12 +305,217 @@ namespace webby {
          * @brief Function that handles processing for the route.
          */
         handler_t handler;
+
+        /**
+         * @brief Filters that run around the handler, in order.
+         */
+        std::vector<stage> stages;
+      };
+
+      /**
+       * @brief A filter added with router::use().
+       */
+      struct registered_filter {
+        /**
+         * @brief Path whose routes the filter applies to, without a trailing `/`.
+         */
+        std::string prefix;
+
+        /**
+         * @brief The filter, shared with the copies of the router.
+         */
+        std::shared_ptr<void> filter;
+
+        /**
+         * @brief Stage that calls the filter.
+         */
+        stage s;
       };
 
       /**
-       * @brief Stores routes and handlers.
+       * @brief A node in the routing trie. Each node matches one path segment.
+       */
+      struct node {
+        /**
+         * @brief Text of a static segment, or the name of a parameter without the `:`.
+         */
+        std::string segment;
+
+        /**
+         * @brief Static child segments sorted by text so they can be binary searched.
+         */
+        std::vector<node> children;
+
+        /**
+         * @brief Parameter child segment. There is at most one.
+         */
+        std::vector<node> parameter;
+
+        /**
+         * @brief Handlers for routes that end at this node.
+         */
+        std::vector<endpoint> endpoints;
+
+        /**
+         * @brief Finds a static child.
+         * @returns the child, or `nullptr` if there is none for @p segment.
+         */
+        const node* find(string_view segment) const {
+          auto itr = std::lower_bound(children.begin(), children.end(), segment,
+              [](const node& n, string_view s) { return string_view(n.segment) < s; });
+          return (itr != children.end() && string_view(itr->segment) == segment) ? &*itr : nullptr;
+        }
+
+        /**
+         * @brief Gets or creates the child for a pattern segment.
+         * @throws std::invalid_argument if @p pattern is a parameter and the parameter child has
+         *         a different name.
+         */
+        node& child(const std::string& pattern) {
+          if(pattern[0] == ':') {
+            if(parameter.empty()) {
+              parameter.push_back(node());
+              parameter.back().segment = pattern.substr(1);
+            }
+            else if(pattern.compare(1, std::string::npos, parameter.back().segment) != 0) {
+              throw std::invalid_argument("Route parameter " + pattern + " conflicts with :" +
+                                          parameter.back().segment);
+            }
+            return parameter.back();
+          }
+          auto itr = std::lower_bound(children.begin(), children.end(), pattern,
+              [](const node& n, const std::string& s) { return n.segment < s; });
+          if(itr == children.end() || itr->segment != pattern) {
+            itr = children.insert(itr, node());
+            itr->segment = pattern;
+          }
+          return *itr;
+        }
+      };
+
+      /**
+       * @brief State of a match in progress, and the best match found.
+       */
+      struct match {
+        match() : n(nullptr), length(0), count(0) { }
+
+        /**
+         * @brief Node that matched, or `nullptr`.
+         */
+        const node* n;
+
+        /**
+         * @brief Length of the part of the path that matched.
+         */
+        size_t length;
+
+        /**
+         * @brief Captured parameters.
+         */
+        request::parameter params[request::max_params];
+
+        /**
+         * @brief Number of captured parameters.
+         */
+        unsigned count;
+      };
+
+      /**
+       * @brief Searches the trie for the route that matches the most segments of a path.
+       * @param[in] n Node that matched the path up to @p pos.
+       * @param[in] path Request path without the query string.
+       * @param[in] pos Offset of the end of the part of the path matched so far.
+       * @param[in] current Parameters captured so far.
+       * @param[out] best Receives the best match.
+       */
+      static void find(const node& n, string_view path, size_t pos, match& current, match& best) {
+        if(!n.endpoints.empty() && (best.n == nullptr || pos > best.length)) {
+          best = current;
+          best.n = &n;
+          best.length = pos;
+        }
+
+        if(pos >= path.size()) {
+          return;
+        }
+        const size_t first = pos + 1;
+        size_t last = path.find('/', first);
+        if(last == string_view::npos) {
+          last = path.size();
+        }
+        string_view segment = path.substr(first, last - first);
+        if(segment.empty()) {
+          return;
+        }
+
+        const node* child = n.find(segment);
+        if(child != nullptr) {
+          find(*child, path, last, current, best);
+        }
+        if(!n.parameter.empty() && current.count < request::max_params) {
+          current.params[current.count++] = request::parameter{n.parameter[0].segment, segment};
+          find(n.parameter[0], path, last, current, best);
+          --current.count;
+        }
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a filter added for @p prefix applies to the
+       *        route added with @p path.
+       */
+      static bool applies(const std::string& prefix, const std::string& path) {
+        return prefix == "/" ||
+               (path.compare(0, prefix.size(), prefix) == 0 &&
+                (path.size() == prefix.size() || path[prefix.size()] == '/'));
+      }
+
+      /**
+       * @brief Adds the stage of a filter to the routes under a node that it applies to.
+       */
+      static void add_stage(node& n, const registered_filter& f) {
+        for(auto& e : n.endpoints) {
+          if(applies(f.prefix, e.path)) {
+            e.stages.push_back(f.s);
+          }
+        }
+        for(auto& child : n.children) {
+          add_stage(child, f);
+        }
+        for(auto& child : n.parameter) {
+          add_stage(child, f);
+        }
+      }
+
+      /**
+       * @brief Removes the stages of the routes under a node.
+       */
+      static void clear_stages(node& n) {
+        for(auto& e : n.endpoints) {
+          e.stages.clear();
+        }
+        for(auto& child : n.children) {
+          clear_stages(child);
+        }
+        for(auto& child : n.parameter) {
+          clear_stages(child);
+        }
+      }
+
+      /**
+       * @brief Root of the routing trie. It matches the path `/`.
+       */
+      node _root;
+
+      /**
+       * @brief Filters in the order they were added.
+       */
+      std::vector<registered_filter> _filters;
+
+      /**
+       * @brief Stages of the filters added for every route, which also run around the error
+       *        handler and "405 Method Not Allowed" responses.
        */
-      std::vector<route> _route;
+      std::vector<stage> _error_stages;
 
       /**
        * @brief Stores the error handler.
@@ -0,0 +1,219 @@
+/**
+ * @file scan.hpp
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define WEBBY_SCAN_AVX2 1
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define WEBBY_SCAN_SSE42 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WEBBY_SCAN_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WEBBY_SCAN_NEON 1
+#endif
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Vectorized delimiter scanning used by webby::parser.
+   *
+   * The kernel is selected at compile time from the instruction sets enabled for the build: AVX2
+   * scans 32 bytes per step, SSE4.2, SSE2 and NEON scan 16, and a scalar loop handles the tail and
+   * any other target. Build with `-mavx2`, `-msse4.2` or `-march=native` (the `WEBBY_NATIVE` CMake
+   * option) to select the wider kernels.
+   */
+  namespace scan {
+    /**
+     * @brief Gets a value that indicates whether a byte ends a line scan.
+     *
+     * Line scans stop at CR and LF, and at control characters that are not allowed in a request
+     * line or header field: everything below 0x20 except HT, and DEL. The parser checks that a
+     * CR is followed by LF.
+     */
+    inline bool is_line_stop(unsigned char c) {
+      return (c < 0x20 && c != '\t') || c == 0x7f;
+    }
+
+    /**
+     * @brief Name of the kernel selected at compile time.
+     */
+    inline const char* kernel() {
+#if defined(WEBBY_SCAN_AVX2)
+      return "avx2";
+#elif defined(WEBBY_SCAN_SSE42)
+      return "sse4.2";
+#elif defined(WEBBY_SCAN_SSE2)
+      return "sse2";
+#elif defined(WEBBY_SCAN_NEON)
+      return "neon";
+#else
+      return "scalar";
+#endif
+    }
+
+#if defined(WEBBY_SCAN_NEON)
+    /**
+     * @brief Converts a NEON comparison result to the offset of its first set byte, or 16.
+     */
+    inline unsigned first_set(uint8x16_t mask) {
+      // Narrows each byte to a nibble so the 128-bit mask fits in one 64-bit lane.
+      uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(
+          vshrn_n_u16(vreinterpretq_u16_u8(mask), 4)), 0);
+      return bits == 0 ? 16 : static_cast<unsigned>(__builtin_ctzll(bits)) / 4;
+    }
+#endif
+
+    /**
+     * @brief Finds the end of a line.
+     * @param[in] first Start of the range.
+     * @param[in] last End of the range.
+     * @returns the first byte in `[first, last)` for which scan::is_line_stop() is `true`, or
+     *          @p last. The caller distinguishes CR and LF from a forbidden control character.
+     */
+    inline const char* find_line_stop(const char* first, const char* last) {
+#if defined(WEBBY_SCAN_AVX2)
+      const __m256i space = _mm256_set1_epi8(0x20);
+      const __m256i del = _mm256_set1_epi8(0x7f);
+      const __m256i tab = _mm256_set1_epi8('\t');
+      const __m256i minus_one = _mm256_set1_epi8(-1);
+      while(last - first >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        // Bytes 0x00-0x1f: below 0x20 in a signed compare and not negative (0x80-0xff).
+        __m256i ctl = _mm256_and_si256(_mm256_cmpgt_epi8(space, v),
+                                       _mm256_cmpgt_epi8(v, minus_one));
+        ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), ctl);
+        __m256i stop = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, del));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(stop));
+        if(mask != 0) {
+          return first + __builtin_ctz(mask);
+        }
+        first += 32;
+      }
+#elif defined(WEBBY_SCAN_SSE42)
+      // Ranges of stop bytes: 0x00-0x08, 0x0a-0x1f and 0x7f.
+      static const char ranges[16] = "\x00\x08\x0a\x1f\x7f\x7f";
+      const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges));
+      while(last - first >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        int i = _mm_cmpestri(r, 6, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                             _SIDD_LEAST_SIGNIFICANT);
+        if(i != 16) {
+          return first + i;
+        }
+        first += 16;
+      }
+#elif defined(WEBBY_SCAN_SSE2)
+      const __m128i space = _mm_set1_epi8(0x20);
+      const __m128i del = _mm_set1_epi8(0x7f);
+      const __m128i tab = _mm_set1_epi8('\t');
+      const __m128i minus_one = _mm_set1_epi8(-1);
+      while(last - first >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        __m128i ctl = _mm_and_si128(_mm_cmpgt_epi8(space, v), _mm_cmpgt_epi8(v, minus_one));
+        ctl = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), ctl);
+        __m128i stop = _mm_or_si128(ctl, _mm_cmpeq_epi8(v, del));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(stop));
+        if(mask != 0) {
+          return first + __builtin_ctz(mask);
+        }
+        first += 16;
+      }
+#elif defined(WEBBY_SCAN_NEON)
+      const uint8x16_t space = vdupq_n_u8(0x20);
+      const uint8x16_t del = vdupq_n_u8(0x7f);
+      const uint8x16_t tab = vdupq_n_u8('\t');
+      while(last - first >= 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(first));
+        uint8x16_t ctl = vbicq_u8(vcltq_u8(v, space), vceqq_u8(v, tab));
+        unsigned i = first_set(vorrq_u8(ctl, vceqq_u8(v, del)));
+        if(i != 16) {
+          return first + i;
+        }
+        first += 16;
+      }
+#endif
+      while(first != last && !is_line_stop(static_cast<unsigned char>(*first))) {
+        ++first;
+      }
+      return first;
+    }
+
+    /**
+     * @brief Finds a delimiter, stopping early at the end of the line.
+     * @param[in] first Start of the range.
+     * @param[in] last End of the range.
+     * @param[in] c Delimiter to find, e.g. the space after the request target.
+     * @returns the first byte in `[first, last)` that is @p c, CR or LF, or @p last.
+     */
+    inline const char* find_delimiter(const char* first, const char* last, char c) {
+#if defined(WEBBY_SCAN_AVX2)
+      const __m256i d = _mm256_set1_epi8(c);
+      const __m256i lf = _mm256_set1_epi8('\n');
+      const __m256i cr = _mm256_set1_epi8('\r');
+      while(last - first >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, d), _mm256_or_si256(
+            _mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+        if(mask != 0) {
+          return first + __builtin_ctz(mask);
+        }
+        first += 32;
+      }
+#elif defined(WEBBY_SCAN_SSE42)
+      const char set[16] = { c, '\r', '\n' };
+      const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(set));
+      while(last - first >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        int i = _mm_cmpestri(s, 3, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                             _SIDD_LEAST_SIGNIFICANT);
+        if(i != 16) {
+          return first + i;
+        }
+        first += 16;
+      }
+#elif defined(WEBBY_SCAN_SSE2)
+      const __m128i d = _mm_set1_epi8(c);
+      const __m128i lf = _mm_set1_epi8('\n');
+      const __m128i cr = _mm_set1_epi8('\r');
+      while(last - first >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, d), _mm_or_si128(_mm_cmpeq_epi8(v, lf),
+                                                                      _mm_cmpeq_epi8(v, cr)));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hit));
+        if(mask != 0) {
+          return first + __builtin_ctz(mask);
+        }
+        first += 16;
+      }
+#elif defined(WEBBY_SCAN_NEON)
+      const uint8x16_t d = vdupq_n_u8(static_cast<uint8_t>(c));
+      const uint8x16_t lf = vdupq_n_u8('\n');
+      const uint8x16_t cr = vdupq_n_u8('\r');
+      while(last - first >= 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(first));
+        unsigned i = first_set(vorrq_u8(vceqq_u8(v, d), vorrq_u8(vceqq_u8(v, lf),
+                                                                 vceqq_u8(v, cr))));
+        if(i != 16) {
+          return first + i;
+        }
+        first += 16;
+      }
+#endif
+      while(first != last && *first != c && *first != '\r' && *first != '\n') {
+        ++first;
+      }
+      return first;
+    }
+  }
+}
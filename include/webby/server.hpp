@@ -4,12 +4,31 @@
 #pragma once
 
 #include <asf.hpp>
-#include <net.hpp>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
+#include <webby/access_log.hpp>
+#include <webby/affinity.hpp>
 #include <webby/config.hpp>
+#include <webby/connection.hpp>
+#include <webby/event_loop.hpp>
+#include <webby/executor.hpp>
+#include <webby/http2.hpp>
+#include <webby/metrics.hpp>
+#include <webby/queue.hpp>
 #include <webby/request.hpp>
 #include <webby/response.hpp>
 #include <webby/router.hpp>
+#include <webby/socket.hpp>
+#include <webby/tls.hpp>
 
 namespace webby {
   /**
@@ -48,14 +67,24 @@ namespace webby {
        * request is handled, or if an error is sent back to the client.
        */
       server(const webby::config& config, const webby::router& router)
-            : _config(config), _router(router) {
-        _config.error_log() << qlog::debug
-                            << "server::server(const webby::config&)" << std::endl;
+            : server(config, std::shared_ptr<const webby::router>(&router,
+                                                                   [](const webby::router*) { })) {
+      }
+
+      /**
+       * @brief Constructor that accepts a server configuration and a router it shares.
+       * @param[in] config Server configuration.
+       * @param[in] router Request router, which can later be replaced with server::set_router().
+       */
+      server(const webby::config& config, std::shared_ptr<const webby::router> router)
+            : _config(config), _router(std::move(router)), _id(next_id()), _generation(0),
+              _stopping(false) {
+        WEBBY_LOG(_config, debug) << "server::server(const webby::config&)";
         try {
           init();
         }
         catch(const webby::server::error& e) {
-          _config.error_log() << qlog::error << e.what() << std::endl;
+          WEBBY_LOG(_config, error) << e.what();
           throw;
         }
       }
@@ -64,43 +93,99 @@ namespace webby {
        * @brief Destructor
        */
       ~server() {
-        _config.error_log() << qlog::debug << "server::~server" << std::endl;
+        WEBBY_LOG(_config, debug) << "server::~server";
+        ::close(_stop[0]);
+        ::close(_stop[1]);
       }
 
       /**
        * @brief Runs the server.
+       *
+       * With `config::concurrency_model::thread_pool` the calling thread becomes the acceptor: it
+       * blocks on the server socket and hands each accepted connection to a queue that is drained
+       * by `webby::config::worker_threads()` worker threads, so a slow client or handler only
+       * stalls its own thread.
+       *
+       * With `config::concurrency_model::event_loop` the server runs one event loop per worker
+       * thread, the calling thread included.
+       *
+       * It returns once server::stop() has been called and the connections have been drained.
        */
       void run() {
-        _config.error_log() << qlog::debug << "server::run()" << std::endl;
-
-        // The base implementation of the server is the simplest possible: An infinite loop that
-        // blocks on the server::accept() call until a client connects.
-        while(1) {
-          // Accept the incoming connection and create a worker socket for it.
-          net::worker worker = _server.accept();
+        WEBBY_LOG(_config, debug) << "server::run()";
+        if(_config.concurrency() == config::concurrency_model::event_loop) {
+          run_event_loops();
+        }
+        else {
+          run_thread_pool();
+        }
+      }
 
-          // Some connection logging.
-          _config.error_log() << qlog::debug << "Accepted connection" << std::endl;
-          _config.error_log() << qlog::debug << "  Client Hostname: " << worker.client_hostname()
-              << std::endl;
-          _config.error_log() << qlog::debug << "  Client IP: " << worker.client_ip() << std::endl;
+      /**
+       * @brief Gets the server's metrics registry.
+       *
+       * Every request is counted by route, status class and size, and its latency is recorded.
+       * Mount a webby::metrics_handler on the router to expose them to Prometheus.
+       */
+      webby::metrics& metrics() {
+        return _metrics;
+      }
 
-          // Decompose the HTTP request from the client.
-          request req(_config, worker);
+      /**
+       * @brief Stops accepting connections and lets server::run() return once the requests in
+       *        progress have been answered.
+       *
+       * Idle persistent connections are closed, and the others are closed after their current
+       * response, which carries `Connection: close`. HTTP/2 clients are sent `GOAWAY`. This can
+       * be called from any thread, and from a signal handler.
+       */
+      void stop() {
+        _stopping.store(true);
+        const char c = 0;
+        ssize_t n = ::write(_stop[1], &c, 1);
+        (void)(n);
+      }
 
-          // Create the default response for the handler to populate.
-          response res(_config, worker);
+      /**
+       * @brief Gets a value that indicates whether server::stop() has been called.
+       */
+      bool stopping() const {
+        return _stopping.load(std::memory_order_relaxed);
+      }
 
-          // Populates some default headers.
-          if(req.has_header("Host")) {
-            std::ostringstream location;
-            location << "http://" << req.header("Host") << req.path();
-            res.set_header("Location", location.str());
-          }
+      /**
+       * @brief Replaces the router while the server runs.
+       * @param[in] router The new router.
+       *
+       * Requests received from now on are dispatched to the new router, while those in progress,
+       * asynchronous ones included, finish with the router they started with. Dispatch itself
+       * takes no lock: each worker thread keeps a reference to the router it last used and only
+       * picks up the new one when it sees that the router has changed. A router is released once
+       * no worker uses it any more.
+       *
+       * The configuration cannot be replaced this way, since the loggers, the listener and every
+       * connection depend on it. Hand the listener to a new process instead; see
+       * server::listener().
+       */
+      void set_router(std::shared_ptr<const webby::router> router) {
+        // The previous router is released after the lock, if no worker holds it.
+        std::lock_guard<std::mutex> lock(_router_mutex);
+        _router.swap(router);
+        _generation.fetch_add(1, std::memory_order_release);
+      }
 
-          // Routes the request to a handler.
-          _router.dispatch(req, res);
-        }
+      /**
+       * @brief Gets the descriptor of the listening socket, to hand to the process that replaces
+       *        this one.
+       *
+       * The descriptor is inherited across `fork()` and `exec()`, or can be sent over a Unix
+       * socket with `SCM_RIGHTS`. The new process passes it to webby::config::set_listener() and
+       * starts accepting connections; this one then calls server::stop(). Connections that are
+       * queued on the socket in between are accepted by the new process, so none is refused and
+       * the address is never unbound.
+       */
+      int listener() const {
+        return _listener.descriptor();
       }
 
     private:
@@ -108,23 +193,879 @@ namespace webby {
       const webby::config& _config;
 
       /**
-       * @brief Request router.
+       * @brief Request router. Protected by server::_router_mutex.
        */
-      const webby::router& _router;
+      std::shared_ptr<const webby::router> _router;
+
+      /**
+       * @brief Number that identifies the server in the router cache of each thread.
+       */
+      const uint64_t _id;
+
+      /**
+       * @brief Number of times the router has been replaced.
+       */
+      std::atomic<uint64_t> _generation;
+
+      /**
+       * @brief Protects server::_router.
+       */
+      std::mutex _router_mutex;
+
+      /**
+       * @brief `true` once server::stop() has been called.
+       */
+      std::atomic<bool> _stopping;
+
+      /**
+       * @brief Pipe written to by server::stop(): read end, then write end. It is never read, so
+       *        it stays readable for the acceptor and every event loop.
+       */
+      int _stop[2];
 
       /**
        * @brief Initializes the server.
        */
       void init() {
-        _config.error_log() << qlog::debug << "server::init()" << std::endl;
-        _server.connect(_config.address(), _config.port());
-        _config.error_log() << qlog::info << "Server listening at " << _config.address() << ":"
-          << _config.port() << std::endl;
+        WEBBY_LOG(_config, debug) << "server::init()";
+        if(_config.listener() >= 0) {
+          _listener = webby::socket(_config.listener());
+        }
+        else {
+          try {
+            _listener = webby::socket::listen(_config.address(), _config.port(),
+                _config.concurrency() == config::concurrency_model::event_loop);
+          }
+          catch(const webby::socket::error& e) {
+            throw server::error(e.what());
+          }
+        }
+        if(_config.tls()) {
+#ifdef WEBBY_HAVE_OPENSSL
+          try {
+            _tls.reset(new tls_context(_config.tls_certificate(), _config.tls_private_key(),
+                                       _config.http2()));
+          }
+          catch(const tls_context::error& e) {
+            throw server::error(e.what());
+          }
+#else
+          throw server::error("TLS is configured but webby was built without OpenSSL");
+#endif
+        }
+        if(_config.cpu_affinity()) {
+          _placement = cpu_placement::detect();
+        }
+        if(::pipe(_stop) != 0) {
+          throw server::error(std::string("pipe: ") + strerror(errno));
+        }
+        for(int fd : _stop) {
+          ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+          ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        WEBBY_LOG(_config, info) << "Server listening at " << _config.address() << ":"
+          << _config.port() << (_config.listener() >= 0 ? " on an inherited socket" : "")
+          << (_config.tls() ? " with TLS" : "");
+
+        // Formats the response to connections that are turned away once, so overload costs as
+        // little as possible.
+        _busy = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: " +
+                std::to_string(_config.retry_after()) + "\r\nConnection: close\r\n\r\n";
+      }
+
+      /**
+       * @brief Turns away a connection the server is too busy to serve with a `503`.
+       */
+      void reject(webby::socket& s) {
+        WEBBY_LOG(_config, debug) << "Rejected connection";
+        if(_config.tls()) {
+          // A plain response would be garbage to a client that expects a handshake.
+          s.close();
+        }
+        else {
+          s.reject(_busy.data(), _busy.size());
+        }
+        _metrics.record(string_view(), 503, 0, 0, 0);
       }
 
+      /**
+       * @brief Applies the timeouts to a new connection and starts TLS on it if configured.
+       */
+      void open(connection& c) {
+        c.set_timeouts(_config.read_timeout(), _config.write_timeout());
+#ifdef WEBBY_HAVE_OPENSSL
+        if(_tls) {
+          c.set_transport(_tls->accept(c.socket()));
+        }
+#endif
+      }
+
+      /**
+       * @brief Accepts connections and queues them for the worker threads.
+       */
+      void run_thread_pool() {
+        // Starts the worker threads.
+        std::vector<std::thread> threads;
+        for(unsigned i = 0; i < _config.worker_threads(); ++i) {
+          threads.push_back(std::thread(&server::work, this, i));
+        }
+        WEBBY_LOG(_config, info) << "Started " << threads.size() << " worker threads";
+
+        // Waits for the listener or server::stop(), which writes to the other descriptor. The
+        // listener does not block, since another process that shares it may take the connection.
+        _listener.set_nonblocking();
+        struct pollfd fds[2];
+        fds[0].fd = _listener.descriptor();
+        fds[0].events = POLLIN;
+        fds[1].fd = _stop[0];
+        fds[1].events = POLLIN;
+        try {
+          while(1) {
+            if(::poll(fds, 2, -1) < 0) {
+              if(errno == EINTR) {
+                continue;
+              }
+              throw socket::error(std::string("poll: ") + strerror(errno));
+            }
+            if(fds[1].revents != 0) {
+              break;
+            }
+
+            // Accept the incoming connection.
+            webby::socket s = _listener.accept();
+            if(!s.valid()) {
+              continue;
+            }
+
+            // Some connection logging.
+            WEBBY_LOG(_config, debug) << "Accepted connection";
+            WEBBY_LOG(_config, debug) << "  Client IP: " << s.peer_ip();
+
+            // Sheds the connection before reading anything from it if the queue or the number of
+            // connections is at its limit.
+            const long queued = _metrics.queued().value();
+            if((_config.max_queued_connections() > 0 &&
+                queued >= static_cast<long>(_config.max_queued_connections())) ||
+               (_config.max_connections() > 0 && queued + _metrics.connections().value() >=
+                    static_cast<long>(_config.max_connections()))) {
+              reject(s);
+              continue;
+            }
+
+            _metrics.queued().increment();
+            if(!_queue.push(std::move(s))) {
+              _metrics.queued().decrement();
+            }
+          }
+        }
+        catch(...) {
+          join(threads);
+          throw;
+        }
+        join(threads);
+        WEBBY_LOG(_config, info) << "Server stopped";
+      }
+
+      /**
+       * @brief Lets the worker threads finish the connections that are already queued, and
+       *        waits for them.
+       */
+      void join(std::vector<std::thread>& threads) {
+        _queue.close();
+        for(auto& t : threads) {
+          t.join();
+        }
+      }
+
+      /**
+       * @brief Body of each worker thread. Processes queued connections until the queue closes.
+       * @param[in] index Index of the worker, which decides its CPU.
+       */
+      void work(unsigned index) {
+        pin(index);
+        webby::socket s;
+        while(_queue.pop(s)) {
+          _metrics.queued().decrement();
+          _metrics.connections().increment();
+          {
+            connection c(std::move(s));
+            open(c);
+            while(handle(c) && next_request(c)) { }
+          }
+          _metrics.connections().decrement();
+        }
+        release_router();
+      }
+
+      /**
+       * @brief Waits for the next request on a persistent connection served by a worker thread.
+       * @returns `true` if data is available; `false` if the wait timed out, the peer closed the
+       *          connection or the server is stopping.
+       */
+      bool next_request(connection& c) {
+        if(stopping()) {
+          return false;
+        }
+        if(c.buffered() > 0 || c.pending()) {
+          return c.wait_request(static_cast<int>(_config.idle_timeout()));
+        }
+        struct pollfd fds[2];
+        fds[0].fd = c.socket().descriptor();
+        fds[0].events = POLLIN;
+        fds[1].fd = _stop[0];
+        fds[1].events = POLLIN;
+        if(::poll(fds, 2, static_cast<int>(_config.idle_timeout())) <= 0 || fds[1].revents != 0) {
+          return false;
+        }
+        return c.wait_request(0);
+      }
+
+      /**
+       * @brief Runs one event loop per worker thread.
+       *
+       * Each loop owns a `SO_REUSEPORT` listener bound to the same address, so the kernel balances
+       * new connections between the loops without any shared accept lock. Platforms without
+       * `SO_REUSEPORT`, and servers that adopted an inherited listener, share the server's
+       * listener instead.
+       */
+      void run_event_loops() {
+        const unsigned count = _config.worker_threads();
+        _listener.set_nonblocking();
+
+        std::vector<webby::socket> listeners;
+#ifdef SO_REUSEPORT
+        for(unsigned i = 1; i < count && _config.listener() < 0; ++i) {
+          listeners.push_back(webby::socket::listen(_config.address(), _config.port(), true));
+          listeners.back().set_nonblocking();
+          listeners.back().set_inheritable(false);
+          if(!_placement.empty()) {
+            listeners.back().set_incoming_cpu(_placement.cpu(i));
+          }
+        }
+        if(!_placement.empty() && !listeners.empty()) {
+          _listener.set_incoming_cpu(_placement.cpu(0));
+        }
+#endif
+
+        std::vector<std::thread> threads;
+        for(unsigned i = 1; i < count; ++i) {
+          const webby::socket& listener = listeners.empty() ? _listener : listeners[i - 1];
+          threads.push_back(std::thread(&server::run_event_loop, this, std::cref(listener), i));
+        }
+        WEBBY_LOG(_config, info) << "Started " << count << " event loops";
+
+        run_event_loop(_listener, 0);
+        for(auto& t : threads) {
+          t.join();
+        }
+        WEBBY_LOG(_config, info) << "Server stopped";
+      }
+
+      /**
+       * @brief Pins the calling worker thread to its CPU if the configuration asks for it.
+       * @param[in] index Index of the worker.
+       */
+      void pin(unsigned index) {
+        if(_placement.empty()) {
+          return;
+        }
+        if(!_placement.pin(index)) {
+          WEBBY_LOG(_config, error) << "Cannot pin worker " << index << " to CPU "
+            << _placement.cpu(index);
+        }
+        else {
+          WEBBY_LOG(_config, debug) << "Pinned worker " << index << " to CPU "
+            << _placement.cpu(index);
+        }
+      }
+
+      /**
+       * @brief Body of each event loop thread.
+       * @param[in] listener Non-blocking listening socket polled by this loop.
+       * @param[in] index Index of the loop, which decides its CPU.
+       */
+      void run_event_loop(const webby::socket& listener, unsigned index) {
+        pin(index);
+        try {
+          event_loop::limits limits;
+          limits.idle_timeout = _config.idle_timeout();
+          limits.read_timeout = _config.read_timeout();
+          limits.write_timeout = _config.write_timeout();
+          limits.max_connections = _config.max_connections();
+          // Bodies are buffered up to the size the server accepts, or 1 MiB without a limit.
+          limits.max_body_buffer = _config.max_body_size() != 0 ? _config.max_body_size()
+                                                                : 1024 * 1024;
+          event_loop loop(listener, [this](connection& c) { return handle(c); }, limits,
+                          &_metrics.connections(), [this](webby::socket& s) { reject(s); },
+                          [this](connection& c) { open(c); });
+          loop.stop_on(_stop[0], &listener != &_listener);
+          loop.run();
+        }
+        catch(const std::exception& e) {
+          WEBBY_LOG(_config, error) << e.what();
+        }
+        release_router();
+      }
+
+      /**
+       * @brief A request being processed and its response.
+       *
+       * It is allocated from the connection's arena rather than on the stack, so that it can
+       * outlive server::handle() when an asynchronous handler finishes the response later.
+       */
+      struct exchange {
+        exchange(const webby::config& config, connection& c, unsigned count)
+            : record(config, c), served(count), req(nullptr), res(nullptr), keep_alive(false),
+              responded(false), persistent(false), upgraded(nullptr) { }
+
+        /**
+         * @brief Destroys the request and the response that were constructed.
+         */
+        ~exchange() {
+          if(res != nullptr) {
+            res->~response();
+          }
+          if(req != nullptr) {
+            req->~request();
+          }
+        }
+
+        /**
+         * @brief Access log record of the request.
+         */
+        access_record record;
+
+        /**
+         * @brief Number of requests received over the connection, this one included.
+         */
+        unsigned served;
+
+        /**
+         * @brief The request, or `nullptr` until it has been received.
+         */
+        request* req;
+
+        /**
+         * @brief The response, or `nullptr` until it has been created.
+         */
+        response* res;
+
+        /**
+         * @brief Memory the request is constructed in.
+         */
+        std::aligned_storage<sizeof(request), alignof(request)>::type request_storage;
+
+        /**
+         * @brief Memory the response is constructed in.
+         */
+        std::aligned_storage<sizeof(response), alignof(response)>::type response_storage;
+
+        /**
+         * @brief Time the request was received.
+         */
+        std::chrono::steady_clock::time_point start;
+
+        /**
+         * @brief `true` if the client and the configuration allow another request.
+         */
+        bool keep_alive;
+
+        /**
+         * @brief `true` once the handler has returned, or finished the response.
+         */
+        bool responded;
+
+        /**
+         * @brief `true` if the connection can carry another request.
+         */
+        bool persistent;
+
+        /**
+         * @brief Stream the request became when it upgraded the connection to HTTP/2, or
+         *        `nullptr`.
+         */
+        http2::stream* upgraded;
+
+        /**
+         * @brief Router the request was dispatched to, held while the response is suspended.
+         */
+        std::shared_ptr<const webby::router> router;
+      };
+
+      /**
+       * @brief Processes the next request received on a connection.
+       * @param[in] c Connection to the host that sent the request.
+       * @returns `true` if the connection can carry another request; `false` if it must be closed.
+       *
+       * Errors are logged rather than propagated so that one bad request cannot take down the
+       * thread that processed it. Each request is recorded in the access log, if one is set.
+       *
+       * A connection that has switched to HTTP/2 is passed to its http2::session instead, which
+       * calls back for each request it receives.
+       *
+       * If the handler suspended the response on a connection served by an event loop, the
+       * connection is suspended and `true` is returned before the response has been finished.
+       * Elsewhere the thread waits for the handler to finish it.
+       */
+      bool handle(connection& c) {
+        if(c.upgraded() != nullptr) {
+          http2::session& session = *static_cast<http2::session*>(c.upgraded());
+          const bool open = session.process();
+          if(open && stopping()) {
+            session.shut_down();
+            return false;
+          }
+          return open;
+        }
+        exchange& x = *new(c.arena().allocate(sizeof(exchange), alignof(exchange)))
+            exchange(_config, c, c.count_request());
+        blocking_executor local;
+        try {
+          // A client that knows the server speaks HTTP/2 starts with its preface, which is not a
+          // request. Nothing has been constructed in the exchange, which the check releases.
+          if(x.served == 1 && _config.http2() && http2::session::preface(c)) {
+            return start_http2(c, false).process();
+          }
+
+          // Decompose the HTTP request from the client.
+          request& req = *(x.req = new(&x.request_storage) request(_config, c));
+          x.record.parsed();
+          x.start = std::chrono::steady_clock::now();
+
+          // Switches a cleartext connection to HTTP/2 if the first request asks for it. The
+          // request becomes stream 1 and is answered over HTTP/2.
+          if(x.served == 1 && _config.http2() && !_config.tls() && !req.has_body() &&
+             req.has_header(known_header::upgrade) &&
+             contains_token(req.header(known_header::upgrade), "h2c") &&
+             req.has_header(known_header::http2_settings)) {
+            x.upgraded = &start_http2(c, true).upgrade(req.header(known_header::http2_settings));
+          }
+
+          // Create the default response for the handler to populate. Only an event loop can go
+          // on with other connections while an asynchronous handler runs.
+          response& res = *(x.res = new(&x.response_storage) response(_config, c));
+          const bool detached = c.executor() != nullptr && x.upgraded == nullptr;
+          res._sink = x.upgraded;
+          res._executor = detached ? c.executor() : &local;
+          res._chunked_allowed = req.version() != "1.0";
+          prepare(req, res);
+
+          // Decides whether the connection is persistent. A stopping server closes it.
+          x.keep_alive = x.upgraded != nullptr ||
+                         (req.keep_alive() && x.served < _config.max_requests_per_connection() &&
+                          !stopping());
+          if(!x.keep_alive) {
+            res.set_header("Connection", "close");
+          }
+          else if(req.version() == "1.0") {
+            res.set_header("Connection", "keep-alive");
+          }
+
+          route(req, res);
+          if(res._async && detached) {
+            // The request refers to the route it matched, so the router must outlive it.
+            x.router = current_router();
+            detach(c, x);
+            return true;
+          }
+          if(res._async) {
+            wait(res, local);
+          }
+        }
+        catch(...) {
+          recover(c, x);
+          return end(c, x);
+        }
+        return complete(c, x);
+      }
+
+      /**
+       * @brief Finishes the response once the handler is done with it.
+       * @returns `true` if the connection can carry another request.
+       */
+      bool complete(connection& c, exchange& x) {
+        try {
+          request& req = *x.req;
+          response& res = *x.res;
+          x.record.handled();
+          x.responded = true;
+          res.finish();
+          x.record.finished();
+          x.record.set_request(c.request_header().method(), req.path(), req.route());
+          x.record.set_response(res._status_code, res._bytes_sent);
+
+          x.persistent = x.keep_alive && (x.upgraded != nullptr || res.persistent()) &&
+                         req.discard_body();
+          _metrics.record(req.route_pattern(), res._status_code,
+                          c.request_header().length() + req._body_read, res._bytes_sent,
+                          elapsed(x.start));
+        }
+        catch(...) {
+          recover(c, x);
+        }
+        return end(c, x);
+      }
+
+      /**
+       * @brief Writes the access log record and releases the request.
+       * @returns `true` if the connection can carry another request.
+       */
+      bool end(connection& c, exchange& x) {
+        const bool persistent = x.persistent;
+        const bool upgraded = x.upgraded != nullptr;
+
+        // Writes the access log record while its views of the header block are still valid.
+        x.record.write();
+        x.~exchange();
+
+        // Releases the header block so the connection can parse the next request.
+        c.release();
+
+        // Sends the upgraded response and handles the frames that followed it.
+        if(upgraded && persistent) {
+          return static_cast<http2::session*>(c.upgraded())->process();
+        }
+        return persistent;
+      }
+
+      /**
+       * @brief Answers the request whose processing threw the exception being handled.
+       *
+       * This must be called from a `catch` block. A request that could not be received or that
+       * timed out is answered with an error, unless its response was already being sent.
+       */
+      void recover(connection& c, exchange& x) {
+        try {
+          throw;
+        }
+        catch(const connection::timeout& e) {
+          WEBBY_LOG(_config, error) << e.what();
+          if(!x.responded) {
+            x.record.parsed();
+            x.record.set_response(408, 0);
+            _metrics.record(string_view(), 408, c.request_header().length(), 0, 0);
+            static const char timed_out[] =
+                "HTTP/1.1 408 Request Time-out\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            try {
+              c.write(timed_out, sizeof(timed_out) - 1);
+              x.record.finished();
+            }
+            catch(const std::exception&) { }
+          }
+        }
+        catch(const request::body_too_large& e) {
+          WEBBY_LOG(_config, error) << e.what();
+          x.record.parsed();
+          x.record.set_response(413, 0);
+          _metrics.record(string_view(), 413, c.request_header().length(), 0, 0);
+          static const char too_large[] =
+              "HTTP/1.1 413 Request Entity Too Large\r\n"
+              "Content-Length: 0\r\nConnection: close\r\n\r\n";
+          try {
+            c.write(too_large, sizeof(too_large) - 1);
+            x.record.finished();
+          }
+          catch(const std::exception&) { }
+        }
+        catch(const request::unsupported_version& e) {
+          WEBBY_LOG(_config, error) << e.what();
+          x.record.parsed();
+          x.record.set_response(505, 0);
+          _metrics.record(string_view(), 505, c.request_header().length(), 0, 0);
+          static const char unsupported[] =
+              "HTTP/1.1 505 HTTP Version not supported\r\n"
+              "Content-Length: 0\r\nConnection: close\r\n\r\n";
+          try {
+            c.write(unsupported, sizeof(unsupported) - 1);
+            x.record.finished();
+          }
+          catch(const std::exception&) { }
+        }
+        catch(const request::error& e) {
+          WEBBY_LOG(_config, error) << e.what();
+          x.record.parsed();
+          x.record.set_response(400, 0);
+          _metrics.record(string_view(), 400, c.request_header().length(), 0, 0);
+          static const char bad_request[] =
+              "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+          try {
+            c.write(bad_request, sizeof(bad_request) - 1);
+            x.record.finished();
+          }
+          catch(const std::exception&) { }
+        }
+        catch(const std::exception& e) {
+          WEBBY_LOG(_config, error) << e.what();
+        }
+      }
+
+      /**
+       * @brief Leaves a suspended response to be finished on the event loop of its connection.
+       *
+       * The connection is suspended until the handler finishes the response, or a task of the
+       * handler fails. The loop then goes on with the connection. If the last task suspended the
+       * response again the connection stays suspended.
+       */
+      void detach(connection& c, exchange& x) {
+        c.set_suspended(true);
+        completion::state* s = x.res->_async.get();
+        s->run = [this, &c, &x, s](const executor::task_t& task, bool last) {
+          const bool succeeded = !task || guard(*x.res, task);
+          if(succeeded && !last) {
+            return;
+          }
+          if(succeeded && x.res->_async.get() != s) {
+            detach(c, x);
+            return;
+          }
+          x.res->_async->done = true;
+          event_loop* loop = static_cast<event_loop*>(c.executor());
+          const bool keep = complete(c, x);
+          loop->resume(c, keep);
+        };
+      }
+
+      /**
+       * @brief Runs the tasks of a suspended response on this thread until the handler has
+       *        finished it, or one of its tasks failed.
+       */
+      void wait(response& res, blocking_executor& local) {
+        bool done = false;
+        watch(res, done);
+        local.run(done);
+      }
+
+      /**
+       * @brief Sets @p done once the handler has finished a suspended response, or one of its
+       *        tasks failed. A response suspended again by its last task is watched in turn.
+       */
+      void watch(response& res, bool& done) {
+        completion::state* s = res._async.get();
+        s->run = [this, &res, &done, s](const executor::task_t& task, bool last) {
+          const bool succeeded = !task || guard(res, task);
+          if(succeeded && !last) {
+            return;
+          }
+          if(succeeded && res._async.get() != s) {
+            watch(res, done);
+            return;
+          }
+          res._async->done = true;
+          done = true;
+        };
+      }
+
+      /**
+       * @brief Processes a request received on an HTTP/2 stream.
+       * @param[in] c Connection the stream belongs to.
+       * @param[in] s Stream with the complete request, which the response is sent on.
+       *
+       * Streams are processed one at a time, so the session waits for asynchronous handlers.
+       */
+      void handle(connection& c, http2::stream& s) {
+        access_record record(_config, c);
+        try {
+          request req(_config, c, s.fields(), s.method(), s.path(), s.body());
+          record.parsed();
+          const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+          blocking_executor local;
+          response res(_config, c);
+          res._sink = &s;
+          res._executor = &local;
+          prepare(req, res);
+          route(req, res);
+          if(res._async) {
+            wait(res, local);
+          }
+          record.handled();
+          res.finish();
+          record.finished();
+          record.set_request(s.method(), req.path(), req.route());
+          record.set_response(res._status_code, res._bytes_sent);
+          _metrics.record(req.route_pattern(), res._status_code, s.header_size() + req._body_read,
+                          res._bytes_sent, elapsed(start));
+        }
+        catch(const request::error& e) {
+          WEBBY_LOG(_config, error) << e.what();
+          record.parsed();
+          record.set_response(400, 0);
+          _metrics.record(string_view(), 400, s.header_size(), 0, 0);
+          try {
+            response res(_config, c);
+            res._sink = &s;
+            res.fail(400);
+            record.finished();
+          }
+          catch(const std::exception&) { }
+        }
+        catch(const std::exception& e) {
+          WEBBY_LOG(_config, error) << e.what();
+        }
+        record.write();
+        c.release();
+      }
+
+      /**
+       * @brief Hands a connection over to HTTP/2.
+       * @param[in] c Connection to switch.
+       * @param[in] upgraded `true` if the client asked to upgrade from HTTP/1.1.
+       * @returns the session, which is owned by the connection.
+       */
+      http2::session& start_http2(connection& c, bool upgraded) {
+        http2::session* s = new http2::session(_config, c,
+            [this, &c](http2::stream& stream) { handle(c, stream); }, upgraded);
+        c.upgrade(std::unique_ptr<connection::protocol>(s));
+        return *s;
+      }
+
+      /**
+       * @brief Sets up the response to a request before it is routed: whether it is a response
+       *        to a HEAD request, and whether it is compressed.
+       */
+      void prepare(const request& req, response& res) {
+        res._head = req.method() == method::HEAD;
+        if(_config.compression()) {
+          res._compressible = true;
+          if(req.has_header(known_header::accept_encoding)) {
+            res._coding = negotiate_coding(req.header(known_header::accept_encoding));
+          }
+        }
+      }
+
+      /**
+       * @brief Routes a request to a handler.
+       *
+       * A failure inside the handler is answered here, so the client gets an error response
+       * rather than a bare 400 or a reset connection.
+       */
+      void route(request& req, response& res) {
+        const webby::router& router = *current_router();
+        guard(res, [&router, &req, &res]() { router.dispatch(req, res); });
+      }
+
+      /**
+       * @brief Gets the router used by the calling thread, picking up the current one if the
+       *        router has been replaced since the thread last used it.
+       *
+       * Only the first request after a replacement takes the lock. The thread keeps the router
+       * alive until then.
+       */
+      const std::shared_ptr<const webby::router>& current_router() {
+        router_cache& c = cached_router();
+        const uint64_t generation = _generation.load(std::memory_order_acquire);
+        if(c.owner != _id || c.generation != generation || !c.router) {
+          std::lock_guard<std::mutex> lock(_router_mutex);
+          c.owner = _id;
+          c.generation = _generation.load(std::memory_order_relaxed);
+          c.router = _router;
+        }
+        return c.router;
+      }
+
+      /**
+       * @brief Router last used by a thread, and the server and generation it belongs to.
+       */
+      struct router_cache {
+        uint64_t owner = 0;
+        uint64_t generation = 0;
+        std::shared_ptr<const webby::router> router;
+      };
+
+      /**
+       * @brief Gets the router cache of the calling thread.
+       */
+      static router_cache& cached_router() {
+        static thread_local router_cache c;
+        return c;
+      }
+
+      /**
+       * @brief Releases the router cached by the calling thread once it stops serving requests.
+       */
+      void release_router() {
+        router_cache& c = cached_router();
+        if(c.owner == _id) {
+          c.router.reset();
+        }
+      }
+
+      /**
+       * @brief Gets a number that identifies a server for as long as the process runs, unlike
+       *        its address.
+       */
+      static uint64_t next_id() {
+        static std::atomic<uint64_t> last(0);
+        return last.fetch_add(1) + 1;
+      }
+
+      /**
+       * @brief Runs a handler, or a task of an asynchronous handler, and answers its failure.
+       * @returns `false` if it failed.
+       */
+      template<typename F>
+      bool guard(response& res, const F& f) {
+        try {
+          f();
+          return true;
+        }
+        catch(const connection::timeout& e) {
+          WEBBY_LOG(_config, error) << e.what();
+          res.fail(408);
+        }
+        catch(const request::body_too_large& e) {
+          WEBBY_LOG(_config, error) << e.what();
+          res.fail(413);
+        }
+        catch(const request::error& e) {
+          WEBBY_LOG(_config, error) << e.what();
+          res.fail(400);
+        }
+        catch(const std::exception& e) {
+          WEBBY_LOG(_config, error) << e.what();
+          res.fail(500);
+        }
+        return false;
+      }
+
+      /**
+       * @brief Gets the microseconds elapsed since @p start.
+       */
+      static uint64_t elapsed(std::chrono::steady_clock::time_point start) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+      }
+
+      /**
+       * @brief Request counters and latency histograms.
+       */
+      webby::metrics _metrics;
+
       /**
        * @brief Server socket.
        */
-      net::server _server;
+      webby::socket _listener;
+
+      /**
+       * @brief CPUs of the worker threads, or empty if they are not pinned.
+       */
+      cpu_placement _placement;
+
+      /**
+       * @brief Response to connections that are turned away.
+       */
+      std::string _busy;
+
+#ifdef WEBBY_HAVE_OPENSSL
+      /**
+       * @brief TLS settings, or empty for plain HTTP.
+       */
+      std::unique_ptr<tls_context> _tls;
+#endif
+
+      /**
+       * @brief Connections accepted but not yet picked up by a worker thread.
+       */
+      webby::queue<webby::socket> _queue;
   };
 }
@@ -0,0 +1,467 @@
+/**
+ * @file socket.hpp
+ */
+#pragma once
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Owns a socket descriptor and closes it when destroyed.
+   *
+   * Sockets may be moved but not copied, so ownership of a connection can be handed from the
+   * acceptor to a worker thread or an event loop.
+   */
+  class socket {
+    public:
+      /**
+       * @brief Reports errors generated by socket system calls.
+       */
+      class error : public std::runtime_error {
+        public:
+          /**
+           * @brief Constructs the `socket::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const std::string& what_arg) : runtime_error(what_arg) { }
+
+          /**
+           * @brief Constructs the `socket::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const char* what_arg) : runtime_error(what_arg) { }
+      };
+
+      /**
+       * @brief Constructs an empty socket that does not own a descriptor.
+       */
+      socket() : _fd(-1) { }
+
+      /**
+       * @brief Takes ownership of a descriptor.
+       * @param[in] fd Open socket descriptor.
+       */
+      explicit socket(int fd) : _fd(fd) { }
+
+      /**
+       * @brief Move constructor.
+       */
+      socket(socket&& other) : _fd(other._fd) {
+        other._fd = -1;
+      }
+
+      /**
+       * @brief Move assignment.
+       */
+      socket& operator=(socket&& other) {
+        if(this != &other) {
+          close();
+          _fd = other._fd;
+          other._fd = -1;
+        }
+        return *this;
+      }
+
+      socket(const socket&) = delete;
+      socket& operator=(const socket&) = delete;
+
+      /**
+       * @brief Closes the descriptor.
+       */
+      ~socket() {
+        close();
+      }
+
+      /**
+       * @brief Creates a socket that listens for connections.
+       * @param[in] address Hostname or address to bind to.
+       * @param[in] port Port to bind to.
+       * @param[in] reuse_port `true` to set `SO_REUSEPORT` so that several sockets, one per event
+       *                       loop, can listen on the same port and have the kernel balance
+       *                       connections between them.
+       * @returns the listening socket.
+       * @throws webby::socket::error if the address cannot be resolved or bound.
+       */
+      static socket listen(const std::string& address, unsigned short port, bool reuse_port) {
+        struct addrinfo hints;
+        struct addrinfo* result = nullptr;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+
+        const std::string service = std::to_string(port);
+        int rc = ::getaddrinfo(address.empty() ? nullptr : address.c_str(), service.c_str(), &hints,
+                               &result);
+        if(rc != 0) {
+          throw socket::error(std::string("getaddrinfo: ") + gai_strerror(rc));
+        }
+
+        socket s;
+        int err = 0;
+        for(struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+          socket candidate(::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol));
+          if(!candidate.valid()) {
+            err = errno;
+            continue;
+          }
+
+          int on = 1;
+          ::setsockopt(candidate._fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+          if(reuse_port) {
+            ::setsockopt(candidate._fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+          }
+#else
+          (void)(reuse_port);
+#endif
+
+          if(::bind(candidate._fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+             ::listen(candidate._fd, SOMAXCONN) == 0) {
+            s = std::move(candidate);
+            break;
+          }
+          err = errno;
+        }
+        ::freeaddrinfo(result);
+
+        if(!s.valid()) {
+          throw socket::error("Unable to listen on " + address + ":" + service + ": " +
+                              strerror(err));
+        }
+        return s;
+      }
+
+      /**
+       * @brief Accepts a connection on a listening socket.
+       * @returns the connected socket, or an invalid socket if the listener is non-blocking and no
+       *          connection was pending.
+       * @throws webby::socket::error if accept fails for any other reason.
+       */
+      socket accept() const {
+        while(1) {
+          int fd = ::accept(_fd, nullptr, nullptr);
+          if(fd >= 0) {
+            socket s(fd);
+
+            // Connections are not inherited by processes the server starts, which would keep them
+            // open.
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+            int on = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+            return s;
+          }
+          if(errno == EINTR || errno == ECONNABORTED) {
+            continue;
+          }
+          if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return socket();
+          }
+          throw socket::error(std::string("accept: ") + strerror(errno));
+        }
+      }
+
+      /**
+       * @brief Switches the socket to non-blocking mode.
+       */
+      void set_nonblocking() {
+        int flags = ::fcntl(_fd, F_GETFL, 0);
+        ::fcntl(_fd, F_SETFL, flags | O_NONBLOCK);
+      }
+
+      /**
+       * @brief Sets whether the socket is inherited by programs that the process executes.
+       * @param[in] on `false` to close the socket on `exec()`.
+       */
+      void set_inheritable(bool on) {
+        int flags = ::fcntl(_fd, F_GETFD, 0);
+        ::fcntl(_fd, F_SETFD, on ? flags & ~FD_CLOEXEC : flags | FD_CLOEXEC);
+      }
+
+      /**
+       * @brief Stops listening, so that the kernel stops queuing connections on the socket and
+       *        passes them to the other `SO_REUSEPORT` listeners bound to the same address.
+       *
+       * Connections still queued on the socket are reset, so they should be accepted first.
+       */
+      void stop_listening() const {
+        ::shutdown(_fd, SHUT_RDWR);
+      }
+
+      /**
+       * @brief Enables or disables Nagle's algorithm.
+       * @param[in] on `true` to send small segments immediately.
+       */
+      void set_nodelay(bool on) {
+        int value = on ? 1 : 0;
+        ::setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+      }
+
+      /**
+       * @brief Asks the kernel to prefer this listener for connections whose packets arrive on a
+       *        CPU, among the `SO_REUSEPORT` listeners bound to the same address.
+       * @param[in] cpu The CPU. It is ignored where `SO_INCOMING_CPU` is not available.
+       */
+      void set_incoming_cpu(int cpu) {
+#ifdef SO_INCOMING_CPU
+        ::setsockopt(_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+#else
+        (void)(cpu);
+#endif
+      }
+
+      /**
+       * @brief Waits until the socket is ready for reading or writing.
+       * @param[in] events `POLLIN` and/or `POLLOUT`.
+       * @param[in] timeout_ms Maximum time to wait in milliseconds, or `-1` to wait forever.
+       * @returns `true` if the socket became ready; `false` if the wait timed out.
+       */
+      bool wait(short events, int timeout_ms) const {
+        struct pollfd pfd;
+        pfd.fd = _fd;
+        pfd.events = events;
+        pfd.revents = 0;
+        while(1) {
+          int rc = ::poll(&pfd, 1, timeout_ms);
+          if(rc >= 0) {
+            return rc > 0;
+          }
+          if(errno != EINTR) {
+            throw socket::error(std::string("poll: ") + strerror(errno));
+          }
+        }
+      }
+
+      /**
+       * @brief Receives data.
+       * @param[in] buffer Buffer that receives the data.
+       * @param[in] length Length of the buffer.
+       * @param[in] peek `true` to leave the data in the socket's receive queue.
+       * @returns the number of bytes received, `0` if the peer closed the connection, or `-1` if
+       *          the socket is non-blocking and no data was available.
+       * @throws webby::socket::error on any other failure.
+       */
+      ssize_t read(char* buffer, size_t length, bool peek = false) const {
+        while(1) {
+          ssize_t n = ::recv(_fd, buffer, length, peek ? MSG_PEEK : 0);
+          if(n >= 0) {
+            return n;
+          }
+          if(errno == EINTR) {
+            continue;
+          }
+          if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+          }
+          if(errno == ECONNRESET) {
+            return 0;
+          }
+          throw socket::error(std::string("recv: ") + strerror(errno));
+        }
+      }
+
+      /**
+       * @brief Sends data.
+       * @param[in] data Data to send.
+       * @param[in] length Length of the data.
+       * @returns the number of bytes sent, or `-1` if the socket is non-blocking and its send
+       *          buffer is full.
+       * @throws webby::socket::error on any other failure.
+       */
+      ssize_t write(const void* data, size_t length) const {
+        while(1) {
+          ssize_t n = ::send(_fd, data, length, send_flags);
+          if(n >= 0) {
+            return n;
+          }
+          if(errno == EINTR) {
+            continue;
+          }
+          if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+          }
+          throw socket::error(std::string("send: ") + strerror(errno));
+        }
+      }
+
+      /**
+       * @brief Sends data gathered from several buffers with a single system call.
+       * @param[in] iov Buffers to send, in order.
+       * @param[in] count Number of buffers. Must not exceed `IOV_MAX`.
+       * @param[in] more `true` if more data follows immediately, so that the kernel can hold a
+       *                 partial segment back (`MSG_MORE`) instead of sending it on its own.
+       * @returns the number of bytes sent, or `-1` if the socket is non-blocking and its send
+       *          buffer is full.
+       * @throws webby::socket::error on any other failure.
+       */
+      ssize_t writev(const struct iovec* iov, int count, bool more = false) const {
+        int flags = send_flags;
+#ifdef MSG_MORE
+        if(more) {
+          flags |= MSG_MORE;
+        }
+#else
+        (void)(more);
+#endif
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = const_cast<struct iovec*>(iov);
+        msg.msg_iovlen = count;
+        while(1) {
+          ssize_t n = ::sendmsg(_fd, &msg, flags);
+          if(n >= 0) {
+            return n;
+          }
+          if(errno == EINTR) {
+            continue;
+          }
+          if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+          }
+          throw socket::error(std::string("sendmsg: ") + strerror(errno));
+        }
+      }
+
+      /**
+       * @brief Sends part of a file without copying it through user space.
+       * @param[in] fd Descriptor of a regular file open for reading.
+       * @param[in] offset Offset of the first byte to send.
+       * @param[in] length Number of bytes to send.
+       * @returns the number of bytes sent, `0` if @p offset is at or past the end of the file, or
+       *          `-1` if the socket is non-blocking and its send buffer is full.
+       * @throws webby::socket::error on any other failure.
+       *
+       * Uses `sendfile()` on Linux and macOS. Other platforms read the file into a buffer and send
+       * it with socket::write().
+       */
+      ssize_t sendfile(int fd, off_t offset, size_t length) const {
+        while(1) {
+#if defined(__linux__)
+          ssize_t n = ::sendfile(_fd, fd, &offset, length);
+          if(n >= 0) {
+            return n;
+          }
+#elif defined(__APPLE__)
+          off_t len = static_cast<off_t>(length);
+          if(::sendfile(fd, _fd, offset, &len, nullptr, 0) == 0 ||
+             ((errno == EAGAIN || errno == EINTR) && len > 0)) {
+            return static_cast<ssize_t>(len);
+          }
+#else
+          char buffer[16384];
+          ssize_t r = ::pread(fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer),
+                              offset);
+          if(r >= 0) {
+            return r == 0 ? 0 : write(buffer, static_cast<size_t>(r));
+          }
+#endif
+          if(errno == EINTR) {
+            continue;
+          }
+          if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+          }
+          throw socket::error(std::string("sendfile: ") + strerror(errno));
+        }
+      }
+
+      /**
+       * @brief Gets the IP address of the connected peer.
+       */
+      std::string peer_ip() const {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        char buffer[INET6_ADDRSTRLEN] = { 0 };
+        if(::getpeername(_fd, reinterpret_cast<struct sockaddr*>(&addr), &len) == 0) {
+          if(addr.ss_family == AF_INET) {
+            ::inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in*>(&addr)->sin_addr, buffer,
+                        sizeof(buffer));
+          }
+          else if(addr.ss_family == AF_INET6) {
+            ::inet_ntop(AF_INET6, &reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_addr,
+                        buffer, sizeof(buffer));
+          }
+        }
+        return buffer;
+      }
+
+      /**
+       * @brief Gets the socket descriptor.
+       */
+      int descriptor() const {
+        return _fd;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the socket owns a descriptor.
+       */
+      bool valid() const {
+        return _fd >= 0;
+      }
+
+      /**
+       * @brief Sends a short response without waiting and closes the socket.
+       * @param[in] data Complete response, e.g. a preformatted `503 Service Unavailable`.
+       * @param[in] length Length of the response.
+       *
+       * This turns away connections that the server is too busy to serve, so it neither blocks
+       * nor throws, and the response is dropped if it does not fit in the send buffer. Data the
+       * client has already sent is discarded first: closing a socket with unread data resets the
+       * connection, which can destroy the response before the client reads it.
+       */
+      void reject(const void* data, size_t length) {
+        char discard[4096];
+        for(int i = 0; i < 16 && ::recv(_fd, discard, sizeof(discard), MSG_DONTWAIT) > 0; ++i) { }
+        if(::send(_fd, data, length, send_flags | MSG_DONTWAIT) > 0) {
+          ::shutdown(_fd, SHUT_WR);
+        }
+        close();
+      }
+
+      /**
+       * @brief Closes the descriptor.
+       */
+      void close() {
+        if(_fd >= 0) {
+          ::close(_fd);
+          _fd = -1;
+        }
+      }
+
+    private:
+#ifdef MSG_NOSIGNAL
+      /// Prevents SIGPIPE when the peer has closed the connection.
+      static const int send_flags = MSG_NOSIGNAL;
+#else
+      /// SIGPIPE is suppressed with `SO_NOSIGPIPE` on platforms without `MSG_NOSIGNAL`.
+      static const int send_flags = 0;
+#endif
+
+      /**
+       * @brief Socket descriptor.
+       */
+      int _fd;
+  };
+}
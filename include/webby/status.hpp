@@ -0,0 +1,112 @@
+/**
+ * @file status.hpp
+ */
+#pragma once
+
+#include <string.h>
+#include <webby/utility.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Complete HTTP/1.1 status lines, indexed by status code.
+   *
+   * Each line is stored with its protocol version and line terminator, e.g.
+   * `"HTTP/1.1 200 OK\r\n"`, so a response copies its status line with one `memcpy()` instead of
+   * looking up the reason phrase and formatting the code.
+   */
+  class status_table {
+    public:
+      /**
+       * @brief One past the largest status code in the table.
+       */
+      static const unsigned short limit = 600;
+
+      /**
+       * @brief Gets the status line for a status code.
+       * @param[in] code HTTP status code.
+       * @returns the complete status line, or an empty view if @p code is not a known status.
+       */
+      static string_view line(unsigned short code) {
+        static const status_table table;
+        return code < limit ? table._lines[code] : string_view();
+      }
+
+      /**
+       * @brief Gets the reason phrase for a status code.
+       * @param[in] code HTTP status code.
+       * @returns the reason phrase, e.g. `Not Found`, or an empty view if @p code is not known.
+       */
+      static string_view reason(unsigned short code) {
+        string_view l = line(code);
+        // Skips "HTTP/1.1 200 " and drops the trailing CRLF.
+        return l.empty() ? l : l.substr(13, l.size() - 15);
+      }
+
+    private:
+      /**
+       * @brief Builds the index from the list of status lines.
+       */
+      status_table() {
+        static const char* const lines[] = {
+          "HTTP/1.1 100 Continue\r\n",
+          "HTTP/1.1 101 Switching Protocols\r\n",
+
+          "HTTP/1.1 200 OK\r\n",
+          "HTTP/1.1 201 Created\r\n",
+          "HTTP/1.1 202 Accepted\r\n",
+          "HTTP/1.1 203 Non-Authoritative Information\r\n",
+          "HTTP/1.1 204 No Content\r\n",
+          "HTTP/1.1 205 Reset Content\r\n",
+          "HTTP/1.1 206 Partial Content\r\n",
+
+          "HTTP/1.1 300 Multiple Choices\r\n",
+          "HTTP/1.1 301 Moved Permanently\r\n",
+          "HTTP/1.1 302 Found\r\n",
+          "HTTP/1.1 303 See Other\r\n",
+          "HTTP/1.1 304 Not Modified\r\n",
+          "HTTP/1.1 305 Use Proxy\r\n",
+          "HTTP/1.1 307 Temporary Redirect\r\n",
+
+          "HTTP/1.1 400 Bad Request\r\n",
+          "HTTP/1.1 401 Unauthorized\r\n",
+          "HTTP/1.1 402 Payment Required\r\n",
+          "HTTP/1.1 403 Forbidden\r\n",
+          "HTTP/1.1 404 Not Found\r\n",
+          "HTTP/1.1 405 Method Not Allowed\r\n",
+          "HTTP/1.1 406 Not Acceptable\r\n",
+          "HTTP/1.1 407 Proxy Authentication Required\r\n",
+          "HTTP/1.1 408 Request Time-out\r\n",
+          "HTTP/1.1 409 Conflict\r\n",
+          "HTTP/1.1 410 Gone\r\n",
+          "HTTP/1.1 411 Length Required\r\n",
+          "HTTP/1.1 412 Precondition Failed\r\n",
+          "HTTP/1.1 413 Request Entity Too Large\r\n",
+          "HTTP/1.1 414 Request-URI Too Large\r\n",
+          "HTTP/1.1 415 Unsupported Media Type\r\n",
+          "HTTP/1.1 416 Requested range not satisfiable\r\n",
+          "HTTP/1.1 417 Expectation Failed\r\n",
+
+          "HTTP/1.1 500 Internal Server Error\r\n",
+          "HTTP/1.1 501 Not Implemented\r\n",
+          "HTTP/1.1 502 Bad Gateway\r\n",
+          "HTTP/1.1 503 Service Unavailable\r\n",
+          "HTTP/1.1 504 Gateway Time-out\r\n",
+          "HTTP/1.1 505 HTTP Version not supported\r\n"
+        };
+        for(size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); ++i) {
+          const char* l = lines[i];
+          unsigned short code = static_cast<unsigned short>(
+              (l[9] - '0') * 100 + (l[10] - '0') * 10 + (l[11] - '0'));
+          _lines[code] = string_view(l, strlen(l));
+        }
+      }
+
+      /**
+       * @brief Status lines, or empty views for unknown codes.
+       */
+      string_view _lines[limit];
+  };
+}
@@ -0,0 +1,161 @@
+/**
+ * @file task.hpp
+ */
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define WEBBY_HAVE_COROUTINES 1
+#endif
+#endif
+
+#ifdef WEBBY_HAVE_COROUTINES
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+#include <webby/executor.hpp>
+#include <webby/request.hpp>
+#include <webby/response.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Return type of route handlers written as C++20 coroutines.
+   *
+   * Such a handler is registered with webby::router::add() like a synchronous one. The response
+   * is suspended when the coroutine starts and finished when it returns, and each
+   * `co_await webby::suspend(...)` lets the thread serve other connections until the awaited
+   * work is done:
+   *
+   *     router.add("/users/:id", webby::method::GET,
+   *         [&db](const webby::request& req, webby::response& res) -> webby::task {
+   *           std::string user;
+   *           co_await webby::suspend([&](std::function<void()> resume) {
+   *             db.find(req.param("id"), [&, resume](std::string u) { user = u; resume(); });
+   *           });
+   *           res.stream() << user;
+   *         });
+   *
+   * The coroutine always resumes on the thread that serves the connection. An exception that
+   * escapes it fails the response as one thrown from a synchronous handler would.
+   *
+   * This is only available when webby is compiled as C++20 or newer. Older compilers use
+   * webby::router::async_handler_t instead.
+   */
+  class task {
+    public:
+      /**
+       * @brief Promise of the coroutines that return a webby::task.
+       */
+      class promise_type {
+        public:
+          /**
+           * @brief Suspends the response of a handler that is a free function.
+           */
+          promise_type(const request&, response& res) : _completion(res.suspend()) { }
+
+          /**
+           * @brief Suspends the response of a handler that is a member function, e.g. of a
+           *        lambda.
+           */
+          template<typename T>
+          promise_type(T&, const request&, response& res) : _completion(res.suspend()) { }
+
+          task get_return_object() {
+            return task();
+          }
+
+          /**
+           * @brief Runs the coroutine until its first suspension point before the handler returns.
+           */
+          std::suspend_never initial_suspend() noexcept {
+            return std::suspend_never();
+          }
+
+          /**
+           * @brief Frees the coroutine as soon as it is done. Nothing waits for it.
+           */
+          std::suspend_never final_suspend() noexcept {
+            return std::suspend_never();
+          }
+
+          void return_void() {
+            _completion.finish();
+          }
+
+          void unhandled_exception() {
+            std::exception_ptr e = std::current_exception();
+            _completion.finish([e]() { std::rethrow_exception(e); });
+          }
+
+          /**
+           * @brief Gets the completion of the response.
+           */
+          const completion& get_completion() const {
+            return _completion;
+          }
+
+        private:
+          /**
+           * @brief Completion of the handler's response.
+           */
+          completion _completion;
+      };
+  };
+
+  /**
+   * @brief Awaitable returned by webby::suspend().
+   */
+  template<typename F>
+  class suspension {
+    public:
+      /**
+       * @brief Constructs the awaitable.
+       * @param[in] start Function that starts the awaited work.
+       */
+      explicit suspension(F start) : _start(std::move(start)) { }
+
+      bool await_ready() const noexcept {
+        return false;
+      }
+
+      /**
+       * @brief Starts the awaited work with a function that resumes the coroutine on the thread
+       *        that serves its connection.
+       */
+      void await_suspend(std::coroutine_handle<task::promise_type> h) {
+        completion c = h.promise().get_completion();
+        std::shared_ptr<std::atomic<bool>> resumed = std::make_shared<std::atomic<bool>>(false);
+        _start([c, h, resumed]() {
+          if(!resumed->exchange(true)) {
+            c.post([h]() { h.resume(); });
+          }
+        });
+      }
+
+      void await_resume() const noexcept { }
+
+    private:
+      /**
+       * @brief Function that starts the awaited work.
+       */
+      F _start;
+  };
+
+  /**
+   * @brief Suspends a coroutine handler until some work, such as a call to an upstream service,
+   *        is done.
+   * @param[in] start Function called with a `std::function<void()>` that must be called, from any
+   *                  thread, once the work is done. Only the first call has an effect.
+   * @returns an awaitable for `co_await`.
+   */
+  template<typename F>
+  suspension<F> suspend(F start) {
+    return suspension<F>(std::move(start));
+  }
+}
+#endif
@@ -0,0 +1,373 @@
+/**
+ * @file tls.hpp
+ */
+#pragma once
+
+#ifdef WEBBY_HAVE_OPENSSL
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <webby/socket.hpp>
+#include <webby/transport.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief TLS transport of one connection, created by webby::tls_context::accept().
+   *
+   * The handshake happens implicitly with the first read, so a non-blocking socket can complete
+   * it on an event loop over several calls. Writes are collected into TLS records of up to
+   * tls_transport::record_size bytes, so a header block and the start of its body travel in one
+   * record.
+   *
+   * When the kernel has taken over encryption after the handshake (kTLS), files are sent with
+   * `sendfile()` and never pass through user space, as they do on plain connections. Otherwise
+   * they are read into a buffer and encrypted.
+   */
+  class tls_transport : public transport {
+    public:
+      /**
+       * @brief Largest plaintext of one TLS record.
+       */
+      static const size_t record_size = 16384;
+
+      /**
+       * @brief Takes ownership of an OpenSSL connection.
+       * @param[in] ssl Connection in the accept state, attached to the socket.
+       */
+      explicit tls_transport(SSL* ssl) : _ssl(ssl), _wants(0) { }
+
+      tls_transport(const tls_transport&) = delete;
+      tls_transport& operator=(const tls_transport&) = delete;
+
+      /**
+       * @brief Sends a `close_notify` alert if the handshake completed, without waiting, and
+       *        frees the connection.
+       */
+      ~tls_transport() {
+        if(SSL_is_init_finished(_ssl)) {
+          SSL_shutdown(_ssl);
+        }
+        SSL_free(_ssl);
+      }
+
+      ssize_t read(char* buffer, size_t length, bool peek) override {
+        ERR_clear_error();
+        int n = peek ? SSL_peek(_ssl, buffer, clamp(length))
+                     : SSL_read(_ssl, buffer, clamp(length));
+        if(n > 0) {
+          return n;
+        }
+        return fail(n, "SSL_read");
+      }
+
+      ssize_t writev(const struct iovec* iov, int count, bool more) override {
+        (void)more;
+        const char* data = static_cast<const char*>(iov[0].iov_base);
+        size_t length = iov[0].iov_len;
+
+        // Gathers small buffers into one record. A write that could not complete is retried
+        // with the same buffers, which yields the same record.
+        if(count > 1 && length < record_size) {
+          if(!_scratch) {
+            _scratch.reset(new char[record_size]);
+          }
+          length = 0;
+          for(int i = 0; i < count && length < record_size; ++i) {
+            size_t n = std::min(iov[i].iov_len, record_size - length);
+            memcpy(_scratch.get() + length, iov[i].iov_base, n);
+            length += n;
+          }
+          data = _scratch.get();
+        }
+        return write(data, length);
+      }
+
+      ssize_t sendfile(int fd, off_t offset, size_t length) override {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+        if(BIO_get_ktls_send(SSL_get_wbio(_ssl))) {
+          ERR_clear_error();
+          ossl_ssize_t n = SSL_sendfile(_ssl, fd, offset, length, 0);
+          if(n >= 0) {
+            return n;
+          }
+          return fail(static_cast<int>(n), "SSL_sendfile");
+        }
+#endif
+        if(!_scratch) {
+          _scratch.reset(new char[record_size]);
+        }
+        while(1) {
+          ssize_t r = ::pread(fd, _scratch.get(), length < record_size ? length : record_size,
+                              offset);
+          if(r >= 0) {
+            return r == 0 ? 0 : write(_scratch.get(), static_cast<size_t>(r));
+          }
+          if(errno != EINTR) {
+            throw socket::error(std::string("pread: ") + strerror(errno));
+          }
+        }
+      }
+
+      size_t pending() const override {
+        return static_cast<size_t>(SSL_pending(_ssl));
+      }
+
+      short wait_events(short events) const override {
+        return _wants != 0 ? _wants : events;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the kernel encrypts what is sent (kTLS).
+       */
+      bool kernel_send() const {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+        return BIO_get_ktls_send(SSL_get_wbio(_ssl)) != 0;
+#else
+        return false;
+#endif
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the handshake resumed an earlier session.
+       */
+      bool resumed() const {
+        return SSL_session_reused(_ssl) != 0;
+      }
+
+    private:
+      /**
+       * @brief Encrypts and sends one record.
+       */
+      ssize_t write(const char* data, size_t length) {
+        ERR_clear_error();
+        int n = SSL_write(_ssl, data, clamp(length));
+        if(n > 0) {
+          return n;
+        }
+        return fail(n, "SSL_write");
+      }
+
+      /**
+       * @brief Translates the result of an OpenSSL call that did not transfer anything.
+       * @returns `-1` if the call must be retried once the socket is ready, or `0` at the end of
+       *          the stream.
+       * @throws webby::socket::error on a protocol or system error.
+       */
+      ssize_t fail(int rc, const char* operation) {
+        _wants = 0;
+        switch(SSL_get_error(_ssl, rc)) {
+          case SSL_ERROR_WANT_READ:
+            _wants = POLLIN;
+            return -1;
+          case SSL_ERROR_WANT_WRITE:
+            _wants = POLLOUT;
+            return -1;
+          case SSL_ERROR_ZERO_RETURN:
+            return 0;
+          case SSL_ERROR_SYSCALL:
+            if(errno == 0 || errno == ECONNRESET || errno == EPIPE) {
+              return 0;
+            }
+            throw socket::error(std::string(operation) + ": " + strerror(errno));
+          default: {
+            char reason[256];
+            ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+            throw socket::error(std::string(operation) + ": " + reason);
+          }
+        }
+      }
+
+      /**
+       * @brief Limits a length to what OpenSSL accepts in one call.
+       */
+      static int clamp(size_t length) {
+        return static_cast<int>(std::min(length, static_cast<size_t>(1) << 30));
+      }
+
+      /**
+       * @brief OpenSSL connection.
+       */
+      SSL* _ssl;
+
+      /**
+       * @brief Events the last call that returned `-1` is waiting for, or `0`.
+       */
+      short _wants;
+
+      /**
+       * @brief Buffer that small writes and file contents are gathered in, allocated on first
+       *        use.
+       */
+      std::unique_ptr<char[]> _scratch;
+  };
+
+  /**
+   * @brief Server-side TLS settings shared by all connections: certificate, key and session
+   *        cache.
+   *
+   * Clients that reconnect skip the full handshake. TLS 1.2 clients resume from the context's
+   * session cache or from a session ticket, TLS 1.3 clients from a ticket. The ticket keys are
+   * generated when the context is created, so tickets are only valid within one process.
+   *
+   * If the platform supports kernel TLS (Linux with the `tls` module and OpenSSL 3 built with
+   * kTLS), OpenSSL hands the connection's keys to the kernel after the handshake.
+   *
+   * A context is used by every worker thread; OpenSSL locks its shared state internally.
+   */
+  class tls_context {
+    public:
+      /**
+       * @brief Exception object used for TLS configuration errors.
+       */
+      class error : public std::runtime_error {
+        public:
+          /**
+           * @brief Constructs the `tls_context::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const std::string& what_arg) : runtime_error(what_arg) { }
+
+          /**
+           * @brief Constructs the `tls_context::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const char* what_arg) : runtime_error(what_arg) { }
+      };
+
+      /**
+       * @brief Number of sessions kept for resumption.
+       */
+      static const long session_cache_size = 20480;
+
+      /**
+       * @brief Seconds a session can be resumed for.
+       */
+      static const long session_timeout = 3600;
+
+      /**
+       * @brief Loads a certificate chain and its private key.
+       * @param[in] certificate Path of a PEM file with the certificate, followed by any
+       *                        intermediate certificates.
+       * @param[in] private_key Path of the PEM file with the private key.
+       * @param[in] http2 `true` to offer HTTP/2 with ALPN as well as HTTP/1.1.
+       * @throws webby::tls_context::error if the files cannot be loaded or do not match.
+       */
+      tls_context(const std::string& certificate, const std::string& private_key,
+                  bool http2 = false)
+          : _ctx(SSL_CTX_new(TLS_server_method())), _http2(http2) {
+        if(_ctx == nullptr) {
+          throw tls_context::error("SSL_CTX_new: " + last_error());
+        }
+        SSL_CTX_set_min_proto_version(_ctx, TLS1_2_VERSION);
+        if(SSL_CTX_use_certificate_chain_file(_ctx, certificate.c_str()) != 1) {
+          std::string reason = last_error();
+          SSL_CTX_free(_ctx);
+          throw tls_context::error("Cannot load certificate " + certificate + ": " + reason);
+        }
+        if(SSL_CTX_use_PrivateKey_file(_ctx, private_key.c_str(), SSL_FILETYPE_PEM) != 1 ||
+           SSL_CTX_check_private_key(_ctx) != 1) {
+          std::string reason = last_error();
+          SSL_CTX_free(_ctx);
+          throw tls_context::error("Cannot load private key " + private_key + ": " + reason);
+        }
+
+        // Writes are retried with the same bytes from wherever the caller keeps them, and a
+        // record may be sent in parts. Idle connections give their buffers back.
+        SSL_CTX_set_mode(_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                               SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+        // Session resumption from the cache and from tickets.
+        static const unsigned char id[] = "webby";
+        SSL_CTX_set_session_id_context(_ctx, id, sizeof(id) - 1);
+        SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(_ctx, session_cache_size);
+        SSL_CTX_set_timeout(_ctx, session_timeout);
+
+        long options = SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_RENEGOTIATION;
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        // Clients commonly close without a close_notify alert; that ends the stream normally.
+        options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+        options |= SSL_OP_ENABLE_KTLS;
+#endif
+        SSL_CTX_set_options(_ctx, options);
+
+        SSL_CTX_set_alpn_select_cb(_ctx, select_protocol, this);
+      }
+
+      tls_context(const tls_context&) = delete;
+      tls_context& operator=(const tls_context&) = delete;
+
+      ~tls_context() {
+        SSL_CTX_free(_ctx);
+      }
+
+      /**
+       * @brief Starts TLS on an accepted connection.
+       * @param[in] s Connected socket. It must outlive the transport.
+       * @returns the transport, which performs the handshake with its first read.
+       * @throws webby::socket::error if OpenSSL cannot allocate the connection.
+       */
+      std::unique_ptr<tls_transport> accept(const webby::socket& s) const {
+        SSL* ssl = SSL_new(_ctx);
+        if(ssl == nullptr || SSL_set_fd(ssl, s.descriptor()) != 1) {
+          SSL_free(ssl);
+          throw socket::error("SSL_new: " + last_error());
+        }
+        SSL_set_accept_state(ssl);
+        return std::unique_ptr<tls_transport>(new tls_transport(ssl));
+      }
+
+    private:
+      /**
+       * @brief Selects `h2`, if HTTP/2 is enabled, or `http/1.1` when the client offers it.
+       */
+      static int select_protocol(SSL*, const unsigned char** out, unsigned char* outlen,
+                                 const unsigned char* in, unsigned int inlen, void* arg) {
+        static const unsigned char supported[] = "\x02h2\x08http/1.1";
+        const bool http2 = static_cast<const tls_context*>(arg)->_http2;
+        const unsigned char* offered = http2 ? supported : supported + 3;
+        const unsigned int size = sizeof(supported) - (http2 ? 1 : 4);
+        unsigned char* selected = nullptr;
+        if(SSL_select_next_proto(&selected, outlen, offered, size, in, inlen) !=
+           OPENSSL_NPN_NEGOTIATED) {
+          return SSL_TLSEXT_ERR_NOACK;
+        }
+        *out = selected;
+        return SSL_TLSEXT_ERR_OK;
+      }
+
+      /**
+       * @brief Gets the description of the last OpenSSL error of this thread.
+       */
+      static std::string last_error() {
+        char reason[256];
+        ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+        return reason;
+      }
+
+      /**
+       * @brief OpenSSL context.
+       */
+      SSL_CTX* _ctx;
+
+      /**
+       * @brief `true` if HTTP/2 is offered.
+       */
+      bool _http2;
+  };
+}
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * @file transport.hpp
+ */
+#pragma once
+
+#include <poll.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Byte stream layered over a connected socket, such as TLS.
+   *
+   * A webby::connection reads and writes its socket directly unless a transport has been set
+   * with connection::set_transport(), in which case all of its I/O goes through the transport.
+   * Requests and responses never see the difference.
+   *
+   * The operations follow the conventions of webby::socket: they transfer as much as they can
+   * without waiting and return `-1` when the socket is not ready, `0` from a read means the peer
+   * closed the stream, and failures throw webby::socket::error. After a `-1` the connection
+   * waits for the events returned by transport::wait_events() and tries again with the same
+   * arguments.
+   */
+  class transport {
+    public:
+      virtual ~transport() { }
+
+      /**
+       * @brief Receives data.
+       * @param[in] buffer Buffer that receives the data.
+       * @param[in] length Length of the buffer, which is not `0`.
+       * @param[in] peek `true` to leave the data available for the next read.
+       * @returns the number of bytes received, `0` at end of stream, or `-1` if the socket is
+       *          not ready.
+       */
+      virtual ssize_t read(char* buffer, size_t length, bool peek) = 0;
+
+      /**
+       * @brief Sends data gathered from several buffers.
+       * @param[in] iov Buffers to send, in order.
+       * @param[in] count Number of buffers.
+       * @param[in] more `true` if more data follows immediately.
+       * @returns the number of bytes sent, or `-1` if the socket is not ready.
+       */
+      virtual ssize_t writev(const struct iovec* iov, int count, bool more) = 0;
+
+      /**
+       * @brief Sends part of a file.
+       * @param[in] fd Descriptor of a regular file open for reading.
+       * @param[in] offset Offset of the first byte to send.
+       * @param[in] length Number of bytes to send.
+       * @returns the number of bytes sent, `0` if @p offset is at or past the end of the file, or
+       *          `-1` if the socket is not ready.
+       */
+      virtual ssize_t sendfile(int fd, off_t offset, size_t length) = 0;
+
+      /**
+       * @brief Gets the number of bytes received and decoded that have not been read yet.
+       *
+       * Such bytes do not make the socket readable, so they must be read before waiting for it.
+       */
+      virtual size_t pending() const = 0;
+
+      /**
+       * @brief Gets the socket events to wait for after an operation returned `-1`.
+       * @param[in] events `POLLIN` after a read or `POLLOUT` after a write.
+       *
+       * A protocol such as TLS may have to write while reading, or read while writing.
+       */
+      virtual short wait_events(short events) const {
+        return events;
+      }
+  };
+}
@@ -4,22 +4,276 @@
 
 #pragma once
 #include <algorithm>
+#include <ostream>
+#include <stdexcept>
 #include <string.h>
 #include <string>
+#include <strings.h>
 
 /**
  * @namespace webby
  */
 namespace webby {
+  /**
+   * @brief Non-owning reference to a sequence of characters.
+   *
+   * This is a subset of C++17's `std::string_view`. Request fields are exposed as views into the
+   * connection's receive buffer so that parsing a request does not allocate.
+   */
+  class string_view {
+    public:
+      typedef const char* iterator;
+      typedef const char* const_iterator;
+
+      /**
+       * @brief Special value that means "not found" or "until the end".
+       */
+      static const size_t npos = static_cast<size_t>(-1);
+
+      /**
+       * @brief Constructs an empty view.
+       */
+      string_view() : _data(nullptr), _size(0) { }
+
+      /**
+       * @brief Constructs a view of @p size characters starting at @p data.
+       */
+      string_view(const char* data, size_t size) : _data(data), _size(size) { }
+
+      /**
+       * @brief Constructs a view of a null-terminated string.
+       */
+      string_view(const char* str) : _data(str), _size(strlen(str)) { }
+
+      /**
+       * @brief Constructs a view of a `std::string`.
+       */
+      string_view(const std::string& str) : _data(str.data()), _size(str.size()) { }
+
+      const char* data() const { return _data; }
+      size_t size() const { return _size; }
+      size_t length() const { return _size; }
+      bool empty() const { return _size == 0; }
+      const_iterator begin() const { return _data; }
+      const_iterator end() const { return _data + _size; }
+      char operator[](size_t pos) const { return _data[pos]; }
+
+      /**
+       * @brief Gets a view of part of this view.
+       * @throws std::out_of_range if @p pos is past the end of the view.
+       */
+      string_view substr(size_t pos, size_t n = npos) const {
+        if(pos > _size) {
+          throw std::out_of_range("string_view::substr");
+        }
+        return string_view(_data + pos, std::min(n, _size - pos));
+      }
+
+      /**
+       * @brief Compares this view with another lexicographically.
+       */
+      int compare(string_view other) const {
+        const size_t n = std::min(_size, other._size);
+        int rc = n > 0 ? memcmp(_data, other._data, n) : 0;
+        if(rc != 0) {
+          return rc;
+        }
+        return _size < other._size ? -1 : (_size > other._size ? 1 : 0);
+      }
+
+      /**
+       * @brief Compares part of this view with another view.
+       */
+      int compare(size_t pos, size_t n, string_view other) const {
+        return substr(pos, n).compare(other);
+      }
+
+      /**
+       * @brief Finds the first occurrence of a character.
+       * @returns the position of the character, or `npos` if it was not found.
+       */
+      size_t find(char c, size_t pos = 0) const {
+        if(pos >= _size) {
+          return npos;
+        }
+        const void* p = memchr(_data + pos, c, _size - pos);
+        return p ? static_cast<size_t>(static_cast<const char*>(p) - _data) : npos;
+      }
+
+      /**
+       * @brief Copies the view into a `std::string`.
+       */
+      explicit operator std::string() const {
+        return std::string(_data, _size);
+      }
+
+    private:
+      const char* _data;
+      size_t _size;
+  };
+
+  inline bool operator==(string_view lhs, string_view rhs) {
+    return lhs.size() == rhs.size() && lhs.compare(rhs) == 0;
+  }
+
+  inline bool operator!=(string_view lhs, string_view rhs) {
+    return !(lhs == rhs);
+  }
+
+  inline bool operator<(string_view lhs, string_view rhs) {
+    return lhs.compare(rhs) < 0;
+  }
+
+  inline std::ostream& operator<<(std::ostream& os, string_view sv) {
+    return os.write(sv.data(), static_cast<std::streamsize>(sv.size()));
+  }
+
+  inline std::string operator+(const std::string& lhs, string_view rhs) {
+    std::string str(lhs);
+    str.append(rhs.data(), rhs.size());
+    return str;
+  }
+
+  /**
+   * @brief Compares two strings without regard to ASCII case.
+   */
+  inline bool iequals(string_view lhs, string_view rhs) {
+    return lhs.size() == rhs.size() && strncasecmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+  }
+
   /**
    * @brief Comparison function for the header map.
    */
   struct no_case_compare {
-    bool operator()(const std::string& lhs, const std::string& rhs) const {
-      return strcasecmp(lhs.c_str(), rhs.c_str()) < 0;
+    bool operator()(string_view lhs, string_view rhs) const {
+      const size_t n = std::min(lhs.size(), rhs.size());
+      int rc = n > 0 ? strncasecmp(lhs.data(), rhs.data(), n) : 0;
+      return rc < 0 || (rc == 0 && lhs.size() < rhs.size());
     }
   };
 
+  /**
+   * @brief Parses an unsigned decimal number.
+   * @param[in] str String that contains only digits.
+   * @param[out] value Receives the number.
+   * @returns `false` if the string contains anything but digits or the number overflows.
+   */
+  inline bool parse_number(string_view str, unsigned long& value) {
+    unsigned long n = 0;
+    for(auto itr = str.begin(); itr != str.end(); ++itr) {
+      if(*itr < '0' || *itr > '9') {
+        return false;
+      }
+      unsigned long next = n * 10 + static_cast<unsigned long>(*itr - '0');
+      if(next / 10 != n) {
+        return false;
+      }
+      n = next;
+    }
+    value = n;
+    return true;
+  }
+
+  /**
+   * @brief Formats an unsigned decimal number.
+   * @param[in] value The number.
+   * @param[out] buffer Receives the digits, without a terminator. It must hold 20 characters.
+   * @returns the number of digits.
+   */
+  inline size_t format_number(unsigned long long value, char* buffer) {
+    char reversed[20];
+    size_t n = 0;
+    do {
+      reversed[n++] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    } while(value != 0);
+    size_t length = 0;
+    while(n > 0) {
+      buffer[length++] = reversed[--n];
+    }
+    return length;
+  }
+
+  /**
+   * @brief Gets a value that indicates whether a comma-separated header value contains a token.
+   * @param[in] list Header value, e.g. `keep-alive, Upgrade`.
+   * @param[in] token Token to look for. The comparison is case insensitive.
+   */
+  inline bool contains_token(string_view list, string_view token) {
+    size_t first = 0;
+    while(first < list.size()) {
+      size_t last = list.find(',', first);
+      if(last == string_view::npos) {
+        last = list.size();
+      }
+      string_view item = list.substr(first, last - first);
+      while(!item.empty() && (item[0] == ' ' || item[0] == '\t')) {
+        item = item.substr(1);
+      }
+      while(!item.empty() && (item[item.size() - 1] == ' ' || item[item.size() - 1] == '\t')) {
+        item = item.substr(0, item.size() - 1);
+      }
+      if(iequals(item, token)) {
+        return true;
+      }
+      first = last + 1;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Gets a value that indicates whether a header such as `Accept-Encoding` accepts a token.
+   * @param[in] list Header value, e.g. `gzip;q=1.0, br, *;q=0`.
+   * @param[in] token Token to look for. The comparison is case insensitive.
+   * @returns `true` if the token, or `*`, is listed without a quality value of zero. An explicit
+   *          entry for the token takes precedence over `*`.
+   */
+  inline bool accepts_token(string_view list, string_view token) {
+    bool wildcard = false;
+    size_t first = 0;
+    while(first < list.size()) {
+      size_t last = list.find(',', first);
+      if(last == string_view::npos) {
+        last = list.size();
+      }
+      string_view item = list.substr(first, last - first);
+      first = last + 1;
+
+      // Splits the item into its name and parameters.
+      size_t semicolon = item.find(';');
+      string_view name = item.substr(0, semicolon);
+      while(!name.empty() && (name[0] == ' ' || name[0] == '\t')) {
+        name = name.substr(1);
+      }
+      while(!name.empty() && (name[name.size() - 1] == ' ' || name[name.size() - 1] == '\t')) {
+        name = name.substr(0, name.size() - 1);
+      }
+
+      // A quality value of zero ("q=0", "q=0.0", ...) means "not acceptable".
+      bool acceptable = true;
+      if(semicolon != string_view::npos) {
+        string_view params = item.substr(semicolon + 1);
+        size_t q = params.find('=');
+        if(q != string_view::npos && q > 0 && (params[q - 1] == 'q' || params[q - 1] == 'Q')) {
+          acceptable = false;
+          for(size_t i = q + 1; i < params.size() && params[i] != ';'; ++i) {
+            if(params[i] >= '1' && params[i] <= '9') {
+              acceptable = true;
+            }
+          }
+        }
+      }
+
+      if(iequals(name, token)) {
+        return acceptable;
+      }
+      if(name == "*") {
+        wildcard = acceptable;
+      }
+    }
+    return wildcard;
+  }
+
   /**
    * @brief Converts a string to all lowercase characters.
    */
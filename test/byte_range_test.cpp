@@ -0,0 +1,148 @@
+/**
+ * @file byte_range_test.cpp
+ */
+#include <string>
+#include <handlers/byte_range.hpp>
+#include "check.hpp"
+
+using webby::range_set;
+
+namespace {
+  const range_set::status ignore = range_set::status::ignore;
+  const range_set::status satisfiable = range_set::status::satisfiable;
+  const range_set::status unsatisfiable = range_set::status::unsatisfiable;
+
+  // A `Range` header, the size of the representation, and what it parses to. The satisfiable
+  // ranges are written as in the header, e.g. `0-9,20-29`.
+  struct example {
+    const char* header;
+    unsigned long size;
+    range_set::status status;
+    const char* ranges;
+  };
+
+  // Formats the parsed ranges like example::ranges.
+  std::string format(const range_set& ranges) {
+    std::string out;
+    for(unsigned i = 0; i < ranges.size(); ++i) {
+      if(i > 0) {
+        out += ',';
+      }
+      out += std::to_string(ranges[i].first) + '-' + std::to_string(ranges[i].last);
+    }
+    return out;
+  }
+
+  void check_examples(const example* examples, size_t count, int line) {
+    for(size_t i = 0; i < count; ++i) {
+      range_set ranges;
+      const range_set::status status = ranges.parse(examples[i].header, examples[i].size);
+      test::check(status == examples[i].status &&
+                  (status != satisfiable || format(ranges) == examples[i].ranges),
+                  examples[i].header, __FILE__, line);
+    }
+  }
+
+  void single_ranges() {
+    const example examples[] = {
+      {"bytes=0-499", 1000, satisfiable, "0-499"},
+      {"bytes=500-999", 1000, satisfiable, "500-999"},
+      {"bytes= 10 - 19 ", 1000, satisfiable, "10-19"},
+
+      // Ranges that end past the representation are shortened.
+      {"bytes=500-5000", 1000, satisfiable, "500-999"},
+      {"bytes=999-999", 1000, satisfiable, "999-999"},
+
+      // Open-ended ranges run to the end.
+      {"bytes=0-", 1000, satisfiable, "0-999"},
+      {"bytes=900-", 1000, satisfiable, "900-999"},
+
+      // Suffix ranges select the last bytes, or all of them if there are fewer.
+      {"bytes=-100", 1000, satisfiable, "900-999"},
+      {"bytes=-1000", 1000, satisfiable, "0-999"},
+      {"bytes=-5000", 1000, satisfiable, "0-999"},
+
+      // Nothing overlaps the representation.
+      {"bytes=1000-", 1000, unsatisfiable, ""},
+      {"bytes=1000-1999", 1000, unsatisfiable, ""},
+      {"bytes=-0", 1000, unsatisfiable, ""},
+      {"bytes=0-", 0, unsatisfiable, ""},
+      {"bytes=-10", 0, unsatisfiable, ""},
+      {"bytes=0-0", 0, unsatisfiable, ""},
+
+      // Malformed headers, or headers for other units, are ignored.
+      {"items=0-9", 1000, ignore, ""},
+      {"bytes=", 1000, ignore, ""},
+      {"bytes=9-0", 1000, ignore, ""},
+      {"bytes=-", 1000, ignore, ""},
+      {"bytes=a-9", 1000, ignore, ""},
+      {"bytes=0-9x", 1000, ignore, ""},
+      {"bytes=5", 1000, ignore, ""},
+      {"bytes=0-9,oops", 1000, ignore, ""},
+    };
+    check_examples(examples, sizeof(examples) / sizeof(examples[0]), __LINE__);
+  }
+
+  void several_ranges() {
+    const example examples[] = {
+      {"bytes=0-9,20-29", 1000, satisfiable, "0-9,20-29"},
+      {"bytes=0-9, ,20-29,", 1000, satisfiable, "0-9,20-29"},
+
+      // Ranges that do not overlap may come in any order, and are served in that order.
+      {"bytes=20-29,0-9", 1000, satisfiable, "20-29,0-9"},
+      {"bytes=-10,0-9", 1000, satisfiable, "990-999,0-9"},
+
+      // Ranges that overlap or adjoin the one before are merged into it.
+      {"bytes=0-9,10-19", 1000, satisfiable, "0-19"},
+      {"bytes=0-9,5-19", 1000, satisfiable, "0-19"},
+      {"bytes=10-19,0-9", 1000, satisfiable, "0-19"},
+      {"bytes=0-,0-", 1000, satisfiable, "0-999"},
+      {"bytes=0-99,10-19", 1000, satisfiable, "0-99"},
+      {"bytes=900-,-200", 1000, satisfiable, "800-999"},
+      {"bytes=0-9,10-19,20-29", 1000, satisfiable, "0-29"},
+
+      // Ranges past the end are dropped and the rest served.
+      {"bytes=0-9,2000-2999", 1000, satisfiable, "0-9"},
+      {"bytes=2000-,3000-", 1000, unsatisfiable, ""},
+
+      // Ranges that still overlap after merging were not listed in order, and are ignored.
+      {"bytes=0-9,20-29,5-24", 1000, ignore, ""},
+      {"bytes=50-59,0-9,5-54", 1000, ignore, ""},
+      {"bytes=500-599,0-9,-600", 1000, ignore, ""},
+    };
+    check_examples(examples, sizeof(examples) / sizeof(examples[0]), __LINE__);
+  }
+
+  // More ranges than range_set::max_ranges are ignored, unless merging brings them under it.
+  void many_ranges() {
+    std::string header = "bytes=";
+    std::string expected;
+    for(unsigned i = 0; i < range_set::max_ranges; ++i) {
+      header += (i > 0 ? "," : "") + std::to_string(i * 10) + '-' + std::to_string(i * 10);
+      expected += (i > 0 ? "," : "") + std::to_string(i * 10) + '-' + std::to_string(i * 10);
+    }
+    range_set ranges;
+    CHECK(ranges.parse(header, 1000) == satisfiable);
+    CHECK(ranges.size() == range_set::max_ranges);
+    CHECK(format(ranges) == expected);
+
+    const std::string too_many = header + ",500-500";
+    CHECK(ranges.parse(too_many, 1000) == ignore);
+
+    const std::string adjoining = header + "," + std::to_string(range_set::max_ranges * 10 - 9) +
+                                  "-" + std::to_string(range_set::max_ranges * 10 - 5);
+    CHECK(ranges.parse(adjoining, 1000) == satisfiable);
+    CHECK(ranges.size() == range_set::max_ranges);
+
+    // Ranges dropped for starting past the end do not count.
+    CHECK(ranges.parse(header + ",5000-5999", 1000) == satisfiable);
+    CHECK(ranges.size() == range_set::max_ranges);
+  }
+}
+
+int main() {
+  single_ranges();
+  several_ranges();
+  many_ranges();
+  return test::result();
+}
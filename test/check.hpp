@@ -0,0 +1,37 @@
+/**
+ * @file check.hpp
+ */
+#pragma once
+
+#include <stdio.h>
+
+// Minimal checks for the unit tests, which are plain programs run by `ctest`. A failed check
+// prints its location and the test goes on, so that one run reports every failure; the test then
+// exits with a non-zero status.
+
+namespace test {
+  // Gets the number of checks that failed so far.
+  inline unsigned& failures() {
+    static unsigned count = 0;
+    return count;
+  }
+
+  // Records the result of a check.
+  inline void check(bool passed, const char* expression, const char* file, int line) {
+    if(!passed) {
+      fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+      ++failures();
+    }
+  }
+
+  // Gets the exit status of the test.
+  inline int result() {
+    if(failures() > 0) {
+      fprintf(stderr, "%u checks failed\n", failures());
+      return 1;
+    }
+    return 0;
+  }
+}
+
+#define CHECK(expression) ::test::check((expression), #expression, __FILE__, __LINE__)
@@ -0,0 +1,228 @@
+/**
+ * @file hpack_test.cpp
+ */
+#include <string>
+#include <utility>
+#include <vector>
+#include <webby/hpack.hpp>
+#include "check.hpp"
+
+using webby::hpack;
+using webby::string_view;
+
+namespace {
+  typedef std::vector<std::pair<std::string, std::string>> field_list;
+
+  // Converts the hexadecimal dump of a header block, as printed in RFC 7541, to bytes. Spaces
+  // are skipped.
+  std::string from_hex(const char* hex) {
+    std::string out;
+    int high = -1;
+    for(const char* p = hex; *p != '\0'; ++p) {
+      int digit;
+      if(*p >= '0' && *p <= '9') {
+        digit = *p - '0';
+      }
+      else if(*p >= 'a' && *p <= 'f') {
+        digit = *p - 'a' + 10;
+      }
+      else {
+        continue;
+      }
+      if(high < 0) {
+        high = digit;
+      }
+      else {
+        out += static_cast<char>(high << 4 | digit);
+        high = -1;
+      }
+    }
+    return out;
+  }
+
+  // Decodes a header block.
+  field_list decode(hpack::decoder& d, const std::string& block) {
+    field_list fields;
+    d.decode(reinterpret_cast<const unsigned char*>(block.data()), block.size(),
+             [&fields](string_view name, string_view value) {
+               fields.push_back(std::make_pair(std::string(name.data(), name.size()),
+                                               std::string(value.data(), value.size())));
+             });
+    return fields;
+  }
+
+  // Gets a value that indicates whether a header block is rejected.
+  bool rejects(hpack::decoder& d, const std::string& block) {
+    try {
+      decode(d, block);
+    }
+    catch(const hpack::error&) {
+      return true;
+    }
+    return false;
+  }
+
+  // A header block of RFC 7541 appendix C and the fields it decodes to.
+  struct example {
+    const char* hex;
+    field_list fields;
+  };
+
+  // Decodes the header blocks of one connection in order, so that each block depends on the
+  // dynamic table left by the ones before it.
+  void check_sequence(const std::vector<example>& examples, int line) {
+    hpack::decoder d;
+    for(size_t i = 0; i < examples.size(); ++i) {
+      field_list fields;
+      try {
+        fields = decode(d, from_hex(examples[i].hex));
+      }
+      catch(const hpack::error&) { }
+      test::check(fields == examples[i].fields, examples[i].hex, __FILE__, line);
+    }
+  }
+
+  // RFC 7541 appendix C.2: one field of each representation, each in its own block.
+  void field_representations() {
+    hpack::decoder d;
+    CHECK(decode(d, from_hex("400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572")) ==
+          field_list({{"custom-key", "custom-header"}}));
+    CHECK(decode(d, from_hex("be")) == field_list({{"custom-key", "custom-header"}}));
+
+    hpack::decoder without;
+    CHECK(decode(without, from_hex("040c 2f73 616d 706c 652f 7061 7468")) ==
+          field_list({{":path", "/sample/path"}}));
+    CHECK(rejects(without, from_hex("be")));
+
+    hpack::decoder never;
+    CHECK(decode(never, from_hex("1008 7061 7373 776f 7264 0673 6563 7265 74")) ==
+          field_list({{"password", "secret"}}));
+    CHECK(rejects(never, from_hex("be")));
+
+    hpack::decoder indexed;
+    CHECK(decode(indexed, from_hex("82")) == field_list({{":method", "GET"}}));
+  }
+
+  // RFC 7541 appendix C.3 and C.4: requests, without and with Huffman coding.
+  void requests() {
+    const field_list first = {
+      {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}
+    };
+    const field_list second = {
+      {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+      {"cache-control", "no-cache"}
+    };
+    const field_list third = {
+      {":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+      {":authority", "www.example.com"}, {"custom-key", "custom-value"}
+    };
+
+    check_sequence({
+      {"8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", first},
+      {"8286 84be 5808 6e6f 2d63 6163 6865", second},
+      {"8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65", third}
+    }, __LINE__);
+
+    check_sequence({
+      {"8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", first},
+      {"8286 84be 5886 a8eb 1064 9cbf", second},
+      {"8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", third}
+    }, __LINE__);
+  }
+
+  // RFC 7541 appendix C.5 and C.6: responses, without and with Huffman coding. The examples
+  // assume a dynamic table of 256 octets, so that fields are evicted; the first block starts with
+  // a size update to set it (3fe101).
+  void responses() {
+    const field_list first = {
+      {":status", "302"}, {"cache-control", "private"},
+      {"date", "Mon, 21 Oct 2013 20:13:21 GMT"}, {"location", "https://www.example.com"}
+    };
+    const field_list second = {
+      {":status", "307"}, {"cache-control", "private"},
+      {"date", "Mon, 21 Oct 2013 20:13:21 GMT"}, {"location", "https://www.example.com"}
+    };
+    const field_list third = {
+      {":status", "200"}, {"cache-control", "private"},
+      {"date", "Mon, 21 Oct 2013 20:13:22 GMT"}, {"location", "https://www.example.com"},
+      {"content-encoding", "gzip"},
+      {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}
+    };
+
+    hpack::decoder plain;
+    CHECK(decode(plain, from_hex("3fe101 4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c"
+                                 "2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3120 474d"
+                                 "546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63"
+                                 "6f6d")) == first);
+    CHECK(decode(plain, from_hex("4803 3330 37c1 c0bf")) == second);
+    CHECK(decode(plain, from_hex("88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a"
+                                 "3133 3a32 3220 474d 54c0 5a04 677a 6970 7738 666f 6f3d 4153"
+                                 "444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49"
+                                 "553b 206d 6178 2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e"
+                                 "3d31")) == third);
+    // Only the last three fields fit in 256 octets; :status 307 was evicted.
+    CHECK(decode(plain, from_hex("be bf c0")) ==
+          field_list({{"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"},
+                      {"content-encoding", "gzip"},
+                      {"date", "Mon, 21 Oct 2013 20:13:22 GMT"}}));
+    CHECK(rejects(plain, from_hex("c1")));
+
+    hpack::decoder huffman;
+    CHECK(decode(huffman, from_hex("3fe101 4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4"
+                                   "44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7"
+                                   "8f0b 97c8 e9ae 82ae 43d3")) == first);
+    CHECK(decode(huffman, from_hex("4883 640e ffc1 c0bf")) == second);
+    CHECK(decode(huffman, from_hex("88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d"
+                                   "1bff c05a 839b d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b"
+                                   "3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed"
+                                   "4ee5 b106 3d50 07")) == third);
+  }
+
+  // Blocks that are not valid HPACK, which are connection errors.
+  void malformed() {
+    hpack::decoder d;
+    CHECK(rejects(d, from_hex("80")));                    // Index 0.
+    CHECK(rejects(d, from_hex("be")));                    // Empty dynamic table.
+    CHECK(rejects(d, from_hex("ff")));                    // Truncated integer.
+    CHECK(rejects(d, from_hex("ff ff ff ff ff 0f")));     // Integer that overflows.
+    CHECK(rejects(d, from_hex("40 05 61")));              // Truncated name.
+    CHECK(rejects(d, from_hex("40")));                    // Missing name.
+    CHECK(rejects(d, from_hex("3fe21f")));                // Size update above 4096.
+    CHECK(rejects(d, from_hex("00 81 00 00")));           // Huffman padding that is not EOS.
+    CHECK(rejects(d, from_hex("00 82 ff ff 00")));        // Huffman padding longer than 7 bits.
+    CHECK(rejects(d, from_hex("00 84 ff ff ff ff 00")));  // EOS in a Huffman string.
+
+    // Shrinking the table evicts its fields.
+    hpack::decoder shrunk;
+    CHECK(decode(shrunk, from_hex("4001 6101 62")) == field_list({{"a", "b"}}));
+    CHECK(decode(shrunk, from_hex("be")) == field_list({{"a", "b"}}));
+    CHECK(decode(shrunk, from_hex("20")).empty());
+    CHECK(rejects(shrunk, from_hex("be")));
+  }
+
+  // The encoder's output decodes to the fields it was given, with names in lower case.
+  void round_trip() {
+    std::string block;
+    hpack::encoder::status(200, block);
+    hpack::encoder::status(418, block);
+    hpack::encoder::field("Content-Type", "text/html", block);
+    hpack::encoder::field("accept-encoding", "gzip, deflate", block);
+    hpack::encoder::field("X-Custom", std::string(200, 'x'), block);
+
+    hpack::decoder d;
+    CHECK(decode(d, block) == field_list({{":status", "200"}, {":status", "418"},
+                                          {"content-type", "text/html"},
+                                          {"accept-encoding", "gzip, deflate"},
+                                          {"x-custom", std::string(200, 'x')}}));
+    CHECK(block[0] == static_cast<char>(0x88));
+  }
+}
+
+int main() {
+  field_representations();
+  requests();
+  responses();
+  malformed();
+  round_trip();
+  return test::result();
+}
@@ -0,0 +1,361 @@
+/**
+ * @file http2_test.cpp
+ */
+#include <sys/socket.h>
+#include <unistd.h>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <webby.hpp>
+#include "check.hpp"
+
+using webby::http2;
+
+namespace {
+  // Frame types and flags used by the tests.
+  const uint8_t data = 0x0, headers = 0x1, rst_stream = 0x3, settings = 0x4, ping = 0x6,
+                goaway = 0x7, window_update = 0x8, continuation = 0x9;
+  const uint8_t end_stream = 0x1, end_headers = 0x4, padded = 0x8, priority = 0x20;
+
+  // Header blocks of a GET and a POST for `/` on localhost. They leave the dynamic table alone.
+  const std::string get_block("\x82\x86\x84\x01\x09localhost", 14);
+  const std::string post_block("\x83\x86\x84\x01\x09localhost", 14);
+
+  // A frame received from the server.
+  struct frame {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t id;
+    std::string payload;
+  };
+
+  std::string be32(uint32_t value) {
+    const char bytes[4] = {
+      static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+      static_cast<char>(value >> 8), static_cast<char>(value)
+    };
+    return std::string(bytes, 4);
+  }
+
+  uint32_t be32(const std::string& s, size_t offset) {
+    return static_cast<uint32_t>(static_cast<unsigned char>(s[offset])) << 24 |
+           static_cast<uint32_t>(static_cast<unsigned char>(s[offset + 1])) << 16 |
+           static_cast<uint32_t>(static_cast<unsigned char>(s[offset + 2])) << 8 |
+           static_cast<uint32_t>(static_cast<unsigned char>(s[offset + 3]));
+  }
+
+  // Formats a frame sent by the client.
+  std::string make_frame(uint8_t type, uint8_t flags, uint32_t id, const std::string& payload) {
+    const char head[5] = {
+      static_cast<char>(payload.size() >> 16), static_cast<char>(payload.size() >> 8),
+      static_cast<char>(payload.size()), static_cast<char>(type), static_cast<char>(flags)
+    };
+    return std::string(head, 5) + be32(id) + payload;
+  }
+
+  // Formats a `SETTINGS` parameter.
+  std::string setting(uint16_t id, uint32_t value) {
+    const char bytes[2] = { static_cast<char>(id >> 8), static_cast<char>(id) };
+    return std::string(bytes, 2) + be32(value);
+  }
+
+  // An HTTP/2 session on one end of a socket pair, and the client on the other. The client has
+  // sent the first line of the preface, which the server consumes before it starts the session.
+  class client {
+    public:
+      // Starts the session and sends the rest of the client preface and empty settings.
+      client() : _requests(0) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+          throw std::runtime_error("socketpair() failed");
+        }
+        _peer = fds[1];
+        _config.set_log_level(webby::log_level::none);
+        _connection.reset(new webby::connection(webby::socket(fds[0])));
+        _connection->set_timeouts(1000, 1000);
+        _session.reset(new http2::session(_config, *_connection,
+                                          [this](http2::stream& s) { dispatch(s); }, false));
+        send("SM\r\n\r\n" + make_frame(settings, 0, 0, ""));
+      }
+
+      ~client() {
+        _session.reset();
+        _connection.reset();
+        close(_peer);
+      }
+
+      // Sets what the server answers each request with.
+      void on_request(std::function<void(http2::stream&)> handler) {
+        _handler = handler;
+      }
+
+      // Sends bytes to the server and lets the session process them. Returns `false` if the
+      // session closed the connection.
+      bool send(const std::string& bytes) {
+        for(size_t sent = 0; sent < bytes.size(); ) {
+          const ssize_t n = ::write(_peer, bytes.data() + sent, bytes.size() - sent);
+          if(n <= 0) {
+            throw std::runtime_error("write() failed");
+          }
+          sent += static_cast<size_t>(n);
+        }
+        while(_connection->fill() > 0) { }
+        return _session->process();
+      }
+
+      // Gets the frames the server sent since the last call, except its `SETTINGS` and their
+      // acknowledgements.
+      std::vector<frame> received() {
+        char buffer[65536];
+        ssize_t n;
+        while((n = ::recv(_peer, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+          _in.append(buffer, static_cast<size_t>(n));
+        }
+        std::vector<frame> frames;
+        size_t p = 0;
+        while(_in.size() - p >= 9) {
+          const size_t length = be32(_in, p) >> 8;
+          if(_in.size() - p < 9 + length) {
+            break;
+          }
+          frame f = { static_cast<uint8_t>(_in[p + 3]), static_cast<uint8_t>(_in[p + 4]),
+                      be32(_in, p + 5) & 0x7fffffff, _in.substr(p + 9, length) };
+          if(f.type != settings) {
+            frames.push_back(f);
+          }
+          p += 9 + length;
+        }
+        _in.erase(0, p);
+        return frames;
+      }
+
+      // Gets the number of requests that reached the handler.
+      unsigned requests() const {
+        return _requests;
+      }
+
+      // Gets the body of the last request.
+      const std::string& body() const {
+        return _body;
+      }
+
+      // Answers a request with a body.
+      static void respond(http2::stream& s, const std::string& body) {
+        webby::arena a;
+        webby::header_builder h(a);
+        h.set_content_length(body.size());
+        s.send_headers(200, h, false);
+        struct iovec iov = { const_cast<char*>(body.data()), body.size() };
+        s.send_data(&iov, 1, true);
+      }
+
+    private:
+      void dispatch(http2::stream& s) {
+        ++_requests;
+        _body.assign(s.body().data(), s.body().size());
+        if(_handler) {
+          _handler(s);
+        }
+        else {
+          respond(s, "hello");
+        }
+      }
+
+      webby::config _config;
+      int _peer;
+      std::unique_ptr<webby::connection> _connection;
+      std::unique_ptr<http2::session> _session;
+      std::function<void(http2::stream&)> _handler;
+      unsigned _requests;
+      std::string _body;
+      std::string _in;
+  };
+
+  // Gets the error code of the `GOAWAY` among @p frames, or -1 if there is none.
+  long goaway_code(const std::vector<frame>& frames) {
+    for(auto itr = frames.cbegin(); itr != frames.cend(); ++itr) {
+      if(itr->type == goaway && itr->payload.size() >= 8) {
+        return static_cast<long>(be32(itr->payload, 4));
+      }
+    }
+    return -1;
+  }
+
+  // Gets the body sent on a stream among @p frames, and whether it was ended.
+  std::string body_of(const std::vector<frame>& frames, uint32_t id, bool* ended = nullptr) {
+    std::string body;
+    for(auto itr = frames.cbegin(); itr != frames.cend(); ++itr) {
+      if(itr->type == data && itr->id == id) {
+        body += itr->payload;
+        if(ended != nullptr && (itr->flags & end_stream)) {
+          *ended = true;
+        }
+      }
+    }
+    return body;
+  }
+
+  void request() {
+    client c;
+    CHECK(c.send(make_frame(headers, end_headers | end_stream, 1, get_block)));
+    CHECK(c.requests() == 1);
+    std::vector<frame> frames = c.received();
+    bool ended = false;
+    CHECK(!frames.empty() && frames[0].type == headers && frames[0].id == 1);
+    CHECK(body_of(frames, 1, &ended) == "hello");
+    CHECK(ended);
+  }
+
+  void padding() {
+    // Padding and a priority in HEADERS, and padding in DATA, are stripped.
+    client c;
+    const std::string pad(10, '\0');
+    CHECK(c.send(make_frame(headers, end_headers | padded | priority, 1,
+                            std::string(1, '\x0a') + be32(0) + '\x10' + post_block + pad)));
+    CHECK(c.send(make_frame(data, padded, 1, std::string(1, '\x0a') + "abc" + pad)));
+    CHECK(c.send(make_frame(data, padded | end_stream, 1, std::string(1, '\0') + "def")));
+    CHECK(c.requests() == 1);
+    CHECK(c.body() == "abcdef");
+
+    // Padding that is as long as the frame is a connection error.
+    client invalid;
+    CHECK(!invalid.send(make_frame(headers, end_headers | padded, 1,
+                                   std::string(1, '\x0f') + get_block)));
+    CHECK(goaway_code(invalid.received()) == 0x1);
+    CHECK(invalid.requests() == 0);
+
+    client empty;
+    CHECK(empty.send(make_frame(headers, end_headers, 1, post_block)));
+    CHECK(!empty.send(make_frame(data, padded, 1, "")));
+    CHECK(goaway_code(empty.received()) == 0x1);
+  }
+
+  void continuation_frames() {
+    // A header block may be split over CONTINUATION frames.
+    client c;
+    CHECK(c.send(make_frame(headers, end_stream, 1, get_block.substr(0, 5))));
+    CHECK(c.requests() == 0);
+    CHECK(c.send(make_frame(continuation, 0, 1, get_block.substr(5, 4))));
+    CHECK(c.send(make_frame(continuation, end_headers, 1, get_block.substr(9))));
+    CHECK(c.requests() == 1);
+
+    // No other frame may come between them, on the same stream or another one.
+    client other_stream;
+    CHECK(!other_stream.send(make_frame(headers, end_stream, 1, get_block.substr(0, 5)) +
+                             make_frame(headers, end_headers | end_stream, 3, get_block)));
+    CHECK(goaway_code(other_stream.received()) == 0x1);
+    CHECK(other_stream.requests() == 0);
+
+    client control;
+    CHECK(!control.send(make_frame(headers, end_stream, 1, get_block.substr(0, 5)) +
+                        make_frame(ping, 0, 0, std::string(8, '\0'))));
+    CHECK(goaway_code(control.received()) == 0x1);
+
+    client wrong_stream;
+    CHECK(!wrong_stream.send(make_frame(headers, end_stream, 1, get_block.substr(0, 5)) +
+                             make_frame(continuation, end_headers, 3, get_block.substr(5))));
+    CHECK(goaway_code(wrong_stream.received()) == 0x1);
+
+    client unexpected;
+    CHECK(!unexpected.send(make_frame(continuation, end_headers, 1, get_block)));
+    CHECK(goaway_code(unexpected.received()) == 0x1);
+  }
+
+  void window_overflow() {
+    // The connection window may not exceed 2^31 - 1.
+    client connection;
+    CHECK(!connection.send(make_frame(window_update, 0, 0, be32(0x7fffffff - 65535 + 1))));
+    CHECK(goaway_code(connection.received()) == 0x3);
+
+    // A stream whose window would overflow is reset, and the connection goes on.
+    client stream;
+    CHECK(stream.send(make_frame(headers, end_headers, 1, post_block)));
+    CHECK(stream.send(make_frame(window_update, 0, 1, be32(0x7fffffff - 65535 + 1))));
+    std::vector<frame> frames = stream.received();
+    CHECK(frames.size() == 1 && frames[0].type == rst_stream && frames[0].id == 1 &&
+          be32(frames[0].payload, 0) == 0x3);
+    CHECK(stream.send(make_frame(headers, end_headers | end_stream, 3, get_block)));
+    CHECK(body_of(stream.received(), 3) == "hello");
+
+    // A change of the initial window may not take an open stream past the limit either.
+    client initial;
+    CHECK(initial.send(make_frame(headers, end_headers, 1, post_block)));
+    CHECK(initial.send(make_frame(window_update, 0, 1, be32(0x7fffffff - 65535))));
+    CHECK(!initial.send(make_frame(settings, 0, 0, setting(0x4, 65536))));
+    CHECK(goaway_code(initial.received()) == 0x3);
+
+    client too_large;
+    CHECK(!too_large.send(make_frame(settings, 0, 0, setting(0x4, 0x80000000))));
+    CHECK(goaway_code(too_large.received()) == 0x3);
+  }
+
+  void window_underflow() {
+    // The body that does not fit in the window is held back, and the handler returns.
+    client c;
+    const std::string body(100, 'x');
+    c.on_request([&body](http2::stream& s) { client::respond(s, body); });
+    CHECK(c.send(make_frame(settings, 0, 0, setting(0x4, 10))));
+    CHECK(c.send(make_frame(headers, end_headers | end_stream, 1, get_block)));
+    CHECK(c.requests() == 1);
+    bool ended = false;
+    CHECK(body_of(c.received(), 1, &ended) == body.substr(0, 10));
+    CHECK(!ended);
+
+    // Shrinking the initial window makes the stream's window negative, so an update that does
+    // not make up for it sends nothing.
+    CHECK(c.send(make_frame(settings, 0, 0, setting(0x4, 0))));
+    CHECK(c.send(make_frame(window_update, 0, 1, be32(5))));
+    CHECK(body_of(c.received(), 1).empty());
+    CHECK(c.send(make_frame(window_update, 0, 1, be32(15))));
+    CHECK(body_of(c.received(), 1, &ended) == body.substr(10, 10));
+    CHECK(!ended);
+
+    // Other streams are served meanwhile.
+    c.on_request([](http2::stream& s) { client::respond(s, ""); });
+    CHECK(c.send(make_frame(headers, end_headers | end_stream, 3, get_block)));
+    CHECK(c.requests() == 2);
+    std::vector<frame> frames = c.received();
+    CHECK(frames.size() == 2 && frames[0].type == headers && frames[0].id == 3 &&
+          frames[1].type == data && frames[1].id == 3 && (frames[1].flags & end_stream));
+
+    CHECK(c.send(make_frame(window_update, 0, 1, be32(1000))));
+    CHECK(body_of(c.received(), 1, &ended) == body.substr(20));
+    CHECK(ended);
+  }
+
+  void connection_window() {
+    // The connection window holds back a body even when the stream's window is open.
+    client c;
+    const std::string body(100000, 'x');
+    c.on_request([&body](http2::stream& s) { client::respond(s, body); });
+    CHECK(c.send(make_frame(settings, 0, 0, setting(0x4, 1000000))));
+    CHECK(c.send(make_frame(headers, end_headers | end_stream, 1, get_block)));
+    bool ended = false;
+    CHECK(body_of(c.received(), 1, &ended).size() == 65535);
+    CHECK(c.send(make_frame(window_update, 0, 0, be32(100000))));
+    CHECK(body_of(c.received(), 1, &ended).size() == 100000 - 65535);
+    CHECK(ended);
+
+    // A stream that the client resets drops what was held back.
+    client reset;
+    reset.on_request([&body](http2::stream& s) { client::respond(s, body); });
+    CHECK(reset.send(make_frame(headers, end_headers | end_stream, 1, get_block)));
+    CHECK(body_of(reset.received(), 1).size() == 65535);
+    CHECK(reset.send(make_frame(rst_stream, 0, 1, be32(0x8))));
+    CHECK(reset.send(make_frame(window_update, 0, 0, be32(100000)) +
+                     make_frame(window_update, 0, 1, be32(100000))));
+    CHECK(reset.received().empty());
+  }
+}
+
+int main() {
+  request();
+  padding();
+  continuation_frames();
+  window_overflow();
+  window_underflow();
+  connection_window();
+  return test::result();
+}
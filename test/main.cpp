@@ -7,23 +7,22 @@
 // Example implementation of a restful web service.
 class item : public webby::rest_handler<item> {
   public:
-    // Responds with all of the items in a JSON array.
+    // Responds with all of the items in a JSON array. No Content-Length is set, so the array is
+    // streamed to the client as it is generated instead of being built in memory first.
     void index(const webby::request& req, webby::response& res) {
-      std::string s = get_all();
-      res.set_status_code(200)
-         .set_header("Content-Length", std::to_string(s.length()))
-         .write_block(reinterpret_cast<const unsigned char*>(s.c_str()), s.length());
+      res.set_status_code(200);
+      write_all(res.stream());
     }
 
     // Responds with a single item in JSON format.
     void show(const webby::request& req, webby::response& res) {
-      // Parse the ID of the resource to respond with from the request path.
-      int id = std::stoi(req.path().substr(req.route().length() + 1));
+      // The ID of the resource to respond with is captured from the request path.
+      int id = req.param<int>("id");
       std::string s = get_by_id(id);
 
       if(s.length()) {
         res.set_status_code(200)
-           .set_header("Content-Length", std::to_string(s.length()))
+           .set_content_length(s.length())
            .write_block(reinterpret_cast<const unsigned char*>(s.c_str()), s.length());
       }
       else {
@@ -32,21 +31,19 @@ class item : public webby::rest_handler<item> {
     }
 
   private:
-    // Gets all of the items in JSON format. This should really be handled by a JSON generator,
+    // Writes all of the items in JSON format. This should really be handled by a JSON generator,
     // but for the purpose of this example it's good enough.
-    std::string get_all() {
-      std::stringstream ss;
-      ss << "[";
+    void write_all(std::ostream& os) {
+      os << "[";
       bool first = true;
       for(auto i : _item) {
         if(!first) {
-          ss << ",";
-          first = false;
+          os << ",";
         }
-        ss << "{id:" << i.first << ", value:\"" << i.second << "\"}";
+        first = false;
+        os << "{id:" << i.first << ", value:\"" << i.second << "\"}";
       }
-      ss << "]";
-      return ss.str();
+      os << "]";
     }
 
     // Gets a single item by its ID in JSON format. Again, this should be performed by a JSON
@@ -80,7 +77,9 @@ int main() {
   config.set_address("localhost")
         .set_port(8080)
         .set_access_log(access_log)
-        .set_error_log(error_log);
+        .set_error_log(error_log)
+        .set_log_level(webby::log_level::debug)
+        .set_async_logging(true);
 
   // Sets up the routing table.
   webby::router router;
@@ -90,6 +89,9 @@ int main() {
   // Create the server.
   webby::server server(config, router);
 
+  // Exposes the server's metrics to Prometheus.
+  router.add("/metrics", webby::method::GET, webby::metrics_handler(server.metrics()));
+
   // Run the server.
   server.run();
 
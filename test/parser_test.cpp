@@ -0,0 +1,207 @@
+/**
+ * @file parser_test.cpp
+ */
+#include <string>
+#include <vector>
+#include <webby/parser.hpp>
+#include "check.hpp"
+
+using webby::parser;
+using webby::string_view;
+
+namespace {
+  // Feeds a request to a parser in one piece.
+  parser::status parse(parser& p, std::string& request) {
+    return p.parse(&request[0], request.size());
+  }
+
+  // Feeds a request to a parser one byte more at a time, as if every byte arrived in its own read.
+  // The bytes are copied to a fresh buffer before each call so that the parser cannot rely on the
+  // buffer staying in place. The fields refer to @p buffer once parsing stops.
+  parser::status parse_split(parser& p, const std::string& request, std::vector<char>& buffer) {
+    parser::status result = parser::status::incomplete;
+    buffer.clear();
+    for(size_t size = 1; size <= request.size(); ++size) {
+      std::vector<char> moved(buffer);
+      moved.push_back(request[size - 1]);
+      buffer.swap(moved);
+      result = p.parse(buffer.data(), buffer.size());
+      if(result != parser::status::incomplete) {
+        break;
+      }
+    }
+    return result;
+  }
+
+  // Gets the value of the first header named @p name, or an empty view.
+  string_view header(const parser& p, const char* name) {
+    for(auto itr = p.fields().cbegin(); itr != p.fields().cend(); ++itr) {
+      if(itr->name == name) {
+        return itr->value;
+      }
+    }
+    return string_view();
+  }
+
+  // Parses @p request in one piece and byte by byte, and checks that both give @p expected.
+  void check_status(std::string request, parser::status expected, const char* expression,
+                    int line) {
+    parser whole, split;
+    std::vector<char> buffer;
+    test::check(parse_split(split, request, buffer) == expected, expression, __FILE__, line);
+    test::check(parse(whole, request) == expected, expression, __FILE__, line);
+  }
+
+#define CHECK_STATUS(request, expected)                                                           \
+  check_status((request), parser::status::expected, #request " is " #expected, __LINE__)
+
+  void request_line() {
+    std::string request = "GET /path?query HTTP/1.1\r\nHost: example.com\r\n\r\n";
+    parser p;
+    CHECK(parse(p, request) == parser::status::complete);
+    CHECK(p.method() == "GET");
+    CHECK(p.target() == "/path?query");
+    CHECK(p.version() == "1.1");
+    CHECK(p.length() == request.size());
+    CHECK(p.fields().size() == 1);
+    CHECK(header(p, "Host") == "example.com");
+
+    // A pipelined request after the header block is not part of it.
+    std::string pipelined = request + "GET / HTTP/1.1\r\n\r\n";
+    parser q;
+    CHECK(parse(q, pipelined) == parser::status::complete);
+    CHECK(q.length() == request.size());
+
+    // Empty lines before the request line are ignored.
+    std::string leading = "\r\n\nGET / HTTP/1.0\r\n\r\n";
+    parser r;
+    CHECK(parse(r, leading) == parser::status::complete);
+    CHECK(r.method() == "GET");
+    CHECK(r.version() == "1.0");
+
+    CHECK_STATUS("GET / HTTP/1.1\r\n\r\n", complete);
+    CHECK_STATUS("GET / HTTP/2.0\r\n\r\n", complete);
+    CHECK_STATUS("GET / HTTP/1.1\n\n", complete);
+    CHECK_STATUS("GET / HTTP/1.1\r\n", incomplete);
+    CHECK_STATUS("GET / HTTP/1.1\r", incomplete);
+    CHECK_STATUS("GET /", incomplete);
+
+    CHECK_STATUS("GET / HTTP/1.1garbage\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/11.1\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.x\r\n\r\n", invalid);
+    CHECK_STATUS("GET / http/1.1\r\n\r\n", invalid);
+    CHECK_STATUS("GET /\r\n\r\n", invalid);
+    CHECK_STATUS("GET  / HTTP/1.1\r\n\r\n", invalid);
+    CHECK_STATUS(" GET / HTTP/1.1\r\n\r\n", invalid);
+    CHECK_STATUS("G(T / HTTP/1.1\r\n\r\n", invalid);
+  }
+
+  void header_lines() {
+    std::string request = "GET / HTTP/1.1\r\n"
+                          "Host:example.com\r\n"
+                          "Accept: \t text/html \t\r\n"
+                          "Empty:\r\n"
+                          "Obs-Text: caf\xc3\xa9\r\n"
+                          "\r\n";
+    parser p;
+    std::vector<char> buffer;
+    CHECK(parse_split(p, request, buffer) == parser::status::complete);
+    CHECK(p.fields().size() == 4);
+    CHECK(header(p, "Host") == "example.com");
+    CHECK(header(p, "Accept") == "text/html");
+    CHECK(header(p, "Empty").empty());
+    CHECK(header(p, "Obs-Text") == "caf\xc3\xa9");
+
+    // The parser can be reused for the next request on the connection.
+    std::string next = "POST /form HTTP/1.0\r\nContent-Length: 0\r\n\r\n";
+    p.reset();
+    CHECK(parse(p, next) == parser::status::complete);
+    CHECK(p.method() == "POST");
+    CHECK(p.fields().size() == 1);
+    CHECK(header(p, "Content-Length") == "0");
+
+    CHECK_STATUS("GET / HTTP/1.1\r\nHost example.com\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\r\nHost : example.com\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\r\n: example.com\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\r\nHo(st: example.com\r\n\r\n", invalid);
+  }
+
+  void folding() {
+    std::string request = "GET / HTTP/1.1\r\n"
+                          "Folded: a\r\n"
+                          "    b  \r\n"
+                          "\tc\r\n"
+                          "Empty-First:\r\n"
+                          "  d\r\n"
+                          "Blank-Fold: e\r\n"
+                          " \t\r\n"
+                          "Next: f\r\n"
+                          "\r\n";
+    parser p;
+    std::vector<char> buffer;
+    CHECK(parse_split(p, request, buffer) == parser::status::complete);
+    CHECK(p.fields().size() == 4);
+    CHECK(header(p, "Folded") == "a      b    \tc");
+    CHECK(header(p, "Empty-First") == "d");
+    CHECK(header(p, "Blank-Fold") == "e");
+    CHECK(header(p, "Next") == "f");
+
+    // The value is rewritten in place, so it stays a single view into the request.
+    string_view folded = header(p, "Folded");
+    CHECK(folded.data() >= buffer.data() &&
+          folded.data() + folded.size() <= buffer.data() + buffer.size());
+
+    // A continuation line needs a field to continue.
+    CHECK_STATUS("GET / HTTP/1.1\r\n folded\r\n\r\n", invalid);
+  }
+
+  void invalid_bytes() {
+    // A CR is only allowed directly before LF.
+    CHECK_STATUS("GET / HTTP/1.1\r\nA: b\rX: y\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\r\nA: b\r\r\n\r\n", invalid);
+    CHECK_STATUS("GET /a\rb HTTP/1.1\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\rHost: x\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\r\n\r\r\n", invalid);
+
+    // Other control characters are never allowed, but a tab is whitespace in a value.
+    CHECK_STATUS(std::string("GET / HTTP/1.1\r\nA: b") + '\0' + "c\r\n\r\n", invalid);
+    CHECK_STATUS(std::string("GET /") + '\0' + " HTTP/1.1\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\r\nA: b\x7f" "c\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\r\nA: b\x1b" "c\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\r\nA: b\x0b" "c\r\n\r\n", invalid);
+    CHECK_STATUS("GET / HTTP/1.1\r\nA: b\tc\r\n\r\n", complete);
+  }
+
+  // Checks the scanning kernel in every position of a block, so that each lane of the vector
+  // kernels and the scalar tail are covered.
+  void kernel() {
+    const unsigned char stops[] = {'\r', '\n', 0x00, 0x01, 0x1f, 0x7f};
+    const unsigned char others[] = {'\t', ' ', 'a', 0x80, 0xff};
+    char block[64];
+
+    for(size_t i = 0; i < sizeof(block); ++i) {
+      for(size_t s = 0; s < sizeof(stops); ++s) {
+        memset(block, 'x', sizeof(block));
+        block[i] = static_cast<char>(stops[s]);
+        CHECK(webby::scan::find_line_stop(block, block + sizeof(block)) == block + i);
+        CHECK(webby::scan::find_line_stop(block + i + 1, block + sizeof(block)) ==
+              block + sizeof(block));
+      }
+      for(size_t o = 0; o < sizeof(others); ++o) {
+        memset(block, 'x', sizeof(block));
+        block[i] = static_cast<char>(others[o]);
+        CHECK(webby::scan::find_line_stop(block, block + sizeof(block)) == block + sizeof(block));
+      }
+    }
+  }
+}
+
+int main() {
+  request_line();
+  header_lines();
+  folding();
+  invalid_bytes();
+  kernel();
+  return test::result();
+}
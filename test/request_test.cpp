@@ -0,0 +1,128 @@
+/**
+ * @file request_test.cpp
+ */
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <webby.hpp>
+#include "check.hpp"
+
+namespace {
+  // A request received on one end of a socket pair. Its constructor is protected, as only the
+  // server makes requests.
+  class received : public webby::request {
+    public:
+      received(const webby::config& config, webby::connection& connection)
+          : webby::request(config, connection) { }
+  };
+
+  // A client on one end of a socket pair that sends a request to a connection on the other.
+  class exchange {
+    public:
+      // Sends @p bytes to the connection.
+      explicit exchange(const std::string& bytes) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+          throw std::runtime_error("socketpair() failed");
+        }
+        _peer = fds[1];
+        _config.set_log_level(webby::log_level::none);
+        _connection.reset(new webby::connection(webby::socket(fds[0])));
+        _connection->set_timeouts(1000, 1000);
+        if(::write(_peer, bytes.data(), bytes.size()) != static_cast<ssize_t>(bytes.size())) {
+          throw std::runtime_error("write() failed");
+        }
+        shutdown(_peer, SHUT_WR);
+      }
+
+      ~exchange() {
+        _request.reset();
+        _connection.reset();
+        close(_peer);
+      }
+
+      // Receives the request. Returns `false` if it was rejected.
+      bool receive() {
+        try {
+          _request.reset(new received(_config, *_connection));
+        }
+        catch(const webby::request::error&) {
+          return false;
+        }
+        return true;
+      }
+
+      // Reads the body of the received request.
+      std::string body() {
+        std::string body;
+        char buffer[64];
+        size_t n;
+        while((n = _request->read_body(buffer, sizeof(buffer))) > 0) {
+          body.append(buffer, n);
+        }
+        return body;
+      }
+
+    private:
+      webby::config _config;
+      int _peer;
+      std::unique_ptr<webby::connection> _connection;
+      std::unique_ptr<received> _request;
+  };
+
+  // Gets a value that indicates whether a POST with the given header lines is rejected.
+  bool rejects(const std::string& lines, const std::string& body) {
+    exchange e("POST / HTTP/1.1\r\nHost: x\r\n" + lines + "\r\n" + body);
+    return !e.receive();
+  }
+
+  // A request that frames its body more than one way is rejected, because a proxy in front of
+  // the server may have framed it the other way.
+  void ambiguous_framing() {
+    const std::string chunked_body = "5\r\nhello\r\n0\r\n\r\n";
+
+    CHECK(rejects("Transfer-Encoding: chunked\r\nContent-Length: 5\r\n", chunked_body));
+    CHECK(rejects("Content-Length: 5\r\nTransfer-Encoding: chunked\r\n", chunked_body));
+    CHECK(rejects("Transfer-Encoding: identity\r\nContent-Length: 5\r\n", "hello"));
+    CHECK(rejects("Transfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n", chunked_body));
+    CHECK(rejects("Transfer-Encoding: chunked\r\nTransfer-Encoding: identity\r\n", chunked_body));
+    CHECK(rejects("transfer-encoding: chunked\r\nTRANSFER-ENCODING: chunked\r\n", chunked_body));
+    CHECK(rejects("Transfer-Encoding: gzip\r\n", chunked_body));
+    CHECK(rejects("Content-Length: 5\r\nContent-Length: 6\r\n", "hello!"));
+    CHECK(rejects("Content-Length: 5\r\ncontent-length: 50\r\n", "hello"));
+    CHECK(rejects("Content-Length: 5, 6\r\n", "hello"));
+    CHECK(rejects("Content-Length: -5\r\n", "hello"));
+    CHECK(rejects("Content-Length: 0x5\r\n", "hello"));
+    CHECK(rejects("Content-Length:\r\n", "hello"));
+  }
+
+  // Requests whose framing is unambiguous are accepted, and their bodies are read.
+  void framing() {
+    exchange length("POST / HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n\r\nhello");
+    CHECK(length.receive());
+    CHECK(length.body() == "hello");
+
+    // Repeated Content-Length fields that agree frame the body the same way for everyone.
+    exchange repeated("POST / HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n"
+                      "content-length: 5\r\n\r\nhello");
+    CHECK(repeated.receive());
+    CHECK(repeated.body() == "hello");
+
+    exchange chunked("POST / HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n"
+                     "5\r\nhello\r\n0\r\n\r\n");
+    CHECK(chunked.receive());
+    CHECK(chunked.body() == "hello");
+
+    exchange none("GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+    CHECK(none.receive());
+    CHECK(none.body().empty());
+  }
+}
+
+int main() {
+  ambiguous_framing();
+  framing();
+  return test::result();
+}
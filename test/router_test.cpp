@@ -0,0 +1,200 @@
+/**
+ * @file router_test.cpp
+ */
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <webby.hpp>
+#include "check.hpp"
+
+using webby::method;
+using webby::router;
+
+namespace {
+  // A request and its response on one end of a socket pair. Their constructors are protected, as
+  // only the server makes them.
+  class received : public webby::request {
+    public:
+      received(const webby::config& config, webby::connection& connection)
+          : webby::request(config, connection) { }
+  };
+
+  class sent : public webby::response {
+    public:
+      sent(const webby::config& config, webby::connection& connection)
+          : webby::response(config, connection) { }
+  };
+
+  // What the handlers saw of the last request.
+  std::string last;
+
+  // Gets a handler that records its name and the parameters it reads.
+  router::handler_t record(const std::string& name, std::vector<std::string> params = {}) {
+    return [name, params](const webby::request& req, webby::response&) {
+      last = name;
+      for(auto itr = params.cbegin(); itr != params.cend(); ++itr) {
+        last += " " + *itr + "=" + std::string(req.param(*itr).data(), req.param(*itr).size());
+      }
+    };
+  }
+
+  // Routes a request and gets the response the client receives.
+  std::string route(const router& r, const std::string& request_line) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      throw std::runtime_error("socketpair() failed");
+    }
+    const std::string request = request_line + "\r\nHost: x\r\n\r\n";
+    if(::write(fds[1], request.data(), request.size()) != static_cast<ssize_t>(request.size())) {
+      throw std::runtime_error("write() failed");
+    }
+
+    last.clear();
+    webby::config config;
+    config.set_log_level(webby::log_level::none);
+    {
+      webby::connection c{webby::socket(fds[0])};
+      c.set_timeouts(1000, 1000);
+      received req(config, c);
+      sent res(config, c);
+      r.dispatch(req, res);
+    }
+
+    std::string response;
+    char buffer[4096];
+    ssize_t n;
+    while((n = ::recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+      response.append(buffer, static_cast<size_t>(n));
+    }
+    close(fds[1]);
+    return response;
+  }
+
+  // Gets the status line of a response.
+  std::string status(const std::string& response) {
+    return response.substr(0, response.find("\r\n"));
+  }
+
+  // Gets a value that indicates whether adding a route throws std::invalid_argument.
+  bool rejects(router& r, const std::string& path) {
+    try {
+      r.add(path, method::GET, record("rejected"));
+    }
+    catch(const std::invalid_argument&) {
+      return true;
+    }
+    return false;
+  }
+
+  // The route that matches the most leading segments wins, and static segments beat parameters.
+  void longest_match() {
+    router r;
+    r.add("/", method::GET, record("root"));
+    r.add("/items", method::GET, record("items"));
+    r.add("/items/:id", method::GET, record("item", {"id"}));
+    r.add("/items/:id/parts", method::GET, record("parts", {"id"}));
+    r.add("/items/special", method::GET, record("special"));
+    r.add("/items/special/:part", method::GET, record("special part", {"part", "id"}));
+
+    route(r, "GET / HTTP/1.1");
+    CHECK(last == "root");
+    route(r, "GET /items HTTP/1.1");
+    CHECK(last == "items");
+    route(r, "GET /items/ HTTP/1.1");
+    CHECK(last == "items");
+    route(r, "GET /items/42 HTTP/1.1");
+    CHECK(last == "item id=42");
+    route(r, "GET /items/special HTTP/1.1");
+    CHECK(last == "special");
+    route(r, "GET /items/42/parts HTTP/1.1");
+    CHECK(last == "parts id=42");
+    route(r, "GET /items/special/wheel HTTP/1.1");
+    CHECK(last == "special part part=wheel id=");
+
+    // Segments past the longest match are left to its handler.
+    route(r, "GET /items/42/parts/7 HTTP/1.1");
+    CHECK(last == "parts id=42");
+    route(r, "GET /items/42/other HTTP/1.1");
+    CHECK(last == "item id=42");
+    route(r, "GET /other HTTP/1.1");
+    CHECK(last == "root");
+
+    // The query string is not part of the path.
+    route(r, "GET /items/7?id=8 HTTP/1.1");
+    CHECK(last == "item id=7");
+    route(r, "GET /items?x=/parts HTTP/1.1");
+    CHECK(last == "items");
+  }
+
+  void parameters() {
+    router r;
+    r.add("/users/:user/posts/:post", method::GET, record("post", {"user", "post", "other"}));
+    r.add("/files/:name", method::GET, record("file", {"name"}));
+
+    route(r, "GET /users/ann/posts/12 HTTP/1.1");
+    CHECK(last == "post user=ann post=12 other=");
+    route(r, "GET /files/a.txt HTTP/1.1");
+    CHECK(last == "file name=a.txt");
+    route(r, "GET /files/%2e%2e HTTP/1.1");
+    CHECK(last == "file name=%2e%2e");
+  }
+
+  // Requests that match no route get a 404, and requests whose route does not accept their
+  // method a 405 that lists the methods it does accept.
+  void errors() {
+    router r;
+    r.add("/items", method::GET, record("get"));
+    r.add("/items", method::POST | method::PUT, record("post or put"));
+
+    CHECK(status(route(r, "GET /items HTTP/1.1")) == "HTTP/1.1 200 OK");
+    CHECK(last == "get");
+    route(r, "PUT /items HTTP/1.1");
+    CHECK(last == "post or put");
+
+    const std::string not_found = route(r, "GET /nothing HTTP/1.1");
+    CHECK(status(not_found) == "HTTP/1.1 404 Not Found");
+    CHECK(last.empty());
+
+    const std::string not_allowed = route(r, "DELETE /items HTTP/1.1");
+    CHECK(status(not_allowed) == "HTTP/1.1 405 Method Not Allowed");
+    CHECK(not_allowed.find("\r\nAllow: GET, POST, PUT\r\n") != std::string::npos);
+    CHECK(last.empty());
+
+    r.set_error_handler([](const webby::request&, webby::response& res) {
+      last = "error handler";
+      res.set_status_code(410);
+    });
+    CHECK(status(route(r, "GET /nothing HTTP/1.1")) == "HTTP/1.1 410 Gone");
+    CHECK(last == "error handler");
+  }
+
+  // Routes share the trie node of a parameter, so a parameter cannot be renamed in a route added
+  // later.
+  void conflicting_parameters() {
+    router r;
+    r.add("/users/:id/posts", method::GET, record("posts", {"id"}));
+
+    CHECK(rejects(r, "/users/:name"));
+    CHECK(rejects(r, "/users/:name/posts"));
+    CHECK(rejects(r, "/users/:user/comments"));
+    CHECK(!rejects(r, "/users/:id"));
+    CHECK(!rejects(r, "/users/:id/comments/:comment"));
+    CHECK(!rejects(r, "/users/me"));
+    CHECK(!rejects(r, "/groups/:name"));
+
+    // The routes added before the conflict still work.
+    route(r, "GET /users/5/posts HTTP/1.1");
+    CHECK(last == "posts id=5");
+  }
+}
+
+int main() {
+  longest_match();
+  parameters();
+  errors();
+  conflicting_parameters();
+  return test::result();
+}